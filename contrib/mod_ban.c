@@ -61,6 +61,9 @@
 # define BAN_STRING_MAXSZ	128
 #endif
 
+/* Default number of entries in the ban and ban event lists; see
+ * BanTableSize.
+ */
 #ifndef BAN_LIST_MAXSZ
 # define BAN_LIST_MAXSZ		512
 #endif
@@ -69,14 +72,23 @@
 # define BAN_EVENT_LIST_MAXSZ	512
 #endif
 
-/* This "headroom" is for cases where many concurrent processes are
- * incrementing the index, possibly past the MAXSZs above.  We thus allocate
- * some headroom for them, to mitigate/avoid array out-of-bounds faults.
+/* Number of one-second slots in the expiry wheels of the ban and ban event
+ * lists.  Entries are hung off the slot for their expiration time, so that
+ * expiring entries only requires visiting the slots for the seconds which
+ * have elapsed since the last check, rather than scanning the entire list.
  */
-#ifndef BAN_LIST_HEADROOMSZ
-# define BAN_LIST_HEADROOMSZ	10
+#ifndef BAN_EXPIRY_WHEEL_SIZE
+# define BAN_EXPIRY_WHEEL_SIZE	1024
 #endif
 
+#define BAN_DATA_MAGIC		0x62616e32
+
+/* Maximum number of lines in a 'ban info' response; ftpdctl rejects
+ * responses of more than 1024 lines.
+ */
+#ifndef BAN_INFO_MAX_RESPONSES
+# define BAN_INFO_MAX_RESPONSES	1000
+#endif
 /* From src/main.c */
 extern pid_t mpid;
 extern xaset_t *server_list;
@@ -94,6 +106,14 @@ struct ban_entry {
   char be_message[BAN_STRING_MAXSZ];
   time_t be_expires;
   unsigned int be_sid;
+
+  /* Indices (1-based, zero meaning none) of the next entry in the same hash
+   * chain (or the free list), and of the neighbouring entries in the same
+   * expiry wheel slot.
+   */
+  unsigned int be_next;
+  unsigned int be_wheel_next;
+  unsigned int be_wheel_prev;
 };
 
 #define BAN_TYPE_CLASS		1
@@ -101,10 +121,20 @@ struct ban_entry {
 #define BAN_TYPE_USER		3
 #define BAN_TYPE_USER_HOST	4
 
+/* The ban list entries, and the hash buckets indexing them by type and name,
+ * live in the shm after the struct ban_data header, at the given offsets.
+ */
 struct ban_list {
-  struct ban_entry bl_entries[BAN_LIST_MAXSZ + BAN_LIST_HEADROOMSZ];
   unsigned int bl_listlen;
-  unsigned int bl_next_slot;
+  unsigned int bl_maxsz;
+  unsigned int bl_nbuckets;
+  unsigned int bl_free;
+  size_t bl_buckets_off;
+  size_t bl_entries_off;
+
+  /* The time up to which the expiry wheel has been processed. */
+  time_t bl_wheel_ts;
+  unsigned int bl_wheel[BAN_EXPIRY_WHEEL_SIZE];
 };
 
 struct ban_event_entry {
@@ -117,6 +147,10 @@ struct ban_event_entry {
   time_t bee_expires;
   char bee_message[BAN_STRING_MAXSZ];
   unsigned int bee_sid;
+
+  unsigned int bee_next;
+  unsigned int bee_wheel_next;
+  unsigned int bee_wheel_prev;
 };
 
 #define BAN_EV_TYPE_ANON_REJECT_PASSWORDS		1
@@ -141,16 +175,38 @@ struct ban_event_entry {
 #define BAN_EV_TYPE_MAX_LOGIN_ATTEMPTS_FROM_USER	20
 
 struct ban_event_list {
-  struct ban_event_entry bel_entries[BAN_EVENT_LIST_MAXSZ + BAN_LIST_HEADROOMSZ];
   unsigned int bel_listlen;
-  unsigned int bel_next_slot;
+  unsigned int bel_maxsz;
+  unsigned int bel_nbuckets;
+  unsigned int bel_free;
+  size_t bel_buckets_off;
+  size_t bel_entries_off;
+
+  time_t bel_wheel_ts;
+  unsigned int bel_wheel[BAN_EXPIRY_WHEEL_SIZE];
 };
 
 struct ban_data {
+  unsigned int bd_magic;
+  size_t bd_size;
   struct ban_list bans;
   struct ban_event_list events;
 };
 
+#define BAN_DATA_ALIGN(sz)	(((sz) + 7) & ~((size_t) 7))
+
+#define BAN_LIST_BUCKETS(bd) \
+  ((unsigned int *) ((char *) (bd) + (bd)->bans.bl_buckets_off))
+#define BAN_LIST_ENTRY(bd, idx) \
+  (((struct ban_entry *) ((char *) (bd) + (bd)->bans.bl_entries_off)) + \
+    ((idx) - 1))
+
+#define BAN_EVENT_LIST_BUCKETS(bd) \
+  ((unsigned int *) ((char *) (bd) + (bd)->events.bel_buckets_off))
+#define BAN_EVENT_LIST_ENTRY(bd, idx) \
+  (((struct ban_event_entry *) ((char *) (bd) + (bd)->events.bel_entries_off)) + \
+    ((idx) - 1))
+
 /* Tracks whether we have already seen the client connect, so that we only
  * generate the 'client-connect-rate' event once, even in the face of multiple
  * HOST commands.
@@ -170,6 +226,8 @@ static char *ban_log = NULL;
 static char *ban_message = NULL;
 static int ban_shmid = -1;
 static char *ban_table = NULL;
+static unsigned int ban_table_maxsz = BAN_LIST_MAXSZ;
+static unsigned int ban_table_event_maxsz = BAN_EVENT_LIST_MAXSZ;
 static pr_fh_t *ban_tabfh = NULL;
 static int ban_timerno = -1;
 
@@ -800,19 +858,334 @@ static int ban_cache_entry_set(pool *p, struct ban_cache_entry *bce) {
   return 0;
 }
 
+/* Hash index and expiry wheel routines for the shm lists.  Entries are
+ * referenced by their 1-based index into the entries array, so that the
+ * links remain valid regardless of where the shm is attached.
+ */
+
+static unsigned int ban_hash(unsigned int type, const char *name) {
+  unsigned int h = type;
+
+  while (*name) {
+    h = (h * 33) + (unsigned char) *name;
+    name++;
+  }
+
+  return h;
+}
+
+static unsigned int ban_list_alloc(struct ban_data *bd) {
+  unsigned int idx;
+
+  idx = bd->bans.bl_free;
+  if (idx != 0) {
+    struct ban_entry *be;
+
+    be = BAN_LIST_ENTRY(bd, idx);
+    bd->bans.bl_free = be->be_next;
+    memset(be, '\0', sizeof(struct ban_entry));
+  }
+
+  return idx;
+}
+
+static void ban_list_link(struct ban_data *bd, unsigned int idx) {
+  struct ban_entry *be;
+  unsigned int h, *buckets;
+
+  be = BAN_LIST_ENTRY(bd, idx);
+  buckets = BAN_LIST_BUCKETS(bd);
+
+  h = ban_hash(be->be_type, be->be_name) & (bd->bans.bl_nbuckets - 1);
+  be->be_next = buckets[h];
+  buckets[h] = idx;
+
+  be->be_wheel_next = be->be_wheel_prev = 0;
+  if (be->be_expires != 0) {
+    unsigned int slot;
+
+    slot = (unsigned int) (be->be_expires % BAN_EXPIRY_WHEEL_SIZE);
+    be->be_wheel_next = bd->bans.bl_wheel[slot];
+    if (be->be_wheel_next != 0) {
+      BAN_LIST_ENTRY(bd, be->be_wheel_next)->be_wheel_prev = idx;
+    }
+
+    bd->bans.bl_wheel[slot] = idx;
+  }
+
+  bd->bans.bl_listlen++;
+}
+
+static void ban_list_unlink(struct ban_data *bd, unsigned int idx) {
+  struct ban_entry *be;
+  unsigned int h, *ptr;
+
+  be = BAN_LIST_ENTRY(bd, idx);
+
+  h = ban_hash(be->be_type, be->be_name) & (bd->bans.bl_nbuckets - 1);
+  ptr = &(BAN_LIST_BUCKETS(bd)[h]);
+  while (*ptr != 0) {
+    if (*ptr == idx) {
+      *ptr = be->be_next;
+      break;
+    }
+
+    ptr = &(BAN_LIST_ENTRY(bd, *ptr)->be_next);
+  }
+
+  if (be->be_expires != 0) {
+    if (be->be_wheel_prev != 0) {
+      BAN_LIST_ENTRY(bd, be->be_wheel_prev)->be_wheel_next = be->be_wheel_next;
+
+    } else {
+      bd->bans.bl_wheel[be->be_expires % BAN_EXPIRY_WHEEL_SIZE] =
+        be->be_wheel_next;
+    }
+
+    if (be->be_wheel_next != 0) {
+      BAN_LIST_ENTRY(bd, be->be_wheel_next)->be_wheel_prev = be->be_wheel_prev;
+    }
+  }
+
+  memset(be, '\0', sizeof(struct ban_entry));
+  be->be_next = bd->bans.bl_free;
+  bd->bans.bl_free = idx;
+  bd->bans.bl_listlen--;
+}
+
+static unsigned int ban_event_list_alloc(struct ban_data *bd) {
+  unsigned int idx;
+
+  idx = bd->events.bel_free;
+  if (idx != 0) {
+    struct ban_event_entry *bee;
+
+    bee = BAN_EVENT_LIST_ENTRY(bd, idx);
+    bd->events.bel_free = bee->bee_next;
+    memset(bee, '\0', sizeof(struct ban_event_entry));
+  }
+
+  return idx;
+}
+
+/* Event entries only expire if they have an expiration configured, at the
+ * end of their window.
+ */
+static time_t ban_event_entry_end(struct ban_event_entry *bee) {
+  if (bee->bee_expires == 0) {
+    return 0;
+  }
+
+  return bee->bee_start + bee->bee_window;
+}
+
+static void ban_event_list_link(struct ban_data *bd, unsigned int idx) {
+  struct ban_event_entry *bee;
+  unsigned int h, *buckets;
+  time_t bee_end;
+
+  bee = BAN_EVENT_LIST_ENTRY(bd, idx);
+  buckets = BAN_EVENT_LIST_BUCKETS(bd);
+
+  h = ban_hash(bee->bee_type, bee->bee_src) & (bd->events.bel_nbuckets - 1);
+  bee->bee_next = buckets[h];
+  buckets[h] = idx;
+
+  bee->bee_wheel_next = bee->bee_wheel_prev = 0;
+  bee_end = ban_event_entry_end(bee);
+  if (bee_end != 0) {
+    unsigned int slot;
+
+    slot = (unsigned int) (bee_end % BAN_EXPIRY_WHEEL_SIZE);
+    bee->bee_wheel_next = bd->events.bel_wheel[slot];
+    if (bee->bee_wheel_next != 0) {
+      BAN_EVENT_LIST_ENTRY(bd, bee->bee_wheel_next)->bee_wheel_prev = idx;
+    }
+
+    bd->events.bel_wheel[slot] = idx;
+  }
+
+  bd->events.bel_listlen++;
+}
+
+static void ban_event_list_unlink(struct ban_data *bd, unsigned int idx) {
+  struct ban_event_entry *bee;
+  unsigned int h, *ptr;
+  time_t bee_end;
+
+  bee = BAN_EVENT_LIST_ENTRY(bd, idx);
+
+  h = ban_hash(bee->bee_type, bee->bee_src) & (bd->events.bel_nbuckets - 1);
+  ptr = &(BAN_EVENT_LIST_BUCKETS(bd)[h]);
+  while (*ptr != 0) {
+    if (*ptr == idx) {
+      *ptr = bee->bee_next;
+      break;
+    }
+
+    ptr = &(BAN_EVENT_LIST_ENTRY(bd, *ptr)->bee_next);
+  }
+
+  bee_end = ban_event_entry_end(bee);
+  if (bee_end != 0) {
+    if (bee->bee_wheel_prev != 0) {
+      BAN_EVENT_LIST_ENTRY(bd, bee->bee_wheel_prev)->bee_wheel_next =
+        bee->bee_wheel_next;
+
+    } else {
+      bd->events.bel_wheel[bee_end % BAN_EXPIRY_WHEEL_SIZE] =
+        bee->bee_wheel_next;
+    }
+
+    if (bee->bee_wheel_next != 0) {
+      BAN_EVENT_LIST_ENTRY(bd, bee->bee_wheel_next)->bee_wheel_prev =
+        bee->bee_wheel_prev;
+    }
+  }
+
+  memset(bee, '\0', sizeof(struct ban_event_entry));
+  bee->bee_next = bd->events.bel_free;
+  bd->events.bel_free = idx;
+  bd->events.bel_listlen--;
+}
+
+/* Fill in the header for lists of the given sizes, returning the total
+ * size of the shm needed for them.
+ */
+static size_t ban_data_layout(struct ban_data *bd, unsigned int maxsz,
+    unsigned int event_maxsz) {
+  size_t off;
+  unsigned int nbuckets;
+
+  memset(bd, '\0', sizeof(struct ban_data));
+  off = BAN_DATA_ALIGN(sizeof(struct ban_data));
+
+  /* Keep the bucket counts a power of two, and the load factor at most one. */
+  nbuckets = 1;
+  while (nbuckets < maxsz) {
+    nbuckets <<= 1;
+  }
+
+  bd->bans.bl_maxsz = maxsz;
+  bd->bans.bl_nbuckets = nbuckets;
+  bd->bans.bl_buckets_off = off;
+  off += BAN_DATA_ALIGN(nbuckets * sizeof(unsigned int));
+  bd->bans.bl_entries_off = off;
+  off += BAN_DATA_ALIGN(maxsz * sizeof(struct ban_entry));
+
+  nbuckets = 1;
+  while (nbuckets < event_maxsz) {
+    nbuckets <<= 1;
+  }
+
+  bd->events.bel_maxsz = event_maxsz;
+  bd->events.bel_nbuckets = nbuckets;
+  bd->events.bel_buckets_off = off;
+  off += BAN_DATA_ALIGN(nbuckets * sizeof(unsigned int));
+  bd->events.bel_entries_off = off;
+  off += BAN_DATA_ALIGN(event_maxsz * sizeof(struct ban_event_entry));
+
+  bd->bd_size = off;
+  return off;
+}
+
+static void ban_data_init(struct ban_data *bd, const struct ban_data *layout) {
+  register unsigned int i;
+
+  memset(bd, '\0', layout->bd_size);
+  memcpy(bd, layout, sizeof(struct ban_data));
+
+  /* Chain all of the entries onto the free lists. */
+  for (i = 1; i <= bd->bans.bl_maxsz; i++) {
+    BAN_LIST_ENTRY(bd, i)->be_next = (i < bd->bans.bl_maxsz ? i + 1 : 0);
+  }
+  bd->bans.bl_free = 1;
+
+  for (i = 1; i <= bd->events.bel_maxsz; i++) {
+    BAN_EVENT_LIST_ENTRY(bd, i)->bee_next =
+      (i < bd->events.bel_maxsz ? i + 1 : 0);
+  }
+  bd->events.bel_free = 1;
+
+  bd->bd_magic = BAN_DATA_MAGIC;
+}
+
+/* Copy the entries in use from one set of lists into another, as when the
+ * lists are resized.
+ */
+static void ban_data_copy(struct ban_data *dst, struct ban_data *src) {
+  register unsigned int i;
+  unsigned int ndropped = 0, nevents_dropped = 0;
+
+  for (i = 1; i <= src->bans.bl_maxsz; i++) {
+    struct ban_entry *be;
+    unsigned int idx;
+
+    be = BAN_LIST_ENTRY(src, i);
+    if (be->be_type == 0) {
+      continue;
+    }
+
+    idx = ban_list_alloc(dst);
+    if (idx == 0) {
+      ndropped++;
+      continue;
+    }
+
+    memcpy(BAN_LIST_ENTRY(dst, idx), be, sizeof(struct ban_entry));
+    ban_list_link(dst, idx);
+  }
+
+  for (i = 1; i <= src->events.bel_maxsz; i++) {
+    struct ban_event_entry *bee;
+    unsigned int idx;
+
+    bee = BAN_EVENT_LIST_ENTRY(src, i);
+    if (bee->bee_type == 0) {
+      continue;
+    }
+
+    idx = ban_event_list_alloc(dst);
+    if (idx == 0) {
+      nevents_dropped++;
+      continue;
+    }
+
+    memcpy(BAN_EVENT_LIST_ENTRY(dst, idx), bee,
+      sizeof(struct ban_event_entry));
+    ban_event_list_link(dst, idx);
+  }
+
+  (void) pr_log_writefile(ban_logfd, MOD_BAN_VERSION,
+    "copied %u bans (%u dropped), %u ban events (%u dropped) into resized "
+    "BanTable", dst->bans.bl_listlen, ndropped, dst->events.bel_listlen,
+    nevents_dropped);
+}
+
 /* Functions for marshalling key/value data to/from local cache,
  * i.e. SysV shm.
  */
 static struct ban_data *ban_get_shm(pr_fh_t *tabfh) {
-  int shmid;
-  int shm_existed = FALSE;
-  struct ban_data *data = NULL;
+  int shmid, old_shmid = -1;
+  struct ban_data layout, *data = NULL, *old_data = NULL;
+  size_t datasz;
   key_t key;
 
-  /* If we already have a shmid, no need to do anything. */
+  datasz = ban_data_layout(&layout, ban_table_maxsz, ban_table_event_maxsz);
+
+  /* If we already have a shmid, no need to do anything -- unless the
+   * configured BanTableSize has changed, e.g. on restart, in which case
+   * the lists are rebuilt at the new size.
+   */
   if (ban_shmid >= 0) {
-    errno = EEXIST;
-    return NULL;
+    if (ban_lists->bans.bl_maxsz == ban_table_maxsz &&
+        ban_lists->events.bel_maxsz == ban_table_event_maxsz) {
+      errno = EEXIST;
+      return NULL;
+    }
+
+    old_data = ban_lists;
+    old_shmid = ban_shmid;
   }
 
   /* Get a key for this path. */
@@ -827,54 +1200,145 @@ static struct ban_data *ban_get_shm(pr_fh_t *tabfh) {
     return NULL;
   }
 
-  /* Try first using IPC_CREAT|IPC_EXCL, to check if there is an existing
-   * shm for this key.  If there is, try again, using a flag of zero.
-   */
+  if (old_data == NULL) {
+    struct shmid_ds ds;
 
-  shmid = shmget(key, sizeof(struct ban_data), IPC_CREAT|IPC_EXCL|0666);
-  if (shmid < 0) {
+    /* Try first using IPC_CREAT|IPC_EXCL, to check if there is an existing
+     * shm for this key.  If there is, try again, using a flag of zero.
+     */
 
-    if (errno == EEXIST) {
-      shm_existed = TRUE;
+    shmid = shmget(key, datasz, IPC_CREAT|IPC_EXCL|0666);
+    if (shmid < 0) {
 
-      shmid = shmget(key, 0, 0);
+      if (errno == EEXIST) {
+        shmid = shmget(key, 0, 0);
+        if (shmid < 0) {
+          return NULL;
+        }
 
-    } else {
+      } else {
+        return NULL;
+      }
+    }
+
+    /* Attach to the shm. */
+    data = (struct ban_data *) shmat(shmid, NULL, 0);
+    if (data == (struct ban_data *) -1) {
+      int xerrno = errno;
+
+      (void) pr_log_writefile(ban_logfd, MOD_BAN_VERSION,
+        "unable to attach to shm: %s", strerror(xerrno));
+
+      errno = xerrno;
       return NULL;
     }
-  }
 
-  /* Attach to the shm. */
-  data = (struct ban_data *) shmat(shmid, NULL, 0);
-  if (data == NULL) {
-    int xerrno = errno;
+    memset(&ds, 0, sizeof(ds));
+    if (shmctl(shmid, IPC_STAT, &ds) < 0) {
+      (void) pr_log_writefile(ban_logfd, MOD_BAN_VERSION,
+        "error checking shmid %d: %s", shmid, strerror(errno));
+    }
 
-    (void) pr_log_writefile(ban_logfd, MOD_BAN_VERSION,
-      "unable to attach to shm: %s", strerror(xerrno));
+    if (ban_lock_shm(LOCK_EX) < 0) {
+      (void) pr_log_writefile(ban_logfd, MOD_BAN_VERSION,
+        "error write-locking shm: %s", strerror(errno));
+    }
 
-    errno = xerrno;
-    return NULL;
-  }
+    if (data->bd_magic != BAN_DATA_MAGIC) {
+      if (ds.shm_segsz >= datasz) {
+        /* Make sure the memory is initialized. */
+        ban_data_init(data, &layout);
 
-  if (!shm_existed) {
+      } else {
+        /* An existing shm, too small for our lists, and not one whose
+         * contents we recognize.
+         */
+        old_data = data;
+        old_shmid = shmid;
+      }
+
+    } else if (data->bans.bl_maxsz != ban_table_maxsz ||
+               data->events.bel_maxsz != ban_table_event_maxsz) {
+      old_data = data;
+      old_shmid = shmid;
+    }
 
-    /* Make sure the memory is initialized. */
+  } else {
     if (ban_lock_shm(LOCK_EX) < 0) {
       (void) pr_log_writefile(ban_logfd, MOD_BAN_VERSION,
         "error write-locking shm: %s", strerror(errno));
     }
+  }
 
-    memset(data, '\0', sizeof(struct ban_data));
+  if (old_data != NULL) {
+    struct shmid_ds ds;
+    int res, xerrno;
+
+    /* Remove the existing shm, so that its key can be used for a new shm of
+     * the configured size.  Sessions still attached to the old shm keep using
+     * it until they end.
+     */
+    memset(&ds, 0, sizeof(ds));
 
-    if (ban_lock_shm(LOCK_UN) < 0) {
+    PRIVS_ROOT
+    res = shmctl(old_shmid, IPC_RMID, &ds);
+    xerrno = errno;
+    PRIVS_RELINQUISH
+
+    if (res < 0) {
       (void) pr_log_writefile(ban_logfd, MOD_BAN_VERSION,
-        "error unlocking shm: %s", strerror(errno));
+        "error removing shmid %d: %s", old_shmid, strerror(xerrno));
+    }
+
+    data = NULL;
+    shmid = shmget(key, datasz, IPC_CREAT|IPC_EXCL|0666);
+    if (shmid >= 0) {
+      data = (struct ban_data *) shmat(shmid, NULL, 0);
+      if (data == (struct ban_data *) -1) {
+        data = NULL;
+      }
     }
+
+    if (data == NULL) {
+      xerrno = errno;
+
+      (void) pr_log_writefile(ban_logfd, MOD_BAN_VERSION,
+        "unable to resize shm for BanTable '%s': %s", tabfh->fh_path,
+        strerror(xerrno));
+      (void) ban_lock_shm(LOCK_UN);
+
+      if (old_data == ban_lists) {
+        /* Keep using the lists we have. */
+        errno = EEXIST;
+
+      } else {
+        errno = xerrno;
+      }
+
+      return NULL;
+    }
+
+    ban_data_init(data, &layout);
+    if (old_data->bd_magic == BAN_DATA_MAGIC) {
+      ban_data_copy(data, old_data);
+    }
+
+#if !defined(_POSIX_SOURCE)
+    (void) shmdt((char *) old_data);
+#else
+    (void) shmdt((const void *) old_data);
+#endif
+  }
+
+  if (ban_lock_shm(LOCK_UN) < 0) {
+    (void) pr_log_writefile(ban_logfd, MOD_BAN_VERSION,
+      "error unlocking shm: %s", strerror(errno));
   }
 
   ban_shmid = shmid;
   (void) pr_log_writefile(ban_logfd, MOD_BAN_VERSION,
-    "obtained shmid %d for BanTable '%s'", ban_shmid, tabfh->fh_path);
+    "obtained shmid %d for BanTable '%s' (%u bans, %u ban events)", ban_shmid,
+    tabfh->fh_path, data->bans.bl_maxsz, data->events.bel_maxsz);
 
   return data;
 }
@@ -898,6 +1362,13 @@ static int ban_lock_shm(int flags) {
     return 0;
   }
 
+  /* Only release the lock when the outermost holder unlocks. */
+  if (ban_nlocks > 1 &&
+      (flags & LOCK_UN)) {
+    ban_nlocks--;
+    return 0;
+  }
+
 #ifdef HAVE_FLOCK
   while (flock(ban_tabfh->fh_fd, flags) < 0) {
     if (errno == EINTR) {
@@ -1269,91 +1740,62 @@ static void ban_send_message(pool *p, const char *user,
 static int ban_list_add(pool *p, unsigned int type, unsigned int sid,
     const char *name, const char *reason, time_t lasts,
     const char *rule_message) {
-  unsigned int old_slot;
-  int res = 0, seen = FALSE;
+  unsigned int idx;
+  int res = 0;
 
   if (ban_lists == NULL) {
     errno = EPERM;
     return -1;
   }
 
-  old_slot = ban_lists->bans.bl_next_slot;
-
   /* Find an open slot in the list for this new entry. */
-  while (TRUE) {
+  idx = ban_list_alloc(ban_lists);
+  if (idx != 0) {
     struct ban_entry *be;
 
-    pr_signals_handle();
-
-    if (ban_lists->bans.bl_next_slot >= BAN_LIST_MAXSZ) {
-      ban_lists->bans.bl_next_slot = 0;
-    }
-
-    be = &(ban_lists->bans.bl_entries[ban_lists->bans.bl_next_slot]);
-    if (be->be_type == 0) {
-      be->be_type = type;
-      be->be_sid = sid;
+    be = BAN_LIST_ENTRY(ban_lists, idx);
+    be->be_type = type;
+    be->be_sid = sid;
 
-      sstrncpy(be->be_name, name, sizeof(be->be_name));
-      sstrncpy(be->be_reason, reason, sizeof(be->be_reason));
-      be->be_expires = lasts ? time(NULL) + lasts : 0;
+    sstrncpy(be->be_name, name, sizeof(be->be_name));
+    sstrncpy(be->be_reason, reason, sizeof(be->be_reason));
+    be->be_expires = lasts ? time(NULL) + lasts : 0;
 
-      memset(be->be_message, '\0', sizeof(be->be_message));
-      if (rule_message != NULL) {
-        sstrncpy(be->be_message, rule_message, sizeof(be->be_message));
-      }
-
-      switch (type) {
-        case BAN_TYPE_USER:
-          pr_event_generate("mod_ban.ban-user",
-            ban_lists->bans.bl_entries[ban_lists->bans.bl_next_slot].be_name);
-          ban_disconnect_user(name);
-          break;
-
-        case BAN_TYPE_USER_HOST:
-          pr_event_generate("mod_ban.ban-user@host",
-            ban_lists->bans.bl_entries[ban_lists->bans.bl_next_slot].be_name);
-          ban_disconnect_user(name);
-          break;
-
-        case BAN_TYPE_HOST:
-          pr_event_generate("mod_ban.ban-host",
-            ban_lists->bans.bl_entries[ban_lists->bans.bl_next_slot].be_name);
-          ban_disconnect_host(name);
-          break;
-
-        case BAN_TYPE_CLASS:
-          pr_event_generate("mod_ban.ban-class",
-            ban_lists->bans.bl_entries[ban_lists->bans.bl_next_slot].be_name);
-          ban_disconnect_class(name);
-          break;
-      }
+    if (rule_message != NULL) {
+      sstrncpy(be->be_message, rule_message, sizeof(be->be_message));
+    }
 
-      ban_lists->bans.bl_next_slot++;
-      ban_lists->bans.bl_listlen++;
-      break;
-      
-    } else {
-      pr_signals_handle(); 
+    ban_list_link(ban_lists, idx);
 
-      if (ban_lists->bans.bl_next_slot == old_slot &&
-          seen == TRUE) {
+    switch (type) {
+      case BAN_TYPE_USER:
+        pr_event_generate("mod_ban.ban-user", be->be_name);
+        ban_disconnect_user(name);
+        break;
 
-        /* This happens when we've scanned the entire list, found no
-         * empty slot, and have returned back to the slot at which we
-         * started.
-         */
-        (void) pr_log_writefile(ban_logfd, MOD_BAN_VERSION,
-          "maximum number of ban slots (%u) already in use", BAN_LIST_MAXSZ);
+      case BAN_TYPE_USER_HOST:
+        pr_event_generate("mod_ban.ban-user@host", be->be_name);
+        ban_disconnect_user(name);
+        break;
 
-        errno = ENOSPC;
-        res = -1;
+      case BAN_TYPE_HOST:
+        pr_event_generate("mod_ban.ban-host", be->be_name);
+        ban_disconnect_host(name);
         break;
-      }
 
-      ban_lists->bans.bl_next_slot++;
-      seen = TRUE;
+      case BAN_TYPE_CLASS:
+        pr_event_generate("mod_ban.ban-class", be->be_name);
+        ban_disconnect_class(name);
+        break;
     }
+
+  } else {
+    (void) pr_log_writefile(ban_logfd, MOD_BAN_VERSION,
+      "maximum number of ban slots (%u) already in use",
+      ban_lists->bans.bl_maxsz);
+
+    errno = ENOSPC;
+    res = -1;
   }
 
   /* Add the entry to cache, if configured AND if the caller provided a pool
@@ -1404,24 +1846,36 @@ static int ban_list_exists(pool *p, unsigned int type, unsigned int sid,
   }
 
   if (ban_lists->bans.bl_listlen) {
-    register unsigned int i = 0;
+    unsigned int h, idx;
 
-    for (i = 0; i < BAN_LIST_MAXSZ; i++) {
-      pr_signals_handle();
+    if (ban_lock_shm(LOCK_SH) < 0) {
+      (void) pr_log_writefile(ban_logfd, MOD_BAN_VERSION,
+        "error read-locking shm: %s", strerror(errno));
+    }
 
-      if (ban_lists->bans.bl_entries[i].be_type == type &&
-          (ban_lists->bans.bl_entries[i].be_sid == 0 ||
-           ban_lists->bans.bl_entries[i].be_sid == sid) &&
-          strcmp(ban_lists->bans.bl_entries[i].be_name, name) == 0) {
+    h = ban_hash(type, name) & (ban_lists->bans.bl_nbuckets - 1);
+    for (idx = BAN_LIST_BUCKETS(ban_lists)[h]; idx != 0;) {
+      struct ban_entry *be;
+
+      be = BAN_LIST_ENTRY(ban_lists, idx);
+      if (be->be_type == type &&
+          (be->be_sid == 0 ||
+           be->be_sid == sid) &&
+          strcmp(be->be_name, name) == 0) {
 
         if (message != NULL &&
-            strlen(ban_lists->bans.bl_entries[i].be_message) > 0) {
-          *message = ban_lists->bans.bl_entries[i].be_message;
+            strlen(be->be_message) > 0) {
+          *message = be->be_message;
         }
 
+        (void) ban_lock_shm(LOCK_UN);
         return 0;
       }
+
+      idx = be->be_next;
     }
+
+    (void) ban_lock_shm(LOCK_UN);
   }
 
   /* Check with cache, if configured AND if the caller provided a pool for
@@ -1515,6 +1969,32 @@ static int ban_list_exists(pool *p, unsigned int type, unsigned int sid,
   return -1;
 }
 
+static void ban_list_remove_entry(unsigned int idx) {
+  struct ban_entry *be;
+
+  be = BAN_LIST_ENTRY(ban_lists, idx);
+
+  switch (be->be_type) {
+    case BAN_TYPE_USER:
+      pr_event_generate("mod_ban.permit-user", be->be_name);
+      break;
+
+    case BAN_TYPE_USER_HOST:
+      pr_event_generate("mod_ban.permit-user@host", be->be_name);
+      break;
+
+    case BAN_TYPE_HOST:
+      pr_event_generate("mod_ban.permit-host", be->be_name);
+      break;
+
+    case BAN_TYPE_CLASS:
+      pr_event_generate("mod_ban.permit-class", be->be_name);
+      break;
+  }
+
+  ban_list_unlink(ban_lists, idx);
+}
+
 static int ban_list_remove(pool *p, unsigned int type, unsigned int sid,
     const char *name) {
 
@@ -1530,55 +2010,52 @@ static int ban_list_remove(pool *p, unsigned int type, unsigned int sid,
   }
 
   if (ban_lists->bans.bl_listlen) {
-    register unsigned int i = 0;
-
-    for (i = 0; i < BAN_LIST_MAXSZ; i++) {
-      pr_signals_handle();
 
-      if (ban_lists->bans.bl_entries[i].be_type == type &&
-          (sid == 0 || ban_lists->bans.bl_entries[i].be_sid == sid) &&
-          (name ? strcmp(ban_lists->bans.bl_entries[i].be_name, name) == 0 :
-           TRUE)) {
+    /* If name is null, it means the caller wants to remove all
+     * names for the given type/SID combination.
+     *
+     * If name is not null, but sid is zero, then it means the caller
+     * wants to remove the given name/type combination for all SIDs.
+     *
+     * Thus we only want to return here if sid is non-zero and name
+     * is not null.
+     */
+    if (name != NULL) {
+      unsigned int h, idx;
 
-        switch (type) {
-          case BAN_TYPE_USER:
-            pr_event_generate("mod_ban.permit-user",
-              ban_lists->bans.bl_entries[i].be_name);
-            break;
+      h = ban_hash(type, name) & (ban_lists->bans.bl_nbuckets - 1);
+      for (idx = BAN_LIST_BUCKETS(ban_lists)[h]; idx != 0;) {
+        struct ban_entry *be;
+        unsigned int next_idx;
 
-          case BAN_TYPE_USER_HOST:
-            pr_event_generate("mod_ban.permit-user@host",
-              ban_lists->bans.bl_entries[i].be_name);
-            break;
+        be = BAN_LIST_ENTRY(ban_lists, idx);
+        next_idx = be->be_next;
 
-          case BAN_TYPE_HOST:
-            pr_event_generate("mod_ban.permit-host",
-              ban_lists->bans.bl_entries[i].be_name);
-            break;
+        if (be->be_type == type &&
+            (sid == 0 || be->be_sid == sid) &&
+            strcmp(be->be_name, name) == 0) {
+          ban_list_remove_entry(idx);
 
-          case BAN_TYPE_CLASS:
-            pr_event_generate("mod_ban.permit-class",
-              ban_lists->bans.bl_entries[i].be_name);
-            break;
+          if (sid != 0) {
+            return 0;
+          }
         }
 
-        memset(&(ban_lists->bans.bl_entries[i]), '\0',
-          sizeof(struct ban_entry)); 
+        idx = next_idx;
+      }
 
-        ban_lists->bans.bl_listlen--;
+    } else {
+      register unsigned int i;
 
-        /* If name is null, it means the caller wants to remove all
-         * names for the given type/SID combination.
-         *
-         * If name is not null, but sid is zero, then it means the caller
-         * wants to remove the given name/type combination for all SIDs.
-         *
-         * Thus we only want to return here if sid is non-zero and name
-         * is not null.
-         */
-        if (sid != 0 &&
-            name != NULL) {
-          return 0;
+      for (i = 1; i <= ban_lists->bans.bl_maxsz; i++) {
+        struct ban_entry *be;
+
+        pr_signals_handle();
+
+        be = BAN_LIST_ENTRY(ban_lists, i);
+        if (be->be_type == type &&
+            (sid == 0 || be->be_sid == sid)) {
+          ban_list_remove_entry(i);
         }
       }
     }
@@ -1593,42 +2070,81 @@ static int ban_list_remove(pool *p, unsigned int type, unsigned int sid,
   return -1;
 }
 
-/* Remove all expired bans from the list. */
+/* Remove all expired bans from the list, by visiting the expiry wheel slots
+ * for the seconds which have passed since the last check.
+ */
 static void ban_list_expire(void) {
-  time_t now = time(NULL);
+  time_t now = time(NULL), ts;
+  unsigned int nslots;
   register unsigned int i = 0;
 
   if (ban_lists == NULL ||
-      ban_lists->bans.bl_listlen == 0) {
+      ban_lists->bans.bl_listlen == 0 ||
+      ban_lists->bans.bl_wheel_ts == now) {
     return;
   }
 
-  for (i = 0; i < BAN_LIST_MAXSZ; i++) {
+  if (ban_lock_shm(LOCK_EX) < 0) {
+    (void) pr_log_writefile(ban_logfd, MOD_BAN_VERSION,
+      "error write-locking shm: %s", strerror(errno));
+    return;
+  }
+
+  ts = ban_lists->bans.bl_wheel_ts;
+  if (ts > now ||
+      now - ts >= BAN_EXPIRY_WHEEL_SIZE) {
+    /* Too long since the last check (or the clock went backwards); visit
+     * every slot.
+     */
+    nslots = BAN_EXPIRY_WHEEL_SIZE;
+    ts = now - BAN_EXPIRY_WHEEL_SIZE;
+
+  } else {
+    nslots = (unsigned int) (now - ts);
+  }
+
+  for (i = 1; i <= nslots; i++) {
+    unsigned int idx;
+
     pr_signals_handle();
 
-    if (ban_lists->bans.bl_entries[i].be_type &&
-        ban_lists->bans.bl_entries[i].be_expires &&
-        !(ban_lists->bans.bl_entries[i].be_expires > now)) {
-      char *ban_desc, *ban_name;
-      int ban_type;
-      pool *tmp_pool;
+    idx = ban_lists->bans.bl_wheel[(ts + i) % BAN_EXPIRY_WHEEL_SIZE];
+    while (idx != 0) {
+      struct ban_entry *be;
+      unsigned int next_idx;
 
-      ban_type = ban_lists->bans.bl_entries[i].be_type;
-      ban_name = ban_lists->bans.bl_entries[i].be_name;
+      be = BAN_LIST_ENTRY(ban_lists, idx);
+      next_idx = be->be_wheel_next;
 
-      (void) pr_log_writefile(ban_logfd, MOD_BAN_VERSION,
-        "ban for %s '%s' has expired (%lu seconds ago)",
-        ban_get_type_text(ban_type), ban_name,
-        (unsigned long) now - ban_lists->bans.bl_entries[i].be_expires);
+      if (!(be->be_expires > now)) {
+        char *ban_desc;
+        pool *tmp_pool;
 
-      tmp_pool = make_sub_pool(ban_pool ? ban_pool : session.pool);
-      ban_desc = pstrcat(tmp_pool, ban_get_type_desc(ban_type), ban_name, NULL);
-      pr_event_generate("mod_ban.ban.expired", ban_desc);
+        (void) pr_log_writefile(ban_logfd, MOD_BAN_VERSION,
+          "ban for %s '%s' has expired (%lu seconds ago)",
+          ban_get_type_text(be->be_type), be->be_name,
+          (unsigned long) now - be->be_expires);
+
+        tmp_pool = make_sub_pool(ban_pool ? ban_pool : session.pool);
+        ban_desc = pstrcat(tmp_pool, ban_get_type_desc(be->be_type),
+          be->be_name, NULL);
+        pr_event_generate("mod_ban.ban.expired", ban_desc);
+
+        if (mcache != NULL ||
+            redis != NULL) {
+          (void) ban_cache_entry_delete(tmp_pool, be->be_type, be->be_name);
+        }
 
-      ban_list_remove(tmp_pool, ban_type, 0, ban_name);
-      destroy_pool(tmp_pool);
+        ban_list_remove_entry(idx);
+        destroy_pool(tmp_pool);
+      }
+
+      idx = next_idx;
     }
   }
+
+  ban_lists->bans.bl_wheel_ts = now;
+  (void) ban_lock_shm(LOCK_UN);
 }
 
 static const char *ban_event_entry_typestr(unsigned int type) {
@@ -1700,65 +2216,36 @@ static const char *ban_event_entry_typestr(unsigned int type) {
 /* Add an entry to the ban event list. */
 static int ban_event_list_add(unsigned int type, unsigned int sid,
     const char *src, unsigned int max, time_t window, time_t expires) {
-  unsigned int old_slot;
-  int seen = FALSE;
+  struct ban_event_entry *bee;
+  unsigned int idx;
 
   if (!ban_lists) {
     errno = EPERM;
     return -1;
   }
 
-  old_slot = ban_lists->events.bel_next_slot;
-
   /* Find an open slot in the list for this new entry. */
-  while (TRUE) {
-    struct ban_event_entry *bee;
-
-    pr_signals_handle();
-
-    if (ban_lists->events.bel_next_slot >= BAN_EVENT_LIST_MAXSZ) {
-      ban_lists->events.bel_next_slot = 0;
-    }
-
-    bee = &(ban_lists->events.bel_entries[ban_lists->events.bel_next_slot]);
-
-    if (bee->bee_type == 0) {
-      bee->bee_type = type;
-      bee->bee_sid = sid;
-
-      sstrncpy(bee->bee_src, src, sizeof(bee->bee_src));
-      bee->bee_count_max = max;
-      time(&bee->bee_start);
-      bee->bee_window = window;
-      bee->bee_expires = expires;
-
-      ban_lists->events.bel_next_slot++;
-      ban_lists->events.bel_listlen++;
-      break;
-
-    } else {
-      pr_signals_handle();
-
-      if (ban_lists->events.bel_next_slot == old_slot &&
-          seen == TRUE) {
+  idx = ban_event_list_alloc(ban_lists);
+  if (idx == 0) {
+    (void) pr_log_writefile(ban_logfd, MOD_BAN_VERSION,
+      "maximum number of ban event slots (%u) already in use",
+      ban_lists->events.bel_maxsz);
 
-        /* This happens when we've scanned the entire list, found no
-         * empty slot, and have returned back to the slot at which we
-         * started.
-         */
-        (void) pr_log_writefile(ban_logfd, MOD_BAN_VERSION,
-          "maximum number of ban event slots (%u) already in use",
-          BAN_EVENT_LIST_MAXSZ);
+    errno = ENOSPC;
+    return -1;
+  }
 
-        errno = ENOSPC;
-        return -1;
-      }
+  bee = BAN_EVENT_LIST_ENTRY(ban_lists, idx);
+  bee->bee_type = type;
+  bee->bee_sid = sid;
 
-      ban_lists->events.bel_next_slot++;
-      seen = TRUE;
-    }
-  }
+  sstrncpy(bee->bee_src, src, sizeof(bee->bee_src));
+  bee->bee_count_max = max;
+  time(&bee->bee_start);
+  bee->bee_window = window;
+  bee->bee_expires = expires;
 
+  ban_event_list_link(ban_lists, idx);
   return 0;
 }
 
@@ -1769,88 +2256,83 @@ static struct ban_event_entry *ban_event_list_get(unsigned int type,
     return NULL;
 
   if (ban_lists->events.bel_listlen) {
-    register unsigned int i = 0;
+    unsigned int h, idx;
 
-    for (i = 0; i < BAN_EVENT_LIST_MAXSZ; i++) {
-      pr_signals_handle();
+    h = ban_hash(type, src) & (ban_lists->events.bel_nbuckets - 1);
+    for (idx = BAN_EVENT_LIST_BUCKETS(ban_lists)[h]; idx != 0;) {
+      struct ban_event_entry *bee;
 
-      if (ban_lists->events.bel_entries[i].bee_type == type &&
-          ban_lists->events.bel_entries[i].bee_sid == sid &&
-          strcmp(ban_lists->events.bel_entries[i].bee_src, src) == 0) {
-        return &(ban_lists->events.bel_entries[i]);
+      bee = BAN_EVENT_LIST_ENTRY(ban_lists, idx);
+      if (bee->bee_type == type &&
+          bee->bee_sid == sid &&
+          strcmp(bee->bee_src, src) == 0) {
+        return bee;
       }
+
+      idx = bee->bee_next;
     }
   }
 
   return NULL;
 }
 
-static int ban_event_list_remove(unsigned int type, unsigned int sid,
-    const char *src) {
+static void ban_event_list_expire(void) {
+  time_t now = time(NULL), ts;
+  unsigned int nslots;
+  register unsigned int i = 0;
 
-  if (!ban_lists) {
-    errno = EPERM;
-    return -1;
+  if (ban_lists == NULL ||
+      ban_lists->events.bel_listlen == 0 ||
+      ban_lists->events.bel_wheel_ts == now) {
+    return;
   }
 
-  if (ban_lists->events.bel_listlen) {
-    register unsigned int i = 0;
-
-    for (i = 0; i < BAN_EVENT_LIST_MAXSZ; i++) {
-      pr_signals_handle();
-
-      if (ban_lists->events.bel_entries[i].bee_type == type &&
-          ban_lists->events.bel_entries[i].bee_sid == sid &&
-          (src ? strcmp(ban_lists->events.bel_entries[i].bee_src, src) == 0 :
-           TRUE)) {
-        memset(&(ban_lists->events.bel_entries[i]), 0,
-          sizeof(struct ban_event_entry));
+  if (ban_lock_shm(LOCK_EX) < 0) {
+    (void) pr_log_writefile(ban_logfd, MOD_BAN_VERSION,
+      "error write-locking shm: %s", strerror(errno));
+    return;
+  }
 
-        ban_lists->events.bel_listlen--;
+  ts = ban_lists->events.bel_wheel_ts;
+  if (ts > now ||
+      now - ts >= BAN_EXPIRY_WHEEL_SIZE) {
+    nslots = BAN_EXPIRY_WHEEL_SIZE;
+    ts = now - BAN_EXPIRY_WHEEL_SIZE;
 
-        if (src)
-          return 0;
-      }
-    }
+  } else {
+    nslots = (unsigned int) (now - ts);
   }
 
-  if (src == NULL) {
-    return 0;
-  }
+  for (i = 1; i <= nslots; i++) {
+    unsigned int idx;
 
-  errno = ENOENT;
-  return -1;
-}
+    pr_signals_handle();
 
-static void ban_event_list_expire(void) {
-  register unsigned int i = 0;
-  time_t now = time(NULL);
+    idx = ban_lists->events.bel_wheel[(ts + i) % BAN_EXPIRY_WHEEL_SIZE];
+    while (idx != 0) {
+      struct ban_event_entry *bee;
+      unsigned int next_idx;
+      time_t bee_end;
 
-  if (ban_lists == NULL ||
-      ban_lists->events.bel_listlen == 0) {
-    return;
-  }
+      bee = BAN_EVENT_LIST_ENTRY(ban_lists, idx);
+      next_idx = bee->bee_wheel_next;
 
-  for (i = 0; i < BAN_EVENT_LIST_MAXSZ; i++) {
-    time_t bee_end = ban_lists->events.bel_entries[i].bee_start +
-      ban_lists->events.bel_entries[i].bee_window;
+      bee_end = ban_event_entry_end(bee);
+      if (!(bee_end > now)) {
+        (void) pr_log_writefile(ban_logfd, MOD_BAN_VERSION,
+          "ban event %s entry '%s' has expired (%lu seconds ago)",
+          ban_event_entry_typestr(bee->bee_type), bee->bee_src,
+          (unsigned long) now - bee_end);
 
-    pr_signals_handle();
+        ban_event_list_unlink(ban_lists, idx);
+      }
 
-    if (ban_lists->events.bel_entries[i].bee_type &&
-        ban_lists->events.bel_entries[i].bee_expires &&
-        !(bee_end > now)) {
-      (void) pr_log_writefile(ban_logfd, MOD_BAN_VERSION,
-        "ban event %s entry '%s' has expired (%lu seconds ago)",
-        ban_event_entry_typestr(ban_lists->events.bel_entries[i].bee_type),
-        ban_lists->events.bel_entries[i].bee_src,
-        (unsigned long) now - bee_end);
-
-      ban_event_list_remove(ban_lists->events.bel_entries[i].bee_type,
-        ban_lists->events.bel_entries[i].bee_sid,
-        ban_lists->events.bel_entries[i].bee_src);
+      idx = next_idx;
     }
   }
+
+  ban_lists->events.bel_wheel_ts = now;
+  (void) ban_lock_shm(LOCK_UN);
 }
 
 /* Controls handlers
@@ -1893,9 +2375,21 @@ static int ban_get_sid_by_addr(const pr_netaddr_t *server_addr,
   return -1;
 }
 
+/* A single control response can only carry so many lines; large ban lists
+ * are truncated, rather than failing the whole response.
+ */
+static int ban_info_full(pr_ctrls_t *ctrl) {
+  if (ctrl->ctrls_cb_resps != NULL &&
+      ctrl->ctrls_cb_resps->nelts >= BAN_INFO_MAX_RESPONSES) {
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
 static int ban_handle_info(pr_ctrls_t *ctrl, int reqargc, char **reqargv) {
   register unsigned int i;
-  int optc, verbose = FALSE, show_events = FALSE;
+  int optc, verbose = FALSE, show_events = FALSE, truncated = FALSE;
   const char *reqopts = "ev";
 
   /* Check for options. */
@@ -1928,25 +2422,32 @@ static int ban_handle_info(pr_ctrls_t *ctrl, int reqargc, char **reqargv) {
   if (ban_lists->bans.bl_listlen) {
     int have_user = FALSE, have_host = FALSE, have_class = FALSE;
 
-    for (i = 0; i < BAN_LIST_MAXSZ; i++) {
-      if (ban_lists->bans.bl_entries[i].be_type == BAN_TYPE_USER) {
+    for (i = 1; i <= ban_lists->bans.bl_maxsz; i++) {
+      struct ban_entry *be = BAN_LIST_ENTRY(ban_lists, i);
+
+      if (ban_info_full(ctrl)) {
+        truncated = TRUE;
+        break;
+      }
+
+      if (be->be_type == BAN_TYPE_USER) {
         if (have_user == FALSE) {
           pr_ctrls_add_response(ctrl, "Banned Users:");
           have_user = TRUE;
         }
 
         pr_ctrls_add_response(ctrl, "  %s",
-          ban_lists->bans.bl_entries[i].be_name);
+          be->be_name);
 
         if (verbose) {
           server_rec *s;
 
           pr_ctrls_add_response(ctrl, "    Reason: %s",
-            ban_lists->bans.bl_entries[i].be_reason);
+            be->be_reason);
 
-          if (ban_lists->bans.bl_entries[i].be_expires) {
+          if (be->be_expires) {
             time_t now = time(NULL);
-            time_t then = ban_lists->bans.bl_entries[i].be_expires;
+            time_t then = be->be_expires;
 
             pr_ctrls_add_response(ctrl, "    Expires: %s (in %lu seconds)",
               pr_strtime3(ctrl->ctrls_tmp_pool, then, FALSE),
@@ -1956,7 +2457,7 @@ static int ban_handle_info(pr_ctrls_t *ctrl, int reqargc, char **reqargv) {
             pr_ctrls_add_response(ctrl, "    Expires: never");
           }
 
-          s = ban_get_server_by_id(ban_lists->bans.bl_entries[i].be_sid);
+          s = ban_get_server_by_id(be->be_sid);
           if (s != NULL) {
             pr_ctrls_add_response(ctrl, "    <VirtualHost>: %s (%s#%u)",
               s->ServerName, pr_netaddr_get_ipstr(s->addr),
@@ -1966,25 +2467,32 @@ static int ban_handle_info(pr_ctrls_t *ctrl, int reqargc, char **reqargv) {
       }
     }
 
-    for (i = 0; i < BAN_LIST_MAXSZ; i++) {
-      if (ban_lists->bans.bl_entries[i].be_type == BAN_TYPE_USER_HOST) {
+    for (i = 1; i <= ban_lists->bans.bl_maxsz; i++) {
+      struct ban_entry *be = BAN_LIST_ENTRY(ban_lists, i);
+
+      if (ban_info_full(ctrl)) {
+        truncated = TRUE;
+        break;
+      }
+
+      if (be->be_type == BAN_TYPE_USER_HOST) {
         if (have_user == FALSE) {
           pr_ctrls_add_response(ctrl, "Banned User@Hosts:");
           have_user = TRUE;
         }
 
         pr_ctrls_add_response(ctrl, "  %s",
-          ban_lists->bans.bl_entries[i].be_name);
+          be->be_name);
 
         if (verbose) {
           server_rec *s;
 
           pr_ctrls_add_response(ctrl, "    Reason: %s",
-            ban_lists->bans.bl_entries[i].be_reason);
+            be->be_reason);
 
-          if (ban_lists->bans.bl_entries[i].be_expires) {
+          if (be->be_expires) {
             time_t now = time(NULL);
-            time_t then = ban_lists->bans.bl_entries[i].be_expires;
+            time_t then = be->be_expires;
 
             pr_ctrls_add_response(ctrl, "    Expires: %s (in %lu seconds)",
               pr_strtime3(ctrl->ctrls_tmp_pool, then, FALSE),
@@ -1994,7 +2502,7 @@ static int ban_handle_info(pr_ctrls_t *ctrl, int reqargc, char **reqargv) {
             pr_ctrls_add_response(ctrl, "    Expires: never");
           }
 
-          s = ban_get_server_by_id(ban_lists->bans.bl_entries[i].be_sid);
+          s = ban_get_server_by_id(be->be_sid);
           if (s != NULL) {
             pr_ctrls_add_response(ctrl, "    <VirtualHost>: %s (%s#%u)",
               s->ServerName, pr_netaddr_get_ipstr(s->addr),
@@ -2004,8 +2512,15 @@ static int ban_handle_info(pr_ctrls_t *ctrl, int reqargc, char **reqargv) {
       }
     }
 
-    for (i = 0; i < BAN_LIST_MAXSZ; i++) {
-      if (ban_lists->bans.bl_entries[i].be_type == BAN_TYPE_HOST) {
+    for (i = 1; i <= ban_lists->bans.bl_maxsz; i++) {
+      struct ban_entry *be = BAN_LIST_ENTRY(ban_lists, i);
+
+      if (ban_info_full(ctrl)) {
+        truncated = TRUE;
+        break;
+      }
+
+      if (be->be_type == BAN_TYPE_HOST) {
         if (have_host == FALSE) {
           if (have_user == TRUE) {
             pr_ctrls_add_response(ctrl, "%s", "");
@@ -2016,17 +2531,17 @@ static int ban_handle_info(pr_ctrls_t *ctrl, int reqargc, char **reqargv) {
         }
 
         pr_ctrls_add_response(ctrl, "  %s",
-          ban_lists->bans.bl_entries[i].be_name);
+          be->be_name);
 
         if (verbose) {
           server_rec *s;
 
           pr_ctrls_add_response(ctrl, "    Reason: %s",
-            ban_lists->bans.bl_entries[i].be_reason);
+            be->be_reason);
 
-          if (ban_lists->bans.bl_entries[i].be_expires) {
+          if (be->be_expires) {
             time_t now = time(NULL);
-            time_t then = ban_lists->bans.bl_entries[i].be_expires;
+            time_t then = be->be_expires;
 
             pr_ctrls_add_response(ctrl, "    Expires: %s (in %lu seconds)",
               pr_strtime3(ctrl->ctrls_tmp_pool, then, FALSE),
@@ -2036,7 +2551,7 @@ static int ban_handle_info(pr_ctrls_t *ctrl, int reqargc, char **reqargv) {
             pr_ctrls_add_response(ctrl, "    Expires: never");
           }
 
-          s = ban_get_server_by_id(ban_lists->bans.bl_entries[i].be_sid);
+          s = ban_get_server_by_id(be->be_sid);
           if (s != NULL) {
             pr_ctrls_add_response(ctrl, "    <VirtualHost>: %s (%s#%u)",
               s->ServerName, pr_netaddr_get_ipstr(s->addr),
@@ -2046,8 +2561,15 @@ static int ban_handle_info(pr_ctrls_t *ctrl, int reqargc, char **reqargv) {
       }
     }
 
-    for (i = 0; i < BAN_LIST_MAXSZ; i++) {
-      if (ban_lists->bans.bl_entries[i].be_type == BAN_TYPE_CLASS) {
+    for (i = 1; i <= ban_lists->bans.bl_maxsz; i++) {
+      struct ban_entry *be = BAN_LIST_ENTRY(ban_lists, i);
+
+      if (ban_info_full(ctrl)) {
+        truncated = TRUE;
+        break;
+      }
+
+      if (be->be_type == BAN_TYPE_CLASS) {
         if (have_class == FALSE) {
           if (have_host == TRUE) {
             pr_ctrls_add_response(ctrl, "%s", "");
@@ -2058,17 +2580,17 @@ static int ban_handle_info(pr_ctrls_t *ctrl, int reqargc, char **reqargv) {
         }
 
         pr_ctrls_add_response(ctrl, "  %s",
-          ban_lists->bans.bl_entries[i].be_name);
+          be->be_name);
 
         if (verbose) {
           server_rec *s;
 
           pr_ctrls_add_response(ctrl, "    Reason: %s",
-            ban_lists->bans.bl_entries[i].be_reason);
+            be->be_reason);
 
-          if (ban_lists->bans.bl_entries[i].be_expires) {
+          if (be->be_expires) {
             time_t now = time(NULL);
-            time_t then = ban_lists->bans.bl_entries[i].be_expires;
+            time_t then = be->be_expires;
 
             pr_ctrls_add_response(ctrl, "    Expires: %s (in %lu seconds)",
               pr_strtime3(ctrl->ctrls_tmp_pool, then, FALSE),
@@ -2078,7 +2600,7 @@ static int ban_handle_info(pr_ctrls_t *ctrl, int reqargc, char **reqargv) {
             pr_ctrls_add_response(ctrl, "    Expires: never");
           }
 
-          s = ban_get_server_by_id(ban_lists->bans.bl_entries[i].be_sid);
+          s = ban_get_server_by_id(be->be_sid);
           if (s != NULL) {
             pr_ctrls_add_response(ctrl, "    <VirtualHost>: %s (%s#%u)",
               s->ServerName, pr_netaddr_get_ipstr(s->addr),
@@ -2101,9 +2623,15 @@ static int ban_handle_info(pr_ctrls_t *ctrl, int reqargc, char **reqargv) {
       int have_banner = FALSE;
       time_t now = time(NULL);
 
-      for (i = 0; i < BAN_EVENT_LIST_MAXSZ; i++) {
+      for (i = 1; i <= ban_lists->events.bel_maxsz; i++) {
+        struct ban_event_entry *bee = BAN_EVENT_LIST_ENTRY(ban_lists, i);
         server_rec *s;
-        int type = ban_lists->events.bel_entries[i].bee_type;
+        int type = bee->bee_type;
+
+        if (ban_info_full(ctrl)) {
+          truncated = TRUE;
+          break;
+        }
 
         switch (type) {
           case BAN_EV_TYPE_ANON_REJECT_PASSWORDS:
@@ -2134,15 +2662,15 @@ static int ban_handle_info(pr_ctrls_t *ctrl, int reqargc, char **reqargv) {
             pr_ctrls_add_response(ctrl, "  Event: %s",
               ban_event_entry_typestr(type));
             pr_ctrls_add_response(ctrl, "  Source: %s",
-              ban_lists->events.bel_entries[i].bee_src);
+              bee->bee_src);
             pr_ctrls_add_response(ctrl, "    Occurrences: %u/%u",
-              ban_lists->events.bel_entries[i].bee_count_curr,
-              ban_lists->events.bel_entries[i].bee_count_max);
+              bee->bee_count_curr,
+              bee->bee_count_max);
             pr_ctrls_add_response(ctrl, "    Entry Expires: %lu seconds",
-              (unsigned long) ban_lists->events.bel_entries[i].bee_start +
-                ban_lists->events.bel_entries[i].bee_window - now);
+              (unsigned long) bee->bee_start +
+                bee->bee_window - now);
 
-            s = ban_get_server_by_id(ban_lists->events.bel_entries[i].bee_sid);
+            s = ban_get_server_by_id(bee->bee_sid);
             if (s != NULL) {
               pr_ctrls_add_response(ctrl, "    <VirtualHost>: %s (%s#%u)",
                 s->ServerName, pr_netaddr_get_ipstr(s->addr),
@@ -2158,6 +2686,11 @@ static int ban_handle_info(pr_ctrls_t *ctrl, int reqargc, char **reqargv) {
     }
   }
 
+  if (truncated) {
+    pr_ctrls_add_response(ctrl, "(list truncated: %u bans, %u ban events)",
+      ban_lists->bans.bl_listlen, ban_lists->events.bel_listlen);
+  }
+
   ban_lock_shm(LOCK_UN);
 
   return 0;
@@ -2268,7 +2801,7 @@ static int ban_handle_ban(pr_ctrls_t *ctrl, int reqargc,
       if (ban_list_exists(ctrl->ctrls_tmp_pool, BAN_TYPE_USER, sid, reqargv[i],
           NULL) < 0) {
 
-        if (ban_lists->bans.bl_listlen < BAN_LIST_MAXSZ) {
+        if (ban_lists->bans.bl_listlen < ban_lists->bans.bl_maxsz) {
           const char *reason;
 
           reason = pstrcat(ctrl->ctrls_tmp_pool, "requested by '",
@@ -2313,7 +2846,7 @@ static int ban_handle_ban(pr_ctrls_t *ctrl, int reqargc,
       if (ban_list_exists(ctrl->ctrls_tmp_pool, BAN_TYPE_USER_HOST, sid,
           reqargv[i], NULL) < 0) {
 
-        if (ban_lists->bans.bl_listlen < BAN_LIST_MAXSZ) {
+        if (ban_lists->bans.bl_listlen < ban_lists->bans.bl_maxsz) {
           const char *reason;
 
           reason = pstrcat(ctrl->ctrls_tmp_pool, "requested by '",
@@ -2366,7 +2899,7 @@ static int ban_handle_ban(pr_ctrls_t *ctrl, int reqargc,
       if (ban_list_exists(ctrl->ctrls_tmp_pool, BAN_TYPE_HOST, sid,
           pr_netaddr_get_ipstr(site), NULL) < 0) {
 
-        if (ban_lists->bans.bl_listlen < BAN_LIST_MAXSZ) {
+        if (ban_lists->bans.bl_listlen < ban_lists->bans.bl_maxsz) {
           ban_list_add(ctrl->ctrls_tmp_pool, BAN_TYPE_HOST, sid,
             pr_netaddr_get_ipstr(site),
             pstrcat(ctrl->ctrls_tmp_pool, "requested by '",
@@ -2410,7 +2943,7 @@ static int ban_handle_ban(pr_ctrls_t *ctrl, int reqargc,
       if (ban_list_exists(ctrl->ctrls_tmp_pool, BAN_TYPE_CLASS, sid,
           reqargv[i], NULL) < 0) {
 
-        if (ban_lists->bans.bl_listlen < BAN_LIST_MAXSZ) {
+        if (ban_lists->bans.bl_listlen < ban_lists->bans.bl_maxsz) {
           const char *reason;
 
           reason = pstrcat(ctrl->ctrls_tmp_pool, "requested by '",
@@ -3177,6 +3710,39 @@ MODRET set_bantable(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
+/* usage: BanTableSize max-bans [max-events] */
+MODRET set_bantablesize(cmd_rec *cmd) {
+  register unsigned int i;
+  unsigned int sizes[2] = { 0, 0 };
+
+  if (cmd->argc < 2 ||
+      cmd->argc > 3) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  for (i = 1; i < cmd->argc; i++) {
+    char *ptr = NULL;
+    long sz;
+
+    sz = strtol(cmd->argv[i], &ptr, 10);
+    if ((ptr != NULL && *ptr) ||
+        sz < 1 ||
+        sz > INT_MAX) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid table size: '",
+        cmd->argv[i], "'", NULL));
+    }
+
+    sizes[i-1] = (unsigned int) sz;
+  }
+
+  ban_table_maxsz = sizes[0];
+  ban_table_event_maxsz = (cmd->argc == 3 ? sizes[1] : sizes[0]);
+
+  return PR_HANDLED(cmd);
+}
+
 /* Timer handlers
  */
 
@@ -3787,6 +4353,12 @@ static void ban_restart_ev(const void *event_data, void *user_data) {
     ban_tabfh = NULL;
   }
 
+  /* Reset the list sizes; if BanTableSize changes, the lists are resized by
+   * the postparse event listener.
+   */
+  ban_table_maxsz = BAN_LIST_MAXSZ;
+  ban_table_event_maxsz = BAN_EVENT_LIST_MAXSZ;
+
   /* Remove the timer. */
   if (ban_timerno > 0) {
     (void) pr_timer_remove(ban_timerno, &ban_module);
@@ -4140,6 +4712,7 @@ static conftable ban_conftab[] = {
   { "BanOnEvent",		set_banonevent,		NULL },
   { "BanOptions",		set_banoptions,		NULL },
   { "BanTable",			set_bantable,		NULL },
+  { "BanTableSize",		set_bantablesize,	NULL },
   { NULL }
 };
 
@@ -290,6 +290,7 @@ static int ctrls_handle_config_set(pr_ctrls_t *ctrl, int reqargc,
        */
       set = c->set;
       xaset_insert_end(set, (xasetmember_t *) c);
+      pr_config_index_invalidate();
     }
 
   } else {
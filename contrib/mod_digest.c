@@ -27,6 +27,7 @@
  */
 
 #include "conf.h"
+#include "privs.h"
 
 #define MOD_DIGEST_VERSION      "mod_digest/2.0.0"
 
@@ -139,6 +140,78 @@ static xaset_t *digest_cache_keys = NULL;
 /* How often do we check for expired cache entries (in secs)? */
 #define DIGEST_CACHE_EXPIRY_INTVL		5
 
+/* The DigestCacheTable, shared by all sessions, persists digests across
+ * sessions and restarts.  Entries are keyed by the file's device, inode,
+ * size, mtime and ctime, along with the algorithm and the digested range, and
+ * are stored in fixed-size buckets; a full bucket has its oldest entry
+ * replaced.
+ */
+#ifndef DIGEST_CACHE_TABLE_DEFAULT_SIZE
+# define DIGEST_CACHE_TABLE_DEFAULT_SIZE	16384
+#endif
+
+#define DIGEST_TABLE_MAGIC		0x44475442
+#define DIGEST_TABLE_VERSION		2
+#define DIGEST_TABLE_BUCKET_SIZE	4
+
+struct digest_table_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t nentries;
+  uint32_t entrysz;
+};
+
+struct digest_table_key {
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  uint64_t mtime;
+  uint64_t ctime;
+  uint64_t start;
+  uint64_t len;
+  uint32_t algo;
+  uint32_t mtime_nsec;
+  uint32_t ctime_nsec;
+  uint32_t reserved;
+};
+
+struct digest_table_entry {
+  struct digest_table_key key;
+  uint64_t stored;
+  uint32_t digest_len;
+  uint32_t reserved;
+  unsigned char digest[EVP_MAX_MD_SIZE];
+};
+
+static int digest_table_fd = -1;
+static const char *digest_table_path = NULL;
+static uint32_t digest_table_nentries = 0;
+
+/* For CRC32 digests of large ranges, DigestWorkers splits the range into
+ * chunks digested in parallel by forked worker processes.  Each worker
+ * digests at least this many bytes.
+ */
+#ifndef DIGEST_WORKERS_MIN_CHUNK_SIZE
+# define DIGEST_WORKERS_MIN_CHUNK_SIZE	(16 * 1024 * 1024)
+#endif
+
+#ifndef DIGEST_WORKERS_MAX
+# define DIGEST_WORKERS_MAX		64
+#endif
+
+static unsigned int digest_workers = 1;
+
+/* Read files for digesting in chunks of at least this size, asking the
+ * kernel to read ahead of the digesting, this much at a time.
+ */
+#ifndef DIGEST_READ_BUFFER_SIZE
+# define DIGEST_READ_BUFFER_SIZE	(256 * 1024)
+#endif
+
+#ifndef DIGEST_READAHEAD_SIZE
+# define DIGEST_READAHEAD_SIZE		(8 * 1024 * 1024)
+#endif
+
 /* Digest algorithms supported by mod_digest. */
 #define DIGEST_ALGO_CRC32		0x0001
 #ifndef OPENSSL_NO_MD5
@@ -744,6 +817,49 @@ MODRET set_digestcache(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
+/* usage: DigestCacheTable path [count] */
+MODRET set_digestcachetable(cmd_rec *cmd) {
+  config_rec *c;
+  unsigned int count = DIGEST_CACHE_TABLE_DEFAULT_SIZE;
+
+  if (cmd->argc < 2 ||
+      cmd->argc > 3) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_GLOBAL|CONF_VIRTUAL);
+
+  if (pr_fs_valid_path(cmd->argv[1]) < 0) {
+    CONF_ERROR(cmd, "must be an absolute path");
+  }
+
+  if (cmd->argc == 3) {
+    long size;
+    char *ptr = NULL;
+
+    size = strtol(cmd->argv[2], &ptr, 10);
+    if (ptr && *ptr) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid table size: ",
+        cmd->argv[2], NULL));
+    }
+
+    if (size < DIGEST_TABLE_BUCKET_SIZE ||
+        size > (long) (UINT32_MAX / sizeof(struct digest_table_entry))) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "table size out of range: ",
+        cmd->argv[2], NULL));
+    }
+
+    count = (unsigned int) size;
+  }
+
+  c = add_config_param(cmd->argv[0], 2, NULL, NULL);
+  c->argv[0] = pstrdup(c->pool, cmd->argv[1]);
+  c->argv[1] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = count;
+
+  return PR_HANDLED(cmd);
+}
+
 /* usage: DigestDefaultAlgorithm algo */
 MODRET set_digestdefaultalgo(cmd_rec *cmd) {
   config_rec *c;
@@ -913,6 +1029,34 @@ MODRET set_digestoptions(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
+/* usage: DigestWorkers count */
+MODRET set_digestworkers(cmd_rec *cmd) {
+  config_rec *c;
+  long count;
+  char *ptr = NULL;
+
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT|CONF_GLOBAL|CONF_VIRTUAL);
+
+  count = strtol(cmd->argv[1], &ptr, 10);
+  if (ptr && *ptr) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid worker count: ",
+      cmd->argv[1], NULL));
+  }
+
+  if (count < 1 ||
+      count > DIGEST_WORKERS_MAX) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "worker count out of range: ",
+      cmd->argv[1], NULL));
+  }
+
+  c = add_config_param(cmd->argv[0], 1, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[0]) = (unsigned int) count;
+
+  return PR_HANDLED(cmd);
+}
+
 static int check_digest_max_size(off_t len) {
   config_rec *c;
   off_t max_size;
@@ -1030,14 +1174,359 @@ static int blacklisted_file(const char *path) {
   return res;
 }
 
+/* Combines the CRC32 values of two adjacent ranges, given the length of the
+ * second range: the first CRC32 is advanced over that many zero bytes, using
+ * GF(2) matrix operations, as zlib's crc32_combine() does.
+ */
+static uint32_t gf2_matrix_times(const uint32_t *mat, uint32_t vec) {
+  uint32_t sum = 0;
+
+  while (vec) {
+    if (vec & 1) {
+      sum ^= *mat;
+    }
+
+    vec >>= 1;
+    mat++;
+  }
+
+  return sum;
+}
+
+static void gf2_matrix_square(uint32_t *square, const uint32_t *mat) {
+  register unsigned int i;
+
+  for (i = 0; i < 32; i++) {
+    square[i] = gf2_matrix_times(mat, mat[i]);
+  }
+}
+
+static uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, off_t len2) {
+  register unsigned int i;
+  uint32_t even[32], odd[32], row;
+
+  if (len2 <= 0) {
+    return crc1;
+  }
+
+  /* The operator for one zero bit. */
+  odd[0] = 0xEDB88320;
+  row = 1;
+  for (i = 1; i < 32; i++) {
+    odd[i] = row;
+    row <<= 1;
+  }
+
+  /* The operators for two, then four, zero bits. */
+  gf2_matrix_square(even, odd);
+  gf2_matrix_square(odd, even);
+
+  /* Apply len2 zero bytes to crc1, squaring the operator for each bit of
+   * len2 (the first square yields the operator for one zero byte).
+   */
+  do {
+    gf2_matrix_square(even, odd);
+    if (len2 & 1) {
+      crc1 = gf2_matrix_times(even, crc1);
+    }
+
+    len2 >>= 1;
+    if (len2 == 0) {
+      break;
+    }
+
+    gf2_matrix_square(odd, even);
+    if (len2 & 1) {
+      crc1 = gf2_matrix_times(odd, crc1);
+    }
+
+    len2 >>= 1;
+  } while (len2 != 0);
+
+  return crc1 ^ crc2;
+}
+
+/* Computes the CRC32 of the given range of the file.  Note that this uses
+ * positioned reads, so that forked workers can share the file handle.
+ */
+static int crc32_range(pool *p, pr_fh_t *fh, const char *path, off_t start,
+    off_t len, size_t bufsz, size_t progress_nth, uint32_t *crc,
+    void (*hash_progress_cb)(const char *, off_t)) {
+  CRC32_CTX ctx;
+  unsigned char *buf;
+  size_t iter_count = 0;
+
+  if (CRC32_Init(&ctx) != 1) {
+    return -1;
+  }
+
+  buf = palloc(p, bufsz);
+
+  while (len > 0) {
+    ssize_t res;
+    size_t readsz;
+
+    readsz = bufsz;
+    if ((off_t) readsz > len) {
+      readsz = len;
+    }
+
+    res = pr_fsio_pread(fh, buf, readsz, start);
+    if (res < 0) {
+      int xerrno = errno;
+
+      if (xerrno == EINTR ||
+          xerrno == EAGAIN) {
+        pr_signals_handle();
+        continue;
+      }
+
+      CRC32_Free(&ctx);
+      errno = xerrno;
+      return -1;
+    }
+
+    if (res == 0) {
+      pr_log_debug(DEBUG3, MOD_DIGEST_VERSION
+        ": failed to read all %" PR_LU " bytes of '%s' (premature EOF?)",
+        (pr_off_t) len, path);
+      CRC32_Free(&ctx);
+      errno = EIO;
+      return -1;
+    }
+
+    CRC32_Update(&ctx, buf, res);
+    start += res;
+    len -= res;
+
+    iter_count++;
+    if (hash_progress_cb != NULL &&
+        (iter_count % progress_nth) == 0) {
+      (hash_progress_cb)(path, len);
+    }
+  }
+
+  *crc = ctx.data ^ 0xffffffff;
+  CRC32_Free(&ctx);
+  return 0;
+}
+
+struct digest_worker {
+  pid_t pid;
+
+  /* Our end of the pipe for the worker's result, or -1 if we digest this
+   * chunk ourselves.
+   */
+  int fd;
+
+  off_t start;
+  off_t len;
+  uint32_t crc;
+};
+
+struct digest_worker_result {
+  uint32_t crc;
+  int xerrno;
+};
+
+static void digest_worker_exec(pool *p, pr_fh_t *fh, const char *path,
+    struct digest_worker *worker, size_t bufsz, int fd) {
+  struct digest_worker_result result;
+
+  /* We have nothing to say to the client, and the session tells us to stop,
+   * if needed, using SIGTERM.
+   */
+  if (session.c != NULL) {
+    (void) close(session.c->rfd);
+    if (session.c->wfd != session.c->rfd) {
+      (void) close(session.c->wfd);
+    }
+  }
+
+  (void) signal(SIGALRM, SIG_IGN);
+  (void) signal(SIGHUP, SIG_IGN);
+  (void) signal(SIGINT, SIG_IGN);
+  (void) signal(SIGUSR1, SIG_IGN);
+  (void) signal(SIGUSR2, SIG_IGN);
+  (void) signal(SIGTERM, SIG_DFL);
+
+  memset(&result, 0, sizeof(result));
+  if (crc32_range(p, fh, path, worker->start, worker->len, bufsz, 1,
+      &result.crc, NULL) < 0) {
+    result.xerrno = errno;
+  }
+
+  if (write(fd, &result, sizeof(result)) < 0) {
+    _exit(1);
+  }
+
+  _exit(0);
+}
+
+static int compute_crc32_parallel(pool *p, pr_fh_t *fh, const char *path,
+    off_t start, off_t len, unsigned int nworkers, size_t bufsz,
+    size_t progress_nth, unsigned char *digest, unsigned int *digest_len,
+    void (*hash_progress_cb)(const char *, off_t)) {
+  register unsigned int i;
+  int xerrno = 0;
+  unsigned int nforked = 0;
+  struct digest_worker *workers;
+  sigset_t chld_mask, saved_mask;
+  off_t chunk_len, remaining;
+  uint32_t crc;
+
+  workers = pcalloc(p, nworkers * sizeof(struct digest_worker));
+  chunk_len = len / nworkers;
+
+  for (i = 0; i < nworkers; i++) {
+    workers[i].pid = -1;
+    workers[i].fd = -1;
+    workers[i].start = start + (i * chunk_len);
+    workers[i].len = chunk_len;
+  }
+
+  /* The last chunk takes any remainder. */
+  workers[nworkers-1].len = len - ((nworkers - 1) * chunk_len);
+
+  /* Keep the session from reaping our workers before we do. */
+  sigemptyset(&chld_mask);
+  sigaddset(&chld_mask, SIGCHLD);
+  if (sigprocmask(SIG_BLOCK, &chld_mask, &saved_mask) < 0) {
+    return -1;
+  }
+
+  /* We digest the first chunk ourselves, as well as any chunk for which a
+   * worker could not be started.
+   */
+  for (i = 1; i < nworkers; i++) {
+    int fds[2];
+    pid_t pid;
+
+    if (pipe(fds) < 0) {
+      pr_trace_msg(trace_channel, 3, "error opening pipe for worker: %s",
+        strerror(errno));
+      continue;
+    }
+
+    pid = fork();
+    if (pid < 0) {
+      pr_trace_msg(trace_channel, 3, "error forking worker: %s",
+        strerror(errno));
+      (void) close(fds[0]);
+      (void) close(fds[1]);
+      continue;
+    }
+
+    if (pid == 0) {
+      /* We're the worker. */
+      (void) close(fds[0]);
+      digest_worker_exec(p, fh, path, &(workers[i]), bufsz, fds[1]);
+    }
+
+    (void) close(fds[1]);
+    workers[i].pid = pid;
+    workers[i].fd = fds[0];
+    nforked++;
+  }
+
+  pr_trace_msg(trace_channel, 8,
+    "computing CRC32 digest of %" PR_LU " bytes of '%s' using %u %s",
+    (pr_off_t) len, path, nforked + 1, nforked != 0 ? "processes" : "process");
+
+  remaining = len;
+  for (i = 0; i < nworkers; i++) {
+    if (workers[i].fd >= 0) {
+      continue;
+    }
+
+    if (crc32_range(p, fh, path, workers[i].start, workers[i].len, bufsz,
+        progress_nth, &(workers[i].crc), hash_progress_cb) < 0) {
+      xerrno = errno;
+      break;
+    }
+
+    remaining -= workers[i].len;
+  }
+
+  /* Always collect every worker, even after a failure. */
+  for (i = 0; i < nworkers; i++) {
+    struct digest_worker_result result;
+    ssize_t res;
+
+    if (workers[i].fd < 0) {
+      continue;
+    }
+
+    if (xerrno != 0) {
+      (void) kill(workers[i].pid, SIGTERM);
+    }
+
+    res = read(workers[i].fd, &result, sizeof(result));
+    while (res < 0 &&
+           errno == EINTR) {
+      pr_signals_handle();
+      res = read(workers[i].fd, &result, sizeof(result));
+    }
+
+    if (res != (ssize_t) sizeof(result)) {
+      if (xerrno == 0) {
+        pr_trace_msg(trace_channel, 3,
+          "error reading result of worker (PID %lu) for '%s'",
+          (unsigned long) workers[i].pid, path);
+        xerrno = EIO;
+      }
+
+    } else if (result.xerrno != 0) {
+      if (xerrno == 0) {
+        xerrno = result.xerrno;
+      }
+
+    } else {
+      workers[i].crc = result.crc;
+    }
+
+    (void) close(workers[i].fd);
+    while (waitpid(workers[i].pid, NULL, 0) < 0 &&
+           errno == EINTR) {
+      pr_signals_handle();
+    }
+
+    remaining -= workers[i].len;
+    if (xerrno == 0 &&
+        hash_progress_cb != NULL) {
+      (hash_progress_cb)(path, remaining);
+    }
+  }
+
+  (void) sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+
+  if (xerrno != 0) {
+    errno = xerrno;
+    return -1;
+  }
+
+  crc = workers[0].crc;
+  for (i = 1; i < nworkers; i++) {
+    crc = crc32_combine(crc, workers[i].crc, workers[i].len);
+  }
+
+  crc = htonl(crc);
+  memcpy(digest, &crc, sizeof(crc));
+  *digest_len = CRC32_DIGEST_LENGTH;
+
+  return 0;
+}
+
 static int compute_digest(pool *p, const char *path, off_t start, off_t len,
-    const EVP_MD *md, unsigned char *digest, unsigned int *digest_len,
-    time_t *mtime, void (*hash_progress_cb)(const char *, off_t)) {
+    unsigned long algo, const EVP_MD *md, unsigned char *digest,
+    unsigned int *digest_len, struct stat *pst,
+    void (*hash_progress_cb)(const char *, off_t)) {
   int res, xerrno = 0;
   pr_fh_t *fh;
   struct stat st;
   unsigned char *buf;
-  size_t bufsz, readsz, iter_count;
+  size_t bufsz, readsz, iter_count, progress_nth;
+  off_t end, readahead;
 #if OPENSSL_VERSION_NUMBER < 0x10100000L || \
     defined(HAVE_LIBRESSL)
   EVP_MD_CTX ctx;
@@ -1075,15 +1564,53 @@ static int compute_digest(pool *p, const char *path, off_t start, off_t len,
     return -1;
   }
 
-  if (mtime != NULL) {
-    /* Inform the caller of the last-mod-time for this file, for use in
-     * e.g caching.
+  if (pst != NULL) {
+    /* Inform the caller of the file's metadata (e.g. last-mod-time), for use
+     * in e.g caching.
      */
-    *mtime = st.st_mtime;
+    memcpy(pst, &st, sizeof(struct stat));
+  }
+
+  /* Determine the optimal block size for reading; large files are read in
+   * larger chunks, for fewer reads.  The progress callback is then invoked
+   * as often, in bytes, as for block-sized reads.
+   */
+  bufsz = st.st_blksize;
+  if (bufsz < DIGEST_READ_BUFFER_SIZE) {
+    bufsz = DIGEST_READ_BUFFER_SIZE;
+  }
+  fh->fh_iosz = bufsz;
+
+  progress_nth = DIGEST_PROGRESS_NTH_ITER;
+  if (st.st_blksize > 0 &&
+      bufsz > (size_t) st.st_blksize) {
+    progress_nth /= (bufsz / st.st_blksize);
+    if (progress_nth == 0) {
+      progress_nth = 1;
+    }
   }
 
-  /* Determine the optimal block size for reading. */
-  fh->fh_iosz = bufsz = st.st_blksize;
+  pr_fs_fadvise(PR_FH_FD(fh), start, len, PR_FS_FADVISE_SEQUENTIAL);
+
+  if (algo == DIGEST_ALGO_CRC32 &&
+      digest_workers > 1) {
+    unsigned int nworkers;
+
+    nworkers = digest_workers;
+    if ((off_t) nworkers > (len / DIGEST_WORKERS_MIN_CHUNK_SIZE)) {
+      nworkers = (unsigned int) (len / DIGEST_WORKERS_MIN_CHUNK_SIZE);
+    }
+
+    if (nworkers > 1) {
+      res = compute_crc32_parallel(p, fh, path, start, len, nworkers, bufsz,
+        progress_nth, digest, digest_len, hash_progress_cb);
+      xerrno = errno;
+
+      (void) pr_fsio_close(fh);
+      errno = xerrno;
+      return res;
+    }
+  }
 
   if (pr_fsio_lseek(fh, start, SEEK_SET) == (off_t) -1) {
     xerrno = errno;
@@ -1123,6 +1650,14 @@ static int compute_digest(pool *p, const char *path, off_t start, off_t len,
     readsz = len;
   }
 
+  /* Have the kernel read ahead of us, a window at a time, so that reading
+   * overlaps with the digesting.
+   */
+  end = start + len;
+  readahead = start + DIGEST_READAHEAD_SIZE;
+  pr_fs_fadvise(PR_FH_FD(fh), start, DIGEST_READAHEAD_SIZE,
+    PR_FS_FADVISE_WILLNEED);
+
   iter_count = 0;
   res = pr_fsio_read(fh, (char *) buf, readsz);
   xerrno = errno;
@@ -1145,6 +1680,11 @@ static int compute_digest(pool *p, const char *path, off_t start, off_t len,
       continue;
     }
 
+    if (res <= 0) {
+      /* Read error, or premature EOF. */
+      break;
+    }
+
     if (EVP_DigestUpdate(pctx, buf, res) != 1) {
       pr_log_debug(DEBUG1, MOD_DIGEST_VERSION
         ": error updating digest: %s", get_errors());
@@ -1152,8 +1692,15 @@ static int compute_digest(pool *p, const char *path, off_t start, off_t len,
 
     len -= res;
 
+    if (readahead < end &&
+        (end - len) + DIGEST_READAHEAD_SIZE > readahead) {
+      pr_fs_fadvise(PR_FH_FD(fh), readahead, DIGEST_READAHEAD_SIZE,
+        PR_FS_FADVISE_WILLNEED);
+      readahead += DIGEST_READAHEAD_SIZE;
+    }
+
     /* Every Nth iteration, invoke the progress callback. */
-    if ((iter_count % DIGEST_PROGRESS_NTH_ITER) == 0) {
+    if ((iter_count % progress_nth) == 0) {
       (hash_progress_cb)(path, len);
     }
 
@@ -1617,6 +2164,310 @@ static char *get_cached_digest(pool *p, unsigned long algo, const char *path,
   return NULL;
 }
 
+static int digest_table_lock(int fd, int lock_type, off_t offset, off_t len) {
+  struct flock lock;
+
+  lock.l_type = lock_type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = offset;
+  lock.l_len = len;
+
+  while (fcntl(fd, F_SETLKW, &lock) < 0) {
+    int xerrno = errno;
+
+    if (xerrno == EINTR) {
+      pr_signals_handle();
+      continue;
+    }
+
+    pr_trace_msg(trace_channel, 3,
+      "error locking DigestCacheTable '%s': %s", digest_table_path,
+      strerror(xerrno));
+    errno = xerrno;
+    return -1;
+  }
+
+  return 0;
+}
+
+static void digest_table_make_key(struct digest_table_key *key,
+    unsigned long algo, struct stat *st, off_t start, off_t len) {
+  memset(key, 0, sizeof(struct digest_table_key));
+  key->dev = (uint64_t) st->st_dev;
+  key->ino = (uint64_t) st->st_ino;
+  key->size = (uint64_t) st->st_size;
+  key->mtime = (uint64_t) st->st_mtime;
+  key->ctime = (uint64_t) st->st_ctime;
+#ifdef HAVE_STAT_ST_MTIM
+  /* A file rewritten within the same second, at the same size, differs
+   * only in its sub-second timestamps.
+   */
+  key->mtime_nsec = (uint32_t) st->st_mtim.tv_nsec;
+  key->ctime_nsec = (uint32_t) st->st_ctim.tv_nsec;
+#endif /* HAVE_STAT_ST_MTIM */
+  key->start = (uint64_t) start;
+  key->len = (uint64_t) len;
+  key->algo = (uint32_t) algo;
+}
+
+/* Returns the offset of the bucket for the given key; the bucket is chosen
+ * using the FNV-1a hash of the key.
+ */
+static off_t digest_table_get_bucket(const struct digest_table_key *key) {
+  register unsigned int i;
+  const unsigned char *ptr;
+  uint64_t h = 14695981039346656037ULL;
+  uint32_t nbuckets;
+
+  ptr = (const unsigned char *) key;
+  for (i = 0; i < sizeof(struct digest_table_key); i++) {
+    h ^= ptr[i];
+    h *= 1099511628211ULL;
+  }
+
+  nbuckets = digest_table_nentries / DIGEST_TABLE_BUCKET_SIZE;
+  return sizeof(struct digest_table_header) +
+    ((off_t) (h % nbuckets) * DIGEST_TABLE_BUCKET_SIZE *
+      sizeof(struct digest_table_entry));
+}
+
+static char *get_table_digest(pool *p, unsigned long algo, const char *path,
+    off_t start, off_t len, struct stat *pst) {
+  register unsigned int i;
+  int xerrno;
+  pr_fh_t *fh;
+  struct stat st;
+  struct digest_table_key key;
+  struct digest_table_entry entries[DIGEST_TABLE_BUCKET_SIZE];
+  off_t offset;
+  ssize_t res;
+
+  if (digest_table_fd < 0 ||
+      digest_caching == FALSE) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  /* Open the file, rather than merely stat'ing it, so that a cached digest
+   * is only provided to a client which could read the file.
+   */
+  fh = pr_fsio_open(path, O_RDONLY);
+  if (fh == NULL) {
+    return NULL;
+  }
+
+  res = pr_fsio_fstat(fh, &st);
+  xerrno = errno;
+  (void) pr_fsio_close(fh);
+
+  if (res < 0) {
+    errno = xerrno;
+    return NULL;
+  }
+
+  digest_table_make_key(&key, algo, &st, start, len);
+  offset = digest_table_get_bucket(&key);
+
+  if (digest_table_lock(digest_table_fd, F_RDLCK, offset,
+      sizeof(entries)) < 0) {
+    return NULL;
+  }
+
+  res = pread(digest_table_fd, entries, sizeof(entries), offset);
+  xerrno = errno;
+
+  (void) digest_table_lock(digest_table_fd, F_UNLCK, offset, sizeof(entries));
+
+  if (res != (ssize_t) sizeof(entries)) {
+    errno = (res < 0 ? xerrno : ENOENT);
+    return NULL;
+  }
+
+  for (i = 0; i < DIGEST_TABLE_BUCKET_SIZE; i++) {
+    char *hex_digest;
+
+    if (entries[i].digest_len == 0 ||
+        entries[i].digest_len > EVP_MAX_MD_SIZE ||
+        memcmp(&(entries[i].key), &key, sizeof(key)) != 0) {
+      continue;
+    }
+
+    hex_digest = pr_str_bin2hex(p, entries[i].digest, entries[i].digest_len,
+      PR_STR_FL_HEX_USE_LC);
+    pr_trace_msg(trace_channel, 12,
+      "using DigestCacheTable %s digest '%s' for '%s'", get_algo_name(algo, 0),
+      hex_digest, path);
+
+    if (pst != NULL) {
+      memcpy(pst, &st, sizeof(struct stat));
+    }
+
+    return hex_digest;
+  }
+
+  errno = ENOENT;
+  return NULL;
+}
+
+static int add_table_digest(unsigned long algo, const char *path,
+    struct stat *st, off_t start, off_t len, const unsigned char *digest,
+    unsigned int digest_len) {
+  register unsigned int i;
+  int idx = -1, xerrno;
+  struct digest_table_key key;
+  struct digest_table_entry entries[DIGEST_TABLE_BUCKET_SIZE];
+  off_t offset;
+  ssize_t res;
+
+  if (digest_table_fd < 0 ||
+      digest_caching == FALSE) {
+    return 0;
+  }
+
+  if (digest_len == 0 ||
+      digest_len > EVP_MAX_MD_SIZE) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  digest_table_make_key(&key, algo, st, start, len);
+  offset = digest_table_get_bucket(&key);
+
+  if (digest_table_lock(digest_table_fd, F_WRLCK, offset,
+      sizeof(entries)) < 0) {
+    return -1;
+  }
+
+  res = pread(digest_table_fd, entries, sizeof(entries), offset);
+  if (res != (ssize_t) sizeof(entries)) {
+    memset(entries, 0, sizeof(entries));
+  }
+
+  /* Use the entry with this key, if any; otherwise an empty entry, or the
+   * oldest entry.
+   */
+  for (i = 0; i < DIGEST_TABLE_BUCKET_SIZE; i++) {
+    if (memcmp(&(entries[i].key), &key, sizeof(key)) == 0) {
+      idx = i;
+      break;
+    }
+  }
+
+  if (idx < 0) {
+    for (i = 0; i < DIGEST_TABLE_BUCKET_SIZE; i++) {
+      if (entries[i].digest_len == 0) {
+        idx = i;
+        break;
+      }
+
+      if (idx < 0 ||
+          entries[i].stored < entries[idx].stored) {
+        idx = i;
+      }
+    }
+  }
+
+  memset(&(entries[idx]), 0, sizeof(struct digest_table_entry));
+  memcpy(&(entries[idx].key), &key, sizeof(key));
+  entries[idx].stored = (uint64_t) time(NULL);
+  entries[idx].digest_len = digest_len;
+  memcpy(entries[idx].digest, digest, digest_len);
+
+  res = pwrite(digest_table_fd, &(entries[idx]),
+    sizeof(struct digest_table_entry),
+    offset + (idx * sizeof(struct digest_table_entry)));
+  xerrno = errno;
+
+  (void) digest_table_lock(digest_table_fd, F_UNLCK, offset, sizeof(entries));
+
+  if (res != (ssize_t) sizeof(struct digest_table_entry)) {
+    errno = (res < 0 ? xerrno : EIO);
+    return -1;
+  }
+
+  pr_trace_msg(trace_channel, 12,
+    "stored %s digest for '%s' in DigestCacheTable", get_algo_name(algo, 0),
+    path);
+  return 0;
+}
+
+static int digest_table_open(const char *path, uint32_t nentries) {
+  int fd, res, xerrno;
+  struct digest_table_header hdr;
+  off_t tabsz;
+
+  /* Round up to whole buckets. */
+  nentries = ((nentries + DIGEST_TABLE_BUCKET_SIZE - 1) /
+    DIGEST_TABLE_BUCKET_SIZE) * DIGEST_TABLE_BUCKET_SIZE;
+
+  PRIVS_ROOT
+  fd = open(path, O_RDWR|O_CREAT, 0600);
+  xerrno = errno;
+  PRIVS_RELINQUISH
+
+  if (fd < 0) {
+    errno = xerrno;
+    return -1;
+  }
+
+  if (fd <= STDERR_FILENO) {
+    int usable_fd;
+
+    usable_fd = pr_fs_get_usable_fd(fd);
+    if (usable_fd >= 0) {
+      (void) close(fd);
+      fd = usable_fd;
+    }
+  }
+
+  (void) fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  if (digest_table_lock(fd, F_WRLCK, 0, sizeof(hdr)) < 0) {
+    xerrno = errno;
+    (void) close(fd);
+    errno = xerrno;
+    return -1;
+  }
+
+  tabsz = sizeof(hdr) + ((off_t) nentries * sizeof(struct digest_table_entry));
+
+  memset(&hdr, 0, sizeof(hdr));
+  res = pread(fd, &hdr, sizeof(hdr), 0);
+  if (res != (int) sizeof(hdr) ||
+      hdr.magic != DIGEST_TABLE_MAGIC ||
+      hdr.version != DIGEST_TABLE_VERSION ||
+      hdr.nentries != nentries ||
+      hdr.entrysz != sizeof(struct digest_table_entry)) {
+
+    /* A new table, or one created with a different size; start afresh. */
+    hdr.magic = DIGEST_TABLE_MAGIC;
+    hdr.version = DIGEST_TABLE_VERSION;
+    hdr.nentries = nentries;
+    hdr.entrysz = sizeof(struct digest_table_entry);
+
+    if (ftruncate(fd, 0) < 0 ||
+        ftruncate(fd, tabsz) < 0 ||
+        pwrite(fd, &hdr, sizeof(hdr), 0) != (ssize_t) sizeof(hdr)) {
+      xerrno = errno;
+
+      (void) digest_table_lock(fd, F_UNLCK, 0, sizeof(hdr));
+      (void) close(fd);
+      errno = xerrno;
+      return -1;
+    }
+
+    pr_log_debug(DEBUG5, MOD_DIGEST_VERSION
+      ": initialized DigestCacheTable '%s' for %lu entries", path,
+      (unsigned long) nentries);
+  }
+
+  (void) digest_table_lock(fd, F_UNLCK, 0, sizeof(hdr));
+
+  digest_table_fd = fd;
+  digest_table_nentries = nentries;
+  return 0;
+}
+
 static int digest_cache_expiry_cb(CALLBACK_FRAME) {
   struct digest_cache_key *cache_key;
   time_t now;
@@ -1696,7 +2547,7 @@ static int check_cache_size(cmd_rec *cmd) {
 }
 
 static char *get_digest(cmd_rec *cmd, unsigned long algo, const char *path,
-    time_t mtime, off_t start, size_t len, int flags,
+    struct stat *st, off_t start, size_t len, int flags,
     void (*hash_progress_cb)(const char *, off_t)) {
   int res;
   const EVP_MD *md;
@@ -1704,6 +2555,10 @@ static char *get_digest(cmd_rec *cmd, unsigned long algo, const char *path,
   unsigned int digest_len;
   char *hex_digest;
   const char *algo_name;
+  time_t mtime;
+  struct stat digest_st;
+
+  mtime = st->st_mtime;
 
   hex_digest = get_cached_digest(cmd->tmp_pool, algo, path, mtime, start, len);
 
@@ -1741,18 +2596,31 @@ static char *get_digest(cmd_rec *cmd, unsigned long algo, const char *path,
     return hex_digest;
   }
 
-  md = get_algo_md(algo);
-  digest_len = EVP_MD_size(md);
-  digest = palloc(cmd->tmp_pool, digest_len);
+  hex_digest = get_table_digest(cmd->tmp_pool, algo, path, start, len,
+    &digest_st);
+  if (hex_digest == NULL) {
+    md = get_algo_md(algo);
+    digest_len = EVP_MD_size(md);
+    digest = palloc(cmd->tmp_pool, digest_len);
 
-  res = compute_digest(cmd->tmp_pool, path, start, len, md, digest,
-    &digest_len, &mtime, hash_progress_cb);
-  if (res < 0) {
-    return NULL;
+    res = compute_digest(cmd->tmp_pool, path, start, len, algo, md, digest,
+      &digest_len, &digest_st, hash_progress_cb);
+    if (res < 0) {
+      return NULL;
+    }
+
+    hex_digest = pr_str_bin2hex(cmd->tmp_pool, digest, digest_len,
+      PR_STR_FL_HEX_USE_LC);
+
+    if (add_table_digest(algo, path, &digest_st, start, len, digest,
+        digest_len) < 0) {
+      pr_trace_msg(trace_channel, 8,
+        "error storing %s digest for path '%s' in DigestCacheTable: %s",
+        get_algo_name(algo, 0), path, strerror(errno));
+    }
   }
 
-  hex_digest = pr_str_bin2hex(cmd->tmp_pool, digest, digest_len,
-    PR_STR_FL_HEX_USE_LC);
+  mtime = digest_st.st_mtime;
 
   if (add_cached_digest(cmd->pool, cmd, algo, path, mtime, start, len,
       hex_digest) < 0) {
@@ -1956,7 +2824,7 @@ static modret_t *digest_xcmd(cmd_rec *cmd, unsigned long algo) {
       char *hex_digest;
 
       pr_response_add(R_250, _("Computing %s digest"), get_algo_name(algo, 0));
-      hex_digest = get_digest(cmd, algo, path, st.st_mtime, start_pos, len,
+      hex_digest = get_digest(cmd, algo, path, &st, start_pos, len,
         PR_STR_FL_HEX_USE_UC, digest_progress_cb);
       if (hex_digest != NULL) {
         pr_response_add(R_DUP, "%s", hex_digest);
@@ -2076,7 +2944,7 @@ MODRET digest_hash(cmd_rec *cmd) {
 
   pr_response_add(R_213, _("Computing %s digest"),
     get_algo_name(digest_hash_algo, DIGEST_ALGO_FL_IANA_STYLE));
-  hex_digest = get_digest(cmd, digest_hash_algo, path, st.st_mtime, start_pos,
+  hex_digest = get_digest(cmd, digest_hash_algo, path, &st, start_pos,
     len, PR_STR_FL_HEX_USE_LC, digest_progress_cb);
   xerrno = errno;
 
@@ -2659,7 +3527,7 @@ MODRET digest_md5(cmd_rec *cmd) {
     (char *) cmd->argv[0], get_algo_name(algo, 0), path);
 
   pr_response_add(R_251, _("Computing %s digest"), get_algo_name(algo, 0));
-  hex_digest = get_digest(cmd, algo, path, st.st_mtime, start_pos,
+  hex_digest = get_digest(cmd, algo, path, &st, start_pos,
     len, PR_STR_FL_HEX_USE_UC, digest_progress_cb);
   xerrno = errno;
 
@@ -2818,6 +3686,13 @@ static void digest_sess_reinit_ev(const void *event_data, void *user_data) {
   digest_algos = DIGEST_DEFAULT_ALGOS;
   digest_hash_algo = DIGEST_ALGO_SHA1;
   digest_hash_md = NULL;
+  digest_workers = 1;
+
+  if (digest_table_fd >= 0) {
+    (void) close(digest_table_fd);
+    digest_table_fd = -1;
+  }
+  digest_table_path = NULL;
 
   res = digest_sess_init();
   if (res < 0) {
@@ -2931,6 +3806,28 @@ static int digest_sess_init(void) {
     c = find_config_next(c, c->next, CONF_PARAM, "DigestOptions", FALSE);
   }
 
+  c = find_config(main_server->conf, CONF_PARAM, "DigestCacheTable", FALSE);
+  if (c != NULL &&
+      digest_caching == TRUE) {
+    const char *path;
+    unsigned int count;
+
+    path = c->argv[0];
+    count = *((unsigned int *) c->argv[1]);
+
+    digest_table_path = path;
+    if (digest_table_open(path, count) < 0) {
+      pr_log_pri(PR_LOG_NOTICE, MOD_DIGEST_VERSION
+        ": unable to use DigestCacheTable '%s': %s", path, strerror(errno));
+      digest_table_path = NULL;
+    }
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "DigestWorkers", FALSE);
+  if (c != NULL) {
+    digest_workers = *((unsigned int *) c->argv[0]);
+  }
+
   if (digest_caching == TRUE) {
     digest_crc32_tab = pr_table_alloc(digest_pool, 0);
     digest_md5_tab = pr_table_alloc(digest_pool, 0);
@@ -2981,11 +3878,13 @@ static cmdtable digest_cmdtab[] = {
 static conftable digest_conftab[] = {
   { "DigestAlgorithms",		set_digestalgorithms,	NULL },
   { "DigestCache",		set_digestcache,	NULL },
+  { "DigestCacheTable",		set_digestcachetable,	NULL },
   { "DigestDefaultAlgorithm",	set_digestdefaultalgo,	NULL },
   { "DigestEnable",		set_digestenable,	NULL },
   { "DigestEngine",		set_digestengine,	NULL },
   { "DigestMaxSize",		set_digestmaxsize,	NULL },
   { "DigestOptions",		set_digestoptions,	NULL },
+  { "DigestWorkers",		set_digestworkers,	NULL },
 
   { NULL }
 };
@@ -89,6 +89,7 @@ static void ifsess_remove_param(xaset_t *set, int config_type,
     fset = c->set;
     member = (xasetmember_t *) c;
     xaset_remove(fset, member);
+    pr_config_index_invalidate();
 
     c = find_config(set, lookup_type, name, TRUE);
   }
@@ -420,6 +421,7 @@ static int ifsess_sess_merge_class(void) {
   for (i = 0; i < class_remove_list->nelts; i++) {
     c = ((config_rec **) class_remove_list->elts)[i];
     xaset_remove(main_server->conf, (xasetmember_t *) c);
+    pr_config_index_invalidate();
   }
 
   destroy_pool(tmp_pool);
@@ -878,6 +880,7 @@ MODRET ifsess_post_pass(cmd_rec *cmd) {
   for (i = 0; i < authn_remove_list->nelts; i++) {
     c = ((config_rec **) authn_remove_list->elts)[i];
     xaset_remove(main_server->conf, (xasetmember_t *) c);
+    pr_config_index_invalidate();
   }
 
   c = find_config(main_server->conf, -1, IFSESS_GROUP_TEXT, FALSE);
@@ -980,6 +983,7 @@ MODRET ifsess_post_pass(cmd_rec *cmd) {
   for (i = 0; i < group_remove_list->nelts; i++) {
     c = ((config_rec **) group_remove_list->elts)[i];
     xaset_remove(main_server->conf, (xasetmember_t *) c);
+    pr_config_index_invalidate();
   }
 
   c = find_config(main_server->conf, -1, IFSESS_USER_TEXT, FALSE);
@@ -1051,6 +1055,7 @@ MODRET ifsess_post_pass(cmd_rec *cmd) {
   for (i = 0; i < user_remove_list->nelts; i++) {
     c = ((config_rec **) user_remove_list->elts)[i];
     xaset_remove(main_server->conf, (xasetmember_t *) c);
+    pr_config_index_invalidate();
   }
 
   destroy_pool(tmp_pool);
@@ -30,6 +30,9 @@
 
 #include "mod_quotatab.h"
 
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
 typedef struct regtab_obj {
   struct regtab_obj *prev, *next;
  
@@ -120,6 +123,61 @@ static unsigned char have_aborted_transfer = FALSE;
  */
 static unsigned char have_err_response = FALSE;
 
+/* For caching tallies in shared memory, and buffering updates to them (see
+ * QuotaTallyCache).  Each cached tally carries the updates not yet written
+ * to the QuotaTallyTable; these survive the process which made them, and
+ * are written out by the next session using that tally.
+ */
+#ifndef QUOTA_TALLY_CACHE_SIZE
+# define QUOTA_TALLY_CACHE_SIZE			1024
+#endif
+
+/* Maximum number of buffered updates to a cached tally before they are
+ * written to the QuotaTallyTable, regardless of the flush interval.
+ */
+#ifndef QUOTA_TALLY_CACHE_MAX_PENDING
+# define QUOTA_TALLY_CACHE_MAX_PENDING		256
+#endif
+
+/* Number of slots, starting at a tally's hash, searched for that tally. */
+#define QUOTA_TALLY_CACHE_PROBES		16
+
+#define QUOTA_TALLY_CACHE_DEFAULT_INTERVAL	10
+#define QUOTA_TALLY_CACHE_MAGIC			0x71746331
+#define QUOTA_TALLY_CACHE_PROJ_ID		81
+
+struct quota_cache_entry {
+
+  /* Identifies the QuotaTallyTable to which this tally belongs. */
+  unsigned int qce_tab_id;
+
+  /* The tally, including pending updates.  A quota_type of zero marks an
+   * unused slot.
+   */
+  quota_tally_t qce_tally;
+
+  /* Updates not yet written to the QuotaTallyTable. */
+  quota_deltas_t qce_pending;
+  unsigned int qce_npending;
+
+  time_t qce_synced;
+  time_t qce_last_used;
+};
+
+struct quota_cache_data {
+  unsigned int qcd_magic;
+  unsigned int qcd_size;
+  struct quota_cache_entry qcd_entries[QUOTA_TALLY_CACHE_SIZE];
+};
+
+static struct quota_cache_data *quota_cache = NULL;
+static int quota_cache_fd = -1;
+static int quota_cache_interval = QUOTA_TALLY_CACHE_DEFAULT_INTERVAL;
+static unsigned int quota_cache_tab_id = 0;
+static int quota_cache_timerno = -1;
+static unsigned char quota_cache_locked = FALSE;
+static unsigned char use_quota_cache = FALSE;
+
 /* convenience macros */
 #define DISPLAY_BYTES_IN(x) \
     quota_display_bytes((x)->tmp_pool, \
@@ -176,6 +234,9 @@ static int quotatab_runlock(quota_table_t *);
 static int quotatab_wlock(quota_table_t *);
 static int quotatab_wunlock(quota_table_t *);
 
+static int quotatab_cache_read(quota_tally_t *);
+static int quotatab_cache_write(double, double, double, int, int, int);
+
 /* Support routines
  */
 
@@ -770,15 +831,9 @@ static int quotatab_open(quota_tabtype_t tab_type) {
 /* Reads via this function are only ever done on tally tables.  Limit tables
  * are read via the quotatab_lookup() function.
  */
-int quotatab_read(quota_tally_t *tally) {
+static int quotatab_tab_read(quota_tally_t *tally) {
   int bread = 0;
 
-  /* Make sure the tally table can support reads. */
-  if (!tally_tab || !tally_tab->tab_read) {
-    errno = EPERM;
-    return -1;
-  }
-
   /* Obtain a reader lock for the entry in question. */
   if (quotatab_rlock(tally_tab) < 0) {
     quotatab_log("error: unable to obtain read lock: %s", strerror(errno));
@@ -803,6 +858,27 @@ int quotatab_read(quota_tally_t *tally) {
   return bread;
 }
 
+int quotatab_read(quota_tally_t *tally) {
+
+  /* Make sure the tally table can support reads. */
+  if (!tally_tab || !tally_tab->tab_read) {
+    errno = EPERM;
+    return -1;
+  }
+
+  if (use_quota_cache &&
+      tally == &sess_tally) {
+    if (quotatab_cache_read(tally) == 0) {
+      return 0;
+    }
+
+    quotatab_log("unable to read cached tally, reading QuotaTallyTable: %s",
+      strerror(errno));
+  }
+
+  return quotatab_tab_read(tally);
+}
+
 /* This function is used by mod_quotatab backends, to register their
  * individual backend table function pointers with the main mod_quotatab
  * module.
@@ -1283,59 +1359,44 @@ static int quotatab_wunlock(quota_table_t *tab) {
   return res;
 }
 
-int quotatab_write(quota_tally_t *tally,
+/* Add the given increments to the tally, for those tallies which are not
+ * "unlimited", and accumulate them in the given deltas.
+ */
+static void quotatab_tally_add(quota_tally_t *tally, quota_deltas_t *deltas,
     double bytes_in_inc, double bytes_out_inc, double bytes_xfer_inc,
     int files_in_inc, int files_out_inc, int files_xfer_inc) {
 
-  /* Make sure the tally table can support writes. */
-  if (!tally_tab || !tally_tab->tab_write) {
-    errno = EPERM;
-    return -1;
-  }
-
-  /* Obtain a writer lock for the entry in question */
-  if (quotatab_wlock(tally_tab) < 0) {
-    quotatab_log("error: unable to obtain write lock: %s", strerror(errno));
-    return -1;
-  }
-
-  /* Make sure the deltas are cleared. */
-  memset(&quotatab_deltas, '\0', sizeof(quotatab_deltas));
-
-  /* Read in the tally (to catch any possible updates by other processes). */
-  QUOTATAB_TALLY_READ
-
   /* Only update the tally if the value is not "unlimited". */
   if (sess_limit.bytes_in_avail > 0.0) {
-    sess_tally.bytes_in_used += bytes_in_inc;
+    tally->bytes_in_used += bytes_in_inc;
 
     /* Prevent underflows. */
-    if (sess_tally.bytes_in_used < 0.0)
-      sess_tally.bytes_in_used = 0.0;
+    if (tally->bytes_in_used < 0.0)
+      tally->bytes_in_used = 0.0;
 
-    quotatab_deltas.bytes_in_delta = bytes_in_inc;
+    deltas->bytes_in_delta += bytes_in_inc;
   }
 
   /* Only update the tally if the value is not "unlimited". */
   if (sess_limit.bytes_out_avail > 0.0) {
-    sess_tally.bytes_out_used += bytes_out_inc;
+    tally->bytes_out_used += bytes_out_inc;
 
     /* Prevent underflows. */
-    if (sess_tally.bytes_out_used < 0.0)
-      sess_tally.bytes_out_used = 0.0;
+    if (tally->bytes_out_used < 0.0)
+      tally->bytes_out_used = 0.0;
 
-    quotatab_deltas.bytes_out_delta = bytes_out_inc;
+    deltas->bytes_out_delta += bytes_out_inc;
   }
 
   /* Only update the tally if the value is not "unlimited". */
   if (sess_limit.bytes_xfer_avail > 0.0) {
-    sess_tally.bytes_xfer_used += bytes_xfer_inc;
+    tally->bytes_xfer_used += bytes_xfer_inc;
 
     /* Prevent underflows. */
-    if (sess_tally.bytes_xfer_used < 0.0)
-      sess_tally.bytes_xfer_used = 0.0;
+    if (tally->bytes_xfer_used < 0.0)
+      tally->bytes_xfer_used = 0.0;
 
-    quotatab_deltas.bytes_xfer_delta = bytes_xfer_inc;
+    deltas->bytes_xfer_delta += bytes_xfer_inc;
   }
 
   /* Only update the tally if the value is not "unlimited". */
@@ -1345,10 +1406,10 @@ int quotatab_write(quota_tally_t *tally,
      * underflow check is not as straightforward as checking for a value
      * less than zero.
      */
-    if (!(sess_tally.files_in_used == 0 && files_in_inc < 0))
-      sess_tally.files_in_used += files_in_inc;
+    if (!(tally->files_in_used == 0 && files_in_inc < 0))
+      tally->files_in_used += files_in_inc;
 
-    quotatab_deltas.files_in_delta = files_in_inc;
+    deltas->files_in_delta += files_in_inc;
   }
 
   /* Only update the tally if the value is not "unlimited". */
@@ -1358,10 +1419,10 @@ int quotatab_write(quota_tally_t *tally,
      * underflow check is not as straightforward as checking for a value
      * less than zero.
      */
-    if (!(sess_tally.files_out_used == 0 && files_out_inc < 0))
-      sess_tally.files_out_used += files_out_inc;
+    if (!(tally->files_out_used == 0 && files_out_inc < 0))
+      tally->files_out_used += files_out_inc;
 
-    quotatab_deltas.files_out_delta = files_out_inc;
+    deltas->files_out_delta += files_out_inc;
   }
 
   /* Only update the tally if the value is not "unlimited". */
@@ -1371,12 +1432,477 @@ int quotatab_write(quota_tally_t *tally,
      * underflow check is not as straightforward as checking for a value
      * less than zero.
      */
-    if (!(sess_tally.files_xfer_used == 0 && files_xfer_inc < 0))
-      sess_tally.files_xfer_used += files_xfer_inc;
+    if (!(tally->files_xfer_used == 0 && files_xfer_inc < 0))
+      tally->files_xfer_used += files_xfer_inc;
+
+    deltas->files_xfer_delta += files_xfer_inc;
+  }
+}
+
+/* Tally cache routines
+ */
+
+static unsigned int quotatab_cache_hash(const char *str) {
+  unsigned int h = 5381;
+
+  while (*str) {
+    h = ((h << 5) + h) + (unsigned char) *str++;
+  }
+
+  return h;
+}
+
+static int quotatab_cache_lock(int lock_type) {
+  struct flock lock;
+
+  lock.l_type = lock_type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = 0;
+  lock.l_len = 0;
+
+  while (fcntl(quota_cache_fd, F_SETLKW, &lock) < 0) {
+    int xerrno = errno;
+
+    if (xerrno == EINTR) {
+      pr_signals_handle();
+      continue;
+    }
+
+    pr_trace_msg("lock", 3, "%s of QuotaTallyCache fd %d failed: %s",
+      lock_type == F_UNLCK ? "unlock" : "write-lock", quota_cache_fd,
+      strerror(xerrno));
+
+    errno = xerrno;
+    return -1;
+  }
+
+  quota_cache_locked = (lock_type != F_UNLCK);
+  return 0;
+}
+
+/* Returns the cache entry for the given tally.  If there is none, and create
+ * is TRUE, a new (not yet loaded) entry is returned, reusing the least
+ * recently used entry with no pending updates if need be.  Slots are never
+ * emptied once used, so a search can stop at the first unused slot.
+ */
+static struct quota_cache_entry *quotatab_cache_get(quota_tally_t *tally,
+    int create) {
+  register unsigned int i;
+  unsigned int h;
+  struct quota_cache_entry *qce, *victim = NULL;
+
+  h = quotatab_cache_hash(tally->name) + (unsigned int) tally->quota_type;
+
+  for (i = 0; i < QUOTA_TALLY_CACHE_PROBES; i++) {
+    qce = &(quota_cache->qcd_entries[(h + i) % QUOTA_TALLY_CACHE_SIZE]);
+
+    if ((int) qce->qce_tally.quota_type == 0) {
+      victim = qce;
+      break;
+    }
+
+    if (qce->qce_tab_id == quota_cache_tab_id &&
+        qce->qce_tally.quota_type == tally->quota_type &&
+        strcmp(qce->qce_tally.name, tally->name) == 0) {
+      return qce;
+    }
+
+    if (qce->qce_npending == 0 &&
+        (victim == NULL ||
+         qce->qce_last_used < victim->qce_last_used)) {
+      victim = qce;
+    }
+  }
+
+  if (!create) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  if (victim == NULL) {
+    /* Every slot available to this tally has pending updates. */
+    errno = ENOSPC;
+    return NULL;
+  }
+
+  memset(victim, '\0', sizeof(struct quota_cache_entry));
+  victim->qce_tab_id = quota_cache_tab_id;
+  sstrncpy(victim->qce_tally.name, tally->name, sizeof(victim->qce_tally.name));
+  victim->qce_tally.quota_type = tally->quota_type;
+
+  return victim;
+}
+
+/* Refreshes the cached tally from the QuotaTallyTable, reapplying any
+ * pending updates.
+ */
+static int quotatab_cache_load(struct quota_cache_entry *qce, time_t now) {
+  quota_tally_t tally;
+  quota_deltas_t deltas;
+  quota_deltas_t *pending;
+
+  memcpy(&tally, &(qce->qce_tally), sizeof(tally));
+  if (quotatab_tab_read(&tally) < 0) {
+    return -1;
+  }
+
+  pending = &(qce->qce_pending);
+  memset(&deltas, '\0', sizeof(deltas));
+  quotatab_tally_add(&tally, &deltas, pending->bytes_in_delta,
+    pending->bytes_out_delta, pending->bytes_xfer_delta,
+    pending->files_in_delta, pending->files_out_delta,
+    pending->files_xfer_delta);
+
+  memcpy(&(qce->qce_tally), &tally, sizeof(tally));
+  qce->qce_synced = now;
+  return 0;
+}
+
+/* Writes the pending updates of the cached tally to the QuotaTallyTable.
+ * The caller must hold the cache lock, and the entry must be the one for
+ * this session's tally: the file backend writes at the position found by
+ * the login lookup.
+ */
+static int quotatab_cache_flush(struct quota_cache_entry *qce) {
+  int res, xerrno;
+  quota_tally_t tally;
+  quota_deltas_t deltas;
+
+  if (qce->qce_npending == 0) {
+    return 0;
+  }
+
+  if (quotatab_wlock(tally_tab) < 0) {
+    return -1;
+  }
+
+  memcpy(&tally, &(qce->qce_tally), sizeof(tally));
+  if (quotatab_tab_read(&tally) < 0) {
+    xerrno = errno;
+
+    quotatab_wunlock(tally_tab);
+    errno = xerrno;
+    return -1;
+  }
+
+  memset(&deltas, '\0', sizeof(deltas));
+  quotatab_tally_add(&tally, &deltas, qce->qce_pending.bytes_in_delta,
+    qce->qce_pending.bytes_out_delta, qce->qce_pending.bytes_xfer_delta,
+    qce->qce_pending.files_in_delta, qce->qce_pending.files_out_delta,
+    qce->qce_pending.files_xfer_delta);
+
+  /* Backends such as mod_quotatab_sql apply the deltas, rather than the
+   * tally, to the table.
+   */
+  memcpy(&quotatab_deltas, &(qce->qce_pending), sizeof(quotatab_deltas));
+  res = tally_tab->tab_write(tally_tab, &tally);
+  xerrno = errno;
+
+  memset(&quotatab_deltas, '\0', sizeof(quotatab_deltas));
+  quotatab_wunlock(tally_tab);
+
+  if (res < 0) {
+    errno = xerrno;
+    return -1;
+  }
+
+  memcpy(&(qce->qce_tally), &tally, sizeof(tally));
+  memset(&(qce->qce_pending), '\0', sizeof(qce->qce_pending));
+  qce->qce_npending = 0;
+  qce->qce_synced = time(NULL);
+
+  return 0;
+}
+
+static int quotatab_cache_read(quota_tally_t *tally) {
+  int xerrno;
+  time_t now;
+  struct quota_cache_entry *qce;
+
+  if (quotatab_cache_lock(F_WRLCK) < 0) {
+    return -1;
+  }
+
+  qce = quotatab_cache_get(tally, TRUE);
+  if (qce == NULL) {
+    xerrno = errno;
+
+    quotatab_cache_lock(F_UNLCK);
+    errno = xerrno;
+    return -1;
+  }
+
+  time(&now);
+  if (now - qce->qce_synced >= quota_cache_interval) {
+    if (quotatab_cache_load(qce, now) < 0) {
+      xerrno = errno;
+
+      quotatab_cache_lock(F_UNLCK);
+      errno = xerrno;
+      return -1;
+    }
+  }
+
+  qce->qce_last_used = now;
+  memcpy(tally, &(qce->qce_tally), sizeof(quota_tally_t));
+
+  quotatab_cache_lock(F_UNLCK);
+  return 0;
+}
+
+static int quotatab_cache_write(double bytes_in_inc, double bytes_out_inc,
+    double bytes_xfer_inc, int files_in_inc, int files_out_inc,
+    int files_xfer_inc) {
+  int xerrno;
+  time_t now;
+  struct quota_cache_entry *qce;
 
-    quotatab_deltas.files_xfer_delta = files_xfer_inc;
+  if (quotatab_cache_lock(F_WRLCK) < 0) {
+    return -1;
+  }
+
+  qce = quotatab_cache_get(&sess_tally, TRUE);
+  if (qce == NULL) {
+    xerrno = errno;
+
+    quotatab_cache_lock(F_UNLCK);
+    errno = xerrno;
+    return -1;
+  }
+
+  time(&now);
+  if (now - qce->qce_synced >= quota_cache_interval) {
+    if (quotatab_cache_load(qce, now) < 0) {
+      xerrno = errno;
+
+      quotatab_cache_lock(F_UNLCK);
+      errno = xerrno;
+      return -1;
+    }
+  }
+
+  quotatab_tally_add(&(qce->qce_tally), &(qce->qce_pending), bytes_in_inc,
+    bytes_out_inc, bytes_xfer_inc, files_in_inc, files_out_inc,
+    files_xfer_inc);
+  qce->qce_npending++;
+  qce->qce_last_used = now;
+
+  memcpy(&sess_tally, &(qce->qce_tally), sizeof(sess_tally));
+
+  if (qce->qce_npending >= QUOTA_TALLY_CACHE_MAX_PENDING) {
+    if (quotatab_cache_flush(qce) < 0) {
+      quotatab_log("error flushing cached tally: %s", strerror(errno));
+    }
+  }
+
+  quotatab_cache_lock(F_UNLCK);
+  return 0;
+}
+
+/* Writes out any pending updates for this session's tally, including those
+ * left behind by earlier sessions which ended without doing so.
+ */
+static int quotatab_cache_sync(void) {
+  int res, xerrno;
+  struct quota_cache_entry *qce;
+
+  if (quotatab_cache_lock(F_WRLCK) < 0) {
+    return -1;
+  }
+
+  qce = quotatab_cache_get(&sess_tally, FALSE);
+  if (qce == NULL) {
+    quotatab_cache_lock(F_UNLCK);
+    return 0;
+  }
+
+  res = quotatab_cache_flush(qce);
+  xerrno = errno;
+
+  quotatab_cache_lock(F_UNLCK);
+
+  errno = xerrno;
+  return res;
+}
+
+static int quotatab_cache_open(const char *path) {
+  int fd, shmid, xerrno;
+  key_t key;
+  struct quota_cache_data *data;
+
+  PRIVS_ROOT
+  fd = open(path, O_RDWR|O_CREAT, 0600);
+  xerrno = errno;
+  PRIVS_RELINQUISH
+
+  if (fd < 0) {
+    errno = xerrno;
+    return -1;
   }
 
+  /* Make sure that this fd is not one of the main three. */
+  if (pr_fs_get_usable_fd2(&fd) < 0) {
+    quotatab_log("warning: unable to find usable fd for QuotaTallyCache "
+      "fd %d: %s", fd, strerror(errno));
+  }
+
+  key = ftok(path, QUOTA_TALLY_CACHE_PROJ_ID);
+  if (key == (key_t) -1) {
+    xerrno = errno;
+
+    (void) close(fd);
+    errno = xerrno;
+    return -1;
+  }
+
+  /* The segment is attached while root, so that it remains usable once
+   * privileges are dropped.  It is deliberately never removed, so that
+   * pending updates outlive the sessions (and daemon) which made them.
+   */
+  PRIVS_ROOT
+  shmid = shmget(key, sizeof(struct quota_cache_data), IPC_CREAT|0600);
+  xerrno = errno;
+
+  if (shmid >= 0) {
+    data = shmat(shmid, NULL, 0);
+    xerrno = errno;
+
+  } else {
+    data = (void *) -1;
+  }
+  PRIVS_RELINQUISH
+
+  if (data == (void *) -1) {
+    if (shmid < 0 &&
+        xerrno == EINVAL) {
+      quotatab_log("existing QuotaTallyCache segment for '%s' has a different "
+        "size; remove it (e.g. using ipcrm(1)) to use this cache", path);
+    }
+
+    (void) close(fd);
+    errno = xerrno;
+    return -1;
+  }
+
+  quota_cache_fd = fd;
+
+  if (quotatab_cache_lock(F_WRLCK) < 0) {
+    xerrno = errno;
+
+    (void) shmdt((void *) data);
+    (void) close(fd);
+    quota_cache_fd = -1;
+    errno = xerrno;
+    return -1;
+  }
+
+  /* New segments are zero-filled. */
+  if (data->qcd_magic == 0) {
+    data->qcd_magic = QUOTA_TALLY_CACHE_MAGIC;
+    data->qcd_size = QUOTA_TALLY_CACHE_SIZE;
+  }
+
+  if (data->qcd_magic != QUOTA_TALLY_CACHE_MAGIC ||
+      data->qcd_size != QUOTA_TALLY_CACHE_SIZE) {
+    quotatab_cache_lock(F_UNLCK);
+
+    quotatab_log("existing QuotaTallyCache segment for '%s' has an "
+      "incompatible layout; remove it (e.g. using ipcrm(1)) to use this cache",
+      path);
+
+    (void) shmdt((void *) data);
+    (void) close(fd);
+    quota_cache_fd = -1;
+    errno = EINVAL;
+    return -1;
+  }
+
+  quotatab_cache_lock(F_UNLCK);
+
+  quota_cache = data;
+  return 0;
+}
+
+static void quotatab_cache_close(void) {
+  if (quota_cache_timerno > 0) {
+    (void) pr_timer_remove(quota_cache_timerno, &quotatab_module);
+    quota_cache_timerno = -1;
+  }
+
+  if (quota_cache != NULL) {
+    (void) shmdt((void *) quota_cache);
+    quota_cache = NULL;
+  }
+
+  if (quota_cache_fd >= 0) {
+    (void) close(quota_cache_fd);
+    quota_cache_fd = -1;
+  }
+
+  use_quota_cache = FALSE;
+}
+
+static int quotatab_cache_timer_cb(CALLBACK_FRAME) {
+
+  /* Do not interfere with a cache or table operation which was interrupted
+   * by this timer; try again at the next interval.
+   */
+  if (quota_cache_locked ||
+      tally_tab->rlock_count > 0 ||
+      tally_tab->wlock_count > 0) {
+    return 1;
+  }
+
+  if (quotatab_cache_sync() < 0) {
+    quotatab_log("error flushing cached tally: %s", strerror(errno));
+  }
+
+  return 1;
+}
+
+int quotatab_write(quota_tally_t *tally,
+    double bytes_in_inc, double bytes_out_inc, double bytes_xfer_inc,
+    int files_in_inc, int files_out_inc, int files_xfer_inc) {
+
+  /* Make sure the tally table can support writes. */
+  if (!tally_tab || !tally_tab->tab_write) {
+    errno = EPERM;
+    return -1;
+  }
+
+  if (use_quota_cache &&
+      tally == &sess_tally) {
+    if (quotatab_cache_write(bytes_in_inc, bytes_out_inc, bytes_xfer_inc,
+        files_in_inc, files_out_inc, files_xfer_inc) == 0) {
+      return 0;
+    }
+
+    quotatab_log("unable to update cached tally, writing QuotaTallyTable: %s",
+      strerror(errno));
+  }
+
+  /* Obtain a writer lock for the entry in question */
+  if (quotatab_wlock(tally_tab) < 0) {
+    quotatab_log("error: unable to obtain write lock: %s", strerror(errno));
+    return -1;
+  }
+
+  /* Make sure the deltas are cleared. */
+  memset(&quotatab_deltas, '\0', sizeof(quotatab_deltas));
+
+  /* Read in the tally (to catch any possible updates by other processes).
+   * The tally is read from the table, not via the QuotaTallyCache: the cache
+   * lock is always taken before the QuotaLock, never while holding it.
+   */
+  if (!sess_limit.quota_per_session) {
+    if (quotatab_tab_read(&sess_tally) < 0) {
+      quotatab_log("error: unable to read tally: %s", strerror(errno));
+    }
+  }
+
+  quotatab_tally_add(&sess_tally, &quotatab_deltas, bytes_in_inc,
+    bytes_out_inc, bytes_xfer_inc, files_in_inc, files_out_inc, files_xfer_inc);
+
   /* No need to write out to the stream if per-session quotas are in effect. */
   if (sess_limit.quota_per_session) {
     memset(&quotatab_deltas, '\0', sizeof(quotatab_deltas));
@@ -1723,6 +2249,41 @@ MODRET set_quotashowquotas(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
+/* usage: QuotaTallyCache path [flush-interval] */
+MODRET set_quotatallycache(cmd_rec *cmd) {
+  config_rec *c;
+  char *path;
+  int interval = QUOTA_TALLY_CACHE_DEFAULT_INTERVAL;
+
+  if (cmd->argc < 2 ||
+      cmd->argc > 3) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  path = cmd->argv[1];
+
+  /* Check for non-absolute paths */
+  if (*path != '/') {
+    CONF_ERROR(cmd, "absolute path required");
+  }
+
+  if (cmd->argc == 3) {
+    interval = atoi(cmd->argv[2]);
+    if (interval < 1) {
+      CONF_ERROR(cmd, "flush interval must be greater than zero");
+    }
+  }
+
+  c = add_config_param(cmd->argv[0], 2, NULL, NULL);
+  c->argv[0] = pstrdup(c->pool, path);
+  c->argv[1] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[1]) = interval;
+
+  return PR_HANDLED(cmd);
+}
+
 /* usage: Quota{Limit,Tally}Table <source-type:source-info> */
 MODRET set_quotatable(cmd_rec *cmd) {
   char *tmp = NULL;
@@ -3143,6 +3704,21 @@ MODRET quotatab_post_pass(cmd_rec *cmd) {
         "tracked in the QuotaTallyTable");
     }
 
+    if (!sess_limit.quota_per_session &&
+        quota_cache != NULL) {
+      use_quota_cache = TRUE;
+
+      quota_cache_timerno = pr_timer_add(quota_cache_interval, -1,
+        &quotatab_module, quotatab_cache_timer_cb, "QuotaTallyCache flush");
+      if (quota_cache_timerno < 0) {
+        quotatab_log("error adding QuotaTallyCache flush timer: %s",
+          strerror(errno));
+      }
+
+      /* Pick up any updates pending from earlier sessions. */
+      QUOTATAB_TALLY_READ
+    }
+
     /* If the limit for this user is a hard limit, install our own FS handlers,
      * which provide custom read() and write() functions.  We will use them to
      * return an error when reading/writing a file causes a limit to be reached.
@@ -4292,6 +4868,12 @@ static void quotatab_exit_ev(const void *event_data, void *user_data) {
     }
   }
 
+  if (use_quota_cache) {
+    if (quotatab_cache_sync() < 0) {
+      quotatab_log("error flushing cached tally: %s", strerror(errno));
+    }
+  }
+
   if (use_quotas &&
       have_quota_tally_table) {
     if (quotatab_close(TYPE_TALLY) < 0)
@@ -4359,6 +4941,10 @@ static void quotatab_sess_reinit_ev(const void *event_data, void *user_data) {
   (void) close(quota_lockfd);
   quota_lockfd = -1;
 
+  quotatab_cache_close();
+  quota_cache_interval = QUOTA_TALLY_CACHE_DEFAULT_INTERVAL;
+  quota_cache_tab_id = 0;
+
   (void) quotatab_close(TYPE_LIMIT);
   (void) quotatab_close(TYPE_TALLY);
 
@@ -4530,6 +5116,27 @@ static int quotatab_sess_init(void) {
     }
   }
 
+  c = find_config(main_server->conf, CONF_PARAM, "QuotaTallyCache", FALSE);
+  if (c != NULL &&
+      have_quota_tally_table) {
+    config_rec *tab_c;
+    const char *path;
+
+    path = c->argv[0];
+    quota_cache_interval = *((int *) c->argv[1]);
+
+    /* Tallies from different QuotaTallyTables may share the cache. */
+    tab_c = find_config(main_server->conf, CONF_PARAM, "QuotaTallyTable",
+      FALSE);
+    quota_cache_tab_id = (quotatab_cache_hash(tab_c->argv[0]) * 33) +
+      quotatab_cache_hash(tab_c->argv[1]);
+
+    if (quotatab_cache_open(path) < 0) {
+      quotatab_log("unable to use QuotaTallyCache '%s': %s", path,
+        strerror(errno));
+    }
+  }
+
   return 0;
 }
 
@@ -4547,6 +5154,7 @@ static conftable quotatab_conftab[] = {
   { "QuotaLog",			set_quotalog,		NULL },
   { "QuotaOptions",		set_quotaoptions,	NULL },
   { "QuotaShowQuotas",		set_quotashowquotas,	NULL },
+  { "QuotaTallyCache",		set_quotatallycache,	NULL },
   { "QuotaTallyTable",		set_quotatable,		NULL },
   { NULL }
 };
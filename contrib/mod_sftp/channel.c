@@ -88,6 +88,16 @@ static array_header *channel_list = NULL;
 static uint32_t chan_window_size = SFTP_SSH2_CHANNEL_WINDOW_SIZE;
 static uint32_t chan_packet_size = SFTP_SSH2_CHANNEL_MAX_PACKET_SIZE;
 
+/* Total size of the windows of the open channels, for capping the growth
+ * of those windows.
+ */
+static uint64_t chan_window_total = 0;
+
+/* Round-trip time, in microseconds, to assume for the connection when the
+ * kernel cannot tell us.
+ */
+#define SFTP_CHANNEL_DEFAULT_RTT_USECS		100000UL
+
 static array_header *accepted_envs = NULL;
 
 static const char *trace_channel = "ssh2";
@@ -111,6 +121,8 @@ static struct ssh2_channel *alloc_channel(const char *type,
 
   chan->local_windowsz = chan_window_size;
   chan->local_max_packetsz = chan_packet_size;
+  chan->local_target_windowsz = chan_window_size;
+  chan_window_total += chan->local_target_windowsz;
 
   chan->remote_channel_id = remote_channel_id;
   chan->remote_windowsz = remote_windowsz;
@@ -143,6 +155,17 @@ static void destroy_channel(uint32_t channel_id) {
        */
       if (chans[i]->recvd_close &&
           chans[i]->sent_close) {
+        pr_trace_msg(trace_channel, 8, "channel ID %lu window stats: "
+          "received %" PR_LU " bytes, sent %u CHANNEL_WINDOW_ADJUST %s, "
+          "window grown %u %s to %lu bytes", (unsigned long) channel_id,
+          (pr_off_t) chans[i]->local_total_recvd,
+          chans[i]->local_window_adjust_count,
+          chans[i]->local_window_adjust_count != 1 ? "messages" : "message",
+          chans[i]->local_window_grow_count,
+          chans[i]->local_window_grow_count != 1 ? "times" : "time",
+          (unsigned long) chans[i]->local_target_windowsz);
+        chan_window_total -= chans[i]->local_target_windowsz;
+
         if (chans[i]->finish != NULL) {
           pr_trace_msg(trace_channel, 15,
             "calling finish handler for channel ID %lu",
@@ -472,6 +495,94 @@ static int handle_channel_close(struct ssh2_packet *pkt) {
   return 0;
 }
 
+/* Returns the smoothed round-trip time of the SSH connection, in
+ * microseconds.
+ */
+static unsigned long get_conn_rtt(void) {
+#if defined(LINUX) && defined(TCP_INFO)
+  struct tcp_info info;
+  socklen_t infolen;
+
+  infolen = sizeof(info);
+  if (getsockopt(sftp_conn->rfd, IPPROTO_TCP, TCP_INFO, &info,
+      &infolen) == 0 &&
+      info.tcpi_rtt > 0) {
+    return info.tcpi_rtt;
+  }
+#endif /* LINUX and TCP_INFO */
+
+  return SFTP_CHANNEL_DEFAULT_RTT_USECS;
+}
+
+/* Grows the window of the given channel, as HPN-SSH does, when the client
+ * sends at least half of that window within one round trip; the window,
+ * rather than the network, is then what limits the throughput.  The windows
+ * of all of the open channels together are not grown beyond
+ * SFTP_SSH2_CHANNEL_WINDOW_AUTOTUNE_MAX.
+ */
+static void autotune_channel_window(struct ssh2_channel *chan,
+    uint32_t datalen) {
+  struct timeval now;
+  unsigned long elapsed_usecs, rtt_usecs;
+  uint64_t rtt_len, max_grow_len;
+  uint32_t grow_len;
+
+  if (sftp_opts & SFTP_OPT_NO_WINDOW_AUTOTUNE) {
+    return;
+  }
+
+  if (chan->local_target_windowsz >= SFTP_SSH2_CHANNEL_WINDOW_AUTOTUNE_MAX ||
+      chan_window_total >= SFTP_SSH2_CHANNEL_WINDOW_AUTOTUNE_MAX) {
+    return;
+  }
+
+  gettimeofday(&now, NULL);
+
+  if (chan->local_window_start.tv_sec == 0) {
+    chan->local_window_start = now;
+    chan->local_window_rtt = get_conn_rtt();
+  }
+
+  chan->local_window_recvd += datalen;
+
+  rtt_usecs = chan->local_window_rtt;
+  elapsed_usecs = ((now.tv_sec - chan->local_window_start.tv_sec) * 1000000) +
+    (now.tv_usec - chan->local_window_start.tv_usec);
+  if (elapsed_usecs < rtt_usecs) {
+    return;
+  }
+
+  /* How much did the client send per round trip, over this interval? */
+  rtt_len = ((uint64_t) chan->local_window_recvd * rtt_usecs) / elapsed_usecs;
+
+  chan->local_window_start = now;
+  chan->local_window_recvd = 0;
+  chan->local_window_rtt = get_conn_rtt();
+
+  if (rtt_len < (chan->local_target_windowsz / 2)) {
+    return;
+  }
+
+  /* Double the window, within the session's limit. */
+  grow_len = chan->local_target_windowsz;
+
+  max_grow_len = SFTP_SSH2_CHANNEL_WINDOW_AUTOTUNE_MAX - chan_window_total;
+  if (grow_len > max_grow_len) {
+    grow_len = (uint32_t) max_grow_len;
+  }
+
+  chan->local_target_windowsz += grow_len;
+  chan->local_window_grown += grow_len;
+  chan->local_window_grow_count++;
+  chan_window_total += grow_len;
+
+  pr_trace_msg(trace_channel, 12, "client sent %lu bytes per round trip "
+    "(RTT %lu ms) for channel ID %lu, growing window to %lu bytes",
+    (unsigned long) rtt_len, rtt_usecs / 1000,
+    (unsigned long) chan->local_channel_id,
+    (unsigned long) chan->local_target_windowsz);
+}
+
 static int process_channel_data(struct ssh2_channel *chan,
     struct ssh2_packet *pkt, unsigned char *data, uint32_t datalen) {
   int res;
@@ -488,8 +599,15 @@ static int process_channel_data(struct ssh2_channel *chan,
     datalen);
 
   chan->local_windowsz -= datalen;
+  chan->local_total_recvd += datalen;
 
-  if (chan->local_windowsz < (chan->local_max_packetsz * 3)) {
+  autotune_channel_window(chan, datalen);
+
+  /* Replenish the window once half of it has been used, so that the client
+   * need not wait for our CHANNEL_WINDOW_ADJUST before sending more.
+   */
+  if (chan->local_windowsz < (chan->local_max_packetsz * 3) ||
+      chan->local_windowsz < (chan->local_target_windowsz / 2)) {
     unsigned char *buf, *ptr;
     uint32_t buflen, bufsz, window_adjlen;
     struct ssh2_packet *resp;
@@ -500,7 +618,7 @@ static int process_channel_data(struct ssh2_channel *chan,
     buflen = bufsz = 128;
     ptr = buf = palloc(pkt->pool, bufsz);
 
-    window_adjlen = chan_window_size - chan->local_windowsz;
+    window_adjlen = chan->local_target_windowsz - chan->local_windowsz;
 
     sftp_msg_write_byte(&buf, &buflen, SFTP_SSH2_MSG_CHANNEL_WINDOW_ADJUST);
     sftp_msg_write_int(&buf, &buflen, chan->remote_channel_id);
@@ -523,6 +641,7 @@ static int process_channel_data(struct ssh2_channel *chan,
 
     destroy_pool(resp->pool); 
     chan->local_windowsz += window_adjlen;
+    chan->local_window_adjust_count++;
   }
 
   return res;
@@ -1408,6 +1527,7 @@ int sftp_channel_free(void) {
         (chans[i]->finish)(chans[i]->local_channel_id);
       }
 
+      chan_window_total -= chans[i]->local_target_windowsz;
       chans[i] = NULL;
       channel_count--;
     }
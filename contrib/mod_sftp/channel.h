@@ -39,6 +39,14 @@
 /* Max channel window size, per RFC4254 Section 5.2 is 2^32-1 bytes. */
 #define SFTP_SSH2_CHANNEL_WINDOW_SIZE		4294967295UL
 
+/* Channel windows smaller than this are grown automatically, as needed to
+ * keep up with the throughput of the connection, until the windows of all
+ * of the session's channels, together, reach this size.
+ */
+#ifndef SFTP_SSH2_CHANNEL_WINDOW_AUTOTUNE_MAX
+# define SFTP_SSH2_CHANNEL_WINDOW_AUTOTUNE_MAX	(64UL * 1024 * 1024)
+#endif /* SFTP_SSH2_CHANNEL_WINDOW_AUTOTUNE_MAX */
+
 struct ssh2_channel_databuf;
 
 struct ssh2_channel {
@@ -49,6 +57,24 @@ struct ssh2_channel {
   uint32_t local_windowsz;
   uint32_t local_max_packetsz;
 
+  /* The window size we keep open for the client, and by how much that
+   * has been grown from the configured size.
+   */
+  uint32_t local_target_windowsz;
+  uint32_t local_window_grown;
+
+  /* For measuring how much data the client sends per round trip; the
+   * round-trip time is looked up once per measuring interval.
+   */
+  struct timeval local_window_start;
+  uint32_t local_window_recvd;
+  unsigned long local_window_rtt;
+
+  /* Window statistics, for tracing. */
+  uint64_t local_total_recvd;
+  unsigned int local_window_adjust_count;
+  unsigned int local_window_grow_count;
+
   uint32_t remote_channel_id;
   uint32_t remote_windowsz;
   uint32_t remote_max_packetsz;
@@ -925,21 +925,12 @@ int sftp_cipher_write_data(struct ssh2_packet *pkt, unsigned char *buf,
     unsigned char *data, *ptr;
     uint32_t datalen, datasz;
 
-    /* Always leave a little extra room in the buffer. */
-    datasz = sizeof(uint32_t) + pkt->packet_len + 64;
-
-    if (pkt->aad_len > 0) {
-      /* Packet length is not encrypted for authentication encryption, or
-       * Encrypt-Then-MAC modes.
-       */
-      datasz -= pkt->aad_len;
-
-      /* And, for ETM modes, we may need a little more space. */
-      datasz += sftp_cipher_get_write_block_size();
-    }
-
-    datalen = datasz;
-    ptr = data = palloc(pkt->pool, datasz);
+    /* The packet is assembled in the caller's buffer, and encrypted there in
+     * place; for authenticated encryption, the tag is then appended to it.
+     * This avoids allocating and copying the packet again.
+     */
+    datasz = datalen = (uint32_t) *buflen;
+    ptr = data = buf;
 
     if (auth_len > 0) {
 #if defined(EVP_CTRL_GCM_IV_GEN)
@@ -982,6 +973,14 @@ int sftp_cipher_write_data(struct ssh2_packet *pkt, unsigned char *buf,
     sftp_msg_write_data(&data, &datalen, pkt->payload, pkt->payload_len, FALSE);
     sftp_msg_write_data(&data, &datalen, pkt->padding, pkt->padding_len, FALSE);
 
+    if (auth_len > datalen) {
+      (void) pr_log_writefile(sftp_logfd, MOD_SFTP_VERSION,
+        "no room for %s authentication tag (%lu bytes) in packet buffer",
+        cipher->algo, (unsigned long) auth_len);
+      errno = EIO;
+      return -1;
+    }
+
     res = EVP_Cipher(pctx, buf, ptr, (datasz - datalen));
     if (res < 0) {
       (void) pr_log_writefile(sftp_logfd, MOD_SFTP_VERSION,
@@ -1024,7 +1023,7 @@ int sftp_cipher_write_data(struct ssh2_packet *pkt, unsigned char *buf,
       }
 
       tag_datalen = auth_len;
-      tag_data = pcalloc(pkt->pool, tag_datalen);
+      tag_data = buf + *buflen;
 
 #if defined(EVP_CTRL_GCM_GET_TAG)
       if (EVP_CIPHER_CTX_ctrl(pctx, EVP_CTRL_GCM_GET_TAG, tag_datalen,
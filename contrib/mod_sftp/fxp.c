@@ -191,6 +191,26 @@
 
 extern pr_response_t *resp_list, *resp_err_list;
 
+/* Size and number of the read-ahead buffers used for sequential READs, and
+ * the number of consecutive sequential READs before read-ahead is used.
+ */
+#ifndef FXP_READAHEAD_BUFFER_SIZE
+# define FXP_READAHEAD_BUFFER_SIZE		(1024 * 256)
+#endif
+
+#ifndef FXP_READAHEAD_BUFFER_COUNT
+# define FXP_READAHEAD_BUFFER_COUNT		4
+#endif
+
+#define FXP_READAHEAD_MIN_SEQ_READS		2
+
+/* Size of the buffer in which contiguous WRITEs are coalesced, when the
+ * WriteBehind SFTPOption is enabled.
+ */
+#ifndef FXP_WRITEBEHIND_BUFFER_SIZE
+# define FXP_WRITEBEHIND_BUFFER_SIZE		(1024 * 1024 * 4)
+#endif
+
 struct fxp_dirent {
   const char *client_path;
   const char *real_path;
@@ -220,10 +240,63 @@ struct fxp_handle {
    */
   size_t fh_bytes_xferred;
 
+  /* For tracking the successful READ/WRITE requests for this file, for
+   * dispatching them in aggregate, per the AggregateReadWrite SFTPOption.
+   * The byte counts exclude the first request of each kind, which is
+   * dispatched on its own.
+   */
+  unsigned long fh_nreads, fh_nwrites;
+  off_t fh_read_bytes, fh_write_bytes;
+
+  /* For serving sequential READs from read-ahead buffers. */
+  struct fxp_readahead *fh_readahead;
+
+  /* For coalescing contiguous WRITEs, per the WriteBehind SFTPOption. */
+  struct fxp_writebehind *fh_writebehind;
+
   void *dirh;
   const char *dir;
 };
 
+/* Read-ahead for sequential READs of read-only handles: clients pipeline
+ * many small READs, which are served from a ring of larger buffers, each
+ * filled by a single read.
+ */
+struct fxp_readahead_buf {
+  unsigned char *data;
+  off_t offset;
+  size_t datalen;
+
+  /* The fxp_write_generation at the time this buffer was filled. */
+  unsigned long generation;
+};
+
+struct fxp_readahead {
+  off_t next_offset;
+  unsigned int seq_reads;
+  unsigned int next_buf;
+  struct fxp_readahead_buf bufs[FXP_READAHEAD_BUFFER_COUNT];
+};
+
+/* Write-behind buffer for WRITEs.  Buffered data is written out when it
+ * reaches the next buffer-aligned offset, when a WRITE is not contiguous
+ * with it, or before any other request is handled.  An error writing it out
+ * is reported for the next WRITE, fsync, or CLOSE of the handle.
+ */
+struct fxp_writebehind {
+  unsigned char *data;
+  off_t offset;
+  size_t datalen;
+
+  /* Maximum datalen, such that the buffer ends at an aligned offset. */
+  size_t datasz;
+
+  int xerrno;
+
+  /* Next handle in the list of handles with buffered data. */
+  struct fxp_handle *next;
+};
+
 struct fxp_packet {
   pool *pool;
   uint32_t channel_id;
@@ -295,6 +368,14 @@ struct fxp_extpair {
 };
 
 static pool *fxp_pool = NULL;
+
+/* Incremented whenever this session changes file contents, invalidating
+ * any read-ahead data.
+ */
+static unsigned long fxp_write_generation = 1;
+
+/* Handles which have buffered WRITE data. */
+static struct fxp_handle *fxp_writebehind_handles = NULL;
 static int fxp_use_gmt = TRUE;
 
 /* FSOptions */
@@ -1027,6 +1108,20 @@ static void fxp_cmd_dispatch_err(cmd_rec *cmd) {
   pr_response_clear(&resp_err_list);
 }
 
+/* Dispatches a successful READ/WRITE.  With the AggregateReadWrite
+ * SFTPOption, only the first such request for a handle is dispatched; the
+ * rest are dispatched as a summary when the handle is closed.
+ */
+static void fxp_cmd_dispatch_xfer(cmd_rec *cmd, unsigned long nreqs) {
+  if (!(sftp_opts & SFTP_OPT_AGGREGATE_READ_WRITE) ||
+      nreqs == 1) {
+    fxp_cmd_dispatch(cmd);
+    return;
+  }
+
+  pr_response_clear(&resp_list);
+}
+
 static void fxp_cmd_note_file_status(cmd_rec *cmd, const char *status) {
   if (pr_table_add(cmd->notes, "mod_sftp.file-status",
       pstrdup(cmd->pool, status), 0) < 0) {
@@ -1037,6 +1132,50 @@ static void fxp_cmd_note_file_status(cmd_rec *cmd, const char *status) {
   }
 }
 
+static void fxp_cmd_dispatch_xfer_summary(pool *p, struct fxp_handle *fxh,
+    const char *name, int cmd_class, unsigned long nreqs, off_t nbytes) {
+  char cmd_arg[256];
+  cmd_rec *cmd;
+
+  memset(cmd_arg, '\0', sizeof(cmd_arg));
+  pr_snprintf(cmd_arg, sizeof(cmd_arg)-1, "%s %" PR_LU " %lu", fxh->name,
+    (pr_off_t) nbytes, nreqs);
+  cmd = fxp_cmd_alloc(p, name, pstrdup(p, cmd_arg));
+  cmd->cmd_class = cmd_class;
+
+  fxp_set_filehandle_note(cmd, fxh);
+
+  pr_trace_msg(trace_channel, 8,
+    "dispatching %s summary for '%s': %lu requests, %" PR_LU " bytes", name,
+    fxh->fh->fh_path, nreqs, (pr_off_t) nbytes);
+
+  pr_response_clear(&resp_list);
+  fxp_cmd_dispatch(cmd);
+}
+
+/* With the AggregateReadWrite SFTPOption, dispatches summaries of the READ
+ * and WRITE requests for the given file handle.
+ */
+static void fxp_handle_dispatch_xfer_summaries(pool *p,
+    struct fxp_handle *fxh) {
+  if (!(sftp_opts & SFTP_OPT_AGGREGATE_READ_WRITE)) {
+    return;
+  }
+
+  /* The summaries cover the requests after the first, which was already
+   * dispatched.
+   */
+  if (fxh->fh_nreads > 1) {
+    fxp_cmd_dispatch_xfer_summary(p, fxh, "READ", CL_READ|CL_SFTP,
+      fxh->fh_nreads - 1, fxh->fh_read_bytes);
+  }
+
+  if (fxh->fh_nwrites > 1) {
+    fxp_cmd_dispatch_xfer_summary(p, fxh, "WRITE", CL_WRITE|CL_SFTP,
+      fxh->fh_nwrites - 1, fxh->fh_write_bytes);
+  }
+}
+
 static const char *fxp_get_request_type_desc(unsigned char request_type) {
   switch (request_type) {
     case SFTP_SSH2_FXP_INIT:
@@ -1539,6 +1678,8 @@ static int fxp_attrs_set(pr_fh_t *fh, const char *path, struct stat *attrs,
           res = pr_fsio_truncate(path, attrs->st_size);
         }
 
+        fxp_write_generation++;
+
       } else {
         res = 0;
       }
@@ -2973,6 +3114,150 @@ static struct fxp_handle *fxp_handle_create(pool *p) {
   return fxh;
 }
 
+/* Writes out any buffered WRITE data for the given handle.  On error, the
+ * error is also stashed, for reporting to the client later.
+ */
+static int fxp_writebehind_flush(struct fxp_handle *fxh) {
+  struct fxp_writebehind *fxw;
+  struct fxp_handle **prev;
+  size_t written = 0;
+
+  fxw = fxh->fh_writebehind;
+  if (fxw == NULL) {
+    return 0;
+  }
+
+  for (prev = &fxp_writebehind_handles; *prev != NULL;
+       prev = &((*prev)->fh_writebehind->next)) {
+    if (*prev == fxh) {
+      *prev = fxw->next;
+      break;
+    }
+  }
+
+  fxw->next = NULL;
+
+  if (fxw->datalen == 0) {
+    return 0;
+  }
+
+  fxp_write_generation++;
+
+  while (written < fxw->datalen) {
+    ssize_t res;
+
+    pr_signals_handle();
+
+    res = pr_fsio_pwrite(fxh->fh, fxw->data + written, fxw->datalen - written,
+      fxw->offset + written);
+    if (res <= 0) {
+      int xerrno = res < 0 ? errno : EIO;
+
+      if (xerrno == EINTR) {
+        continue;
+      }
+
+      (void) pr_log_writefile(sftp_logfd, MOD_SFTP_VERSION,
+        "error writing %lu buffered bytes at offset %" PR_LU " to '%s': %s",
+        (unsigned long) (fxw->datalen - written),
+        (pr_off_t) (fxw->offset + written), fxh->fh->fh_path,
+        strerror(xerrno));
+
+      fxw->datalen = 0;
+      fxw->xerrno = xerrno;
+
+      errno = xerrno;
+      return -1;
+    }
+
+    written += res;
+  }
+
+  pr_trace_msg(trace_channel, 19,
+    "wrote %lu buffered bytes at offset %" PR_LU " to '%s'",
+    (unsigned long) fxw->datalen, (pr_off_t) fxw->offset, fxh->fh->fh_path);
+
+  fxw->datalen = 0;
+  return 0;
+}
+
+static void fxp_writebehind_flush_all(void) {
+  while (fxp_writebehind_handles != NULL) {
+    (void) fxp_writebehind_flush(fxp_writebehind_handles);
+  }
+}
+
+/* Returns, and clears, any stashed error from writing out buffered data. */
+static int fxp_writebehind_get_error(struct fxp_handle *fxh) {
+  int xerrno = 0;
+
+  if (fxh->fh_writebehind != NULL) {
+    xerrno = fxh->fh_writebehind->xerrno;
+    fxh->fh_writebehind->xerrno = 0;
+  }
+
+  return xerrno;
+}
+
+static ssize_t fxp_writebehind_write(struct fxp_handle *fxh,
+    const unsigned char *data, size_t datalen, off_t offset) {
+  struct fxp_writebehind *fxw;
+  size_t copied = 0;
+  int xerrno;
+
+  fxw = fxh->fh_writebehind;
+  if (fxw == NULL) {
+    fxw = fxh->fh_writebehind = pcalloc(fxh->pool,
+      sizeof(struct fxp_writebehind));
+    fxw->data = palloc(fxh->pool, FXP_WRITEBEHIND_BUFFER_SIZE);
+  }
+
+  xerrno = fxp_writebehind_get_error(fxh);
+  if (xerrno != 0) {
+    errno = xerrno;
+    return -1;
+  }
+
+  if (fxw->datalen > 0 &&
+      offset != (off_t) (fxw->offset + fxw->datalen)) {
+    if (fxp_writebehind_flush(fxh) < 0) {
+      errno = fxp_writebehind_get_error(fxh);
+      return -1;
+    }
+  }
+
+  while (copied < datalen) {
+    size_t len;
+
+    if (fxw->datalen == 0) {
+      fxw->offset = offset + copied;
+      fxw->datasz = FXP_WRITEBEHIND_BUFFER_SIZE -
+        (fxw->offset % FXP_WRITEBEHIND_BUFFER_SIZE);
+
+      fxw->next = fxp_writebehind_handles;
+      fxp_writebehind_handles = fxh;
+    }
+
+    len = fxw->datasz - fxw->datalen;
+    if (len > datalen - copied) {
+      len = datalen - copied;
+    }
+
+    memcpy(fxw->data + fxw->datalen, data + copied, len);
+    fxw->datalen += len;
+    copied += len;
+
+    if (fxw->datalen == fxw->datasz) {
+      if (fxp_writebehind_flush(fxh) < 0) {
+        errno = fxp_writebehind_get_error(fxh);
+        return -1;
+      }
+    }
+  }
+
+  return datalen;
+}
+
 /* NOTE: this function is ONLY called when the session is closed, for
  * "aborting" any file handles still left open by the client.
  */
@@ -3013,6 +3298,9 @@ static int fxp_handle_abort(const void *key_data, size_t key_datasz,
     return 0;
   }
 
+  (void) fxp_writebehind_flush(fxh);
+  fxp_handle_dispatch_xfer_summaries(fxh->pool, fxh);
+
   curr_path = pstrdup(fxh->pool, fxh->fh->fh_path);
   real_path = curr_path;
   if (fxh->fh_real_path) {
@@ -4708,6 +4996,8 @@ static int fxp_handle_ext_copy_file(struct fxp_packet *fxp, char *src,
     return fxp_packet_write(resp);
   }
 
+  fxp_write_generation++;
+
   /* No errors. */
   xerrno = errno = 0;
 
@@ -4756,7 +5046,17 @@ static int fxp_handle_ext_fsync(struct fxp_packet *fxp,
   buflen = bufsz = FXP_RESPONSE_DATA_DEFAULT_SZ;
   buf = ptr = palloc(fxp->pool, bufsz);
 
+  (void) fxp_writebehind_flush(fxh);
+
   res = fsync(PR_FH_FD(fxh->fh));
+  if (res == 0) {
+    /* Report any error from writing out previously buffered data. */
+    errno = fxp_writebehind_get_error(fxh);
+    if (errno != 0) {
+      res = -1;
+    }
+  }
+
   if (res < 0) {
     xerrno = errno;
 
@@ -5246,6 +5546,8 @@ static int fxp_handle_ext_posix_rename(struct fxp_packet *fxp, char *src,
         errno = xerrno;
 
       } else {
+        fxp_write_generation++;
+
         /* Once copied, remove the original path. */
         if (pr_fsio_unlink(src) < 0) {
           (void) pr_log_writefile(sftp_logfd, MOD_SFTP_VERSION,
@@ -6502,6 +6804,8 @@ static int fxp_handle_close(struct fxp_packet *fxp) {
     char *curr_path = NULL, *real_path = NULL;
     cmd_rec *cmd2 = NULL;
 
+    fxp_handle_dispatch_xfer_summaries(fxp->pool, fxh);
+
     curr_path = pstrdup(fxp->pool, fxh->fh->fh_path);
     real_path = curr_path;
 
@@ -6527,8 +6831,23 @@ static int fxp_handle_close(struct fxp_packet *fxp) {
       session.curr_cmd = C_RETR;
     }
 
-    res = pr_fsio_close(fxh->fh);
-    xerrno = errno;
+    if (fxp_writebehind_flush(fxh) < 0) {
+      xerrno = fxp_writebehind_get_error(fxh);
+      (void) pr_fsio_close(fxh->fh);
+      res = -1;
+
+    } else {
+      res = pr_fsio_close(fxh->fh);
+      xerrno = errno;
+
+      if (res == 0) {
+        /* Report any error from writing out previously buffered data. */
+        xerrno = fxp_writebehind_get_error(fxh);
+        if (xerrno != 0) {
+          res = -1;
+        }
+      }
+    }
 
     session.curr_cmd = "CLOSE";
 
@@ -9414,6 +9733,10 @@ static int fxp_handle_open(struct fxp_packet *fxp) {
   fxh->fh = fh;
   fxh->fh_flags = open_flags;
   fxh->fh_existed = file_existed;
+
+  if (open_flags & O_TRUNC) {
+    fxp_write_generation++;
+  }
   memcpy(fxh->fh_st, &st, sizeof(struct stat));
 
   if (hiddenstore_path) {
@@ -9866,6 +10189,150 @@ static int fxp_handle_opendir(struct fxp_packet *fxp) {
   return fxp_packet_write(resp);
 }
 
+static struct fxp_readahead_buf *fxp_readahead_get_buf(struct fxp_handle *fxh,
+    off_t offset) {
+  register unsigned int i;
+  struct fxp_readahead *fxr;
+  struct fxp_readahead_buf *fxrb;
+  off_t buf_offset;
+  ssize_t res;
+  int fd;
+
+  fxr = fxh->fh_readahead;
+
+  for (i = 0; i < FXP_READAHEAD_BUFFER_COUNT; i++) {
+    fxrb = &(fxr->bufs[i]);
+
+    if (fxrb->data != NULL &&
+        fxrb->generation == fxp_write_generation &&
+        offset >= fxrb->offset &&
+        offset < (off_t) (fxrb->offset + fxrb->datalen)) {
+      return fxrb;
+    }
+  }
+
+  /* Fill the next buffer in the ring with the aligned block containing the
+   * requested offset.
+   */
+  fxrb = &(fxr->bufs[fxr->next_buf]);
+  fxr->next_buf = (fxr->next_buf + 1) % FXP_READAHEAD_BUFFER_COUNT;
+
+  if (fxrb->data == NULL) {
+    fxrb->data = palloc(fxh->pool, FXP_READAHEAD_BUFFER_SIZE);
+  }
+
+  buf_offset = offset - (offset % FXP_READAHEAD_BUFFER_SIZE);
+  fxrb->offset = buf_offset;
+  fxrb->datalen = 0;
+  fxrb->generation = fxp_write_generation;
+
+  res = pr_fsio_pread(fxh->fh, fxrb->data, FXP_READAHEAD_BUFFER_SIZE,
+    buf_offset);
+  if (res < 0) {
+    return NULL;
+  }
+
+  fxrb->datalen = res;
+
+  pr_trace_msg(trace_channel, 19,
+    "read %lu bytes at offset %" PR_LU " of '%s' into read-ahead buffer",
+    (unsigned long) res, (pr_off_t) buf_offset, fxh->fh->fh_path);
+
+  /* Let the kernel fetch the blocks which will fill the rest of the ring
+   * in the background.
+   */
+  fd = PR_FH_FD(fxh->fh);
+  if (fd >= 0 &&
+      res == FXP_READAHEAD_BUFFER_SIZE) {
+    pr_fs_fadvise(fd, buf_offset + FXP_READAHEAD_BUFFER_SIZE,
+      FXP_READAHEAD_BUFFER_SIZE * (FXP_READAHEAD_BUFFER_COUNT - 1),
+      PR_FS_FADVISE_WILLNEED);
+  }
+
+  return fxrb;
+}
+
+/* Reads the requested data for a READ.  Sequential READs of a read-only
+ * handle are served from the read-ahead buffers; if the requested data lies
+ * within a single buffer, a pointer into that buffer is returned, rather
+ * than a copy.
+ */
+static ssize_t fxp_handle_pread(pool *p, struct fxp_handle *fxh,
+    unsigned char **data, size_t datalen, off_t offset) {
+  struct fxp_readahead *fxr;
+  struct fxp_readahead_buf *fxrb;
+  size_t copied = 0;
+
+  if (fxh->fh_flags != O_RDONLY ||
+      datalen > FXP_READAHEAD_BUFFER_SIZE) {
+    *data = palloc(p, datalen);
+    return pr_fsio_pread(fxh->fh, *data, datalen, offset);
+  }
+
+  fxr = fxh->fh_readahead;
+  if (fxr == NULL) {
+    fxr = fxh->fh_readahead = pcalloc(fxh->pool, sizeof(struct fxp_readahead));
+  }
+
+  if (offset == fxr->next_offset) {
+    fxr->seq_reads++;
+
+  } else {
+    fxr->seq_reads = 0;
+  }
+
+  fxr->next_offset = offset + datalen;
+
+  if (fxr->seq_reads < FXP_READAHEAD_MIN_SEQ_READS) {
+    *data = palloc(p, datalen);
+    return pr_fsio_pread(fxh->fh, *data, datalen, offset);
+  }
+
+  fxrb = fxp_readahead_get_buf(fxh, offset);
+  if (fxrb == NULL) {
+    return -1;
+  }
+
+  if (offset >= (off_t) (fxrb->offset + fxrb->datalen)) {
+    /* EOF */
+    return 0;
+  }
+
+  if ((off_t) (offset + datalen) <= (off_t) (fxrb->offset + fxrb->datalen)) {
+    *data = fxrb->data + (offset - fxrb->offset);
+    return datalen;
+  }
+
+  /* The requested data spans buffers, or reaches EOF. */
+  *data = palloc(p, datalen);
+
+  while (copied < datalen) {
+    size_t len;
+
+    if (offset >= (off_t) (fxrb->offset + fxrb->datalen)) {
+      break;
+    }
+
+    len = (fxrb->offset + fxrb->datalen) - offset;
+    if (len > datalen - copied) {
+      len = datalen - copied;
+    }
+
+    memcpy(*data + copied, fxrb->data + (offset - fxrb->offset), len);
+    copied += len;
+    offset += len;
+
+    if (copied < datalen) {
+      fxrb = fxp_readahead_get_buf(fxh, offset);
+      if (fxrb == NULL) {
+        break;
+      }
+    }
+  }
+
+  return copied;
+}
+
 static int fxp_handle_read(struct fxp_packet *fxp) {
   unsigned char *buf, *data = NULL, *ptr;
   char *file, *name, *ptr2;
@@ -10063,8 +10530,7 @@ static int fxp_handle_read(struct fxp_packet *fxp) {
   pr_throttle_init(cmd2);
 
   if (datalen > 0) {
-    data = palloc(fxp->pool, datalen);
-    res = pr_fsio_pread(fxh->fh, data, datalen, offset);
+    res = fxp_handle_pread(fxp->pool, fxh, &data, datalen, offset);
 
   } else {
     res = 0;
@@ -10114,8 +10580,12 @@ static int fxp_handle_read(struct fxp_packet *fxp) {
     if (xerrno != EOF) {
       fxp_cmd_dispatch_err(cmd);
 
-    } else {
+    } else if (!(sftp_opts & SFTP_OPT_AGGREGATE_READ_WRITE)) {
       fxp_cmd_dispatch(cmd);
+
+    } else {
+      /* An EOF reply carries no data, and is not counted in the summary. */
+      pr_response_clear(&resp_list);
     }
 
     resp = fxp_packet_create(fxp->pool, fxp->channel_id);
@@ -10149,7 +10619,11 @@ static int fxp_handle_read(struct fxp_packet *fxp) {
   session.xfer.total_bytes += res;
   session.total_bytes += res;
 
-  fxp_cmd_dispatch(cmd);
+  fxh->fh_nreads++;
+  if (fxh->fh_nreads > 1) {
+    fxh->fh_read_bytes += res;
+  }
+  fxp_cmd_dispatch_xfer(cmd, fxh->fh_nreads);
 
   res = fxp_packet_write(resp);
   return res;
@@ -11763,6 +12237,8 @@ static int fxp_handle_rename(struct fxp_packet *fxp) {
         errno = xerrno;
 
       } else {
+        fxp_write_generation++;
+
         /* Once copied, remove the original path. */
         if (pr_fsio_unlink(old_path) < 0) {
           (void) pr_log_writefile(sftp_logfd, MOD_SFTP_VERSION,
@@ -13008,7 +13484,14 @@ static int fxp_handle_write(struct fxp_packet *fxp) {
   
   /* Handle zero-length writes as a special case; see Bug#4398. */
   if (datalen > 0) {
-    res = pr_fsio_pwrite(fxh->fh, data, datalen, offset);
+    if ((sftp_opts & SFTP_OPT_WRITE_BEHIND) &&
+        S_ISREG(fxh->fh_st->st_mode)) {
+      res = fxp_writebehind_write(fxh, data, datalen, offset);
+
+    } else {
+      res = pr_fsio_pwrite(fxh->fh, data, datalen, offset);
+      fxp_write_generation++;
+    }
 
   } else {
     res = 0;
@@ -13136,7 +13619,11 @@ static int fxp_handle_write(struct fxp_packet *fxp) {
   fxp_status_write(fxp->pool, &buf, &buflen, fxp->request_id, status_code,
     fxp_strerror(status_code), NULL);
 
-  fxp_cmd_dispatch(cmd);
+  fxh->fh_nwrites++;
+  if (fxh->fh_nwrites > 1) {
+    fxh->fh_write_bytes += datalen;
+  }
+  fxp_cmd_dispatch_xfer(cmd, fxh->fh_nwrites);
 
   resp = fxp_packet_create(fxp->pool, fxp->channel_id);
   resp->payload = ptr;
@@ -13460,6 +13947,13 @@ int sftp_fxp_handle_packet(pool *p, void *ssh2, uint32_t channel_id,
     pr_response_clear(&resp_list);
     pr_response_clear(&resp_err_list);
 
+    /* Write out any buffered WRITE data first, so that other requests see
+     * the data written so far.
+     */
+    if (fxp->request_type != SFTP_SSH2_FXP_WRITE) {
+      fxp_writebehind_flush_all();
+    }
+
     switch (fxp->request_type) {
       case SFTP_SSH2_FXP_INIT:
         /* If we already know the version, then the client has sent
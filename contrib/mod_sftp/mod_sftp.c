@@ -1478,7 +1478,10 @@ MODRET set_sftpoptions(cmd_rec *cmd) {
   c = add_config_param(cmd->argv[0], 1, NULL);
 
   for (i = 1; i < cmd->argc; i++) {
-    if (strncmp(cmd->argv[i], "IgnoreSFTPUploadPerms", 22) == 0) {
+    if (strcmp(cmd->argv[i], "AggregateReadWrite") == 0) {
+      opts |= SFTP_OPT_AGGREGATE_READ_WRITE;
+
+    } else if (strncmp(cmd->argv[i], "IgnoreSFTPUploadPerms", 22) == 0) {
       opts |= SFTP_OPT_IGNORE_SFTP_UPLOAD_PERMS;
 
     } else if (strncmp(cmd->argv[i], "IgnoreSFTPSetOwners", 19) == 0) {
@@ -1538,6 +1541,12 @@ MODRET set_sftpoptions(cmd_rec *cmd) {
     } else if (strcmp(cmd->argv[i], "NoHostkeyRotation") == 0) {
       opts |= SFTP_OPT_NO_HOSTKEY_ROTATION;
 
+    } else if (strcmp(cmd->argv[i], "NoWindowAutotune") == 0) {
+      opts |= SFTP_OPT_NO_WINDOW_AUTOTUNE;
+
+    } else if (strcmp(cmd->argv[i], "WriteBehind") == 0) {
+      opts |= SFTP_OPT_WRITE_BEHIND;
+
     } else {
       CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, ": unknown SFTPOption '",
         cmd->argv[i], "'", NULL));
@@ -203,137 +203,195 @@ static int packet_poll(int sockfd, int io) {
   return 0;
 }
 
+/* Data read from the client but not yet consumed.  Reading from the socket
+ * in large chunks, rather than just the amount needed for the next part of
+ * the current packet, allows many pipelined packets to be parsed out of
+ * memory, without a poll and read(2) for each one.
+ */
+#ifndef SFTP_PACKET_READ_BUFFER_SIZE
+# define SFTP_PACKET_READ_BUFFER_SIZE	(256 * 1024)
+#endif /* SFTP_PACKET_READ_BUFFER_SIZE */
+
+static unsigned char packet_rbuf[SFTP_PACKET_READ_BUFFER_SIZE];
+static size_t packet_rbuf_offset = 0, packet_rbuf_len = 0;
+
+/* Waits for the socket to become readable, and reads whatever is available,
+ * up to bufsz bytes, into the given buffer.  Returns the number of bytes
+ * read.
+ */
+static int packet_sock_fill(int sockfd, void *buf, size_t bufsz) {
+  int res, xerrno;
+
+  /* Generate an event for the read poll we're about to do, for listeners
+   * like mod_proxy that always want to do similar polling, as part of this
+   * event loop in mod_sftp.
+   */
+  pr_event_generate("mod_sftp.ssh2.read-poll", NULL);
+
+  res = packet_poll(sockfd, SFTP_PACKET_IO_RD);
+  xerrno = errno;
+
+  if (res < 0) {
+    errno = xerrno;
+    return -1;
+  }
+
+  /* The socket we accept is blocking, thus there's no need to handle
+   * EAGAIN/EWOULDBLOCK errors.
+   */
+  res = read(sockfd, buf, bufsz);
+  while (res <= 0) {
+    if (res < 0) {
+      xerrno = errno;
+
+      if (xerrno == EINTR) {
+        pr_signals_handle();
+        res = read(sockfd, buf, bufsz);
+        continue;
+      }
+
+      pr_trace_msg(trace_channel, 16,
+        "error reading from client (fd %d): %s", sockfd, strerror(xerrno));
+      (void) pr_log_writefile(sftp_logfd, MOD_SFTP_VERSION,
+        "error reading from client (fd %d): %s", sockfd, strerror(xerrno));
+
+      errno = xerrno;
+
+      /* We explicitly disconnect the client here, rather than sending
+       * a DISCONNECT message, because the errors below all indicate
+       * a problem with the TCP connection, such that trying to write
+       * more data on that connection would cause problems.
+       */
+      if (errno == ECONNRESET ||
+          errno == ECONNABORTED ||
+#ifdef ETIMEDOUT
+          errno == ETIMEDOUT ||
+#endif /* ETIMEDOUT */
+#ifdef ENOTCONN
+          errno == ENOTCONN ||
+#endif /* ENOTCONN */
+#ifdef ESHUTDOWN
+          errno == ESHUTDOWN ||
+#endif /* ESHUTDOWNN */
+          errno == EPIPE) {
+        xerrno = errno;
+
+        pr_trace_msg(trace_channel, 16,
+          "disconnecting client (%s)", strerror(xerrno));
+        (void) pr_log_writefile(sftp_logfd, MOD_SFTP_VERSION,
+          "disconnecting client (%s)", strerror(xerrno));
+        pr_session_disconnect(&sftp_module, PR_SESS_DISCONNECT_CLIENT_EOF,
+          strerror(xerrno));
+      }
+
+      return -1;
+
+    } else {
+      /* If we read zero bytes here, treat it as an EOF and hang up on
+       * the uncommunicative client.
+       */
+
+      pr_trace_msg(trace_channel, 16, "%s",
+        "disconnecting client (received EOF)");
+      (void) pr_log_writefile(sftp_logfd, MOD_SFTP_VERSION,
+        "disconnecting client (received EOF)");
+      pr_session_disconnect(&sftp_module, PR_SESS_DISCONNECT_CLIENT_EOF,
+        NULL);
+    }
+  }
+
+  /* Generate an event for any interested listeners.  Since the data are
+   * probably encrypted and such, and since listeners won't/shouldn't
+   * have the facilities for handling such data, we only pass the
+   * amount of data read in.
+   */
+  pr_event_generate("ssh2.netio-read", &res);
+
+  session.total_raw_in += res;
+  time(&last_recvd);
+
+  return res;
+}
+
 /* The purpose of sock_read() is to loop until either we have read in the
  * requested reqlen from the socket, or the socket gives us an I/O error.
  * We want to prevent short reads from causing problems elsewhere (e.g.
  * in the decipher or MAC code).
  *
+ * Data are served from the receive buffer first; the socket is only read
+ * when that buffer is empty.
+ *
  * It is the caller's responsibility to ensure that buf is large enough to
  * hold reqlen bytes.
  */
 int sftp_ssh2_packet_sock_read(int sockfd, void *buf, size_t reqlen,
     int flags) {
-  void *ptr;
+  unsigned char *ptr;
   size_t remainlen;
 
   if (reqlen == 0) {
     return 0;
   }
 
-  /* Generate an event for the read poll we're about to do, for listeners
-   * like mod_proxy that always want to do similar polling, as part of this
-   * event loop in mod_sftp.
-   */
-  pr_event_generate("mod_sftp.ssh2.read-poll", NULL);
-
   errno = 0;
 
   ptr = buf;
   remainlen = reqlen;
 
   while (remainlen > 0) {
-    int res, xerrno;
+    size_t copylen;
+    int res;
 
-    res = packet_poll(sockfd, SFTP_PACKET_IO_RD);
-    xerrno = errno;
+    if (packet_rbuf_len > 0) {
+      copylen = remainlen;
+      if (copylen > packet_rbuf_len) {
+        copylen = packet_rbuf_len;
+      }
 
-    if (res < 0) {
-      errno = xerrno;
-      return -1;
-    }
+      memcpy(ptr, packet_rbuf + packet_rbuf_offset, copylen);
+      packet_rbuf_offset += copylen;
+      packet_rbuf_len -= copylen;
 
-    /* The socket we accept is blocking, thus there's no need to handle
-     * EAGAIN/EWOULDBLOCK errors.
-     */
-    res = read(sockfd, ptr, remainlen);
-    while (res <= 0) {
+    } else if (remainlen >= sizeof(packet_rbuf)) {
+      /* No point in buffering data which the caller wants anyway. */
+      res = packet_sock_fill(sockfd, ptr, remainlen);
       if (res < 0) {
-        xerrno = errno;
-
-        if (xerrno == EINTR) {
-          pr_signals_handle();
-          res = read(sockfd, ptr, remainlen);
-          continue;
-        }
-
-        pr_trace_msg(trace_channel, 16,
-          "error reading from client (fd %d): %s", sockfd, strerror(xerrno));
-        (void) pr_log_writefile(sftp_logfd, MOD_SFTP_VERSION,
-          "error reading from client (fd %d): %s", sockfd, strerror(xerrno));
-
-        errno = xerrno;
-
-        /* We explicitly disconnect the client here, rather than sending
-         * a DISCONNECT message, because the errors below all indicate
-         * a problem with the TCP connection, such that trying to write
-         * more data on that connection would cause problems.
-         */
-        if (errno == ECONNRESET ||
-            errno == ECONNABORTED ||
-#ifdef ETIMEDOUT
-            errno == ETIMEDOUT ||
-#endif /* ETIMEDOUT */
-#ifdef ENOTCONN
-            errno == ENOTCONN ||
-#endif /* ENOTCONN */
-#ifdef ESHUTDOWN
-            errno == ESHUTDOWN ||
-#endif /* ESHUTDOWNN */
-            errno == EPIPE) {
-          xerrno = errno;
-
-          pr_trace_msg(trace_channel, 16,
-            "disconnecting client (%s)", strerror(xerrno));
-          (void) pr_log_writefile(sftp_logfd, MOD_SFTP_VERSION,
-            "disconnecting client (%s)", strerror(xerrno));
-          pr_session_disconnect(&sftp_module, PR_SESS_DISCONNECT_CLIENT_EOF,
-            strerror(xerrno));
-        }
-
         return -1;
+      }
 
-      } else {
-        /* If we read zero bytes here, treat it as an EOF and hang up on
-         * the uncommunicative client.
-         */
+      copylen = res;
 
-        pr_trace_msg(trace_channel, 16, "%s",
-          "disconnecting client (received EOF)");
-        (void) pr_log_writefile(sftp_logfd, MOD_SFTP_VERSION,
-          "disconnecting client (received EOF)");
-        pr_session_disconnect(&sftp_module, PR_SESS_DISCONNECT_CLIENT_EOF,
-          NULL);
+    } else {
+      res = packet_sock_fill(sockfd, packet_rbuf, sizeof(packet_rbuf));
+      if (res < 0) {
+        return -1;
       }
-    }
 
-    /* Generate an event for any interested listeners.  Since the data are
-     * probably encrypted and such, and since listeners won't/shouldn't
-     * have the facilities for handling such data, we only pass the
-     * amount of data read in.
-     */
-    pr_event_generate("ssh2.netio-read", &res);
+      packet_rbuf_offset = 0;
+      packet_rbuf_len = res;
+      continue;
+    }
 
-    session.total_raw_in += reqlen;
-    time(&last_recvd);
+    ptr += copylen;
+    remainlen -= copylen;
 
-    if ((size_t) res == remainlen) {
+    if (remainlen == 0) {
       break;
     }
 
     if (flags & SFTP_PACKET_READ_FL_PESSIMISTIC) {
       pr_trace_msg(trace_channel, 20, "read %lu bytes, expected %lu bytes; "
-        "pessimistically returning", (unsigned long) res,
-        (unsigned long) remainlen);
+        "pessimistically returning", (unsigned long) (reqlen - remainlen),
+        (unsigned long) reqlen);
       break;
     }
 
     pr_trace_msg(trace_channel, 20, "read %lu bytes, expected %lu bytes; "
-      "reading more", (unsigned long) res, (unsigned long) remainlen);
-    ptr = ((char *) ptr + res);
-    remainlen -= res;
+      "reading more", (unsigned long) (reqlen - remainlen),
+      (unsigned long) reqlen);
   }
 
-  return reqlen;
+  return reqlen - remainlen;
 }
 
 static char peek_msg_type(struct ssh2_packet *pkt) {
@@ -612,8 +670,19 @@ static int read_packet_payload(int sockfd, struct ssh2_packet *pkt,
       errno = EPERM;
       return -1;
     }
+  }
+
+  /* Allocate the payload and padding together, so that the remaining data
+   * can be decrypted directly into place.  Allow for a partial final cipher
+   * block.
+   */
+  if (payload_len + padding_len > 0) {
+    pkt->payload = palloc(pkt->pool, payload_len + padding_len +
+      sftp_cipher_get_read_block_size());
 
-    pkt->payload = pcalloc(pkt->pool, payload_len);
+    if (padding_len > 0) {
+      pkt->padding = pkt->payload + payload_len;
+    }
   }
 
   /* If there's data in the buffer we received, it's probably already part
@@ -638,14 +707,6 @@ static int read_packet_payload(int sockfd, struct ssh2_packet *pkt,
     }
   }
 
-  /* The padding length is required to be greater than zero.  However, we may
-   * not know the padding length yet, as for authenticated encryption or ETM
-   * modes.
-   */
-  if (padding_len > 0) {
-    pkt->padding = pcalloc(pkt->pool, padding_len);
-  }
-
   /* If there's data in the buffer we received, it's probably already part
    * of the padding, unencrypted.  That will leave the remaining padding
    * data, if any, to be read in and decrypted.
@@ -703,17 +764,23 @@ static int read_packet_payload(int sockfd, struct ssh2_packet *pkt,
     *buflen = res;
 
   } else {
+    unsigned char *data;
+
+    /* The remaining payload and padding directly follow the parts of them
+     * which we already have.
+     */
+    data = pkt->payload + (pkt->payload_len - payload_len) +
+      (pkt->padding_len - padding_len);
+    ptr = data;
+
     if (sftp_cipher_read_data(pkt, buf + *offset, data_len, &ptr, &len) < 0) {
       return -1;
     }
 
-    if (payload_len > 0) {
-      memmove(pkt->payload + (pkt->payload_len - payload_len), ptr,
-        payload_len);
+    if (ptr != data) {
+      /* No decryption was done. */
+      memmove(data, ptr, payload_len + padding_len);
     }
-
-    memmove(pkt->padding + (pkt->padding_len - padding_len), ptr + payload_len,
-      padding_len);
   }
 
   return 0;
@@ -948,7 +1015,6 @@ int sftp_ssh2_packet_read(int sockfd, struct ssh2_packet *pkt) {
      */
 
     buflen = 0;
-    memset(buf, 0, sizeof(buf));
 
     if (read_packet_len(sockfd, pkt, buf, &offset, &buflen, bufsz,
         etm_mac) < 0) {
@@ -1075,8 +1141,6 @@ int sftp_ssh2_packet_read(int sockfd, struct ssh2_packet *pkt) {
       memmove(pkt->padding, buf2 + offset + pkt->payload_len, pkt->padding_len);
 
     } else {
-      memset(buf, 0, sizeof(buf));
-
       if (read_packet_mac(sockfd, pkt, buf) < 0) {
         (void) pr_log_writefile(sftp_logfd, MOD_SFTP_VERSION,
           "unable to read MAC from socket %d", sockfd);
@@ -1284,8 +1348,8 @@ static struct iovec packet_iov[SFTP_SSH2_PACKET_IOVSZ];
 static unsigned int packet_niov = 0;
 
 int sftp_ssh2_packet_send(int sockfd, struct ssh2_packet *pkt) {
-  unsigned char buf[SFTP_MAX_PACKET_LEN * 2], msg_type;
-  size_t buflen = 0, bufsz = SFTP_MAX_PACKET_LEN;
+  unsigned char buf[SFTP_MAX_PACKET_LEN * 2], *data, msg_type;
+  size_t buflen = 0, bufsz = sizeof(buf);
   uint32_t packet_len = 0, auth_len = 0;
   int res, write_len = 0, block_alarms = FALSE, etm_mac = FALSE;
 
@@ -1360,11 +1424,14 @@ int sftp_ssh2_packet_send(int sockfd, struct ssh2_packet *pkt) {
 
   pkt->seqno = packet_server_seqno;
 
-  memset(buf, 0, sizeof(buf));
-  buflen = bufsz;
+  /* Leave room at the start of the buffer for any AAD bytes, so that the
+   * AAD, encrypted data, and authentication tag can be sent contiguously.
+   */
+  data = buf + sizeof(uint32_t);
+  buflen = bufsz - sizeof(uint32_t);
 
   if (etm_mac == TRUE) {
-    if (sftp_cipher_write_data(pkt, buf, &buflen) < 0) {
+    if (sftp_cipher_write_data(pkt, data, &buflen) < 0) {
       int xerrno = errno;
 
       if (block_alarms == TRUE) {
@@ -1378,7 +1445,7 @@ int sftp_ssh2_packet_send(int sockfd, struct ssh2_packet *pkt) {
     /* Once we have the encrypted data, overwrite the plaintext packet payload
      * with it, so that the MAC is calculated from the encrypted data.
      */
-    pkt->payload = buf;
+    pkt->payload = data;
     pkt->payload_len = buflen;
 
     if (sftp_mac_write_data(pkt) < 0) {
@@ -1404,7 +1471,7 @@ int sftp_ssh2_packet_send(int sockfd, struct ssh2_packet *pkt) {
       return -1;
     }
 
-    if (sftp_cipher_write_data(pkt, buf, &buflen) < 0) {
+    if (sftp_cipher_write_data(pkt, data, &buflen) < 0) {
       int xerrno = errno;
 
       if (block_alarms == TRUE) {
@@ -1431,20 +1498,25 @@ int sftp_ssh2_packet_send(int sockfd, struct ssh2_packet *pkt) {
     if (pkt->aad_len > 0) {
       pr_trace_msg(trace_channel, 20, "sending %lu bytes of packet AAD data",
         (unsigned long) pkt->aad_len);
-      packet_iov[packet_niov].iov_base = (void *) pkt->aad;
-      packet_iov[packet_niov].iov_len = pkt->aad_len;
-      write_len += packet_iov[packet_niov].iov_len;
-      packet_niov++;
+      memcpy(data - pkt->aad_len, pkt->aad, pkt->aad_len);
     }
 
     pr_trace_msg(trace_channel, 20, "sending %lu bytes of packet payload data",
       (unsigned long) buflen);
-    packet_iov[packet_niov].iov_base = (void *) buf;
-    packet_iov[packet_niov].iov_len = buflen;
+    packet_iov[packet_niov].iov_base = (void *) (data - pkt->aad_len);
+    packet_iov[packet_niov].iov_len = pkt->aad_len + buflen;
     write_len += packet_iov[packet_niov].iov_len;
     packet_niov++;
 
-    if (pkt->mac_len > 0) {
+    if (pkt->mac_len > 0 &&
+        pkt->mac == data + buflen) {
+      /* The authentication tag directly follows the encrypted data. */
+      pr_trace_msg(trace_channel, 20, "sending %lu bytes of packet MAC data",
+        (unsigned long) pkt->mac_len);
+      packet_iov[packet_niov-1].iov_len += pkt->mac_len;
+      write_len += pkt->mac_len;
+
+    } else if (pkt->mac_len > 0) {
       pr_trace_msg(trace_channel, 20, "sending %lu bytes of packet MAC data",
         (unsigned long) pkt->mac_len);
       packet_iov[packet_niov].iov_base = (void *) pkt->mac;
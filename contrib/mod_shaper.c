@@ -439,6 +439,7 @@ static void shaper_remove_config(unsigned int prio) {
     set = c->set;
 
     xaset_remove(set, (xasetmember_t *) c);
+    pr_config_index_invalidate();
 
     if (!set->xas_list) {
       if (c->parent && c->parent->subset == set)
@@ -29,6 +29,9 @@
 #include "mod_sql.h"
 #include "jot.h"
 
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
 #define MOD_SQL_VERSION			"mod_sql/4.5"
 
 #if defined(HAVE_CRYPT_H) && !defined(AIX4) && !defined(AIX5)
@@ -82,6 +85,7 @@
 
 /* SQLLog flags */
 #define SQL_LOG_FL_IGNORE_ERRORS	0x001
+#define SQL_LOG_FL_QUEUE		0x002
 
 /* authmask defines */
 #define SQL_AUTH_USERS             (1<<0)
@@ -453,6 +457,442 @@ static void *cache_findvalue(cache_t *cache, void *data) {
   return (entry == NULL ? NULL : entry->data);
 }
 
+/*
+ * shared cache functions
+ *
+ * The SQLAuthCache keeps user and group records, as looked up by any session,
+ * in a shared memory segment, so that new sessions need not query the
+ * database for them again until they expire.  The per-session caches above
+ * are still used in front of it.
+ */
+
+#ifndef SQL_AUTH_CACHE_SIZE
+# define SQL_AUTH_CACHE_SIZE		1024
+#endif
+
+/* Maximum size of the names and other strings of a cached record; records
+ * needing more (e.g. groups with many members) are not cached.
+ */
+#ifndef SQL_AUTH_CACHE_DATASZ
+# define SQL_AUTH_CACHE_DATASZ		1024
+#endif
+
+/* Number of slots, starting at a record's hash, searched for that record. */
+#define SQL_AUTH_CACHE_PROBES		16
+
+#define SQL_AUTH_CACHE_DEFAULT_TTL	60
+#define SQL_AUTH_CACHE_MAGIC		0x73716c31
+#define SQL_AUTH_CACHE_PROJ_ID		83
+
+#define SQL_AUTH_CACHE_PASSWD		1
+#define SQL_AUTH_CACHE_GROUP		2
+
+/* Records with this ID are not indexed by ID. */
+#define SQL_AUTH_CACHE_NO_ID		((unsigned int) -1)
+
+/* Number of strings in a user record. */
+#define SQL_AUTH_CACHE_PASSWD_NFIELDS	6
+
+struct sql_auth_cache_entry {
+
+  /* Zero marks an unused slot. */
+  unsigned int sace_type;
+
+  /* Identifies the user/group configuration from which this record came. */
+  unsigned int sace_src_id;
+
+  /* UID of a user, as stored in the database; GID of a group. */
+  unsigned int sace_id;
+  unsigned int sace_id2;
+
+  time_t sace_expires;
+
+  /* The strings of the record, each NUL-terminated, starting with the name.
+   * For users, these are the name, password, home, shell, UID and GID columns
+   * as stored in the database, with the bits of nullmask marking those which
+   * are NULL; for groups, the name and members.
+   */
+  unsigned int sace_nfields;
+  unsigned int sace_nullmask;
+  char sace_data[SQL_AUTH_CACHE_DATASZ];
+};
+
+struct sql_auth_cache_data {
+  unsigned int sacd_magic;
+  unsigned int sacd_size;
+  unsigned int sacd_datasz;
+
+  struct sql_auth_cache_entry sacd_entries[SQL_AUTH_CACHE_SIZE];
+
+  /* Index of records by UID/GID; each slot holds an entry index plus one,
+   * and is checked against that entry when used.
+   */
+  unsigned int sacd_ids[SQL_AUTH_CACHE_SIZE];
+};
+
+static struct sql_auth_cache_data *sql_auth_cache = NULL;
+static int sql_auth_cache_fd = -1;
+static int sql_auth_cache_ttl = SQL_AUTH_CACHE_DEFAULT_TTL;
+static unsigned int sql_auth_cache_src_id = 0;
+
+static unsigned int sql_auth_cache_hash(unsigned int h, const char *str) {
+  while (*str) {
+    h = ((h << 5) + h) + (unsigned char) *str++;
+  }
+
+  return h;
+}
+
+static int sql_auth_cache_lock(int lock_type) {
+  struct flock lock;
+
+  lock.l_type = lock_type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = 0;
+  lock.l_len = 0;
+
+  while (fcntl(sql_auth_cache_fd, F_SETLKW, &lock) < 0) {
+    int xerrno = errno;
+
+    if (xerrno == EINTR) {
+      pr_signals_handle();
+      continue;
+    }
+
+    pr_trace_msg(trace_channel, 3, "error locking SQLAuthCache fd %d: %s",
+      sql_auth_cache_fd, strerror(xerrno));
+
+    errno = xerrno;
+    return -1;
+  }
+
+  return 0;
+}
+
+static struct sql_auth_cache_entry *sql_auth_cache_find_name(unsigned int type,
+    const char *name) {
+  register unsigned int i;
+  unsigned int h;
+
+  h = sql_auth_cache_hash(type, name);
+
+  for (i = 0; i < SQL_AUTH_CACHE_PROBES; i++) {
+    struct sql_auth_cache_entry *sace;
+
+    sace = &(sql_auth_cache->sacd_entries[(h + i) % SQL_AUTH_CACHE_SIZE]);
+    if (sace->sace_type == 0) {
+      break;
+    }
+
+    if (sace->sace_type == type &&
+        sace->sace_src_id == sql_auth_cache_src_id &&
+        strcmp(sace->sace_data, name) == 0) {
+      return sace;
+    }
+  }
+
+  return NULL;
+}
+
+static struct sql_auth_cache_entry *sql_auth_cache_find_id(unsigned int type,
+    unsigned int id) {
+  register unsigned int i;
+  unsigned int h;
+
+  if (id == SQL_AUTH_CACHE_NO_ID) {
+    return NULL;
+  }
+
+  h = (type * 33) + id;
+
+  for (i = 0; i < SQL_AUTH_CACHE_PROBES; i++) {
+    unsigned int idx;
+    struct sql_auth_cache_entry *sace;
+
+    idx = sql_auth_cache->sacd_ids[(h + i) % SQL_AUTH_CACHE_SIZE];
+    if (idx == 0) {
+      break;
+    }
+
+    sace = &(sql_auth_cache->sacd_entries[idx - 1]);
+    if (sace->sace_type == type &&
+        sace->sace_src_id == sql_auth_cache_src_id &&
+        sace->sace_id == id) {
+      return sace;
+    }
+  }
+
+  return NULL;
+}
+
+/* Looks up a record, by name if given, otherwise by ID.  On a hit, the
+ * record's strings are copied into the given pool, and returned.
+ */
+static char **sql_auth_cache_get(pool *p, unsigned int type, const char *name,
+    unsigned int id, struct sql_auth_cache_entry *res) {
+  register unsigned int i;
+  struct sql_auth_cache_entry *sace;
+  char **fields = NULL, *ptr;
+
+  if (sql_auth_cache == NULL) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  if (sql_auth_cache_lock(F_RDLCK) < 0) {
+    return NULL;
+  }
+
+  if (name != NULL) {
+    sace = sql_auth_cache_find_name(type, name);
+
+  } else {
+    sace = sql_auth_cache_find_id(type, id);
+  }
+
+  if (sace != NULL &&
+      sace->sace_expires > time(NULL)) {
+    memcpy(res, sace, sizeof(struct sql_auth_cache_entry));
+
+  } else {
+    sace = NULL;
+  }
+
+  sql_auth_cache_lock(F_UNLCK);
+
+  if (sace == NULL) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  fields = pcalloc(p, sizeof(char *) * (res->sace_nfields + 1));
+
+  ptr = res->sace_data;
+  for (i = 0; i < res->sace_nfields; i++) {
+    if (!(res->sace_nullmask & (1 << i))) {
+      fields[i] = pstrdup(p, ptr);
+    }
+
+    ptr += strlen(ptr) + 1;
+  }
+
+  return fields;
+}
+
+static int sql_auth_cache_add(unsigned int type, unsigned int id,
+    unsigned int id2, unsigned int nfields, char **fields) {
+  register unsigned int i;
+  unsigned int h, nullmask = 0;
+  size_t datalen = 0;
+  struct sql_auth_cache_entry *sace, *victim = NULL;
+  char *ptr;
+  time_t now;
+
+  if (sql_auth_cache == NULL) {
+    return 0;
+  }
+
+  for (i = 0; i < nfields; i++) {
+    if (fields[i] == NULL) {
+      nullmask |= (1 << i);
+      datalen++;
+
+    } else {
+      datalen += strlen(fields[i]) + 1;
+    }
+  }
+
+  if (datalen > SQL_AUTH_CACHE_DATASZ ||
+      nfields > 32) {
+    pr_trace_msg(trace_channel, 9, "not caching '%s' in SQLAuthCache: record "
+      "too large (%lu bytes)", fields[0], (unsigned long) datalen);
+    errno = EFBIG;
+    return -1;
+  }
+
+  if (sql_auth_cache_lock(F_WRLCK) < 0) {
+    return -1;
+  }
+
+  time(&now);
+
+  /* Reuse the record's existing slot, else the first unused slot, else the
+   * slot closest to expiring.
+   */
+  h = sql_auth_cache_hash(type, fields[0]);
+
+  for (i = 0; i < SQL_AUTH_CACHE_PROBES; i++) {
+    sace = &(sql_auth_cache->sacd_entries[(h + i) % SQL_AUTH_CACHE_SIZE]);
+
+    if (sace->sace_type == 0) {
+      victim = sace;
+      break;
+    }
+
+    if (sace->sace_type == type &&
+        sace->sace_src_id == sql_auth_cache_src_id &&
+        strcmp(sace->sace_data, fields[0]) == 0) {
+      victim = sace;
+      break;
+    }
+
+    if (victim == NULL ||
+        sace->sace_expires < victim->sace_expires) {
+      victim = sace;
+    }
+  }
+
+  victim->sace_type = type;
+  victim->sace_src_id = sql_auth_cache_src_id;
+  victim->sace_id = id;
+  victim->sace_id2 = id2;
+  victim->sace_expires = now + sql_auth_cache_ttl;
+  victim->sace_nfields = nfields;
+  victim->sace_nullmask = nullmask;
+
+  ptr = victim->sace_data;
+  for (i = 0; i < nfields; i++) {
+    size_t len = 0;
+
+    if (fields[i] != NULL) {
+      len = strlen(fields[i]);
+      memcpy(ptr, fields[i], len);
+    }
+
+    ptr[len] = '\0';
+    ptr += len + 1;
+  }
+
+  /* Point the ID index at this record, replacing an unused or stale index
+   * slot if possible.
+   */
+  h = (type * 33) + id;
+
+  for (i = 0; id != SQL_AUTH_CACHE_NO_ID && i < SQL_AUTH_CACHE_PROBES; i++) {
+    unsigned int *idx;
+    struct sql_auth_cache_entry *indexed;
+
+    idx = &(sql_auth_cache->sacd_ids[(h + i) % SQL_AUTH_CACHE_SIZE]);
+    if (*idx == 0) {
+      *idx = (victim - sql_auth_cache->sacd_entries) + 1;
+      break;
+    }
+
+    indexed = &(sql_auth_cache->sacd_entries[*idx - 1]);
+    if (indexed == victim ||
+        indexed->sace_type != type ||
+        indexed->sace_id != id ||
+        indexed->sace_expires <= now) {
+      *idx = (victim - sql_auth_cache->sacd_entries) + 1;
+      break;
+    }
+  }
+
+  sql_auth_cache_lock(F_UNLCK);
+  return 0;
+}
+
+static int sql_auth_cache_open(const char *path) {
+  int fd, shmid, xerrno;
+  key_t key;
+  struct sql_auth_cache_data *data;
+
+  PRIVS_ROOT
+  fd = open(path, O_RDWR|O_CREAT, 0600);
+  xerrno = errno;
+  PRIVS_RELINQUISH
+
+  if (fd < 0) {
+    errno = xerrno;
+    return -1;
+  }
+
+  /* Make sure that this fd is not one of the main three. */
+  (void) pr_fs_get_usable_fd2(&fd);
+
+  key = ftok(path, SQL_AUTH_CACHE_PROJ_ID);
+  if (key == (key_t) -1) {
+    xerrno = errno;
+
+    (void) close(fd);
+    errno = xerrno;
+    return -1;
+  }
+
+  /* Attach while root, so that the segment remains usable once privileges
+   * are dropped.
+   */
+  PRIVS_ROOT
+  shmid = shmget(key, sizeof(struct sql_auth_cache_data), IPC_CREAT|0600);
+  xerrno = errno;
+
+  if (shmid >= 0) {
+    data = shmat(shmid, NULL, 0);
+    xerrno = errno;
+
+  } else {
+    data = (void *) -1;
+  }
+  PRIVS_RELINQUISH
+
+  if (data == (void *) -1) {
+    (void) close(fd);
+    errno = xerrno;
+    return -1;
+  }
+
+  sql_auth_cache_fd = fd;
+
+  if (sql_auth_cache_lock(F_WRLCK) < 0) {
+    xerrno = errno;
+
+    (void) shmdt((void *) data);
+    (void) close(fd);
+    sql_auth_cache_fd = -1;
+    errno = xerrno;
+    return -1;
+  }
+
+  /* New segments are zero-filled. */
+  if (data->sacd_magic == 0) {
+    data->sacd_magic = SQL_AUTH_CACHE_MAGIC;
+    data->sacd_size = SQL_AUTH_CACHE_SIZE;
+    data->sacd_datasz = SQL_AUTH_CACHE_DATASZ;
+  }
+
+  if (data->sacd_magic != SQL_AUTH_CACHE_MAGIC ||
+      data->sacd_size != SQL_AUTH_CACHE_SIZE ||
+      data->sacd_datasz != SQL_AUTH_CACHE_DATASZ) {
+    sql_auth_cache_lock(F_UNLCK);
+
+    (void) shmdt((void *) data);
+    (void) close(fd);
+    sql_auth_cache_fd = -1;
+    errno = EINVAL;
+    return -1;
+  }
+
+  sql_auth_cache_lock(F_UNLCK);
+
+  sql_auth_cache = data;
+  return 0;
+}
+
+static void sql_auth_cache_close(void) {
+  if (sql_auth_cache != NULL) {
+    (void) shmdt((void *) sql_auth_cache);
+    sql_auth_cache = NULL;
+  }
+
+  if (sql_auth_cache_fd >= 0) {
+    (void) close(sql_auth_cache_fd);
+    sql_auth_cache_fd = -1;
+  }
+
+  sql_auth_cache_ttl = SQL_AUTH_CACHE_DEFAULT_TTL;
+  sql_auth_cache_src_id = 0;
+}
+
 cmd_rec *sql_make_cmd(pool *p, int argc, ...) {
   register int i = 0;
   pool *newpool = NULL;
@@ -536,6 +976,51 @@ static modret_t *sql_dispatch(cmd_rec *cmd, char *cmdname) {
   return PR_ERROR(cmd);
 }
 
+/* Returns TRUE if prepared statements are to be used with the current
+ * backend, i.e. if configured, and implemented by that backend.
+ */
+static int sql_have_prepared(void) {
+  register unsigned int i;
+
+  if (!(pr_sql_opts & SQL_OPT_USE_PREPARED_STATEMENTS)) {
+    return FALSE;
+  }
+
+  for (i = 0; sql_cmdtable[i].command; i++) {
+    if (strcmp(sql_cmdtable[i].command, "sql_execute") == 0) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/* Executes the given statement, with its '?' placeholders bound to the given
+ * parameters, via the backend's "sql_execute" handler.  The backend prepares
+ * each distinct statement once per connection.
+ */
+static modret_t *sql_dispatch_prepared(cmd_rec *cmd, const char *conn_name,
+    const char *stmt, array_header *params) {
+  register unsigned int i;
+  cmd_rec *exec_cmd;
+
+  exec_cmd = sql_make_cmd(cmd->tmp_pool, 2, conn_name, stmt);
+
+  exec_cmd->argv = pcalloc(exec_cmd->pool,
+    sizeof(void *) * (params->nelts + 3));
+  exec_cmd->argv[0] = (void *) conn_name;
+  exec_cmd->argv[1] = (void *) stmt;
+
+  for (i = 0; i < params->nelts; i++) {
+    exec_cmd->argv[i + 2] = ((char **) params->elts)[i];
+  }
+
+  exec_cmd->argc = params->nelts + 2;
+  exec_cmd->argv[exec_cmd->argc] = NULL;
+
+  return sql_dispatch(exec_cmd, "sql_execute");
+}
+
 static struct sql_backend *sql_get_backend(const char *backend) {
   struct sql_backend *sb;
 
@@ -735,6 +1220,15 @@ struct sql_resolved {
   /* Used for escaping the resolved values per the database rules. */
   const char *conn_name;
   int conn_flags;
+
+  /* When preparing a statement, the resolved values are collected here,
+   * rather than appended to the text, and are replaced there by placeholders.
+   */
+  array_header *params;
+  char *literal_start;
+  int in_literal;
+  int closing_quote;
+  int unbindable;
 };
 
 static int is_escaped_text(const char *text, size_t text_len) {
@@ -757,11 +1251,43 @@ static int is_escaped_text(const char *text, size_t text_len) {
   return TRUE;
 }
 
+/* A value can only be bound as a parameter if it makes up the whole of a
+ * quoted string literal in the statement, e.g. '%U'; that literal is then
+ * replaced by a placeholder.  Statements using values in other ways are
+ * sent as text.
+ */
+static int sql_resolved_append_param(pool *p, struct sql_resolved *resolved,
+    const char *text, size_t text_len) {
+
+  if (!resolved->in_literal ||
+      resolved->literal_start != resolved->buf - 1 ||
+      (text_len > 0 && is_escaped_text(text, text_len) == TRUE)) {
+    resolved->unbindable = TRUE;
+    errno = EPERM;
+    return -1;
+  }
+
+  /* Overwrite the opening quote with the placeholder; the closing quote
+   * will be skipped.
+   */
+  resolved->literal_start[0] = '?';
+  resolved->in_literal = FALSE;
+  resolved->closing_quote = TRUE;
+
+  *((char **) push_array(resolved->params)) = pstrndup(p,
+    text != NULL ? text : "", text_len);
+  return 0;
+}
+
 static int sql_resolved_append_text(pool *p, struct sql_resolved *resolved,
     const char *text, size_t text_len) {
   char *new_text;
   size_t new_textlen;
 
+  if (resolved->params != NULL) {
+    return sql_resolved_append_param(p, resolved, text, text_len);
+  }
+
   if (text == NULL ||
       text_len == 0) {
     return 0;
@@ -1083,20 +1609,59 @@ static int sql_resolve_on_other(pool *p, pr_jot_ctx_t *jot_ctx,
   struct sql_resolved *resolved;
 
   resolved = jot_ctx->log;
-  if (resolved->buflen > 0) {
-    pr_trace_msg(trace_channel, 19, "appending text '%.*s' (%lu) to buffer",
-      (int) text_len, text, (unsigned long) text_len);
-    memcpy(resolved->buf, text, text_len);
-    resolved->buf += text_len;
-    resolved->buflen -= text_len;
-  }
 
-  return 0;
-}
+  if (resolved->params != NULL) {
+    register unsigned int i;
 
-/* Default SQL password handlers (a.k.a. "AuthTypes") provided by mod_sql. */
+    if (resolved->closing_quote) {
+      if (text[0] != '\'') {
+        resolved->unbindable = TRUE;
+        errno = EPERM;
+        return -1;
+      }
 
-static modret_t *sql_auth_crypt(cmd_rec *cmd, const char *plaintext,
+      /* Skip the closing quote of the literal replaced by a placeholder. */
+      resolved->closing_quote = FALSE;
+      text++;
+      text_len--;
+    }
+
+    /* Track the quoted literals, for sql_resolved_append_param(). */
+    for (i = 0; i < text_len && i < resolved->buflen; i++) {
+      if (text[i] == '?') {
+        /* Literal placeholder characters would be ambiguous. */
+        resolved->unbindable = TRUE;
+        errno = EPERM;
+        return -1;
+      }
+
+      if (text[i] == '\'') {
+        resolved->in_literal = !resolved->in_literal;
+        if (resolved->in_literal) {
+          resolved->literal_start = resolved->buf + i;
+        }
+      }
+    }
+  }
+
+  if (resolved->buflen > 0) {
+    if (text_len > resolved->buflen) {
+      text_len = resolved->buflen;
+    }
+
+    pr_trace_msg(trace_channel, 19, "appending text '%.*s' (%lu) to buffer",
+      (int) text_len, text, (unsigned long) text_len);
+    memcpy(resolved->buf, text, text_len);
+    resolved->buf += text_len;
+    resolved->buflen -= text_len;
+  }
+
+  return 0;
+}
+
+/* Default SQL password handlers (a.k.a. "AuthTypes") provided by mod_sql. */
+
+static modret_t *sql_auth_crypt(cmd_rec *cmd, const char *plaintext,
     const char *ciphertext) {
   char *res = NULL;
 
@@ -1886,6 +2451,50 @@ static int sql_getgroupprimarykey(cmd_rec *cmd, const char *groupname) {
   return 0;
 }
 
+/* Maps the UID, GID and home directory columns of a user, as stored in the
+ * database, onto the values to use, applying the SQLDefaultUID/GID,
+ * SQLMinUserUID/GID and SQLDefaultHomedir of this vhost.
+ */
+static void sql_map_passwd(cmd_rec *cmd, const char *uidstr,
+    const char *gidstr, char *dirstr, uid_t *uid, gid_t *gid, char **dir) {
+
+  *uid = cmap.defaultuid;
+  if (uidstr != NULL &&
+      pr_str2uid(uidstr, uid) < 0) {
+    *uid = cmap.defaultuid;
+  }
+
+  *gid = cmap.defaultgid;
+  if (gidstr != NULL &&
+      pr_str2gid(gidstr, gid) < 0) {
+    *gid = cmap.defaultgid;
+  }
+
+  /* Use the SQLDefaultHomedir, if any, for empty home columns. */
+  *dir = cmap.defaulthomedir;
+  if (dirstr != NULL &&
+      strcmp(dirstr, "") != 0 &&
+      strcmp(dirstr, "NULL") != 0) {
+    *dir = dirstr;
+  }
+
+  if (*uid < cmap.minuseruid) {
+    sql_log(DEBUG_INFO, "user UID %s below SQLMinUserUID %s, using "
+      "SQLDefaultUID %s", pr_uid2str(cmd->tmp_pool, *uid),
+      pr_uid2str(cmd->tmp_pool, cmap.minuseruid),
+      pr_uid2str(cmd->tmp_pool, cmap.defaultuid));
+    *uid = cmap.defaultuid;
+  }
+
+  if (*gid < cmap.minusergid) {
+    sql_log(DEBUG_INFO, "user GID %s below SQLMinUserGID %s, using "
+      "SQLDefaultGID %s", pr_gid2str(cmd->tmp_pool, *gid),
+      pr_gid2str(cmd->tmp_pool, cmap.minusergid),
+      pr_gid2str(cmd->tmp_pool, cmap.defaultgid));
+    *gid = cmap.defaultgid;
+  }
+}
+
 static struct passwd *sql_getpasswd(cmd_rec *cmd, struct passwd *p) {
   sql_data_t *sd = NULL;
   modret_t *mr = NULL;
@@ -1898,6 +2507,7 @@ static struct passwd *sql_getpasswd(cmd_rec *cmd, struct passwd *p) {
   char *password = NULL;
   char *shell = NULL;
   char *dir = NULL;
+  char *uid_col = NULL, *gid_col = NULL, *dir_col = NULL;
   uid_t uid = 0;
   gid_t gid = 0;
 
@@ -1933,6 +2543,22 @@ static struct passwd *sql_getpasswd(cmd_rec *cmd, struct passwd *p) {
     return pwd;
   }
 
+  if (sql_auth_cache != NULL) {
+    struct sql_auth_cache_entry sace;
+    char **fields;
+
+    fields = sql_auth_cache_get(cmd->tmp_pool, SQL_AUTH_CACHE_PASSWD,
+      p->pw_name, (unsigned int) p->pw_uid, &sace);
+    if (fields != NULL &&
+        sace.sace_nfields == SQL_AUTH_CACHE_PASSWD_NFIELDS) {
+      sql_log(DEBUG_AUTH, "SQLAuthCache hit for user '%s'", fields[0]);
+
+      sql_map_passwd(cmd, fields[4], fields[5], fields[2], &uid, &gid, &dir);
+      return _sql_addpasswd(cmd, fields[0], fields[1], uid, gid, fields[3],
+        dir);
+    }
+  }
+
   if (p->pw_name != NULL) {
     realname = p->pw_name;
 
@@ -2080,41 +2706,16 @@ static struct passwd *sql_getpasswd(cmd_rec *cmd, struct passwd *p) {
   username = sd->data[i++];
   password = sd->data[i++];
   
-  uid = cmap.defaultuid;
   if (cmap.uidfield) {
-    if (sd->data[i]) {
-      if (pr_str2uid(sd->data[i++], &uid) < 0) {
-        uid = cmap.defaultuid;
-      }
-
-    } else {
-      i++;
-    }
+    uid_col = sd->data[i++];
   }
 
-  gid = cmap.defaultgid;
   if (cmap.gidfield) {
-    if (sd->data[i]) {
-      if (pr_str2gid(sd->data[i++], &gid) < 0) {
-        gid = cmap.defaultgid;
-      }
-
-    } else {
-      i++;
-    }
+    gid_col = sd->data[i++];
   }
 
-  dir = cmap.defaulthomedir;
   if (sd->data[i]) {
-    if (strcmp(sd->data[i], "") == 0 ||
-        strcmp(sd->data[i], "NULL") == 0) {
-
-      /* Leave dir pointing to the SQLDefaultHomedir, if any. */
-      i++;
-
-    } else {
-      dir = sd->data[i++];
-    }
+    dir_col = sd->data[i++];
   }
 
   if (cmap.shellfield) {
@@ -2135,22 +2736,31 @@ static struct passwd *sql_getpasswd(cmd_rec *cmd, struct passwd *p) {
     shell = NULL;
   }
 
-  if (uid < cmap.minuseruid) {
-    sql_log(DEBUG_INFO, "user UID %s below SQLMinUserUID %s, using "
-      "SQLDefaultUID %s", pr_uid2str(cmd->tmp_pool, uid),
-      pr_uid2str(cmd->tmp_pool, cmap.minuseruid),
-      pr_uid2str(cmd->tmp_pool, cmap.defaultuid));
-    uid = cmap.defaultuid;
-  }
+  /* Cache the columns as stored, since how they are mapped depends on the
+   * vhost.
+   */
+  if (sql_auth_cache != NULL) {
+    char *fields[SQL_AUTH_CACHE_PASSWD_NFIELDS];
+    uid_t raw_uid;
 
-  if (gid < cmap.minusergid) {
-    sql_log(DEBUG_INFO, "user GID %s below SQLMinUserGID %s, using "
-      "SQLDefaultGID %s", pr_gid2str(cmd->tmp_pool, gid),
-      pr_gid2str(cmd->tmp_pool, cmap.minusergid),
-      pr_gid2str(cmd->tmp_pool, cmap.defaultgid));
-    gid = cmap.defaultgid;
+    fields[0] = username;
+    fields[1] = password;
+    fields[2] = dir_col;
+    fields[3] = shell;
+    fields[4] = uid_col;
+    fields[5] = gid_col;
+
+    if (uid_col == NULL ||
+        pr_str2uid(uid_col, &raw_uid) < 0) {
+      raw_uid = (uid_t) SQL_AUTH_CACHE_NO_ID;
+    }
+
+    (void) sql_auth_cache_add(SQL_AUTH_CACHE_PASSWD, (unsigned int) raw_uid,
+      0, SQL_AUTH_CACHE_PASSWD_NFIELDS, fields);
   }
 
+  sql_map_passwd(cmd, uid_col, gid_col, dir_col, &uid, &gid, &dir);
+
   return _sql_addpasswd(cmd, username, password, uid, gid, shell, dir);
 }
 
@@ -2255,6 +2865,24 @@ static struct group *sql_getgroup(cmd_rec *cmd, struct group *g) {
     return grp;
   }
 
+  if (sql_auth_cache != NULL) {
+    struct sql_auth_cache_entry sace;
+    char **fields;
+
+    fields = sql_auth_cache_get(cmd->tmp_pool, SQL_AUTH_CACHE_GROUP,
+      g->gr_name, (unsigned int) g->gr_gid, &sace);
+    if (fields != NULL) {
+      sql_log(DEBUG_AUTH, "SQLAuthCache hit for group '%s'", fields[0]);
+
+      ah = make_array(cmd->tmp_pool, sace.sace_nfields, sizeof(char *));
+      for (cnt = 1; cnt < (int) sace.sace_nfields; cnt++) {
+        *((char **) push_array(ah)) = fields[cnt];
+      }
+
+      return _sql_addgroup(cmd, fields[0], (gid_t) sace.sace_id, ah);
+    }
+  }
+
   if (g->gr_name != NULL) {
     groupname = g->gr_name;
     sql_log(DEBUG_WARN, "cache miss for group '%s'", groupname);
@@ -2408,6 +3036,19 @@ static struct group *sql_getgroup(cmd_rec *cmd, struct group *g) {
     }      
   }
   
+  if (sql_auth_cache != NULL) {
+    char **fields;
+
+    fields = pcalloc(cmd->tmp_pool, sizeof(char *) * (ah->nelts + 1));
+    fields[0] = groupname;
+    for (cnt = 0; cnt < (int) ah->nelts; cnt++) {
+      fields[cnt + 1] = ((char **) ah->elts)[cnt];
+    }
+
+    (void) sql_auth_cache_add(SQL_AUTH_CACHE_GROUP, (unsigned int) gid, 0,
+      ah->nelts + 1, fields);
+  }
+
   return _sql_addgroup(cmd, groupname, gid, ah);
 }
 
@@ -2613,165 +3254,828 @@ static int sql_getgroups(cmd_rec *cmd) {
     res = groups->nelts;
   }
 
-  cmd->argc = argc;
-  return res;
-}
+  cmd->argc = argc;
+  return res;
+}
+
+/* Command handlers
+ */
+
+MODRET sql_pre_dele(cmd_rec *cmd) {
+  char *path;
+
+  if (cmap.engine == 0) {
+    return PR_DECLINED(cmd);
+  }
+
+  sql_dele_filesz = 0;
+
+  path = dir_canonical_path(cmd->tmp_pool,
+    pr_fs_decode_path(cmd->tmp_pool, cmd->arg));
+  if (path) {
+    struct stat st;
+
+    /* Briefly cache the size of the file being deleted, so that it can be
+     * logged properly using %b.
+     */
+    pr_fs_clear_cache2(path);
+    if (pr_fsio_stat(path, &st) < 0) {
+      sql_log(DEBUG_INFO, "%s: unable to stat '%s': %s", (char *) cmd->argv[0],
+        path, strerror(errno));
+    
+    } else {
+      sql_dele_filesz = st.st_size;
+    }
+  }
+
+  return PR_DECLINED(cmd);
+}
+
+MODRET sql_pre_pass(cmd_rec *cmd) {
+  config_rec *c = NULL;
+  const char *user = NULL;
+
+  if (cmap.engine == 0) {
+    return PR_DECLINED(cmd);
+  }
+
+  sql_log(DEBUG_FUNC, "%s", ">>> sql_pre_pass");
+
+  user = pr_table_get(session.notes, "mod_auth.orig-user", NULL);
+  if (user != NULL) {
+    config_rec *anon_config;
+
+    /* Use the looked-up user name to determine whether this is to be
+     * an anonymous session.
+     */
+    anon_config = pr_auth_get_anon_config(cmd->pool, &user, NULL, NULL);
+
+    c = find_config(anon_config ? anon_config->subset : main_server->conf,
+      CONF_PARAM, "SQLEngine", FALSE);
+    if (c != NULL) {
+      cmap.engine = *((int *) c->argv[0]);
+    }
+
+  } else {
+    /* Just assume the vhost config. */
+    c = find_config(main_server->conf, CONF_PARAM, "SQLEngine", FALSE);
+    if (c != NULL) {
+      cmap.engine = *((int *) c->argv[0]);
+    }
+  }
+
+  sql_log(DEBUG_FUNC, "%s", "<<< sql_pre_pass");
+  return PR_DECLINED(cmd);
+}
+
+MODRET sql_post_pass(cmd_rec *cmd) {
+  int res;
+
+  if (cmap.engine == 0) {
+    return PR_DECLINED(cmd);
+  }
+
+  res = sql_getuserprimarykey(cmd, session.user);
+  if (res < 0) {
+    pr_trace_msg(trace_channel, 9,
+      "error getting primary lookup key for user '%s': %s", session.user,
+      strerror(errno));
+  }
+
+  res = sql_getgroupprimarykey(cmd, session.group);
+  if (res < 0) {
+    pr_trace_msg(trace_channel, 9,
+      "error getting primary lookup key for group '%s': %s", session.group,
+      strerror(errno));
+  }
+
+  return PR_DECLINED(cmd);
+}
+
+MODRET sql_post_stor(cmd_rec *cmd) {
+  if (cmap.engine == 0) {
+    return PR_DECLINED(cmd);
+  }
+
+  sql_log(DEBUG_FUNC, "%s", ">>> sql_post_stor");
+
+  if (cmap.sql_fstor)
+    _setstats(cmd, 1, 0, session.xfer.total_bytes, 0);
+
+  sql_log(DEBUG_FUNC, "%s", "<<< sql_post_stor");
+  return PR_DECLINED(cmd);
+}
+
+MODRET sql_post_retr(cmd_rec *cmd) {
+  if (cmap.engine == 0) {
+    return PR_DECLINED(cmd);
+  }
+
+  sql_log(DEBUG_FUNC, "%s", ">>> sql_post_retr");
+
+  if (cmap.sql_fretr)
+    _setstats(cmd, 0, 1, 0, session.xfer.total_bytes);
+
+  sql_log(DEBUG_FUNC, "%s", "<<< sql_post_retr");
+  return PR_DECLINED(cmd);
+}
+
+static int resolve_numeric_val(cmd_rec *cmd, const char *val) {
+  int idx = -1;
+  char *ptr = NULL;
+
+  idx = strtol(val, &ptr, 10);
+  if (*ptr != '\0') {
+    return -1;
+  }
+
+  if (idx < 0) {
+    return -1;
+  }
+
+  if ((cmd->argc - 3) < (unsigned int) idx) {
+    return -1;
+  }
+
+  return idx;
+}
+
+static char *named_query_type(cmd_rec *cmd, char *name) {
+  config_rec *c = NULL;
+  char *query = NULL;
+
+  query = pstrcat(cmd->tmp_pool, "SQLNamedQuery_", name, NULL);
+  c = find_config(main_server->conf, CONF_PARAM, query, FALSE);
+  if (c != NULL) {
+    return c->argv[0];
+  }
+
+  sql_log(DEBUG_FUNC, "no '%s' SQLNamedQuery found", name);
+  errno = ENOENT;
+  return NULL;
+}
+
+/* Asynchronous SQLLog queue.
+ *
+ * When SQLLogQueue is configured, each session forks a writer process
+ * which owns the SQLLog database work.  The session resolves each SQLLog
+ * statement as usual, then hands it to the writer as a single datagram over
+ * a socketpair; the socket's send buffer is the bounded queue.  The writer
+ * executes whatever has accumulated, turning runs of INSERTs into the same
+ * table into multi-row INSERTs.  Rows which cannot be written because the
+ * database is unreachable are appended to the optional SQLLogJournal, and
+ * replayed once it is reachable again.
+ */
+
+#ifndef SQL_LOG_QUEUE_BATCH_SIZE
+# define SQL_LOG_QUEUE_BATCH_SIZE	64
+#endif /* SQL_LOG_QUEUE_BATCH_SIZE */
+
+#define SQL_LOG_QUEUE_DEFAULT_SIZE	(128 * 1024)
+
+/* Largest message handed to the writer; larger statements are executed
+ * synchronously.
+ */
+#define SQL_LOG_QUEUE_MAX_MSG_LEN	(SQL_MAX_STMT_LEN * 2)
+
+#define SQL_LOG_QUEUE_POLICY_DROP	1
+#define SQL_LOG_QUEUE_POLICY_BLOCK	2
+
+/* Seconds to wait, after finding the database unreachable, before trying
+ * it again.
+ */
+#define SQL_LOG_JOURNAL_RETRY_INTERVAL	10
+
+static int sql_log_queue_fd = -1;
+static pid_t sql_log_queue_pid = 0;
+static int sql_log_queue_policy = 0;
+static int sql_log_queue_size = 0;
+static unsigned long sql_log_queue_ndropped = 0;
+
+/* Writer process state. */
+static int sql_log_journal_fd = -1;
+static time_t sql_log_writer_retry = 0;
+
+struct sql_log_row {
+  char type;
+  const char *conn_name;
+  const char *table;
+  const char *text;
+
+  /* The message, as received from the session. */
+  const char *msg;
+  size_t msglen;
+};
+
+static int sql_log_queue_send(pool *p, char type, const char *conn_name,
+    const char *table, const char *text) {
+  char *msg;
+  size_t conn_namelen, tablelen, textlen, msglen;
+  int flags = 0, res, xerrno;
+
+  conn_namelen = strlen(conn_name) + 1;
+  tablelen = strlen(table) + 1;
+  textlen = strlen(text) + 1;
+
+  msglen = 1 + conn_namelen + tablelen + textlen;
+  if (msglen > SQL_LOG_QUEUE_MAX_MSG_LEN) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  msg = palloc(p, msglen);
+  msg[0] = type;
+  memcpy(msg + 1, conn_name, conn_namelen);
+  memcpy(msg + 1 + conn_namelen, table, tablelen);
+  memcpy(msg + 1 + conn_namelen + tablelen, text, textlen);
+
+  if (sql_log_queue_policy == SQL_LOG_QUEUE_POLICY_DROP) {
+    flags |= MSG_DONTWAIT;
+  }
+
+#if defined(MSG_NOSIGNAL)
+  flags |= MSG_NOSIGNAL;
+#endif /* MSG_NOSIGNAL */
+
+  res = send(sql_log_queue_fd, msg, msglen, flags);
+  while (res < 0) {
+    xerrno = errno;
+
+    if (xerrno == EINTR) {
+      pr_signals_handle();
+      res = send(sql_log_queue_fd, msg, msglen, flags);
+      continue;
+    }
+
+    if (xerrno == EAGAIN ||
+        xerrno == EWOULDBLOCK ||
+        xerrno == ENOBUFS) {
+      /* The queue is full. */
+      sql_log_queue_ndropped++;
+      sql_log(DEBUG_WARN, "SQLLogQueue full, dropping statement "
+        "(%lu dropped so far)", sql_log_queue_ndropped);
+      return 0;
+    }
+
+    sql_log(DEBUG_WARN, "error queueing statement for SQLLog writer: %s",
+      strerror(xerrno));
+    errno = xerrno;
+    return -1;
+  }
+
+  return 0;
+}
+
+static int sql_log_row_parse(char *msg, size_t msglen,
+    struct sql_log_row *row) {
+  char *ptr, *end;
+
+  /* The type, then three NUL-terminated strings. */
+  if (msglen < 4 ||
+      msg[msglen-1] != '\0') {
+    errno = EINVAL;
+    return -1;
+  }
+
+  end = msg + msglen;
+
+  row->type = msg[0];
+  row->conn_name = ptr = msg + 1;
+
+  ptr += strlen(ptr) + 1;
+  if (ptr >= end) {
+    errno = EINVAL;
+    return -1;
+  }
+  row->table = ptr;
+
+  ptr += strlen(ptr) + 1;
+  if (ptr >= end) {
+    errno = EINVAL;
+    return -1;
+  }
+  row->text = ptr;
+
+  row->msg = msg;
+  row->msglen = msglen;
+  return 0;
+}
+
+static int sql_log_journal_append(struct sql_log_row *rows,
+    unsigned int nrows) {
+  register unsigned int i;
+  struct flock lock;
+  int res = 0;
+
+  if (sql_log_journal_fd < 0) {
+    sql_log(DEBUG_WARN, "database unavailable, dropping %u SQLLog %s", nrows,
+      nrows != 1 ? "statements" : "statement");
+    return 0;
+  }
+
+  lock.l_type = F_WRLCK;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = 0;
+  lock.l_len = 0;
+
+  while (fcntl(sql_log_journal_fd, F_SETLKW, &lock) < 0) {
+    if (errno == EINTR) {
+      pr_signals_handle();
+      continue;
+    }
+
+    return -1;
+  }
+
+  for (i = 0; i < nrows; i++) {
+    uint32_t len;
+
+    len = rows[i].msglen;
+    if (write(sql_log_journal_fd, &len, sizeof(len)) != sizeof(len) ||
+        write(sql_log_journal_fd, rows[i].msg, rows[i].msglen) !=
+          (ssize_t) rows[i].msglen) {
+      sql_log(DEBUG_WARN, "error writing to SQLLogJournal: %s",
+        strerror(errno));
+      res = -1;
+      break;
+    }
+  }
+
+  lock.l_type = F_UNLCK;
+  (void) fcntl(sql_log_journal_fd, F_SETLK, &lock);
+
+  if (res == 0) {
+    sql_log(DEBUG_INFO, "database unavailable, journalled %u SQLLog %s",
+      nrows, nrows != 1 ? "statements" : "statement");
+  }
+
+  return res;
+}
+
+/* Executes the given rows, all of the same type, connection, and table, as
+ * one statement.
+ */
+static modret_t *sql_log_writer_exec(pool *p, struct sql_log_row *rows,
+    unsigned int nrows) {
+  register unsigned int i;
+  modret_t *mr;
+  char *query;
+
+  set_named_conn_backend(rows[0].conn_name);
+
+  switch (rows[0].type) {
+    case 'I':
+      query = pstrcat(p, "INTO ", rows[0].table, " VALUES (", rows[0].text,
+        ")", NULL);
+      for (i = 1; i < nrows; i++) {
+        query = pstrcat(p, query, ", (", rows[i].text, ")", NULL);
+      }
+
+      mr = sql_dispatch(sql_make_cmd(p, 2, rows[0].conn_name, query),
+        "sql_insert");
+      break;
+
+    case 'U':
+      mr = sql_dispatch(sql_make_cmd(p, 2, rows[0].conn_name, rows[0].text),
+        "sql_update");
+      break;
+
+    default:
+      mr = sql_dispatch(sql_make_cmd(p, 2, rows[0].conn_name, rows[0].text),
+        "sql_query");
+      break;
+  }
+
+  set_named_conn_backend(NULL);
+  return mr;
+}
+
+/* Returns TRUE if the database for the given connection can be reached. */
+static int sql_log_writer_probe(pool *p, const char *conn_name) {
+  modret_t *mr;
+
+  set_named_conn_backend(conn_name);
+  mr = sql_dispatch(sql_make_cmd(p, 2, conn_name, "1"), "sql_select");
+  set_named_conn_backend(NULL);
+
+  return MODRET_ISERROR(mr) ? FALSE : TRUE;
+}
+
+/* Writes the given rows, coalescing consecutive INSERTs into the same table.
+ * Returns the number of rows handled; any rows not handled were found to
+ * be unwritable, for the database is unreachable.
+ */
+static unsigned int sql_log_writer_write(pool *p, struct sql_log_row *rows,
+    unsigned int nrows) {
+  unsigned int i = 0;
+
+  while (i < nrows) {
+    unsigned int n = 1;
+    modret_t *mr;
+
+    if (rows[i].type == 'I') {
+      while (i + n < nrows &&
+             n < SQL_LOG_QUEUE_BATCH_SIZE &&
+             rows[i + n].type == 'I' &&
+             strcmp(rows[i + n].conn_name, rows[i].conn_name) == 0 &&
+             strcmp(rows[i + n].table, rows[i].table) == 0) {
+        n++;
+      }
+    }
+
+    mr = sql_log_writer_exec(p, &(rows[i]), n);
+    if (MODRET_ISERROR(mr)) {
+      register unsigned int j;
+
+      if (sql_log_writer_probe(p, rows[i].conn_name) == FALSE) {
+        return i;
+      }
+
+      /* The database is there; it is the statement which failed.  Find
+       * which of the batched rows are to blame, and drop them.
+       */
+      sql_log(DEBUG_WARN, "error executing SQLLog statement: %s",
+        mr->mr_message);
+
+      for (j = 0; n > 1 && j < n; j++) {
+        mr = sql_log_writer_exec(p, &(rows[i + j]), 1);
+        if (MODRET_ISERROR(mr)) {
+          sql_log(DEBUG_WARN, "dropping SQLLog statement: %s",
+            mr->mr_message);
+        }
+      }
+    }
+
+    i += n;
+  }
+
+  return nrows;
+}
+
+/* Writes the journalled rows, in order.  Returns -1, with errno set to
+ * EAGAIN, if it stopped for the database being unreachable; the rows not
+ * yet written are then left in the journal.
+ */
+static int sql_log_journal_replay(pool *p) {
+  struct flock lock;
+  struct stat st;
+  char *buf = NULL;
+  off_t buflen = 0, offset = 0;
+  array_header *rows;
+  int outage = FALSE;
+
+  if (sql_log_journal_fd < 0) {
+    return 0;
+  }
+
+  lock.l_type = F_WRLCK;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = 0;
+  lock.l_len = 0;
+
+  while (fcntl(sql_log_journal_fd, F_SETLKW, &lock) < 0) {
+    if (errno == EINTR) {
+      pr_signals_handle();
+      continue;
+    }
+
+    return 0;
+  }
+
+  if (fstat(sql_log_journal_fd, &st) == 0 &&
+      st.st_size > 0) {
+    buflen = st.st_size;
+    buf = palloc(p, buflen);
+
+    if (pread(sql_log_journal_fd, buf, buflen, 0) != (ssize_t) buflen) {
+      sql_log(DEBUG_WARN, "error reading SQLLogJournal: %s", strerror(errno));
+      buflen = 0;
+    }
+  }
+
+  rows = make_array(p, SQL_LOG_QUEUE_BATCH_SIZE, sizeof(struct sql_log_row));
+
+  while (offset < buflen &&
+         outage == FALSE) {
+    off_t batch_offset = offset;
+    unsigned int nwritten;
+
+    rows->nelts = 0;
+
+    while (offset + (off_t) sizeof(uint32_t) <= buflen &&
+           rows->nelts < SQL_LOG_QUEUE_BATCH_SIZE) {
+      uint32_t len;
+      struct sql_log_row *row;
+
+      memcpy(&len, buf + offset, sizeof(len));
+      if (offset + (off_t) sizeof(len) + len > buflen) {
+        /* A truncated record, e.g. from a writer which died mid-append. */
+        offset = buflen;
+        break;
+      }
+
+      row = push_array(rows);
+      if (sql_log_row_parse(buf + offset + sizeof(len), len, row) < 0) {
+        sql_log(DEBUG_WARN, "skipping malformed SQLLogJournal record");
+        rows->nelts--;
+      }
+
+      offset += sizeof(len) + len;
+    }
+
+    nwritten = sql_log_writer_write(p, rows->elts, rows->nelts);
+    if (nwritten < rows->nelts) {
+      register unsigned int i;
+
+      /* Resume with the first unwritten row next time. */
+      outage = TRUE;
+      offset = batch_offset;
+      for (i = 0; i < nwritten; i++) {
+        offset += sizeof(uint32_t) +
+          ((struct sql_log_row *) rows->elts)[i].msglen;
+      }
+    }
+  }
+
+  if (buflen > 0) {
+    /* Keep only the records not yet written. */
+    if (ftruncate(sql_log_journal_fd, 0) == 0 &&
+        offset < buflen) {
+      if (write(sql_log_journal_fd, buf + offset, buflen - offset) !=
+          (ssize_t) (buflen - offset)) {
+        sql_log(DEBUG_WARN, "error rewriting SQLLogJournal: %s",
+          strerror(errno));
+      }
+    }
+
+    sql_log(DEBUG_INFO, "replayed %lu of %lu bytes of SQLLogJournal",
+      (unsigned long) offset, (unsigned long) buflen);
+  }
+
+  lock.l_type = F_UNLCK;
+  (void) fcntl(sql_log_journal_fd, F_SETLK, &lock);
+
+  if (outage) {
+    sql_log_writer_retry = time(NULL) + SQL_LOG_JOURNAL_RETRY_INTERVAL;
+    errno = EAGAIN;
+    return -1;
+  }
+
+  return 0;
+}
+
+static void sql_log_writer_handle(pool *p, struct sql_log_row *rows,
+    unsigned int nrows) {
+  unsigned int nwritten = 0;
+
+  if (time(NULL) >= sql_log_writer_retry) {
+    sql_log_writer_retry = 0;
+
+    /* Catch up on anything journalled first, so that rows reach the
+     * database in the order in which they were logged; if the database is
+     * still unreachable, these rows go into the journal after them.
+     */
+    if (sql_log_journal_replay(p) == 0) {
+      nwritten = sql_log_writer_write(p, rows, nrows);
+      if (nwritten == nrows) {
+        return;
+      }
+
+      sql_log_writer_retry = time(NULL) + SQL_LOG_JOURNAL_RETRY_INTERVAL;
+    }
+  }
+
+  (void) sql_log_journal_append(rows + nwritten, nrows - nwritten);
+}
+
+static void sql_log_writer_loop(pid_t parent_pid) {
+  char *buf;
+  int done = FALSE;
+
+  buf = palloc(session.pool, SQL_LOG_QUEUE_MAX_MSG_LEN);
+
+  /* Catch up on anything journalled by earlier sessions. */
+  if (sql_log_journal_fd >= 0) {
+    pool *tmp_pool;
+
+    tmp_pool = make_sub_pool(session.pool);
+    (void) sql_log_journal_replay(tmp_pool);
+    destroy_pool(tmp_pool);
+  }
+
+  while (done == FALSE) {
+    fd_set rfds;
+    struct timeval tv;
+    pool *tmp_pool;
+    array_header *rows;
+    int res;
 
-/* Command handlers
- */
+    FD_ZERO(&rfds);
+    FD_SET(sql_log_queue_fd, &rfds);
 
-MODRET sql_pre_dele(cmd_rec *cmd) {
-  char *path;
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
 
-  if (cmap.engine == 0) {
-    return PR_DECLINED(cmd);
-  }
+    res = select(sql_log_queue_fd + 1, &rfds, NULL, NULL, &tv);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
 
-  sql_dele_filesz = 0;
+      break;
+    }
 
-  path = dir_canonical_path(cmd->tmp_pool,
-    pr_fs_decode_path(cmd->tmp_pool, cmd->arg));
-  if (path) {
-    struct stat st;
+    tmp_pool = make_sub_pool(session.pool);
 
-    /* Briefly cache the size of the file being deleted, so that it can be
-     * logged properly using %b.
-     */
-    pr_fs_clear_cache2(path);
-    if (pr_fsio_stat(path, &st) < 0) {
-      sql_log(DEBUG_INFO, "%s: unable to stat '%s': %s", (char *) cmd->argv[0],
-        path, strerror(errno));
-    
-    } else {
-      sql_dele_filesz = st.st_size;
+    if (res == 0) {
+      /* Nothing queued.  If the session has gone away, so do we. */
+      if (getppid() != parent_pid) {
+        done = TRUE;
+
+      } else if (sql_log_writer_retry > 0 &&
+                 time(NULL) >= sql_log_writer_retry) {
+        sql_log_writer_retry = 0;
+        (void) sql_log_journal_replay(tmp_pool);
+      }
+
+      destroy_pool(tmp_pool);
+      continue;
     }
-  }
 
-  return PR_DECLINED(cmd);
-}
+    rows = make_array(tmp_pool, SQL_LOG_QUEUE_BATCH_SIZE,
+      sizeof(struct sql_log_row));
 
-MODRET sql_pre_pass(cmd_rec *cmd) {
-  config_rec *c = NULL;
-  const char *user = NULL;
+    /* Take everything queued so far, up to a bound. */
+    while (rows->nelts < (SQL_LOG_QUEUE_BATCH_SIZE * 4)) {
+      ssize_t len;
+      char *msg;
+      struct sql_log_row *row;
 
-  if (cmap.engine == 0) {
-    return PR_DECLINED(cmd);
-  }
+      len = recv(sql_log_queue_fd, buf, SQL_LOG_QUEUE_MAX_MSG_LEN,
+        MSG_DONTWAIT);
+      if (len < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
 
-  sql_log(DEBUG_FUNC, "%s", ">>> sql_pre_pass");
+        if (errno != EAGAIN &&
+            errno != EWOULDBLOCK) {
+          done = TRUE;
+        }
 
-  user = pr_table_get(session.notes, "mod_auth.orig-user", NULL);
-  if (user != NULL) {
-    config_rec *anon_config;
+        break;
+      }
 
-    /* Use the looked-up user name to determine whether this is to be
-     * an anonymous session.
-     */
-    anon_config = pr_auth_get_anon_config(cmd->pool, &user, NULL, NULL);
+      if (len == 0) {
+        /* The session is finished with us. */
+        done = TRUE;
+        break;
+      }
 
-    c = find_config(anon_config ? anon_config->subset : main_server->conf,
-      CONF_PARAM, "SQLEngine", FALSE);
-    if (c != NULL) {
-      cmap.engine = *((int *) c->argv[0]);
+      msg = palloc(tmp_pool, len);
+      memcpy(msg, buf, len);
+
+      row = push_array(rows);
+      if (sql_log_row_parse(msg, len, row) < 0) {
+        sql_log(DEBUG_WARN, "ignoring malformed SQLLog queue message");
+        rows->nelts--;
+      }
     }
 
-  } else {
-    /* Just assume the vhost config. */
-    c = find_config(main_server->conf, CONF_PARAM, "SQLEngine", FALSE);
-    if (c != NULL) {
-      cmap.engine = *((int *) c->argv[0]);
+    if (rows->nelts > 0) {
+      sql_log_writer_handle(tmp_pool, rows->elts, rows->nelts);
     }
-  }
 
-  sql_log(DEBUG_FUNC, "%s", "<<< sql_pre_pass");
-  return PR_DECLINED(cmd);
+    destroy_pool(tmp_pool);
+  }
 }
 
-MODRET sql_post_pass(cmd_rec *cmd) {
-  int res;
+static int sql_log_queue_open(int policy, int size, const char *journal) {
+  int fds[2], sndbufsz, xerrno;
+  socklen_t optlen;
+  pid_t pid, parent_pid;
 
-  if (cmap.engine == 0) {
-    return PR_DECLINED(cmd);
+  if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) < 0) {
+    return -1;
   }
 
-  res = sql_getuserprimarykey(cmd, session.user);
-  if (res < 0) {
-    pr_trace_msg(trace_channel, 9,
-      "error getting primary lookup key for user '%s': %s", session.user,
+  if (setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) < 0) {
+    sql_log(DEBUG_INFO, "error setting SQLLogQueue size %d: %s", size,
       strerror(errno));
   }
 
-  res = sql_getgroupprimarykey(cmd, session.group);
-  if (res < 0) {
-    pr_trace_msg(trace_channel, 9,
-      "error getting primary lookup key for group '%s': %s", session.group,
-      strerror(errno));
+  /* The kernel silently caps the send buffer size (at net.core.wmem_max,
+   * on Linux), so find out what size we actually got.
+   */
+  optlen = sizeof(sndbufsz);
+  if (getsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbufsz, &optlen) == 0) {
+#ifdef LINUX
+    /* Linux reports twice the size set, to allow for its own overhead. */
+    sndbufsz /= 2;
+#endif /* LINUX */
+
+    if (sndbufsz < size) {
+      pr_log_pri(PR_LOG_NOTICE, MOD_SQL_VERSION
+        ": SQLLogQueue size %d bytes exceeds the system limit, using %d bytes",
+        size, sndbufsz);
+      sql_log(DEBUG_WARN,
+        "SQLLogQueue size %d bytes exceeds the system limit, using %d bytes",
+        size, sndbufsz);
+      size = sndbufsz;
+    }
   }
 
-  return PR_DECLINED(cmd);
-}
+  parent_pid = getpid();
 
-MODRET sql_post_stor(cmd_rec *cmd) {
-  if (cmap.engine == 0) {
-    return PR_DECLINED(cmd);
-  }
+  pid = fork();
+  if (pid < 0) {
+    xerrno = errno;
 
-  sql_log(DEBUG_FUNC, "%s", ">>> sql_post_stor");
+    (void) close(fds[0]);
+    (void) close(fds[1]);
 
-  if (cmap.sql_fstor)
-    _setstats(cmd, 1, 0, session.xfer.total_bytes, 0);
+    errno = xerrno;
+    return -1;
+  }
 
-  sql_log(DEBUG_FUNC, "%s", "<<< sql_post_stor");
-  return PR_DECLINED(cmd);
-}
+  if (pid > 0) {
+    /* We're the session. */
+    (void) close(fds[1]);
 
-MODRET sql_post_retr(cmd_rec *cmd) {
-  if (cmap.engine == 0) {
-    return PR_DECLINED(cmd);
+    sql_log_queue_fd = fds[0];
+    sql_log_queue_pid = pid;
+    sql_log_queue_policy = policy;
+    sql_log_queue_size = size;
+    sql_log_queue_ndropped = 0;
+    return 0;
   }
 
-  sql_log(DEBUG_FUNC, "%s", ">>> sql_post_retr");
+  /* We're the writer. */
+  session.pid = getpid();
+  (void) close(fds[0]);
+  sql_log_queue_fd = fds[1];
 
-  if (cmap.sql_fretr)
-    _setstats(cmd, 0, 1, 0, session.xfer.total_bytes);
+  /* We have nothing to say to the client. */
+  if (session.c != NULL) {
+    (void) close(session.c->rfd);
+    if (session.c->wfd != session.c->rfd) {
+      (void) close(session.c->wfd);
+    }
+  }
 
-  sql_log(DEBUG_FUNC, "%s", "<<< sql_post_retr");
-  return PR_DECLINED(cmd);
-}
+  /* We are done when the session tells us so, or goes away; until then,
+   * nothing that the session would react to concerns us.
+   */
+  (void) signal(SIGALRM, SIG_IGN);
+  (void) signal(SIGHUP, SIG_IGN);
+  (void) signal(SIGINT, SIG_IGN);
+  (void) signal(SIGTERM, SIG_IGN);
+  (void) signal(SIGUSR1, SIG_IGN);
+  (void) signal(SIGUSR2, SIG_IGN);
 
-static int resolve_numeric_val(cmd_rec *cmd, const char *val) {
-  int idx = -1;
-  char *ptr = NULL;
+  pr_event_unregister(NULL, NULL, NULL);
+  pr_timer_remove(-1, ANY_MODULE);
 
-  idx = strtol(val, &ptr, 10);
-  if (*ptr != '\0') {
-    return -1;
-  }
+  pr_proctitle_set("(SQLLog writer)");
 
-  if (idx < 0) {
-    return -1;
-  }
+  if (journal != NULL) {
+    PRIVS_ROOT
+    sql_log_journal_fd = open(journal, O_RDWR|O_CREAT|O_APPEND, 0600);
+    xerrno = errno;
+    PRIVS_RELINQUISH
 
-  if ((cmd->argc - 3) < (unsigned int) idx) {
-    return -1;
+    if (sql_log_journal_fd < 0) {
+      sql_log(DEBUG_WARN, "unable to open SQLLogJournal '%s': %s", journal,
+        strerror(xerrno));
+    }
   }
 
-  return idx;
+  sql_log(DEBUG_INFO, "SQLLog writer started");
+  sql_log_writer_loop(parent_pid);
+
+  (void) sql_dispatch(sql_make_cmd(session.pool, 0), "sql_exit");
+  sql_log(DEBUG_INFO, "SQLLog writer exiting");
+  exit(0);
 }
 
-static char *named_query_type(cmd_rec *cmd, char *name) {
-  config_rec *c = NULL;
-  char *query = NULL;
+static void sql_log_queue_close(void) {
+  if (sql_log_queue_fd < 0) {
+    return;
+  }
 
-  query = pstrcat(cmd->tmp_pool, "SQLNamedQuery_", name, NULL);
-  c = find_config(main_server->conf, CONF_PARAM, query, FALSE);
-  if (c != NULL) {
-    return c->argv[0];
+  /* An empty message tells the writer to finish up. */
+  (void) send(sql_log_queue_fd, "", 0, MSG_DONTWAIT);
+  (void) close(sql_log_queue_fd);
+  sql_log_queue_fd = -1;
+
+  if (sql_log_queue_ndropped > 0) {
+    sql_log(DEBUG_INFO, "SQLLogQueue dropped %lu %s", sql_log_queue_ndropped,
+      sql_log_queue_ndropped != 1 ? "statements" : "statement");
   }
 
-  sql_log(DEBUG_FUNC, "no '%s' SQLNamedQuery found", name);
-  errno = ENOENT;
-  return NULL;
+  /* Reap the writer, if it has already finished. */
+  (void) waitpid(sql_log_queue_pid, NULL, WNOHANG);
+  sql_log_queue_pid = 0;
 }
 
 static modret_t *process_named_query(cmd_rec *cmd, char *name, int flags) {
@@ -2811,8 +4115,34 @@ static modret_t *process_named_query(cmd_rec *cmd, char *name, int flags) {
   jot_ctx->log = resolved;
   jot_ctx->user_data = cmd;
 
+  /* Queued statements are handed to the SQLLog writer as text. */
+  if (!(flags & SQL_LOG_FL_QUEUE) &&
+      sql_have_prepared()) {
+    resolved->params = make_array(tmp_pool, 4, sizeof(char *));
+  }
+
   res = pr_jot_resolve_logfmt(tmp_pool, cmd, NULL, c->argv[1], jot_ctx,
     sql_resolve_on_meta, sql_resolve_on_default, sql_resolve_on_other);
+
+  if (resolved->params != NULL &&
+      (resolved->unbindable ||
+       resolved->closing_quote)) {
+    /* The values cannot all be bound as parameters; use the statement text
+     * instead.
+     */
+    pr_trace_msg(trace_channel, 17, "unable to bind values of SQLNamedQuery "
+      "'%s' as parameters, sending statement as text", name);
+
+    memset(resolved, 0, sizeof(struct sql_resolved));
+    resolved->bufsz = resolved->buflen = sizeof(stmt)-1;
+    resolved->ptr = resolved->buf = stmt;
+    resolved->conn_name = conn_name;
+    resolved->conn_flags = flags;
+
+    res = pr_jot_resolve_logfmt(tmp_pool, cmd, NULL, c->argv[1], jot_ctx,
+      sql_resolve_on_meta, sql_resolve_on_default, sql_resolve_on_other);
+  }
+
   if (res < 0) {
     int xerrno = errno;
 
@@ -2830,25 +4160,78 @@ static modret_t *process_named_query(cmd_rec *cmd, char *name, int flags) {
   stmt_len = resolved->bufsz - resolved->buflen;
   stmt[stmt_len] = '\0';
 
+  if ((flags & SQL_LOG_FL_QUEUE) &&
+      sql_log_queue_fd >= 0) {
+    char type = 0;
+    const char *table = "", *text = stmt;
+
+    if (strcasecmp(c->argv[0], SQL_UPDATE_C) == 0) {
+      type = 'U';
+      text = pstrcat(tmp_pool, c->argv[2], " SET ", stmt, NULL);
+
+    } else if (strcasecmp(c->argv[0], SQL_INSERT_C) == 0) {
+      type = 'I';
+      table = c->argv[2];
+
+    } else if (strcasecmp(c->argv[0], SQL_FREEFORM_C) == 0) {
+      type = 'F';
+    }
+
+    /* If the writer cannot take the statement, execute it ourselves. */
+    if (type != 0 &&
+        sql_log_queue_send(tmp_pool, type, conn_name, table, text) == 0) {
+      set_named_conn_backend(NULL);
+      destroy_pool(tmp_pool);
+
+      sql_log(DEBUG_FUNC, "<<< process_named_query '%s' (queued)", name);
+      return PR_HANDLED(cmd);
+    }
+  }
+
   /* Construct our return data based on the type of query */
   if (strcasecmp(c->argv[0], SQL_UPDATE_C) == 0) {
     query = pstrcat(cmd->tmp_pool, c->argv[2], " SET ", stmt, NULL);
-    mr = sql_dispatch(sql_make_cmd(cmd->tmp_pool, 2, conn_name, query),
-      "sql_update");
+
+    if (resolved->params != NULL) {
+      mr = sql_dispatch_prepared(cmd, conn_name,
+        pstrcat(cmd->tmp_pool, "UPDATE ", query, NULL), resolved->params);
+
+    } else {
+      mr = sql_dispatch(sql_make_cmd(cmd->tmp_pool, 2, conn_name, query),
+        "sql_update");
+    }
 
   } else if (strcasecmp(c->argv[0], SQL_INSERT_C) == 0) {
     query = pstrcat(cmd->tmp_pool, "INTO ", c->argv[2], " VALUES (",
       stmt, ")", NULL);
-    mr = sql_dispatch(sql_make_cmd(cmd->tmp_pool, 2, conn_name, query),
-      "sql_insert");
+
+    if (resolved->params != NULL) {
+      mr = sql_dispatch_prepared(cmd, conn_name,
+        pstrcat(cmd->tmp_pool, "INSERT ", query, NULL), resolved->params);
+
+    } else {
+      mr = sql_dispatch(sql_make_cmd(cmd->tmp_pool, 2, conn_name, query),
+        "sql_insert");
+    }
 
   } else if (strcasecmp(c->argv[0], SQL_FREEFORM_C) == 0) {
-    mr = sql_dispatch(sql_make_cmd(cmd->tmp_pool, 2, conn_name, stmt),
-      "sql_query");
+    if (resolved->params != NULL) {
+      mr = sql_dispatch_prepared(cmd, conn_name, stmt, resolved->params);
+
+    } else {
+      mr = sql_dispatch(sql_make_cmd(cmd->tmp_pool, 2, conn_name, stmt),
+        "sql_query");
+    }
 
   } else if (strcasecmp(c->argv[0], SQL_SELECT_C) == 0) {
-    mr = sql_dispatch(sql_make_cmd(cmd->tmp_pool, 2, conn_name, stmt),
-      "sql_select");
+    if (resolved->params != NULL) {
+      mr = sql_dispatch_prepared(cmd, conn_name,
+        pstrcat(cmd->tmp_pool, "SELECT ", stmt, NULL), resolved->params);
+
+    } else {
+      mr = sql_dispatch(sql_make_cmd(cmd->tmp_pool, 2, conn_name, stmt),
+        "sql_select");
+    }
 
     if (MODRET_ISHANDLED(mr) &&
         MODRET_HASDATA(mr) &&
@@ -2898,6 +4281,10 @@ MODRET process_sqllog(cmd_rec *cmd, config_rec *c, const char *label,
     if (strcasecmp(query_type, SQL_UPDATE_C) == 0 ||
         strcasecmp(query_type, SQL_FREEFORM_C) == 0 ||
         strcasecmp(query_type, SQL_INSERT_C) == 0) {
+      if (sql_log_queue_fd >= 0) {
+        flags |= SQL_LOG_FL_QUEUE;
+      }
+
       mr = process_named_query(cmd, query_name, flags);
       if (check_response(mr, flags) < 0) {
         return mr;
@@ -4643,6 +6030,9 @@ MODRET set_sqloptions(cmd_rec *cmd) {
     } else if (strcasecmp(cmd->argv[i], "IgnoreConfigFile") == 0) {
       opts |= SQL_OPT_IGNORE_CONFIG_FILE;
 
+    } else if (strcasecmp(cmd->argv[i], "UsePreparedStatements") == 0) {
+      opts |= SQL_OPT_USE_PREPARED_STATEMENTS;
+
     } else {
       CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown SQLOption '",
         cmd->argv[i], "'", NULL));
@@ -4965,6 +6355,19 @@ MODRET set_sqllogfile(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
+/* usage: SQLLogJournal path */
+MODRET set_sqllogjournal(cmd_rec *cmd) {
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  if (pr_fs_valid_path(cmd->argv[1]) < 0) {
+    CONF_ERROR(cmd, "must be an absolute path");
+  }
+
+  add_config_param_str(cmd->argv[0], 1, cmd->argv[1]);
+  return PR_HANDLED(cmd);
+}
+
 /* usage: SQLLogOnEvent event query-name ["IGNORE_ERRORS"] */
 MODRET set_sqllogonevent(cmd_rec *cmd) {
   config_rec *c;
@@ -5057,6 +6460,55 @@ MODRET set_sqllogonevent(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
+/* usage: SQLLogQueue drop|block|off [size [units]] */
+MODRET set_sqllogqueue(cmd_rec *cmd) {
+  config_rec *c;
+  int policy, size = SQL_LOG_QUEUE_DEFAULT_SIZE;
+
+  if (cmd->argc < 2 ||
+      cmd->argc > 4) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  if (strcasecmp(cmd->argv[1], "drop") == 0) {
+    policy = SQL_LOG_QUEUE_POLICY_DROP;
+
+  } else if (strcasecmp(cmd->argv[1], "block") == 0) {
+    policy = SQL_LOG_QUEUE_POLICY_BLOCK;
+
+  } else if (strcasecmp(cmd->argv[1], "off") == 0) {
+    policy = 0;
+
+  } else {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown SQLLogQueue policy: ",
+      cmd->argv[1], NULL));
+  }
+
+  if (cmd->argc > 2) {
+    off_t nbytes = 0;
+
+    if (pr_str_get_nbytes(cmd->argv[2], cmd->argc == 4 ? cmd->argv[3] : NULL,
+        &nbytes) < 0 ||
+        nbytes < SQL_LOG_QUEUE_MAX_MSG_LEN ||
+        nbytes > INT_MAX) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid queue size: ",
+        cmd->argv[2], NULL));
+    }
+
+    size = (int) nbytes;
+  }
+
+  c = add_config_param(cmd->argv[0], 2, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = policy;
+  c->argv[1] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[1]) = size;
+
+  return PR_HANDLED(cmd);
+}
+
 /* usage: SQLNamedConnectInfo name backend info [user [pass [ttl]]]
  *          [ssl-cert:<path>] [ssl-key:<path>] [ssl-ca:/path] [ssl-ciphers:str]
  */
@@ -5364,6 +6816,38 @@ MODRET set_sqlshowinfo(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
+/* usage: SQLAuthCache path [ttl] */
+MODRET set_sqlauthcache(cmd_rec *cmd) {
+  config_rec *c;
+  int ttl = SQL_AUTH_CACHE_DEFAULT_TTL;
+
+  if (cmd->argc != 2 &&
+      cmd->argc != 3) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  if (*((char *) cmd->argv[1]) != '/') {
+    CONF_ERROR(cmd, "absolute path required");
+  }
+
+  if (cmd->argc == 3) {
+    ttl = atoi(cmd->argv[2]);
+    if (ttl < 1) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "TTL '", (char *) cmd->argv[2],
+        "' must be greater than zero", NULL));
+    }
+  }
+
+  c = add_config_param(cmd->argv[0], 2, NULL, NULL);
+  c->argv[0] = pstrdup(c->pool, cmd->argv[1]);
+  c->argv[1] = pcalloc(c->pool, sizeof(int));
+  *((int *) c->argv[1]) = ttl;
+
+  return PR_HANDLED(cmd);
+}
+
 MODRET set_sqlauthenticate(cmd_rec *cmd) {
   config_rec *c = NULL;
   char *arg = NULL;
@@ -5903,6 +7387,8 @@ static void sql_exit_ev(const void *event_data, void *user_data) {
     c = find_config_next(c, c->next, CONF_PARAM, "SQLLog_EXIT", FALSE);
   }
 
+  sql_log_queue_close();
+
   cmd = sql_make_cmd(session.pool, 0);
   mr = sql_dispatch(cmd, "sql_exit");
   (void) check_response(mr, SQL_LOG_FL_IGNORE_ERRORS);
@@ -5991,6 +7477,8 @@ static void sql_sess_reinit_ev(const void *event_data, void *user_data) {
     c = find_config_next(c, c->next, CONF_PARAM, "SQLLogOnEvent", FALSE);
   }
 
+  sql_log_queue_close();
+
   pr_sql_opts = 0UL;
   pr_sql_conn_policy = 0;
 
@@ -6000,6 +7488,8 @@ static void sql_sess_reinit_ev(const void *event_data, void *user_data) {
     sql_logfile = NULL;
   }
 
+  sql_auth_cache_close();
+
   memset(&cmap, 0, sizeof(cmap));
   sql_cmdtable = NULL;
   sql_default_cmdtable = NULL;
@@ -6682,6 +8172,65 @@ static int sql_sess_init(void) {
   pr_event_register(&sql_module, "core.chroot", sql_chroot_ev, NULL);
   pr_event_register(&sql_module, "core.exit", sql_exit_ev, NULL);
 
+  c = find_config(main_server->conf, CONF_PARAM, "SQLAuthCache", FALSE);
+  if (c != NULL &&
+      (SQL_USERS || SQL_GROUPS)) {
+    const char *path;
+    unsigned int h;
+
+    path = c->argv[0];
+    sql_auth_cache_ttl = *((int *) c->argv[1]);
+
+    /* Records are only shared between sessions looking them up the same way,
+     * in the same database.
+     */
+    ptr = get_param_ptr(main_server->conf, "SQLConnectInfo", FALSE);
+    h = sql_auth_cache_hash(5381, ptr ? (char *) ptr : "");
+    h = sql_auth_cache_hash(h, cmap.usrtable ? cmap.usrtable : "");
+    h = sql_auth_cache_hash(h, cmap.usrfields ? cmap.usrfields : "");
+    h = sql_auth_cache_hash(h, cmap.userwhere ? cmap.userwhere : "");
+    h = sql_auth_cache_hash(h, cmap.usercustom ? cmap.usercustom : "");
+    h = sql_auth_cache_hash(h, cmap.grptable ? cmap.grptable : "");
+    h = sql_auth_cache_hash(h, cmap.grpfields ? cmap.grpfields : "");
+    h = sql_auth_cache_hash(h, cmap.groupwhere ? cmap.groupwhere : "");
+    h = sql_auth_cache_hash(h,
+      cmap.groupcustombyname ? cmap.groupcustombyname : "");
+    sql_auth_cache_src_id = h;
+
+    if (sql_auth_cache_open(path) < 0) {
+      sql_log(DEBUG_INFO, "unable to use SQLAuthCache '%s': %s", path,
+        strerror(errno));
+
+    } else {
+      sql_log(DEBUG_INFO, "using SQLAuthCache '%s' (TTL %d %s)", path,
+        sql_auth_cache_ttl, sql_auth_cache_ttl != 1 ? "secs" : "sec");
+    }
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "SQLLogQueue", FALSE);
+  if (c != NULL &&
+      (cmap.engine & SQL_ENGINE_FL_LOG)) {
+    int policy, size;
+    const char *journal;
+
+    policy = *((int *) c->argv[0]);
+    size = *((int *) c->argv[1]);
+    journal = get_param_ptr(main_server->conf, "SQLLogJournal", FALSE);
+
+    if (policy != 0) {
+      if (sql_log_queue_open(policy, size, journal) < 0) {
+        sql_log(DEBUG_INFO, "unable to start SQLLog writer: %s",
+          strerror(errno));
+
+      } else {
+        sql_log(DEBUG_INFO, "SQLLogQueue: %d bytes, %s when full%s%s",
+          sql_log_queue_size,
+          policy == SQL_LOG_QUEUE_POLICY_DROP ? "drop" : "block",
+          journal ? ", journal " : "", journal ? journal : "");
+      }
+    }
+  }
+
   c = find_config(main_server->conf, CONF_PARAM, "SQLKeepAlive", FALSE);
   if (c != NULL) {
     int interval;
@@ -6705,6 +8254,7 @@ static int sql_sess_init(void) {
  *****************************************************************/
 
 static conftable sql_conftab[] = {
+  { "SQLAuthCache",		set_sqlauthcache,		NULL },
   { "SQLAuthenticate",		set_sqlauthenticate,		NULL },
   { "SQLAuthTypes",		set_sqlauthtypes,		NULL },
   { "SQLBackend",		set_sqlbackend,			NULL },
@@ -6719,7 +8269,9 @@ static conftable sql_conftab[] = {
   { "SQLKeepAlive",		set_sqlkeepalive,		NULL },
   { "SQLLog",			set_sqllog,			NULL },
   { "SQLLogFile",		set_sqllogfile,			NULL },
+  { "SQLLogJournal",		set_sqllogjournal,		NULL },
   { "SQLLogOnEvent",		set_sqllogonevent,		NULL },
+  { "SQLLogQueue",		set_sqllogqueue,		NULL },
   { "SQLMinID",			set_sqlminid,			NULL },
   { "SQLMinUserGID",		set_sqlminusergid,		NULL },
   { "SQLMinUserUID",		set_sqlminuseruid,		NULL },
@@ -83,6 +83,15 @@ typedef struct sql_data_struct sql_data_t;
  */
 #define MOD_SQL_API_V2 "mod_sql_api_v2"
 
+/* Backends may additionally implement the optional cmd_execute ("sql_execute")
+ *  handler, used when the UsePreparedStatements SQLOption is in effect.  It
+ *  is called with the connection name as argv[0], a complete statement using
+ *  '?' placeholders as argv[1], and the text values to bind to those
+ *  placeholders as argv[2] onwards.  Backends are expected to prepare each
+ *  distinct statement once per connection, and to return sql_data_t results
+ *  as for cmd_select.
+ */
+
 /* SQLOption values */
 extern unsigned long pr_sql_opts;
 
@@ -90,6 +99,7 @@ extern unsigned long pr_sql_opts;
 #define SQL_OPT_USE_NORMALIZED_GROUP_SCHEMA     0x0002
 #define SQL_OPT_NO_RECONNECT                    0x0004
 #define SQL_OPT_IGNORE_CONFIG_FILE		0x0008
+#define SQL_OPT_USE_PREPARED_STATEMENTS		0x0010
 
 /* SQL connection policy */
 extern unsigned int pr_sql_conn_policy;
@@ -176,6 +176,15 @@ struct db_conn_struct {
   const char *ssl_ciphers;
 
   MYSQL *mysql;
+
+  /* Statements prepared on this connection, by text. */
+  pool *stmt_pool;
+  array_header *stmts;
+};
+
+struct stmt_entry {
+  const char *sql;
+  MYSQL_STMT *stmt;
 };
 
 typedef struct db_conn_struct db_conn_t;
@@ -395,6 +404,155 @@ static modret_t *build_data(cmd_rec *cmd, db_conn_t *conn) {
   return mod_create_data(cmd, (void *) sd);
 }
 
+static void clear_stmts(db_conn_t *conn) {
+  register unsigned int i;
+  struct stmt_entry *entries;
+
+  entries = conn->stmts->elts;
+  for (i = 0; i < conn->stmts->nelts; i++) {
+    if (entries[i].stmt != NULL) {
+      mysql_stmt_close(entries[i].stmt);
+    }
+  }
+
+  destroy_pool(conn->stmt_pool);
+  conn->stmt_pool = NULL;
+  conn->stmts = NULL;
+}
+
+/* Returns the cache entry for the prepared statement for the given text,
+ * preparing the statement if this connection has not yet seen it.
+ */
+static struct stmt_entry *get_stmt(db_conn_t *conn, const char *sql) {
+  register unsigned int i;
+  struct stmt_entry *entries, *entry = NULL;
+  MYSQL_STMT *stmt;
+
+  if (conn->stmt_pool == NULL) {
+    conn->stmt_pool = make_sub_pool(conn_pool);
+    pr_pool_tag(conn->stmt_pool, "MySQL prepared statements pool");
+
+    conn->stmts = make_array(conn->stmt_pool, 4, sizeof(struct stmt_entry));
+  }
+
+  entries = conn->stmts->elts;
+  for (i = 0; i < conn->stmts->nelts; i++) {
+    if (strcmp(entries[i].sql, sql) == 0) {
+      entry = &(entries[i]);
+      break;
+    }
+  }
+
+  if (entry != NULL &&
+      entry->stmt != NULL) {
+    return entry;
+  }
+
+  stmt = mysql_stmt_init(conn->mysql);
+  if (stmt == NULL) {
+    return NULL;
+  }
+
+  if (mysql_stmt_prepare(stmt, sql, strlen(sql)) != 0) {
+    sql_log(DEBUG_FUNC, "error preparing '%s': %s", sql,
+      mysql_stmt_error(stmt));
+    mysql_stmt_close(stmt);
+    return NULL;
+  }
+
+  pr_trace_msg(trace_channel, 17, "prepared statement '%s'", sql);
+
+  if (entry == NULL) {
+    entry = push_array(conn->stmts);
+    entry->sql = pstrdup(conn->stmt_pool, sql);
+  }
+
+  entry->stmt = stmt;
+  return entry;
+}
+
+/* build_stmt_data: the prepared statement counterpart of build_data(). */
+static modret_t *build_stmt_data(cmd_rec *cmd, MYSQL_STMT *stmt,
+    MYSQL_RES *meta) {
+  MYSQL_FIELD *fields;
+  MYSQL_BIND *binds;
+  unsigned long *lens;
+#if MYSQL_VERSION_ID >= 80000
+  bool *nulls, update_max_len = true;
+#else
+  my_bool *nulls, update_max_len = TRUE;
+#endif
+  sql_data_t *sd = NULL;
+  char **data = NULL;
+  unsigned long i = 0, field;
+  int res;
+
+  sd = (sql_data_t *) pcalloc(cmd->tmp_pool, sizeof(sql_data_t));
+  sd->fnum = (unsigned long) mysql_num_fields(meta);
+
+  /* Have the column widths calculated, for sizing the result buffers. */
+  mysql_stmt_attr_set(stmt, STMT_ATTR_UPDATE_MAX_LENGTH, &update_max_len);
+  if (mysql_stmt_store_result(stmt) != 0) {
+    return NULL;
+  }
+
+  sd->rnum = (unsigned long) mysql_stmt_num_rows(stmt);
+  data = (char **) pcalloc(cmd->tmp_pool,
+    sizeof(char *) * ((sd->rnum * sd->fnum) + 1));
+
+  fields = mysql_fetch_fields(meta);
+  binds = pcalloc(cmd->tmp_pool, sizeof(MYSQL_BIND) * sd->fnum);
+  lens = pcalloc(cmd->tmp_pool, sizeof(unsigned long) * sd->fnum);
+  nulls = pcalloc(cmd->tmp_pool, sizeof(*nulls) * sd->fnum);
+
+  for (field = 0; field < sd->fnum; field++) {
+    unsigned long len;
+
+    /* For non-string columns, max_length is that of the binary value; the
+     * display width bounds the text form.
+     */
+    len = fields[field].max_length;
+    if (fields[field].length > len) {
+      len = fields[field].length;
+    }
+
+    binds[field].buffer_type = MYSQL_TYPE_STRING;
+    binds[field].buffer_length = len + 1;
+    binds[field].buffer = pcalloc(cmd->tmp_pool, binds[field].buffer_length);
+    binds[field].length = &(lens[field]);
+    binds[field].is_null = &(nulls[field]);
+  }
+
+  if (mysql_stmt_bind_result(stmt, binds) != 0) {
+    mysql_stmt_free_result(stmt);
+    return NULL;
+  }
+
+  while (((res = mysql_stmt_fetch(stmt)) == 0 ||
+          res == MYSQL_DATA_TRUNCATED) &&
+         i < (sd->rnum * sd->fnum)) {
+    for (field = 0; field < sd->fnum; field++) {
+      if (nulls[field]) {
+        data[i++] = NULL;
+
+      } else {
+        data[i++] = pstrndup(cmd->tmp_pool, binds[field].buffer, lens[field]);
+      }
+    }
+  }
+
+  mysql_stmt_free_result(stmt);
+
+  if (res == 1) {
+    return NULL;
+  }
+
+  data[i] = NULL;
+  sd->data = data;
+
+  return mod_create_data(cmd, (void *) sd);
+}
+
 /*
  * cmd_open: attempts to open a named connection to the database.
  *
@@ -764,6 +922,10 @@ MODRET cmd_close(cmd_rec *cmd) {
    * timers.
    */
   if (((--entry->connections) == 0) || ((cmd->argc == 2) && (cmd->argv[1]))) {
+    if (conn->stmt_pool != NULL) {
+      clear_stmts(conn);
+    }
+
     if (conn->mysql != NULL) {
       mysql_close(conn->mysql);
       conn->mysql = NULL;
@@ -1526,6 +1688,130 @@ MODRET cmd_query(cmd_rec *cmd) {
   return dmr;
 }
 
+/*
+ * cmd_execute: executes a complete statement, preparing it first if
+ *  necessary, with the given values bound to its placeholders.
+ *
+ * Inputs:
+ *  cmd->argv[0]: connection name
+ *  cmd->argv[1]: statement string, using '?' placeholders
+ *  cmd->argv[2..]: values for the placeholders, in order
+ *
+ * Returns:
+ *  depending on the statement type, returns a modret_t with data, a
+ *  non-error modret_t, or a properly filled error modret_t if the statement
+ *  failed.
+ *
+ * Notes:
+ *  Statements are prepared once per connection, and are discarded when
+ *  the connection is closed.
+ */
+MODRET cmd_execute(cmd_rec *cmd) {
+  conn_entry_t *entry = NULL;
+  db_conn_t *conn = NULL;
+  modret_t *cmr = NULL;
+  modret_t *dmr = NULL;
+  struct stmt_entry *stmt_entry;
+  MYSQL_BIND *binds = NULL;
+  MYSQL_RES *meta;
+  unsigned long *lens = NULL;
+  unsigned int nparams;
+  register unsigned int i;
+  cmd_rec *close_cmd;
+
+  sql_log(DEBUG_FUNC, "%s", "entering \tmysql cmd_execute");
+
+  sql_check_cmd(cmd, "cmd_execute");
+
+  if (cmd->argc < 2) {
+    sql_log(DEBUG_FUNC, "%s", "exiting \tmysql cmd_execute");
+    return PR_ERROR_MSG(cmd, MOD_SQL_MYSQL_VERSION, "badly formed request");
+  }
+
+  entry = sql_get_connection(cmd->argv[0]);
+  if (entry == NULL) {
+    sql_log(DEBUG_FUNC, "%s", "exiting \tmysql cmd_execute");
+    return PR_ERROR_MSG(cmd, MOD_SQL_MYSQL_VERSION,
+      pstrcat(cmd->tmp_pool, "unknown named connection: ", cmd->argv[0], NULL));
+  }
+
+  conn = (db_conn_t *) entry->data;
+
+  cmr = cmd_open(cmd);
+  if (MODRET_ERROR(cmr)) {
+    sql_log(DEBUG_FUNC, "%s", "exiting \tmysql cmd_execute");
+    return cmr;
+  }
+
+  nparams = cmd->argc - 2;
+  sql_log(DEBUG_INFO, "statement \"%s\" (%u %s)", (char *) cmd->argv[1],
+    nparams, nparams == 1 ? "parameter" : "parameters");
+
+  if (nparams > 0) {
+    binds = pcalloc(cmd->tmp_pool, sizeof(MYSQL_BIND) * nparams);
+    lens = pcalloc(cmd->tmp_pool, sizeof(unsigned long) * nparams);
+
+    for (i = 0; i < nparams; i++) {
+      lens[i] = strlen(cmd->argv[i + 2]);
+
+      binds[i].buffer_type = MYSQL_TYPE_STRING;
+      binds[i].buffer = cmd->argv[i + 2];
+      binds[i].buffer_length = lens[i];
+      binds[i].length = &(lens[i]);
+    }
+  }
+
+  stmt_entry = get_stmt(conn, cmd->argv[1]);
+  if (stmt_entry == NULL ||
+      (binds != NULL &&
+       mysql_stmt_bind_param(stmt_entry->stmt, binds) != 0) ||
+      mysql_stmt_execute(stmt_entry->stmt) != 0) {
+
+    if (stmt_entry != NULL) {
+      dmr = PR_ERROR_MSG(cmd, MOD_SQL_MYSQL_VERSION,
+        pstrdup(cmd->pool, mysql_stmt_error(stmt_entry->stmt)));
+
+      /* The statement may have been invalidated, e.g. by a reconnect, so
+       * have it prepared anew next time.
+       */
+      mysql_stmt_close(stmt_entry->stmt);
+      stmt_entry->stmt = NULL;
+
+    } else {
+      dmr = build_error(cmd, conn);
+    }
+
+    close_cmd = sql_make_cmd(cmd->tmp_pool, 1, entry->name);
+    cmd_close(close_cmd);
+    SQL_FREE_CMD(close_cmd);
+
+    sql_log(DEBUG_FUNC, "%s", "exiting \tmysql cmd_execute");
+    return dmr;
+  }
+
+  meta = mysql_stmt_result_metadata(stmt_entry->stmt);
+  if (meta != NULL) {
+    dmr = build_stmt_data(cmd, stmt_entry->stmt, meta);
+    if (dmr == NULL) {
+      dmr = PR_ERROR_MSG(cmd, MOD_SQL_MYSQL_VERSION,
+        pstrdup(cmd->pool, mysql_stmt_error(stmt_entry->stmt)));
+    }
+
+    mysql_free_result(meta);
+
+  } else {
+    dmr = PR_HANDLED(cmd);
+  }
+
+  /* close the connection, return the data. */
+  close_cmd = sql_make_cmd(cmd->tmp_pool, 1, entry->name);
+  cmd_close(close_cmd);
+  SQL_FREE_CMD(close_cmd);
+
+  sql_log(DEBUG_FUNC, "%s", "exiting \tmysql cmd_execute");
+  return dmr;
+}
+
 /*
  * cmd_escapestring: certain strings sent to a database should be properly
  *  escaped -- for instance, quotes need to be escaped to insure that 
@@ -1916,6 +2202,7 @@ static cmdtable sql_mysql_cmdtable[] = {
   { CMD, "sql_cleanup",          G_NONE, cmd_cleanup,          FALSE, FALSE },
   { CMD, "sql_defineconnection", G_NONE, cmd_defineconnection, FALSE, FALSE },
   { CMD, "sql_escapestring",     G_NONE, cmd_escapestring,     FALSE, FALSE },
+  { CMD, "sql_execute",          G_NONE, cmd_execute,          FALSE, FALSE },
   { CMD, "sql_exit",             G_NONE, cmd_exit,             FALSE, FALSE },
   { CMD, "sql_identify",         G_NONE, cmd_identify,         FALSE, FALSE },
   { CMD, "sql_insert",           G_NONE, cmd_insert,           FALSE, FALSE },
@@ -97,6 +97,15 @@ struct db_conn_struct {
 
   PGconn *postgres;
   PGresult *result;
+
+  /* Statements prepared on this connection, by text. */
+  pool *stmt_pool;
+  array_header *stmts;
+};
+
+struct stmt_entry {
+  const char *sql;
+  const char *name;
 };
 
 typedef struct db_conn_struct db_conn_t;
@@ -634,6 +643,13 @@ MODRET cmd_close(cmd_rec *cmd) {
     }
     entry->connections = 0;
 
+    /* Prepared statements do not outlive their connection. */
+    if (conn->stmt_pool != NULL) {
+      destroy_pool(conn->stmt_pool);
+      conn->stmt_pool = NULL;
+      conn->stmts = NULL;
+    }
+
     if (entry->timer) {
       pr_timer_remove(entry->timer, &sql_postgres_module);
       entry->timer = 0;
@@ -1406,6 +1422,178 @@ MODRET cmd_query(cmd_rec *cmd) {
   return dmr;
 }
 
+/* Returns the name of the server-side prepared statement for the given
+ * statement text, preparing it first if this connection has not yet seen it.
+ * The '?' placeholders used by mod_sql are converted to Postgres' $n form.
+ */
+static const char *get_stmt(cmd_rec *cmd, db_conn_t *conn, const char *sql) {
+  register unsigned int i;
+  struct stmt_entry *entries, *entry;
+  char *pg_sql, name[32];
+  size_t len, pg_len = 0;
+  unsigned int nparams = 0;
+  int in_literal = FALSE;
+  PGresult *res;
+
+  if (conn->stmt_pool == NULL) {
+    conn->stmt_pool = make_sub_pool(conn_pool);
+    pr_pool_tag(conn->stmt_pool, "Postgres prepared statements pool");
+
+    conn->stmts = make_array(conn->stmt_pool, 4, sizeof(struct stmt_entry));
+  }
+
+  entries = conn->stmts->elts;
+  for (i = 0; i < conn->stmts->nelts; i++) {
+    if (strcmp(entries[i].sql, sql) == 0) {
+      return entries[i].name;
+    }
+  }
+
+  /* There can be no more placeholders than characters, so each grows to at
+   * most six characters, i.e. "$99999".
+   */
+  len = strlen(sql);
+  pg_sql = pcalloc(cmd->tmp_pool, (len * 6) + 1);
+
+  for (i = 0; i < len; i++) {
+    if (sql[i] == '\'') {
+      in_literal = !in_literal;
+    }
+
+    if (sql[i] == '?' &&
+        in_literal == FALSE) {
+      pg_len += pr_snprintf(pg_sql + pg_len, 7, "$%u", ++nparams);
+      continue;
+    }
+
+    pg_sql[pg_len++] = sql[i];
+  }
+
+  memset(name, '\0', sizeof(name));
+  pr_snprintf(name, sizeof(name)-1, "proftpd_stmt_%u", conn->stmts->nelts);
+
+  res = PQprepare(conn->postgres, name, pg_sql, (int) nparams, NULL);
+  if (res == NULL ||
+      PQresultStatus(res) != PGRES_COMMAND_OK) {
+    sql_log(DEBUG_FUNC, "error preparing '%s': %s", pg_sql,
+      PQerrorMessage(conn->postgres));
+
+    if (res != NULL) {
+      PQclear(res);
+    }
+
+    return NULL;
+  }
+
+  PQclear(res);
+  pr_trace_msg(trace_channel, 17, "prepared statement '%s' as '%s'", pg_sql,
+    name);
+
+  entry = push_array(conn->stmts);
+  entry->sql = pstrdup(conn->stmt_pool, sql);
+  entry->name = pstrdup(conn->stmt_pool, name);
+
+  return entry->name;
+}
+
+/*
+ * cmd_execute: executes a complete statement, preparing it first if
+ *  necessary, with the given values bound to its placeholders.
+ *
+ * Inputs:
+ *  cmd->argv[0]: connection name
+ *  cmd->argv[1]: statement string, using '?' placeholders
+ *  cmd->argv[2..]: values for the placeholders, in order
+ *
+ * Returns:
+ *  depending on the statement type, returns a modret_t with data, a
+ *  non-error modret_t, or a properly filled error modret_t if the statement
+ *  failed.
+ *
+ * Notes:
+ *  Statements are prepared once per connection, and are discarded when
+ *  the connection is closed.
+ */
+MODRET cmd_execute(cmd_rec *cmd) {
+  conn_entry_t *entry = NULL;
+  db_conn_t *conn = NULL;
+  modret_t *cmr = NULL;
+  modret_t *dmr = NULL;
+  const char *stmt_name;
+  const char **values;
+  register unsigned int i;
+  cmd_rec *close_cmd;
+
+  sql_log(DEBUG_FUNC, "%s", "entering \tpostgres cmd_execute");
+
+  sql_check_cmd(cmd, "cmd_execute");
+
+  if (cmd->argc < 2) {
+    sql_log(DEBUG_FUNC, "%s", "exiting \tpostgres cmd_execute");
+    return PR_ERROR_MSG(cmd, MOD_SQL_POSTGRES_VERSION, "badly formed request");
+  }
+
+  entry = sql_get_connection(cmd->argv[0]);
+  if (entry == NULL) {
+    sql_log(DEBUG_FUNC, "%s", "exiting \tpostgres cmd_execute");
+    return PR_ERROR_MSG(cmd, MOD_SQL_POSTGRES_VERSION,
+      pstrcat(cmd->tmp_pool, "unknown named connection: ", cmd->argv[0], NULL));
+  }
+
+  conn = (db_conn_t *) entry->data;
+
+  cmr = cmd_open(cmd);
+  if (MODRET_ERROR(cmr)) {
+    sql_log(DEBUG_FUNC, "%s", "exiting \tpostgres cmd_execute");
+    return cmr;
+  }
+
+  sql_log(DEBUG_INFO, "statement \"%s\" (%u %s)", (char *) cmd->argv[1],
+    cmd->argc - 2, cmd->argc == 3 ? "parameter" : "parameters");
+
+  values = pcalloc(cmd->tmp_pool, sizeof(char *) * cmd->argc);
+  for (i = 2; i < cmd->argc; i++) {
+    values[i - 2] = cmd->argv[i];
+  }
+
+  stmt_name = get_stmt(cmd, conn, cmd->argv[1]);
+  if (stmt_name == NULL ||
+      !(conn->result = PQexecPrepared(conn->postgres, stmt_name,
+        (int) (cmd->argc - 2), values, NULL, NULL, 0)) ||
+      ((PQresultStatus(conn->result) != PGRES_TUPLES_OK) &&
+       (PQresultStatus(conn->result) != PGRES_COMMAND_OK))) {
+    dmr = build_error(cmd, conn);
+
+    if (stmt_name != NULL &&
+        conn->result != NULL) {
+      PQclear(conn->result);
+    }
+
+    close_cmd = sql_make_cmd(cmd->tmp_pool, 1, entry->name);
+    cmd_close(close_cmd);
+    SQL_FREE_CMD(close_cmd);
+
+    sql_log(DEBUG_FUNC, "%s", "exiting \tpostgres cmd_execute");
+    return dmr;
+  }
+
+  if (PQresultStatus(conn->result) == PGRES_TUPLES_OK) {
+    dmr = build_data(cmd, conn);
+
+  } else {
+    dmr = PR_HANDLED(cmd);
+  }
+
+  PQclear(conn->result);
+
+  close_cmd = sql_make_cmd(cmd->tmp_pool, 1, entry->name);
+  cmd_close(close_cmd);
+  SQL_FREE_CMD(close_cmd);
+
+  sql_log(DEBUG_FUNC, "%s", "exiting \tpostgres cmd_execute");
+  return dmr;
+}
+
 /*
  * cmd_escapestring: certain strings sent to a database should be properly
  *  escaped -- for instance, quotes need to be escaped to insure that 
@@ -1562,6 +1750,7 @@ static cmdtable sql_postgres_cmdtable[] = {
   { CMD, "sql_close",            G_NONE, cmd_close,            FALSE, FALSE },
   { CMD, "sql_defineconnection", G_NONE, cmd_defineconnection, FALSE, FALSE },
   { CMD, "sql_escapestring",     G_NONE, cmd_escapestring,     FALSE, FALSE },
+  { CMD, "sql_execute",          G_NONE, cmd_execute,          FALSE, FALSE },
   { CMD, "sql_exit",             G_NONE, cmd_exit,             FALSE, FALSE },
   { CMD, "sql_identify",         G_NONE, cmd_identify,         FALSE, FALSE },
   { CMD, "sql_insert",           G_NONE, cmd_insert,           FALSE, FALSE },
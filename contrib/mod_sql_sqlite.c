@@ -48,8 +48,17 @@ typedef struct db_conn_struct {
 
   sqlite3 *dbh;
 
+  /* Prepared statements, kept for the life of the database handle. */
+  pool *stmt_pool;
+  array_header *stmts;
+
 } db_conn_t;
 
+struct stmt_entry {
+  const char *sql;
+  sqlite3_stmt *stmt;
+};
+
 typedef struct conn_entry_struct {
   char *name;
   void *data;
@@ -258,13 +267,162 @@ static int query_start(cmd_rec *cmd, db_conn_t *conn, int flags,
 
 static int query_run(cmd_rec *cmd, db_conn_t *conn, char *query,
     char **errstr) {
-  return exec_stmt(cmd, conn, query, errstr);
+  int res;
+
+  res = exec_stmt(cmd, conn, query, errstr);
+  if (res < 0) {
+    char *ignored = NULL;
+
+    /* Do not leave the transaction open, lest the next BEGIN fail. */
+    (void) exec_stmt(cmd, conn, pstrdup(cmd->tmp_pool, "ROLLBACK"), &ignored);
+  }
+
+  return res;
 }
 
 static int query_finish(cmd_rec *cmd, db_conn_t *conn, char **errstr) {
   return exec_stmt(cmd, conn, pstrdup(cmd->tmp_pool, "COMMIT"), errstr);
 }
 
+static void clear_stmts(db_conn_t *conn) {
+  register unsigned int i;
+  struct stmt_entry *entries;
+
+  entries = conn->stmts->elts;
+  for (i = 0; i < conn->stmts->nelts; i++) {
+    sqlite3_finalize(entries[i].stmt);
+  }
+
+  destroy_pool(conn->stmt_pool);
+  conn->stmt_pool = NULL;
+  conn->stmts = NULL;
+}
+
+/* Returns the prepared statement for the given SQL text, preparing it, and
+ * caching it on the connection, the first time it is seen.
+ */
+static sqlite3_stmt *get_stmt(db_conn_t *conn, const char *sql,
+    char **errstr, pool *p) {
+  register unsigned int i;
+  struct stmt_entry *entries, *entry;
+  sqlite3_stmt *stmt = NULL;
+  int res;
+
+  if (conn->stmt_pool == NULL) {
+    conn->stmt_pool = make_sub_pool(conn_pool);
+    pr_pool_tag(conn->stmt_pool, "SQLite prepared statements pool");
+
+    conn->stmts = make_array(conn->stmt_pool, 4, sizeof(struct stmt_entry));
+  }
+
+  entries = conn->stmts->elts;
+  for (i = 0; i < conn->stmts->nelts; i++) {
+    if (strcmp(entries[i].sql, sql) == 0) {
+      return entries[i].stmt;
+    }
+  }
+
+  res = sqlite3_prepare_v2(conn->dbh, sql, -1, &stmt, NULL);
+  if (res != SQLITE_OK) {
+    *errstr = pstrdup(p, sqlite3_errmsg(conn->dbh));
+    sql_log(DEBUG_FUNC, "error preparing '%s': (%d) %s", sql, res, *errstr);
+    return NULL;
+  }
+
+  pr_trace_msg(trace_channel, 17, "prepared statement '%s'", sql);
+
+  entry = push_array(conn->stmts);
+  entry->sql = pstrdup(conn->stmt_pool, sql);
+  entry->stmt = stmt;
+
+  return stmt;
+}
+
+static int exec_prepared(cmd_rec *cmd, db_conn_t *conn, sqlite3_stmt *stmt,
+    char **errstr) {
+  register unsigned int i;
+  int res, ncols;
+  unsigned int nretries = 0;
+
+  for (i = 2; i < cmd->argc; i++) {
+    res = sqlite3_bind_text(stmt, i - 1, cmd->argv[i], -1, SQLITE_TRANSIENT);
+    if (res != SQLITE_OK) {
+      *errstr = pstrdup(cmd->pool, sqlite3_errmsg(conn->dbh));
+      sqlite3_clear_bindings(stmt);
+      return -1;
+    }
+  }
+
+  ncols = sqlite3_column_count(stmt);
+
+  while (TRUE) {
+    PRIVS_ROOT
+    res = sqlite3_step(stmt);
+    PRIVS_RELINQUISH
+
+    if (res == SQLITE_ROW) {
+      register int j;
+      char ***row;
+
+      if (result_list == NULL) {
+        result_ncols = ncols;
+        result_list = make_array(cmd->tmp_pool, ncols, sizeof(char **));
+      }
+
+      row = push_array(result_list);
+      *row = pcalloc(cmd->tmp_pool, sizeof(char *) * ncols);
+
+      for (j = 0; j < ncols; j++) {
+        const unsigned char *val;
+
+        /* Make sure we propagate NULL values properly, as for exec_cb(). */
+        val = sqlite3_column_text(stmt, j);
+        if (val != NULL) {
+          (*row)[j] = pstrdup(cmd->tmp_pool, (const char *) val);
+        }
+      }
+
+      continue;
+    }
+
+    if (res == SQLITE_BUSY) {
+      struct timeval tv;
+
+      sqlite3_reset(stmt);
+
+      nretries++;
+      sql_log(DEBUG_FUNC, "attempt #%u, database busy, trying '%s' again",
+        nretries, cmd->argv[1]);
+
+      /* Sleep for short bit, then try again. */
+      tv.tv_sec = 0;
+      tv.tv_usec = 500000L;
+
+      if (select(0, NULL, NULL, NULL, &tv) < 0) {
+        if (errno == EINTR) {
+          pr_signals_handle();
+        }
+      }
+
+      continue;
+    }
+
+    break;
+  }
+
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+
+  if (res != SQLITE_DONE) {
+    *errstr = pstrdup(cmd->pool, sqlite3_errmsg(conn->dbh));
+    sql_log(DEBUG_FUNC, "error executing '%s': (%d) %s", cmd->argv[1], res,
+      *errstr);
+    return -1;
+  }
+
+  return 0;
+}
+
 static modret_t *sql_sqlite_get_data(cmd_rec *cmd) {
   register unsigned int i;
   unsigned int count, k = 0;
@@ -478,6 +636,10 @@ MODRET sql_sqlite_close(cmd_rec *cmd) {
   if ((--entry->nconn) == 0 ||
       (cmd->argc == 2 && cmd->argv[1])) {
 
+    if (conn->stmt_pool != NULL) {
+      clear_stmts(conn);
+    }
+
     if (conn->dbh) {
       if (sqlite3_close(conn->dbh) != SQLITE_OK) {
         sql_log(DEBUG_FUNC, "error closing SQLite database: %s",
@@ -1005,6 +1167,66 @@ MODRET sql_sqlite_query(cmd_rec *cmd) {
   return mr;
 }
 
+MODRET sql_sqlite_execute(cmd_rec *cmd) {
+  conn_entry_t *entry = NULL;
+  db_conn_t *conn = NULL;
+  modret_t *mr = NULL;
+  char *errstr = NULL;
+  sqlite3_stmt *stmt;
+  cmd_rec *close_cmd;
+
+  sql_log(DEBUG_FUNC, "%s", "entering \tsqlite cmd_execute");
+
+  if (cmd->argc < 2) {
+    sql_log(DEBUG_FUNC, "%s", "exiting \tsqlite cmd_execute");
+    return PR_ERROR_MSG(cmd, MOD_SQL_SQLITE_VERSION, "badly formed request");
+  }
+
+  /* Get the named connection. */
+  entry = sql_sqlite_get_conn(cmd->argv[0]);
+  if (entry == NULL) {
+    sql_log(DEBUG_FUNC, "%s", "exiting \tsqlite cmd_execute");
+    return PR_ERROR_MSG(cmd, MOD_SQL_SQLITE_VERSION,
+      pstrcat(cmd->tmp_pool, "unknown named connection: ", cmd->argv[0], NULL));
+  }
+
+  conn = (db_conn_t *) entry->data;
+
+  mr = sql_sqlite_open(cmd);
+  if (MODRET_ERROR(mr)) {
+    sql_log(DEBUG_FUNC, "%s", "exiting \tsqlite cmd_execute");
+    return mr;
+  }
+
+  /* Log the statement string */
+  sql_log(DEBUG_INFO, "statement \"%s\" (%u %s)", cmd->argv[1],
+    cmd->argc - 2, cmd->argc == 3 ? "parameter" : "parameters");
+
+  stmt = get_stmt(conn, cmd->argv[1], &errstr, cmd->pool);
+  if (stmt == NULL ||
+      exec_prepared(cmd, conn, stmt, &errstr) < 0) {
+    result_ncols = 0;
+    result_list = NULL;
+
+    close_cmd = pr_cmd_alloc(cmd->tmp_pool, 1, entry->name);
+    sql_sqlite_close(close_cmd);
+    destroy_pool(close_cmd->pool);
+
+    sql_log(DEBUG_FUNC, "%s", "exiting \tsqlite cmd_execute");
+    return PR_ERROR_MSG(cmd, MOD_SQL_SQLITE_VERSION, errstr);
+  }
+
+  mr = sql_sqlite_get_data(cmd);
+
+  /* Close the connection, return the data. */
+  close_cmd = pr_cmd_alloc(cmd->tmp_pool, 1, entry->name);
+  sql_sqlite_close(close_cmd);
+  destroy_pool(close_cmd->pool);
+
+  sql_log(DEBUG_FUNC, "%s", "exiting \tsqlite cmd_execute");
+  return mr;
+}
+
 MODRET sql_sqlite_quote(cmd_rec *cmd) {
   conn_entry_t *entry = NULL;
   modret_t *mr = NULL;
@@ -1067,6 +1289,7 @@ static cmdtable sql_sqlite_cmdtable[] = {
   { CMD, "sql_cleanup",		G_NONE, sql_sqlite_cleanup,	FALSE, FALSE },
   { CMD, "sql_defineconnection",G_NONE, sql_sqlite_def_conn,	FALSE, FALSE },
   { CMD, "sql_escapestring",	G_NONE, sql_sqlite_quote,	FALSE, FALSE },
+  { CMD, "sql_execute",		G_NONE, sql_sqlite_execute,	FALSE, FALSE },
   { CMD, "sql_exit",		G_NONE,	sql_sqlite_exit,	FALSE, FALSE },
   { CMD, "sql_identify",	G_NONE, sql_sqlite_identify,	FALSE, FALSE },
   { CMD, "sql_insert",		G_NONE, sql_sqlite_insert,	FALSE, FALSE },
@@ -644,6 +644,7 @@ static unsigned char *tls_authenticated = NULL;
 #define TLS_SESS_VERIFY_SERVER			0x1000
 #define TLS_SESS_VERIFY_SERVER_NO_DNS		0x2000
 #define TLS_SESS_VERIFY_CLIENT_OPTIONAL		0x4000
+#define TLS_SESS_DATA_KTLS_SEND			0x8000
 
 /* mod_tls option flags */
 #define TLS_OPT_VERIFY_CERT_FQDN			0x0002
@@ -661,6 +662,7 @@ static unsigned char *tls_authenticated = NULL;
 #define TLS_OPT_ALLOW_WEAK_DH				0x2000
 #define TLS_OPT_IGNORE_SNI				0x4000
 #define TLS_OPT_ALLOW_WEAK_SECURITY			0x8000
+#define TLS_OPT_ENABLE_KTLS				0x10000
 
 /* mod_tls SSCN modes */
 #define TLS_SSCN_MODE_SERVER				0
@@ -7585,6 +7587,39 @@ static int tls_compare_session_ids(SSL_SESSION *ctrl_sess,
   return res;
 }
 
+/* If kernel TLS was requested, and the kernel accepted the negotiated keys,
+ * tell other modules (e.g. mod_xfer) that they can write directly to the
+ * data connection socket, e.g. via sendfile(2).
+ */
+static void tls_data_setup_ktls(SSL *ssl) {
+  tls_flags &= ~TLS_SESS_DATA_KTLS_SEND;
+  (void) pr_table_remove(session.notes, "mod_tls.ktls-send", NULL);
+
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+  if (!(tls_opts & TLS_OPT_ENABLE_KTLS)) {
+    return;
+  }
+
+  if (BIO_get_ktls_send(SSL_get_wbio(ssl))) {
+    tls_flags |= TLS_SESS_DATA_KTLS_SEND;
+
+    if (pr_table_add_dup(session.notes, "mod_tls.ktls-send", "1", 0) < 0) {
+      pr_trace_msg(trace_channel, 3,
+        "error stashing 'mod_tls.ktls-send' note: %s", strerror(errno));
+    }
+
+    pr_trace_msg(trace_channel, 9,
+      "using kernel TLS for sending data using cipher %s (%s)",
+      SSL_get_cipher_name(ssl), SSL_get_version(ssl));
+
+  } else {
+    pr_trace_msg(trace_channel, 9,
+      "kernel TLS not available for sending data using cipher %s (%s)",
+      SSL_get_cipher_name(ssl), SSL_get_version(ssl));
+  }
+#endif /* SSL_OP_ENABLE_KTLS */
+}
+
 static int tls_accept(conn_t *conn, unsigned char on_data) {
   static unsigned char logged_data = FALSE;
   int blocking, res = 0, xerrno = 0;
@@ -7622,6 +7657,17 @@ static int tls_accept(conn_t *conn, unsigned char on_data) {
 
   SSL_set_bio(ssl, rbio, wbio);
 
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+  if (on_data &&
+      (tls_opts & TLS_OPT_ENABLE_KTLS)) {
+    /* Ask OpenSSL to hand the negotiated keys to the kernel after the
+     * handshake, if the kernel and the negotiated cipher support it.  This
+     * allows the data to be sent using sendfile(2).
+     */
+    SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+  }
+#endif /* SSL_OP_ENABLE_KTLS */
+
 #if !defined(OPENSSL_NO_TLSEXT)
   if (tls_opts & TLS_OPT_ENABLE_DIAGS) {
     /* Note that older OpenSSL versions, e.g. 0.9.8, do not implement this
@@ -8012,6 +8058,8 @@ static int tls_accept(conn_t *conn, unsigned char on_data) {
       TLS_DATA_ADAPTIVE_WRITE_MIN_BUFFER_SIZE);
     tls_data_adaptive_bytes_written_ms = 0L;
     tls_data_adaptive_bytes_written_count = 0;
+
+    tls_data_setup_ktls(ssl);
   }
 
   /* Disable the handshake timer. */
@@ -12113,8 +12161,9 @@ static int tls_netio_close_cb(pr_netio_stream_t *nstrm) {
 
         tls_end_sess(ssl, session.d, 0);
         tls_data_netio = NULL;
-        tls_flags &= ~TLS_SESS_ON_DATA;
+        tls_flags &= ~(TLS_SESS_ON_DATA|TLS_SESS_DATA_KTLS_SEND);
         tls_data_renegotiate_current = 0;
+        (void) pr_table_remove(session.notes, "mod_tls.ktls-send", NULL);
       }
     }
   }
@@ -12320,6 +12369,13 @@ static void tls_data_renegotiate(SSL *ssl) {
     return;
   }
 
+  /* Data written via kernel TLS, e.g. with sendfile(2), is not seen by
+   * OpenSSL, and renegotiations are not supported in that case.
+   */
+  if (tls_flags & TLS_SESS_DATA_KTLS_SEND) {
+    return;
+  }
+
   tls_data_renegotiate_current = session.xfer.total_bytes;
 
   if (tls_data_renegotiate_limit > 0 &&
@@ -14358,6 +14414,15 @@ MODRET set_tlsoptions(cmd_rec *cmd) {
     } else if (strcmp(cmd->argv[i], "EnableDiags") == 0) {
       opts |= TLS_OPT_ENABLE_DIAGS;
 
+    } else if (strcmp(cmd->argv[i], "EnableKTLS") == 0) {
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+      opts |= TLS_OPT_ENABLE_KTLS;
+#else
+      pr_log_pri(PR_LOG_NOTICE, MOD_TLS_VERSION
+        ": TLSOption EnableKTLS not supported (OpenSSL version is too old, "
+        "or lacks kernel TLS support)");
+#endif /* SSL_OP_ENABLE_KTLS */
+
     } else if (strcmp(cmd->argv[i], "ExportCertData") == 0) {
       opts |= TLS_OPT_EXPORT_CERT_DATA;
 
@@ -60,28 +60,88 @@ module tls_shmcache_module;
  * SSL session data.
  */
 #ifndef TLS_MAX_SSL_SESSION_SIZE
-# define TLS_MAX_SSL_SESSION_SIZE	1024 * 10
+# define TLS_MAX_SSL_SESSION_SIZE	(1024 * 10)
 #endif
 
-/* The default number of SSL sessions cached in OpenSSL's internal cache
- * is SSL_SESSION_CACHE_MAX_SIZE_DEFAULT, which is defined as 1024*20.
- * This is NOT a size in _bytes_, but is a size in _counts_ of sessions.
+/* The session cache is divided into stripes.  A session is only ever stored
+ * in the stripe to which its ID hashes, and each stripe is protected by its
+ * own lock, a separate byte range of the cache file; processes handling
+ * different sessions thus do not contend for the same lock.
  *
- * Thus the default size of our shm segment should also, in theory, be
- * able to hold the same number of sessions.
- *
- * The recommended default size for Apache's mod_ssl shm segment is 512000
- * bytes (500KB).
+ * Each stripe holds slots for small sessions and, fewer, slots for sessions
+ * up to TLS_MAX_SSL_SESSION_SIZE, so that the common small sessions do not
+ * each take up the space of the largest possible session.  When all of the
+ * slots that a session could use are taken, the least recently used one is
+ * evicted.
  */
+#ifndef TLS_SHMCACHE_SMALL_SESSION_SIZE
+# define TLS_SHMCACHE_SMALL_SESSION_SIZE	2048
+#endif
+
+#ifndef TLS_SHMCACHE_STRIPE_SMALL_SLOTS
+# define TLS_SHMCACHE_STRIPE_SMALL_SLOTS	8
+#endif
+
+#ifndef TLS_SHMCACHE_STRIPE_LARGE_SLOTS
+# define TLS_SHMCACHE_STRIPE_LARGE_SLOTS	1
+#endif
+
+#if TLS_SHMCACHE_STRIPE_SMALL_SLOTS < 1 || TLS_SHMCACHE_STRIPE_LARGE_SLOTS < 1
+# error "Each stripe requires at least one small and one large session slot"
+#endif
+
+#define TLS_SHMCACHE_STRIPE_SLOTS	(TLS_SHMCACHE_STRIPE_SMALL_SLOTS + \
+  TLS_SHMCACHE_STRIPE_LARGE_SLOTS)
+
+/* Identifies the layout of the session cache shm. */
+#define TLS_SHMCACHE_SESS_MAGIC		0x53484d32
 
+/* Each session is stored in a slot, which starts with this header; the
+ * slot's sess_datasz bytes of session data follow it.
+ */
 struct sesscache_entry {
   time_t expires;
+  time_t last_used;
   unsigned int sess_id_len;
   unsigned char sess_id[SSL_MAX_SSL_SESSION_ID_LENGTH];
   unsigned int sess_datalen;
-  unsigned char sess_data[TLS_MAX_SSL_SESSION_SIZE];
+  unsigned int sess_datasz;
+};
+
+#define SESSCACHE_ENTRY_DATA(e)	((unsigned char *) ((e) + 1))
+
+/* The size of a slot, rounded up so that each slot header stays aligned. */
+#define SESSCACHE_SLOT_SIZE(datasz) \
+  ((sizeof(struct sesscache_entry) + (datasz) + 15) & ~((size_t) 15))
+
+/* Each stripe starts with this header, followed by its small session slots,
+ * then its large session slots.  The stats are kept per stripe, so that they
+ * can be updated while holding only the stripe lock.
+ */
+struct sesscache_stripe {
+  unsigned int nhits;
+  unsigned int nmisses;
+
+  unsigned int nstored;
+  unsigned int ndeleted;
+  unsigned int nexpired;
+  unsigned int nevicted;
+  unsigned int nerrors;
+
+  /* Number of sessions currently in this stripe. */
+  unsigned int listlen;
 };
 
+#define SESSCACHE_STRIPE_HEADER_SIZE \
+  ((sizeof(struct sesscache_stripe) + 15) & ~((size_t) 15))
+
+#define SESSCACHE_STRIPE_SIZE \
+  (SESSCACHE_STRIPE_HEADER_SIZE + \
+   (TLS_SHMCACHE_STRIPE_SMALL_SLOTS * \
+     SESSCACHE_SLOT_SIZE(TLS_SHMCACHE_SMALL_SESSION_SIZE)) + \
+   (TLS_SHMCACHE_STRIPE_LARGE_SLOTS * \
+     SESSCACHE_SLOT_SIZE(TLS_MAX_SSL_SESSION_SIZE)))
+
 /* The difference between sesscache_entry and sesscache_large_entry is that the
  * buffers in the latter are dynamically allocated from the heap, not
  * allocated out of the shm segment.  The large_entry struct is used for
@@ -96,44 +156,26 @@ struct sesscache_large_entry {
   const unsigned char *sess_data;
 };
 
-/* The number of entries in the list is determined at run-time, based on
- * the maximum desired size of the shared memory segment.
+/* The number of stripes is determined at run-time, based on the maximum
+ * desired size of the shared memory segment.  The stripes directly follow
+ * this header.
  */
 struct sesscache_data {
+  unsigned int magic;
 
-  /* Cache metadata. */
-  unsigned int nhits;
-  unsigned int nmisses;
-
-  unsigned int nstored;
-  unsigned int ndeleted;
-  unsigned int nexpired;
-  unsigned int nerrors;
+  unsigned int nstripes;
 
   /* This tracks the number of sessions that could not be added because
    * they exceeded TLS_MAX_SSL_SESSION_SIZE.
    */
   unsigned int nexceeded;
   unsigned int exceeded_maxsz;
-
-  /* Track the timestamp of the next session to expire in the cache; used
-   * as an optimization when flushing the cache of expired sessions.
-   */
-  time_t next_expiring;
-
-  /* These listlen/listsz track the number of entries in the cache and total
-   * entries possible, and thus can be used for determining the fullness of
-   * the cache.
-   */
-  unsigned int sd_listlen, sd_listsz;
-
-  /* It is important that this field be the last in the struct! */
-  struct sesscache_entry *sd_entries;
 };
 
 static tls_sess_cache_t sess_cache;
 static struct sesscache_data *sesscache_data = NULL;
 static size_t sesscache_datasz = 0;
+static unsigned char *sesscache_stripes = NULL;
 static int sesscache_shmid = -1;
 static pr_fh_t *sesscache_fh = NULL;
 static array_header *sesscache_sess_list = NULL;
@@ -290,7 +332,8 @@ static const char *shmcache_get_lock_desc(int lock_type) {
  * if the process dies tragically.  Could possibly deal with this in an
  * exit event handler, though.  Something to keep in mind.
  */
-static int shmcache_lock_shm(pr_fh_t *fh, int lock_type) {
+static int shmcache_lock_shm_range(pr_fh_t *fh, int lock_type, off_t start,
+    off_t len) {
   const char *lock_desc;
   int fd;
   struct flock lock;
@@ -298,14 +341,15 @@ static int shmcache_lock_shm(pr_fh_t *fh, int lock_type) {
 
   lock.l_type = lock_type;
   lock.l_whence = SEEK_SET;
-  lock.l_start = 0;
-  lock.l_len = 0;
+  lock.l_start = start;
+  lock.l_len = len;
 
   fd = PR_FH_FD(fh);
   lock_desc = shmcache_get_lock_desc(lock_type);
 
-  pr_trace_msg(trace_channel, 19, "attempting to %s shmcache fd %d", lock_desc,
-    fd);
+  pr_trace_msg(trace_channel, 19, "attempting to %s shmcache fd %d "
+    "(start %" PR_LU ", len %" PR_LU ")", lock_desc, fd, (pr_off_t) start,
+    (pr_off_t) len);
 
   while (fcntl(fd, F_SETLK, &lock) < 0) {
     int xerrno = errno;
@@ -353,6 +397,11 @@ static int shmcache_lock_shm(pr_fh_t *fh, int lock_type) {
   return 0;
 }
 
+/* Locks the entire shm. */
+static int shmcache_lock_shm(pr_fh_t *fh, int lock_type) {
+  return shmcache_lock_shm_range(fh, lock_type, 0, 0);
+}
+
 /* Use a hash function to hash the given lookup key to a slot in the entries
  * list.  This hash, module the number of entries, is the initial iteration
  * start point.  This will hopefully avoid having to do many linear scans for
@@ -363,9 +412,9 @@ static int shmcache_lock_shm(pr_fh_t *fh, int lock_type) {
 static unsigned int shmcache_hash(const unsigned char *id, unsigned int len) {
   unsigned int i = 0;
   size_t sz = len;
+  const unsigned char *k = id;
 
   while (sz--) {
-    const unsigned char *k = id;
     unsigned int c = *k;
     k++;
 
@@ -529,22 +578,44 @@ static void *shmcache_get_shm(pr_fh_t *fh, size_t *shm_size, int project_id,
   return data;
 }
 
+/* Returns the given slot of the given stripe; the small session slots come
+ * first.
+ */
+static struct sesscache_entry *sess_cache_get_entry(unsigned char *stripe,
+    unsigned int slot) {
+  size_t offset;
+
+  offset = SESSCACHE_STRIPE_HEADER_SIZE;
+
+  if (slot < TLS_SHMCACHE_STRIPE_SMALL_SLOTS) {
+    offset += slot * SESSCACHE_SLOT_SIZE(TLS_SHMCACHE_SMALL_SESSION_SIZE);
+
+  } else {
+    offset += (TLS_SHMCACHE_STRIPE_SMALL_SLOTS *
+      SESSCACHE_SLOT_SIZE(TLS_SHMCACHE_SMALL_SESSION_SIZE)) +
+      ((slot - TLS_SHMCACHE_STRIPE_SMALL_SLOTS) *
+        SESSCACHE_SLOT_SIZE(TLS_MAX_SSL_SESSION_SIZE));
+  }
+
+  return (struct sesscache_entry *) (stripe + offset);
+}
+
+#define SESSCACHE_HEADER_SIZE \
+  ((sizeof(struct sesscache_data) + 15) & ~((size_t) 15))
+
 static struct sesscache_data *sess_cache_get_shm(pr_fh_t *fh,
     size_t requested_size) {
   int shmid, xerrno = 0;
   struct sesscache_data *data = NULL;
   size_t shm_size;
-  unsigned int shm_sess_max = 0;
+  unsigned int nstripes = 0;
 
-  /* Calculate the size to allocate.  First, calculate the maximum number
-   * of sessions we can cache, given the configured size.  Then
-   * calculate the shm segment size to allocate to hold that number of
-   * sessions.
+  /* Calculate the size to allocate.  First, calculate the number of stripes
+   * we can have, given the configured size.  Then calculate the shm segment
+   * size to allocate to hold that number of stripes.
    */
-  shm_sess_max = (requested_size - sizeof(struct sesscache_data)) /
-    (sizeof(struct sesscache_entry));
-  shm_size = sizeof(struct sesscache_data) +
-    (shm_sess_max * sizeof(struct sesscache_entry));
+  nstripes = (requested_size - SESSCACHE_HEADER_SIZE) / SESSCACHE_STRIPE_SIZE;
+  shm_size = SESSCACHE_HEADER_SIZE + (nstripes * SESSCACHE_STRIPE_SIZE);
 
   data = shmcache_get_shm(fh, &shm_size, TLS_SHMCACHE_SESS_PROJECT_ID, &shmid);
   if (data == NULL) {
@@ -561,11 +632,55 @@ static struct sesscache_data *sess_cache_get_shm(pr_fh_t *fh,
   sesscache_datasz = shm_size;
   sesscache_shmid = shmid;
   pr_trace_msg(trace_channel, 9,
-    "using shm ID %d for sesscache path '%s' (%u sessions)", sesscache_shmid,
-    fh->fh_path, shm_sess_max);
+    "using shm ID %d for sesscache path '%s' (%u stripes, %u sessions)",
+    sesscache_shmid, fh->fh_path, nstripes,
+    nstripes * TLS_SHMCACHE_STRIPE_SLOTS);
+
+  sesscache_stripes = ((unsigned char *) data) + SESSCACHE_HEADER_SIZE;
+
+  /* A newly created shm is zeroed; a shm left behind by a different version
+   * of this module may have a different layout.  Either way, (re)initialize
+   * it.
+   */
+  if (data->magic != TLS_SHMCACHE_SESS_MAGIC ||
+      data->nstripes != nstripes) {
+    if (shmcache_lock_shm(fh, F_WRLCK) < 0) {
+      pr_trace_msg(trace_channel, 1, "error write-locking shm: %s",
+        strerror(errno));
+    }
+
+    if (data->magic != TLS_SHMCACHE_SESS_MAGIC ||
+        data->nstripes != nstripes) {
+      register unsigned int i;
+
+      pr_trace_msg(trace_channel, 9, "initializing sesscache shm ID %d",
+        sesscache_shmid);
+
+      memset(data, 0, shm_size);
+
+      for (i = 0; i < nstripes; i++) {
+        register unsigned int j;
+        unsigned char *stripe;
+
+        stripe = sesscache_stripes + (i * SESSCACHE_STRIPE_SIZE);
+        for (j = 0; j < TLS_SHMCACHE_STRIPE_SLOTS; j++) {
+          struct sesscache_entry *entry;
 
-  data->sd_entries = (struct sesscache_entry *) (data + 1);
-  data->sd_listsz = shm_sess_max;
+          entry = sess_cache_get_entry(stripe, j);
+          entry->sess_datasz = (j < TLS_SHMCACHE_STRIPE_SMALL_SLOTS) ?
+            TLS_SHMCACHE_SMALL_SESSION_SIZE : TLS_MAX_SSL_SESSION_SIZE;
+        }
+      }
+
+      data->nstripes = nstripes;
+      data->magic = TLS_SHMCACHE_SESS_MAGIC;
+    }
+
+    if (shmcache_lock_shm(fh, F_UNLCK) < 0) {
+      pr_trace_msg(trace_channel, 1, "error unlocking shm: %s",
+        strerror(errno));
+    }
+  }
 
   return data;
 }
@@ -616,83 +731,73 @@ static struct ocspcache_data *ocsp_cache_get_shm(pr_fh_t *fh,
 /* SSL session cache implementation callbacks.
  */
 
-/* Scan the entire list, clearing out expired sessions.  Logs the number
- * of sessions that expired and updates the header stat.
- *
- * NOTE: Callers are assumed to handle the locking of the shm before/after
- * calling this function!
+/* Returns the stripe in which the session with the given ID is stored, and
+ * its index.
  */
-static unsigned int sess_cache_flush(void) {
-  register unsigned int i;
-  unsigned int flushed = 0;
-  time_t now, next_expiring = 0;
-
-  now = time(NULL);
-
-  /* We always scan the in-memory large session entry list. */
-  if (sesscache_sess_list != NULL) {
-    struct sesscache_large_entry *entries;
-
-    entries = sesscache_sess_list->elts;
-    for (i = 0; i < sesscache_sess_list->nelts; i++) {
-      struct sesscache_large_entry *entry;
-
-      entry = &(entries[i]);
+static unsigned char *sess_cache_get_stripe(const unsigned char *sess_id,
+    unsigned int sess_id_len, unsigned int *stripe_idx) {
+  *stripe_idx = shmcache_hash(sess_id, sess_id_len) % sesscache_data->nstripes;
+  return sesscache_stripes + (*stripe_idx * SESSCACHE_STRIPE_SIZE);
+}
 
-      if (entry->expires > now) {
-        /* This entry has expired; clear its slot. */
-        entry->expires = 0;
-        pr_memscrub((void *) entry->sess_data, entry->sess_datalen);
-      }
-    }
-  }
+/* Each stripe has its own lock: the byte of the cache file at the stripe's
+ * index.  Whole-cache operations lock the entire file, which conflicts with
+ * all of the stripe locks.
+ */
+static int sess_cache_lock_stripe(unsigned int stripe_idx, int lock_type) {
+  return shmcache_lock_shm_range(sesscache_fh, lock_type, (off_t) stripe_idx,
+    1);
+}
 
-  /* If now is earlier than the earliest expiring session in the cache,
-   * then a scan will be pointless.
-   */
-  if (now < sesscache_data->next_expiring) {
-    unsigned int secs;
+/* Scrubs the given slot, and marks it as unused. */
+static void sess_cache_clear_entry(struct sesscache_entry *entry) {
+  pr_memscrub(SESSCACHE_ENTRY_DATA(entry), entry->sess_datalen);
+  entry->expires = 0;
+  entry->last_used = 0;
+  entry->sess_id_len = 0;
+  entry->sess_datalen = 0;
+}
 
-    secs = sesscache_data->next_expiring - now;
-    tls_log("shmcache: no expired sessions to flush; %u secs to next "
-      "expiration", secs);
-    return 0;
-  }
+/* Returns the stripe's slot in which the given session is cached, if any.
+ * Expired sessions found along the way are cleared.
+ *
+ * NOTE: Callers are assumed to handle the locking of the stripe before/after
+ * calling this function!
+ */
+static struct sesscache_entry *sess_cache_find_entry(unsigned char *stripe,
+    const unsigned char *sess_id, unsigned int sess_id_len, time_t now) {
+  register unsigned int i;
+  struct sesscache_stripe *hdr;
 
-  tls_log("shmcache: flushing session cache of expired sessions");
+  hdr = (struct sesscache_stripe *) stripe;
 
-  for (i = 0; i < sesscache_data->sd_listsz; i++) {
+  for (i = 0; i < TLS_SHMCACHE_STRIPE_SLOTS; i++) {
     struct sesscache_entry *entry;
 
-    entry = &(sesscache_data->sd_entries[i]);
-    if (entry->expires > 0) {
-      if (entry->expires > now) {
-        if (entry->expires < next_expiring) {
-          next_expiring = entry->expires;
-        }
-
-      } else {
-        /* This entry has expired; clear its slot. */
-        entry->expires = 0;
-        pr_memscrub((void *) entry->sess_data, entry->sess_datalen);
-
-        /* Don't forget to update the stats. */
-        sesscache_data->nexpired++;
+    entry = sess_cache_get_entry(stripe, i);
+    if (entry->expires == 0) {
+      continue;
+    }
 
-        if (sesscache_data->sd_listlen > 0) {
-          sesscache_data->sd_listlen--;
-        }
+    if (entry->expires <= now) {
+      /* This entry has expired; clear its slot. */
+      sess_cache_clear_entry(entry);
+      hdr->nexpired++;
 
-        flushed++;
+      if (hdr->listlen > 0) {
+        hdr->listlen--;
       }
+
+      continue;
     }
 
-    sesscache_data->next_expiring = next_expiring;
+    if (entry->sess_id_len == sess_id_len &&
+        memcmp(entry->sess_id, sess_id, sess_id_len) == 0) {
+      return entry;
+    }
   }
 
-  tls_log("shmcache: flushed %u expired %s from session cache", flushed,
-    flushed != 1 ? "sessions" : "session");
-  return flushed;
+  return NULL;
 }
 
 static int sess_cache_open(tls_sess_cache_t *cache, char *info, long timeout) {
@@ -734,15 +839,14 @@ static int sess_cache_open(tls_sess_cache_t *cache, char *info, long timeout) {
         pr_trace_msg(trace_channel, 1,
           "badly formatted size parameter '%s', ignoring", ptr + 1);
 
-        /* Default size of 1.5M.  That should hold around 100 sessions. */
+        /* Default size of 1.5M.  That should hold around 500 sessions. */
         requested_size = 1538 * 1024;
 
       } else {
         size_t min_size;
 
-        /* The bare minimum size MUST be able to hold at least one session. */
-        min_size = sizeof(struct sesscache_data) +
-          sizeof(struct sesscache_entry);
+        /* The bare minimum size MUST be able to hold at least one stripe. */
+        min_size = SESSCACHE_HEADER_SIZE + SESSCACHE_STRIPE_SIZE;
 
         if ((size_t) size < min_size) {
           pr_trace_msg(trace_channel, 1,
@@ -750,7 +854,7 @@ static int sess_cache_open(tls_sess_cache_t *cache, char *info, long timeout) {
             "(%lu bytes), ignoring", (unsigned long) size,
             (unsigned long) min_size);
         
-          /* Default size of 1.5M.  That should hold around 100 sessions. */
+          /* Default size of 1.5M.  That should hold around 500 sessions. */
           requested_size = 1538 * 1024;
 
         } else {
@@ -762,14 +866,14 @@ static int sess_cache_open(tls_sess_cache_t *cache, char *info, long timeout) {
       pr_trace_msg(trace_channel, 1, 
         "badly formatted size parameter '%s', ignoring", ptr + 1);
 
-      /* Default size of 1.5M.  That should hold around 100 sessions. */
+      /* Default size of 1.5M.  That should hold around 500 sessions. */
       requested_size = 1538 * 1024;
     }
 
     *ptr = '\0';
 
   } else {
-    /* Default size of 1.5M.  That should hold around 100 sessions. */
+    /* Default size of 1.5M.  That should hold around 500 sessions. */
     requested_size = 1538 * 1024;
   }
 
@@ -940,6 +1044,7 @@ static int sess_cache_close(tls_sess_cache_t *cache) {
     }
 
     sesscache_data = NULL;
+    sesscache_stripes = NULL;
   }
 
   pr_fsio_close(sesscache_fh);
@@ -984,25 +1089,24 @@ static int sess_cache_add_large_sess(tls_sess_cache_t *cache,
     for (i = 0; i < sesscache_sess_list->nelts; i++) {
       entry = &(entries[i]);
 
-      if (entry->expires > now) {
+      if (entry->expires <= now) {
         /* This entry has expired; clear and reuse its slot. */
         entry->expires = 0;
         pr_memscrub((void *) entry->sess_data, entry->sess_datalen);
 
         break;
       }
+
+      entry = NULL;
     }
 
   } else {
     sesscache_sess_list = make_array(cache->cache_pool, 1,
       sizeof(struct sesscache_large_entry));
-    entry = push_array(sesscache_sess_list);
   }
 
-  /* Be defensive, and catch the case where entry might still be null here. */
   if (entry == NULL) {
-    errno = EPERM;
-    return -1;
+    entry = push_array(sesscache_sess_list);
   }
 
   entry->expires = expires;
@@ -1019,8 +1123,12 @@ static int sess_cache_add_large_sess(tls_sess_cache_t *cache,
 static int sess_cache_add(tls_sess_cache_t *cache, const unsigned char *sess_id,
     unsigned int sess_id_len, time_t expires, SSL_SESSION *sess) {
   register unsigned int i;
-  unsigned int h, idx, last;
-  int found_slot = FALSE, need_lock = TRUE, res = 0, sess_len;
+  unsigned int first_slot, stripe_idx;
+  int sess_len;
+  unsigned char *ptr, *stripe;
+  struct sesscache_stripe *hdr;
+  struct sesscache_entry *entry, *lru_entry = NULL;
+  time_t now;
 
   pr_trace_msg(trace_channel, 9, "adding session to shmcache session cache %p",
     cache);
@@ -1048,120 +1156,96 @@ static int sess_cache_add(tls_sess_cache_t *cache, const unsigned char *sess_id,
       sess, sess_len);
   }
 
-  if (sesscache_data->sd_listlen == sesscache_data->sd_listsz) {
-    /* It appears that the cache is full.  Try flushing any expired
-     * sessions.
-     */
-
-    if (shmcache_lock_shm(sesscache_fh, F_WRLCK) == 0) {
-      if (sess_cache_flush() > 0) {
-        /* If we made room, then do NOT release the lock; we keep the lock
-         * so that we can add the session.
-         */
-        need_lock = FALSE;
-
-      } else {
-        /* Release the lock, and use the "large session" list fallback. */
-        if (shmcache_lock_shm(sesscache_fh, F_UNLCK) < 0) {
-          tls_log("shmcache: error unlocking shmcache: %s", strerror(errno));
-        }
-
-        return sess_cache_add_large_sess(cache, sess_id, sess_id_len, expires,
-          sess, sess_len);
-      }
+  stripe = sess_cache_get_stripe(sess_id, sess_id_len, &stripe_idx);
+  hdr = (struct sesscache_stripe *) stripe;
 
-    } else {
-      tls_log("shmcache: unable to flush shm cache: error write-locking "
-        "shmcache: %s", strerror(errno));
+  if (sess_cache_lock_stripe(stripe_idx, F_WRLCK) < 0) {
+    tls_log("shmcache: unable to add session to shm cache: error "
+      "write-locking shmcache: %s", strerror(errno));
 
-      /* Add this session to the "large session" list instead as a fallback. */
-      return sess_cache_add_large_sess(cache, sess_id, sess_id_len, expires,
-        sess, sess_len);
-    }
+    /* Add this session to the "large session" list instead as a fallback. */
+    return sess_cache_add_large_sess(cache, sess_id, sess_id_len, expires,
+      sess, sess_len);
   }
 
-  /* Hash the key, start looking for an open slot. */
-  h = shmcache_hash(sess_id, sess_id_len);
-  idx = h % sesscache_data->sd_listsz;
+  now = time(NULL);
 
-  if (need_lock) {
-    if (shmcache_lock_shm(sesscache_fh, F_WRLCK) < 0) {
-      tls_log("shmcache: unable to add session to shm cache: error "
-        "write-locking shmcache: %s", strerror(errno));
+  /* If this session is already cached, it is replaced. */
+  entry = sess_cache_find_entry(stripe, sess_id, sess_id_len, now);
+  if (entry != NULL) {
+    sess_cache_clear_entry(entry);
 
-      /* Add this session to the "large session" list instead as a fallback. */
-      return sess_cache_add_large_sess(cache, sess_id, sess_id_len, expires,
-        sess, sess_len);
+    if (hdr->listlen > 0) {
+      hdr->listlen--;
     }
-  }
-
-  i = idx;
-  last = idx > 0 ? (idx - 1) : 0;
 
-  do {
-    struct sesscache_entry *entry;
-
-    pr_signals_handle();
-
-    /* Look for the first open slot (i.e. expires == 0). */
-    entry = &(sesscache_data->sd_entries[i]);
-    if (entry->expires == 0) {
-      unsigned char *ptr;
-
-      entry->expires = expires;
-      entry->sess_id_len = sess_id_len;
-      memcpy(entry->sess_id, sess_id, sess_id_len);
-      entry->sess_datalen = sess_len;
-
-      ptr = entry->sess_data;
-      i2d_SSL_SESSION(sess, &ptr);
+    entry = NULL;
+  }
 
-      sesscache_data->sd_listlen++;
-      sesscache_data->nstored++;
+  /* Small sessions may use any free slot, but only evict other small
+   * sessions; large sessions can only use the large slots.
+   */
+  first_slot = ((size_t) sess_len <= TLS_SHMCACHE_SMALL_SESSION_SIZE) ? 0 :
+    TLS_SHMCACHE_STRIPE_SMALL_SLOTS;
 
-      if (sesscache_data->next_expiring > 0) {
-        if (expires < sesscache_data->next_expiring) {
-          sesscache_data->next_expiring = expires;
-        }
+  for (i = first_slot; i < TLS_SHMCACHE_STRIPE_SLOTS; i++) {
+    struct sesscache_entry *slot;
 
-      } else {
-        sesscache_data->next_expiring = expires;
-      }
+    slot = sess_cache_get_entry(stripe, i);
+    if (slot->sess_datasz < (unsigned int) sess_len) {
+      continue;
+    }
 
-      found_slot = TRUE;
+    if (slot->expires == 0) {
+      entry = slot;
       break;
     }
 
-    if (i < sesscache_data->sd_listsz) {
-      i++;
+    if (first_slot == 0 &&
+        i >= TLS_SHMCACHE_STRIPE_SMALL_SLOTS) {
+      continue;
+    }
 
-    } else {
-      i = 0;
+    if (lru_entry == NULL ||
+        slot->last_used < lru_entry->last_used) {
+      lru_entry = slot;
     }
+  }
 
-  } while (i != last);
+  if (entry == NULL) {
+    /* Evict the least recently used session. */
+    entry = lru_entry;
+    sess_cache_clear_entry(entry);
+    hdr->nevicted++;
 
-  /* There is a race condition possible between the open slots check
-   * above and the scan through the slots.  So if we didn't actually find
-   * an open slot at this point, add it to the "large session" list.
-   */
-  if (!found_slot) {
-    res = sess_cache_add_large_sess(cache, sess_id, sess_id_len, expires, sess,
-      sess_len);
+    if (hdr->listlen > 0) {
+      hdr->listlen--;
+    }
   }
 
-  if (need_lock) {
-    if (shmcache_lock_shm(sesscache_fh, F_UNLCK) < 0) {
-      tls_log("shmcache: error unlocking shmcache: %s", strerror(errno));
-    }
+  entry->expires = expires;
+  entry->last_used = now;
+  entry->sess_id_len = sess_id_len;
+  memcpy(entry->sess_id, sess_id, sess_id_len);
+  entry->sess_datalen = sess_len;
+
+  ptr = SESSCACHE_ENTRY_DATA(entry);
+  i2d_SSL_SESSION(sess, &ptr);
+
+  hdr->listlen++;
+  hdr->nstored++;
+
+  if (sess_cache_lock_stripe(stripe_idx, F_UNLCK) < 0) {
+    tls_log("shmcache: error unlocking shmcache: %s", strerror(errno));
   }
 
-  return res;
+  return 0;
 }
 
 static SSL_SESSION *sess_cache_get(tls_sess_cache_t *cache,
     const unsigned char *sess_id, unsigned int sess_id_len) {
-  unsigned int h, idx;
+  unsigned int stripe_idx;
+  unsigned char *stripe;
   SSL_SESSION *sess = NULL;
 
   pr_trace_msg(trace_channel, 9,
@@ -1183,7 +1267,7 @@ static SSL_SESSION *sess_cache_get(tls_sess_cache_t *cache,
         time_t now;
 
         now = time(NULL);
-        if (entry->expires <= now) {
+        if (entry->expires > now) {
           TLS_D2I_SSL_SESSION_CONST unsigned char *ptr;
 
           ptr = entry->sess_data;
@@ -1204,63 +1288,40 @@ static SSL_SESSION *sess_cache_get(tls_sess_cache_t *cache,
     return sess;
   }
 
-  h = shmcache_hash(sess_id, sess_id_len);
-  idx = h % sesscache_data->sd_listsz;
-
-  if (shmcache_lock_shm(sesscache_fh, F_WRLCK) == 0) {
-    register unsigned int i;
-    unsigned int last;
-
-    i = idx;
-    last = idx > 0 ? (idx -1) : 0;
+  stripe = sess_cache_get_stripe(sess_id, sess_id_len, &stripe_idx);
 
-    do {
-      struct sesscache_entry *entry;
+  if (sess_cache_lock_stripe(stripe_idx, F_WRLCK) == 0) {
+    struct sesscache_stripe *hdr;
+    struct sesscache_entry *entry;
+    time_t now;
 
-      pr_signals_handle();
+    hdr = (struct sesscache_stripe *) stripe;
+    now = time(NULL);
 
-      entry = &(sesscache_data->sd_entries[i]);
-      if (entry->expires > 0 &&
-          entry->sess_id_len == sess_id_len &&
-          memcmp(entry->sess_id, sess_id, entry->sess_id_len) == 0) {
-        time_t now;
+    entry = sess_cache_find_entry(stripe, sess_id, sess_id_len, now);
+    if (entry != NULL) {
+      TLS_D2I_SSL_SESSION_CONST unsigned char *ptr;
 
+      ptr = SESSCACHE_ENTRY_DATA(entry);
+      sess = d2i_SSL_SESSION(NULL, &ptr, entry->sess_datalen);
+      if (sess != NULL) {
         /* Don't forget to update the stats. */
-        now = time(NULL);
-
-        if (entry->expires > now) {
-          TLS_D2I_SSL_SESSION_CONST unsigned char *ptr;
-
-          ptr = entry->sess_data;
-          sess = d2i_SSL_SESSION(NULL, &ptr, entry->sess_datalen);
-          if (sess != NULL) {
-            sesscache_data->nhits++;
-
-          } else {
-            tls_log("shmcache: error retrieving session from session cache: %s",
-              shmcache_get_errors());
-            sesscache_data->nerrors++;
-          }
-        }
-
-        break;
-      }
-
-      if (i < sesscache_data->sd_listsz) {
-        i++;
+        hdr->nhits++;
+        entry->last_used = now;
 
       } else {
-        i = 0;
+        tls_log("shmcache: error retrieving session from session cache: %s",
+          shmcache_get_errors());
+        hdr->nerrors++;
       }
-
-    } while (i != last);
+    }
 
     if (sess == NULL) {
-      sesscache_data->nmisses++;
+      hdr->nmisses++;
       errno = ENOENT;
     }
 
-    if (shmcache_lock_shm(sesscache_fh, F_UNLCK) < 0) {
+    if (sess_cache_lock_stripe(stripe_idx, F_UNLCK) < 0) {
       tls_log("shmcache: error unlocking shmcache: %s", strerror(errno));
     }
 
@@ -1276,7 +1337,8 @@ static SSL_SESSION *sess_cache_get(tls_sess_cache_t *cache,
 
 static int sess_cache_delete(tls_sess_cache_t *cache,
     const unsigned char *sess_id, unsigned int sess_id_len) {
-  unsigned int h, idx;
+  unsigned int stripe_idx;
+  unsigned char *stripe;
   int res;
 
   pr_trace_msg(trace_channel, 9,
@@ -1302,55 +1364,30 @@ static int sess_cache_delete(tls_sess_cache_t *cache,
     }
   }
 
-  h = shmcache_hash(sess_id, sess_id_len);
-  idx = h % sesscache_data->sd_listsz;
-
-  if (shmcache_lock_shm(sesscache_fh, F_WRLCK) == 0) {
-    register unsigned int i;
-    unsigned int last;
-
-    i = idx;
-    last = idx > 0 ? (idx - 1) : 0;
-
-    do {
-      struct sesscache_entry *entry;
-
-      pr_signals_handle();
+  stripe = sess_cache_get_stripe(sess_id, sess_id_len, &stripe_idx);
 
-      entry = &(sesscache_data->sd_entries[i]);
-      if (entry->sess_id_len == sess_id_len &&
-          memcmp(entry->sess_id, sess_id, entry->sess_id_len) == 0) {
-        time_t now;
-
-        pr_memscrub((void *) entry->sess_data, entry->sess_datalen);
-
-        if (sesscache_data->sd_listlen > 0) {
-          sesscache_data->sd_listlen--;
-        }
-
-        /* Don't forget to update the stats. */
-        now = time(NULL);
-        if (entry->expires > now) {
-          sesscache_data->ndeleted++;
+  if (sess_cache_lock_stripe(stripe_idx, F_WRLCK) == 0) {
+    struct sesscache_stripe *hdr;
+    struct sesscache_entry *entry;
 
-        } else {
-          sesscache_data->nexpired++;
-        }
+    hdr = (struct sesscache_stripe *) stripe;
 
-        entry->expires = 0;
-        break;
-      }
-
-      if (i < sesscache_data->sd_listsz) {
-        i++;
+    /* Note that expired sessions are cleared, and counted, when looking
+     * for the session.
+     */
+    entry = sess_cache_find_entry(stripe, sess_id, sess_id_len, time(NULL));
+    if (entry != NULL) {
+      sess_cache_clear_entry(entry);
 
-      } else {
-        i = 0;
+      if (hdr->listlen > 0) {
+        hdr->listlen--;
       }
 
-    } while (i != last);
+      /* Don't forget to update the stats. */
+      hdr->ndeleted++;
+    }
 
-    if (shmcache_lock_shm(sesscache_fh, F_UNLCK) < 0) {
+    if (sess_cache_lock_stripe(stripe_idx, F_UNLCK) < 0) {
       tls_log("shmcache: error unlocking shmcache: %s", strerror(errno));
     }
 
@@ -1369,7 +1406,7 @@ static int sess_cache_delete(tls_sess_cache_t *cache,
 
 static int sess_cache_clear(tls_sess_cache_t *cache) {
   register unsigned int i;
-  int res;
+  int res = 0;
 
   pr_trace_msg(trace_channel, 9, "clearing shmcache session cache %p", cache);
 
@@ -1397,17 +1434,21 @@ static int sess_cache_clear(tls_sess_cache_t *cache) {
     return -1;
   }
 
-  for (i = 0; i < sesscache_data->sd_listsz; i++) {
-    struct sesscache_entry *entry;
+  for (i = 0; i < sesscache_data->nstripes; i++) {
+    register unsigned int j;
+    unsigned char *stripe;
+    struct sesscache_stripe *hdr;
 
-    entry = &(sesscache_data->sd_entries[i]);
+    stripe = sesscache_stripes + (i * SESSCACHE_STRIPE_SIZE);
+    hdr = (struct sesscache_stripe *) stripe;
 
-    entry->expires = 0;
-    pr_memscrub((void *) entry->sess_data, entry->sess_datalen);
-  }
+    for (j = 0; j < TLS_SHMCACHE_STRIPE_SLOTS; j++) {
+      sess_cache_clear_entry(sess_cache_get_entry(stripe, j));
+    }
 
-  res = sesscache_data->sd_listlen; 
-  sesscache_data->sd_listlen = 0;
+    res += hdr->listlen;
+    hdr->listlen = 0;
+  }
 
   if (shmcache_lock_shm(sesscache_fh, F_UNLCK) < 0) {
     tls_log("shmcache: error unlocking shmcache: %s", strerror(errno));
@@ -1464,9 +1505,11 @@ static int sess_cache_remove(tls_sess_cache_t *cache) {
 
 static int sess_cache_status(tls_sess_cache_t *cache,
     void (*statusf)(void *, const char *, ...), void *arg, int flags) {
+  register unsigned int i;
   int res, xerrno = 0;
   struct shmid_ds ds;
   pool *tmp_pool;
+  struct sesscache_stripe totals;
 
   pr_trace_msg(trace_channel, 9, "checking shmcache session cache %p", cache);
 
@@ -1501,19 +1544,42 @@ static int sess_cache_status(tls_sess_cache_t *cache,
       sesscache_shmid, strerror(xerrno));
   } 
 
+  /* The stats are kept per stripe. */
+  memset(&totals, 0, sizeof(totals));
+  for (i = 0; i < sesscache_data->nstripes; i++) {
+    struct sesscache_stripe *hdr;
+
+    hdr = (struct sesscache_stripe *)
+      (sesscache_stripes + (i * SESSCACHE_STRIPE_SIZE));
+
+    totals.nhits += hdr->nhits;
+    totals.nmisses += hdr->nmisses;
+    totals.nstored += hdr->nstored;
+    totals.ndeleted += hdr->ndeleted;
+    totals.nexpired += hdr->nexpired;
+    totals.nevicted += hdr->nevicted;
+    totals.nerrors += hdr->nerrors;
+    totals.listlen += hdr->listlen;
+  }
+
   statusf(arg, "%s", "");
-  statusf(arg, "Max session cache size: %u", sesscache_data->sd_listsz);
-  statusf(arg, "Current session cache size: %u", sesscache_data->sd_listlen);
+  statusf(arg, "Max session cache size: %u",
+    sesscache_data->nstripes * TLS_SHMCACHE_STRIPE_SLOTS);
+  statusf(arg, "Current session cache size: %u", totals.listlen);
+  statusf(arg, "Session cache stripes: %u (%u small, %u large sessions each)",
+    sesscache_data->nstripes, TLS_SHMCACHE_STRIPE_SMALL_SLOTS,
+    TLS_SHMCACHE_STRIPE_LARGE_SLOTS);
   statusf(arg, "%s", "");
-  statusf(arg, "Cache lifetime hits: %u", sesscache_data->nhits);
-  statusf(arg, "Cache lifetime misses: %u", sesscache_data->nmisses);
+  statusf(arg, "Cache lifetime hits: %u", totals.nhits);
+  statusf(arg, "Cache lifetime misses: %u", totals.nmisses);
   statusf(arg, "%s", "");
-  statusf(arg, "Cache lifetime sessions stored: %u", sesscache_data->nstored);
-  statusf(arg, "Cache lifetime sessions deleted: %u", sesscache_data->ndeleted);
-  statusf(arg, "Cache lifetime sessions expired: %u", sesscache_data->nexpired);
+  statusf(arg, "Cache lifetime sessions stored: %u", totals.nstored);
+  statusf(arg, "Cache lifetime sessions deleted: %u", totals.ndeleted);
+  statusf(arg, "Cache lifetime sessions expired: %u", totals.nexpired);
+  statusf(arg, "Cache lifetime sessions evicted: %u", totals.nevicted);
   statusf(arg, "%s", "");
   statusf(arg, "Cache lifetime errors handling sessions in cache: %u",
-    sesscache_data->nerrors);
+    totals.nerrors);
   statusf(arg, "Cache lifetime sessions exceeding max entry size: %u",
     sesscache_data->nexceeded);
   if (sesscache_data->nexceeded > 0) {
@@ -1522,12 +1588,10 @@ static int sess_cache_status(tls_sess_cache_t *cache,
   }
 
   if (flags & TLS_SESS_CACHE_STATUS_FL_SHOW_SESSIONS) {
-    register unsigned int i;
-
     statusf(arg, "%s", "");
     statusf(arg, "%s", "Cached sessions:");
 
-    if (sesscache_data->sd_listlen == 0) {
+    if (totals.listlen == 0) {
       statusf(arg, "%s", "  (none)");
     }
 
@@ -1541,19 +1605,21 @@ static int sess_cache_status(tls_sess_cache_t *cache,
      * of rolling our own printing function.
      */
 
-    for (i = 0; i < sesscache_data->sd_listsz; i++) {
+    for (i = 0; i < sesscache_data->nstripes * TLS_SHMCACHE_STRIPE_SLOTS; i++) {
       struct sesscache_entry *entry;
 
       pr_signals_handle();
 
-      entry = &(sesscache_data->sd_entries[i]);
+      entry = sess_cache_get_entry(sesscache_stripes +
+        ((i / TLS_SHMCACHE_STRIPE_SLOTS) * SESSCACHE_STRIPE_SIZE),
+        i % TLS_SHMCACHE_STRIPE_SLOTS);
       if (entry->expires > 0) {
         SSL_SESSION *sess;
         TLS_D2I_SSL_SESSION_CONST unsigned char *ptr;
         time_t ts;
         int ssl_version;
 
-        ptr = entry->sess_data;
+        ptr = SESSCACHE_ENTRY_DATA(entry);
         sess = d2i_SSL_SESSION(NULL, &ptr, entry->sess_datalen); 
         if (sess == NULL) {
           pr_log_pri(PR_LOG_NOTICE, MOD_TLS_SHMCACHE_VERSION
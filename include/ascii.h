@@ -63,4 +63,12 @@ int pr_ascii_ftp_from_crlf(pool *p, char *in, size_t inlen, char **out,
 int pr_ascii_ftp_to_crlf(pool *p, char *in, size_t inlen, char **out,
   size_t *outlen);
 
+/* Like `pr_ascii_ftp_to_crlf()`, except that no memory is allocated per call.
+ * If no conversion is needed, the `out' pointer is set to the `in' buffer;
+ * otherwise, the converted data are written into a buffer which is reused
+ * across calls, and which is valid only until the next call.  The caller
+ * MUST NOT free(3) the returned buffer.
+ */
+int pr_ascii_ftp_to_crlf2(char *in, size_t inlen, char **out, size_t *outlen);
+
 #endif /* PR_ASCII_H */
@@ -89,6 +89,13 @@ typedef struct namebind_rec {
  */
 conn_t *pr_ipbind_accept_conn(fd_set *readfds, int *listenfd);
 
+/* Accept a connection on the given listening conn_t, e.g. one returned by
+ * pr_ipbind_get_listeners().  The accepted fd is returned via the `listenfd'
+ * argument; it will be -1 if no connection was pending.  Returns 0 on
+ * success, -1 on failure.
+ */
+int pr_ipbind_accept(conn_t *listener, int *listenfd);
+
 /* Create a new IP-based binding for the server given, using the provided
  * arguments. The new binding is added the list maintained by the bindings
  * layer.  Returns 0 on success, -1 on failure.
@@ -109,6 +116,13 @@ int pr_ipbind_close(const pr_netaddr_t *addr, unsigned int port,
  */
 int pr_ipbind_close_listeners(void);
 
+/* Close and discard all listening connections, including those which would
+ * otherwise be reused when the bindings are next initialized.  This MUST be
+ * followed by free_bindings() and init_bindings(), which will then create
+ * new listening sockets.  Returns 0 on success, -1 on failure.
+ */
+int pr_ipbind_close_listening_conns(void);
+
 /* Search through the given server's configuration records, and for each
  * associated bind configuration found, create an additional IP binding for
  * that bind address.  Honors SocketBindTight, if set.  Returns 0 on
@@ -139,6 +153,13 @@ server_rec *pr_ipbind_get_server(const pr_netaddr_t *addr, unsigned int port);
  */
 int pr_ipbind_listen(fd_set *readfds);
 
+/* Like pr_ipbind_listen(), except that the listening conn_t objects are
+ * returned in an array, rather than as an fd_set.  This allows callers to
+ * use other mechanisms than select(2) for waiting on the listening sockets,
+ * and so to use more listening sockets than FD_SETSIZE allows.
+ */
+array_header *pr_ipbind_get_listeners(void);
+
 /* Prepares the IP-based binding associated with the given server for listening.
  * Returns 0 on success, -1 on failure.
  */
@@ -132,6 +132,28 @@ unsigned int pr_config_get_id(const char *name);
  */
 unsigned int pr_config_set_id(const char *name);
 
+/* Builds an index, keyed by config ID, of the configurations of the given
+ * list of servers; find_config() and friends use this index to avoid walking
+ * every config_rec when searching by name.  Any change to the configuration
+ * makes the index stale; a stale index is rebuilt once the configuration
+ * is searched often enough again.
+ *
+ * Returns 0 on success, or -1 on error, setting errno appropriately.
+ */
+int pr_config_index_build(xaset_t *servers);
+
+/* Marks the config index as stale.  Code which changes the config_rec trees
+ * directly, rather than using the pr_config_add()/pr_config_remove() et al
+ * functions, MUST call this.
+ */
+void pr_config_index_invalidate(void);
+
+/* Returns the generation of the configuration.  The generation changes
+ * whenever the config_rec trees change, allowing callers to cache the
+ * results of searches.
+ */
+unsigned long pr_config_get_generation(void);
+
 void *get_param_ptr(xaset_t *, const char *, int);
 void *get_param_ptr_next(const char *, int);
 
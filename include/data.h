@@ -77,4 +77,10 @@ typedef ssize_t pr_sendfile_t;
 
 pr_sendfile_t pr_data_sendfile(int retr_fd, off_t *offset, off_t count);
 
+/* Moves up to count bytes of uploaded data from the data connection directly
+ * into the given file descriptor, using splice(2).  Returns ENOSYS if not
+ * supported on this platform.
+ */
+int pr_data_splice(int fd, size_t count);
+
 #endif /* PR_DATA_H */
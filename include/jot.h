@@ -183,6 +183,29 @@ int pr_jot_resolve_logfmt(pool *p, cmd_rec *cmd, pr_jot_filters_t *filters,
   int (*on_default)(pool *, pr_jot_ctx_t *, unsigned char),
   int (*on_other)(pool *, pr_jot_ctx_t *, unsigned char *, size_t));
 
+/* This opaque structure is a LogFormat buffer compiled for repeated
+ * resolving.
+ */
+typedef struct jot_plan_rec pr_jot_plan_t;
+
+/* Compiles the given LogFormat buffer into a plan, allocated from the given
+ * pool.  The literal text segments and variable arguments (e.g. the name
+ * in "%{note:name}") are extracted once, here, rather than on every resolving
+ * of the LogFormat.
+ */
+pr_jot_plan_t *pr_jot_compile_logfmt(pool *p, unsigned char *logfmt);
+
+/* Same as pr_jot_resolve_logfmt(), using a compiled plan rather than the
+ * LogFormat buffer.  Note that the text given to the `on_other` callback
+ * belongs to the plan, and must not be modified.
+ */
+int pr_jot_resolve_plan(pool *p, cmd_rec *cmd, pr_jot_filters_t *filters,
+  pr_jot_plan_t *plan, pr_jot_ctx_t *ctx,
+  int (*on_meta)(pool *, pr_jot_ctx_t *, unsigned char, const char *,
+    const void *),
+  int (*on_default)(pool *, pr_jot_ctx_t *, unsigned char),
+  int (*on_other)(pool *, pr_jot_ctx_t *, unsigned char *, size_t));
+
 /* Canned `on_meta` callback to use when resolving LogFormat strings into
  * JSON objects.
  */
@@ -223,6 +223,45 @@ int pr_log_event_listening(unsigned int log_type);
  */
 void pr_log_stacktrace(int fd, const char *name);
 
+/* Buffered log writes.  Records written to a log buffer are accumulated in
+ * memory, and written out to the log fd when the buffer is full, when the
+ * oldest buffered record is older than the buffer's flush interval (if any),
+ * or when explicitly flushed.  Records which do not fit in the buffer, because
+ * the buffer could not be flushed, are dropped.
+ *
+ * Only the process which created the buffer writes it out; in any forked
+ * child, flushing simply discards the inherited buffered records.
+ */
+typedef struct log_buffer_rec pr_log_buffer_t;
+
+pr_log_buffer_t *pr_log_buffer_create(pool *p, const char *name, int fd,
+  size_t bufsz, int interval, int flags);
+#define PR_LOG_BUFFER_FL_SYNC		0x001
+
+int pr_log_buffer_write(pr_log_buffer_t *lb, const char *text, size_t textlen);
+int pr_log_buffer_flush(pr_log_buffer_t *lb);
+
+/* Flushes the buffer for the last time, counting any records which could not
+ * be written as dropped, and logs its counters; the buffer is then no longer
+ * used, nor flushed by pr_log_buffer_flush_all().  Call this before closing
+ * the buffer's fd.
+ */
+int pr_log_buffer_destroy(pr_log_buffer_t *lb);
+
+/* Flushes every log buffer, and logs the counters (see below) of each,
+ * labelled with the buffer name; this is done when the session ends, once
+ * all exit handlers have run.  A buffer whose pool is destroyed beforehand
+ * has its counters logged then, and is no longer flushed.
+ */
+int pr_log_buffer_flush_all(void);
+
+/* Provides the number of records written to the buffer, the number of
+ * records whose writing was delayed by a failed flush, and the number of
+ * records dropped.
+ */
+int pr_log_buffer_get_stats(pr_log_buffer_t *lb, unsigned long *nrecords,
+  unsigned long *ndelayed, unsigned long *ndropped);
+
 /* Set options that affect the format of the logged messages. */
 int pr_log_set_options(unsigned long log_opts);
 #define PR_LOG_OPT_USE_TIMESTAMP			0x0001
@@ -184,6 +184,14 @@
 # define PR_TUNABLE_SCOREBOARD_SCRUB_TIMER	30
 #endif
 
+/* Number of slots by which the shared scoreboard slot index, kept in the
+ * ScoreboardMutex file, grows when more slots are needed.
+ */
+
+#ifndef PR_TUNABLE_SCOREBOARD_INDEX_GROWTH
+# define PR_TUNABLE_SCOREBOARD_INDEX_GROWTH	128
+#endif
+
 /* Maximum number of attempted updates to the scoreboard during a
  * file transfer before an actual write is done.  This is to allow
  * an optimization where the scoreboard is not updated on every loop
@@ -194,6 +202,31 @@
 # define PR_TUNABLE_XFER_SCOREBOARD_UPDATES	10
 #endif
 
+/* When a TransferRate is in effect, data sent in bulk (e.g. via sendfile(2))
+ * is sent in chunks of this many milliseconds' worth of the configured rate,
+ * with throttling pauses in between.
+ */
+
+#ifndef PR_TUNABLE_XFER_THROTTLE_INTERVAL
+# define PR_TUNABLE_XFER_THROTTLE_INTERVAL	250
+#endif
+
+/* Maximum number of idle processes to fork at a time, when replenishing the
+ * spare processes configured via SpareServers.
+ */
+
+#ifndef PR_TUNABLE_PREFORK_SPAWN_MAX
+# define PR_TUNABLE_PREFORK_SPAWN_MAX	8
+#endif
+
+/* Maximum number of paths, and of <Limit> checks, whose results are cached
+ * per session when matching <Directory> sections.
+ */
+
+#ifndef PR_TUNABLE_DIR_CACHE_SIZE
+# define PR_TUNABLE_DIR_CACHE_SIZE	4096
+#endif
+
 #ifndef PR_TUNABLE_CALLER_DEPTH
 /* Max depth of call stack if stacktrace support is enabled. */
 # define PR_TUNABLE_CALLER_DEPTH	32
@@ -99,6 +99,38 @@ typedef struct {
 
 } pr_scoreboard_entry_t;
 
+/* Structures used for the slot index, kept in the ScoreboardMutex file and
+ * shared (via mmap(2)) by all processes using the scoreboard.  The index
+ * holds a sequence number for each scoreboard slot: the process changing a
+ * slot makes the number odd before the change, and even again afterwards, so
+ * that readers can detect (and retry) torn entries.  The index also holds
+ * the list of free slots, for reuse by new sessions.
+ *
+ * The format of the ScoreboardFile itself is unaffected by the index.
+ */
+#define PR_SCOREBOARD_INDEX_MAGIC		0x5c0eb0a7
+
+typedef struct {
+  unsigned int sci_magic;
+
+  /* Number of slot records following this header. */
+  unsigned int sci_nslots;
+
+  /* 1-based number of the first free slot, or zero if none. */
+  unsigned int sci_free;
+
+  unsigned int sci_reserved;
+
+} pr_scoreboard_index_header_t;
+
+typedef struct {
+  volatile unsigned int scs_seqno;
+
+  /* 1-based number of the next free slot, or zero if none. */
+  unsigned int scs_next_free;
+
+} pr_scoreboard_index_slot_t;
+
 /* Scoreboard mode */
 #define PR_SCOREBOARD_MODE		0644
 
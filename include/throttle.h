@@ -31,4 +31,11 @@ int pr_throttle_have_rate(void);
 void pr_throttle_init(cmd_rec *);
 void pr_throttle_pause(off_t, int);
 
+/* Returns the maximum number of bytes which should be sent in one go, given
+ * the number of bytes transferred so far, so that pr_throttle_pause() can
+ * keep the transfer close to the configured rate.  Returns zero if no
+ * TransferRate is in effect.
+ */
+off_t pr_throttle_get_xfer_len(off_t xferlen);
+
 #endif /* PR_THROTTLE_H */
@@ -32,4 +32,13 @@ void xferlog_close(void);
 int xferlog_write(long, const char *, off_t, const char *, char, char, char,
   const char *, char, const char *);
 
+/* Configures the buffering of TransferLog writes, taking effect when the
+ * TransferLog is next opened; a bufsz of zero disables buffering.  The
+ * interval and flags are as for pr_log_buffer_create().
+ */
+int xferlog_set_buffer(size_t bufsz, int interval, int flags);
+
+/* Writes out any buffered TransferLog records. */
+int xferlog_flush(void);
+
 #endif /* PR_XFERLOG_H */
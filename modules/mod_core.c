@@ -39,6 +39,8 @@ extern xaset_t *server_list;
 /* From src/main.c */
 extern unsigned long max_connects;
 extern unsigned int max_connect_interval;
+extern unsigned int prefork_min_spares, prefork_max_spares;
+extern unsigned int acceptor_nprocs;
 
 /* From modules/mod_site.c */
 extern modret_t *site_dispatch(cmd_rec*);
@@ -984,6 +986,80 @@ MODRET set_maxinstances(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
+/* usage: SpareServers min [max]|"none" */
+MODRET set_spareservers(cmd_rec *cmd) {
+  long min_spares = 0L, max_spares = 0L;
+  char *endp = NULL;
+
+  if (cmd->argc-1 < 1 ||
+      cmd->argc-1 > 2) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  if (cmd->argc-1 == 1 &&
+      strcasecmp(cmd->argv[1], "none") == 0) {
+    prefork_min_spares = prefork_max_spares = 0;
+    return PR_HANDLED(cmd);
+  }
+
+  min_spares = strtol(cmd->argv[1], &endp, 10);
+  if ((endp && *endp) ||
+      min_spares < 1) {
+    CONF_ERROR(cmd, "minimum must be 'none' or a number greater than 0");
+  }
+
+  max_spares = min_spares;
+
+  /* If the optional maximum parameter is given, parse it. */
+  if (cmd->argc-1 == 2) {
+    max_spares = strtol(cmd->argv[2], &endp, 10);
+    if ((endp && *endp) ||
+        max_spares < min_spares) {
+      CONF_ERROR(cmd, "maximum must be a number no less than the minimum");
+    }
+  }
+
+  prefork_min_spares = (unsigned int) min_spares;
+  prefork_max_spares = (unsigned int) max_spares;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: AcceptorProcesses count */
+MODRET set_acceptorprocesses(cmd_rec *cmd) {
+  long nprocs;
+  char *endp = NULL;
+
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT);
+
+  nprocs = strtol(cmd->argv[1], &endp, 10);
+  if ((endp && *endp) ||
+      nprocs < 1) {
+    CONF_ERROR(cmd, "argument must be a number greater than 0");
+  }
+
+#if !defined(SO_REUSEPORT)
+  if (nprocs > 1) {
+    pr_log_pri(PR_LOG_NOTICE, "%s: SO_REUSEPORT not supported on this "
+      "platform, ignoring", (char *) cmd->argv[0]);
+    nprocs = 1;
+  }
+#endif /* SO_REUSEPORT */
+
+  /* Multiple acceptor processes need SO_REUSEPORT on the listening sockets;
+   * enable it, unless explicitly disabled via SocketOptions.
+   */
+  if (nprocs > 1 &&
+      cmd->server->tcp_reuse_port == -1) {
+    cmd->server->tcp_reuse_port = 1;
+  }
+
+  acceptor_nprocs = (unsigned int) nprocs;
+  return PR_HANDLED(cmd);
+}
+
 /* usage: MaxCommandRate rate [interval] */
 MODRET set_maxcommandrate(cmd_rec *cmd) {
   config_rec *c;
@@ -7132,6 +7208,7 @@ static conftable core_conftab[] = {
   { "</Limit>", 		end_limit, 			NULL },
   { "<VirtualHost>",		add_virtualhost,		NULL },
   { "</VirtualHost>",		end_virtualhost,		NULL },
+  { "AcceptorProcesses",	set_acceptorprocesses,		NULL },
   { "Allow",			set_allowdeny,			NULL },
   { "AllowAll",			set_allowall,			NULL },
   { "AllowClass",		set_allowdenyusergroupclass,	NULL },
@@ -7194,6 +7271,7 @@ static conftable core_conftab[] = {
   { "ServerType",		set_servertype,			NULL },
   { "SetEnv",			set_setenv,			NULL },
   { "SocketBindTight",		set_socketbindtight,		NULL },
+  { "SpareServers",		set_spareservers,		NULL },
   { "SocketOptions",		set_socketoptions,		NULL },
   { "SyslogFacility",		set_syslogfacility,		NULL },
   { "SyslogLevel",		set_sysloglevel,		NULL },
@@ -26,6 +26,10 @@
 #include "privs.h"
 #include "error.h"
 
+#if defined(HAVE_STATX)
+# include <sys/sysmacros.h>
+#endif /* HAVE_STATX */
+
 #define MOD_FACTS_VERSION		"mod_facts/0.7"
 
 #if PROFTPD_VERSION_NUMBER < 0x0001030101
@@ -67,6 +71,10 @@ static unsigned long facts_mlinfo_opts = 0;
 #define FACTS_MLINFO_FL_APPEND_CRLF			0x00008
 #define FACTS_MLINFO_FL_ADJUSTED_SYMLINKS		0x00010
 #define FACTS_MLINFO_FL_NO_NAMES			0x00020
+#define FACTS_MLINFO_FL_HAVE_STAT			0x00040
+
+/* Number of MLSD entries handled using the same memory pool. */
+#define FACTS_MLSD_BATCH_SIZE		128
 
 struct mlinfo {
   pool *pool;
@@ -509,24 +517,48 @@ static int facts_mlinfobuf_flush(void) {
   return res;
 }
 
+/* Checks the session's access to the given path.  If the caller provided
+ * the lstat(2) info for the path (from the system filesystem), and the path
+ * is not a symlink, there is no need for pr_fsio_access() to stat(2) it again.
+ */
+static int facts_access(const char *path, struct stat *st, int mode,
+    int flags) {
+  if ((flags & FACTS_MLINFO_FL_HAVE_STAT) &&
+      !S_ISLNK(st->st_mode)) {
+    return pr_fs_have_access(st, mode, session.uid, session.gid,
+      session.gids);
+  }
+
+  return pr_fsio_access(path, mode, session.uid, session.gid, session.gids);
+}
+
+/* If FACTS_MLINFO_FL_HAVE_STAT is set, info->st already contains the
+ * lstat(2) info for the path.
+ */
 static int facts_mlinfo_get(struct mlinfo *info, const char *path,
     const char *dent_name, int flags, const char *user, uid_t uid,
     const char *group, gid_t gid, const mode_t *mode) {
   char *perm = "";
   int res;
+  struct stat lst;
 
-  pr_fs_clear_cache2(path);
-  res = pr_fsio_lstat(path, &(info->st));
-  if (res < 0) {
-    int xerrno = errno;
+  if (!(flags & FACTS_MLINFO_FL_HAVE_STAT)) {
+    pr_fs_clear_cache2(path);
+    res = pr_fsio_lstat(path, &(info->st));
+    if (res < 0) {
+      int xerrno = errno;
 
-    pr_log_debug(DEBUG4, MOD_FACTS_VERSION ": error lstat'ing '%s': %s",
-      path, strerror(xerrno));
+      pr_log_debug(DEBUG4, MOD_FACTS_VERSION ": error lstat'ing '%s': %s",
+        path, strerror(xerrno));
 
-    errno = xerrno;
-    return -1;
+      errno = xerrno;
+      return -1;
+    }
   }
 
+  /* Keep the actual ownership and mode, for the access checks. */
+  memcpy(&lst, &(info->st), sizeof(struct stat));
+
   if (user != NULL) {
     info->user = pstrdup(info->pool, user);
 
@@ -687,8 +719,7 @@ static int facts_mlinfo_get(struct mlinfo *info, const char *path,
     info->type = "file";
 #endif
 
-    if (pr_fsio_access(path, R_OK, session.uid, session.gid,
-        session.gids) == 0) {
+    if (facts_access(path, &lst, R_OK, flags) == 0) {
 
       /* XXX Need to come up with a good way of determining whether 'd'
        * should be listed.  For example, if the parent directory does not
@@ -702,8 +733,7 @@ static int facts_mlinfo_get(struct mlinfo *info, const char *path,
       perm = pstrcat(info->pool, perm, "dfr", NULL);
     }
 
-    if (pr_fsio_access(path, W_OK, session.uid, session.gid,
-        session.gids) == 0) {
+    if (facts_access(path, &lst, W_OK, flags) == 0) {
       perm = pstrcat(info->pool, perm, "w", NULL);
     }
 
@@ -725,18 +755,15 @@ static int facts_mlinfo_get(struct mlinfo *info, const char *path,
       }
     }
 
-    if (pr_fsio_access(path, R_OK, session.uid, session.gid,
-        session.gids) == 0) {
+    if (facts_access(path, &lst, R_OK, flags) == 0) {
       perm = pstrcat(info->pool, perm, "fl", NULL);
     }
 
-    if (pr_fsio_access(path, W_OK, session.uid, session.gid,
-        session.gids) == 0) {
+    if (facts_access(path, &lst, W_OK, flags) == 0) {
       perm = pstrcat(info->pool, perm, "cdmp", NULL);
     }
 
-    if (pr_fsio_access(path, X_OK, session.uid, session.gid,
-        session.gids) == 0) {
+    if (facts_access(path, &lst, X_OK, flags) == 0) {
       perm = pstrcat(info->pool, perm, "e", NULL);
     }
   }
@@ -1433,6 +1460,98 @@ MODRET facts_mfmt(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
+/* For MLSD, returns the fd of the directory being listed, if it is on the
+ * system filesystem, so that its entries can be looked up relative to that
+ * fd, or -1 otherwise.
+ */
+static int facts_mlsd_dir_fd(DIR *dirh, const char *path) {
+#if defined(HAVE_DIRFD) && \
+    (defined(HAVE_STATX) || defined(HAVE_FSTATAT))
+  pr_fs_t *fs;
+
+  fs = pr_get_fs(path, NULL);
+  if (fs != NULL &&
+      strcmp(fs->fs_name, "system") == 0) {
+    return dirfd(dirh);
+  }
+#endif /* HAVE_DIRFD and HAVE_STATX or HAVE_FSTATAT */
+
+  return -1;
+}
+
+/* lstat(2)s the given directory entry, relative to the directory fd.  Where
+ * statx(2) is available, only the fields needed for the configured facts
+ * are requested.
+ */
+static int facts_mlsd_lstat(int dir_fd, const char *name, struct stat *st) {
+#if defined(HAVE_STATX)
+  unsigned int mask;
+  struct statx stx;
+
+  /* The type, mode and ownership are always needed, for the perm fact. */
+  mask = STATX_TYPE|STATX_MODE|STATX_UID|STATX_GID;
+
+  if (facts_opts & FACTS_OPT_SHOW_MODIFY) {
+    mask |= STATX_MTIME;
+  }
+
+  if (facts_opts & FACTS_OPT_SHOW_SIZE) {
+    mask |= STATX_SIZE;
+  }
+
+  if (facts_opts & FACTS_OPT_SHOW_UNIQUE) {
+    mask |= STATX_INO;
+  }
+
+  if (statx(dir_fd, name, AT_SYMLINK_NOFOLLOW, mask, &stx) == 0 &&
+      (stx.stx_mask & mask) == mask) {
+    memset(st, 0, sizeof(struct stat));
+    st->st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    st->st_ino = stx.stx_ino;
+    st->st_mode = stx.stx_mode;
+    st->st_nlink = stx.stx_nlink;
+    st->st_uid = stx.stx_uid;
+    st->st_gid = stx.stx_gid;
+    st->st_size = stx.stx_size;
+    st->st_mtime = stx.stx_mtime.tv_sec;
+    return 0;
+  }
+
+  /* Fall back to fstatat(2), e.g. if statx(2) is not supported by the kernel
+   * or filesystem.
+   */
+#endif /* HAVE_STATX */
+
+#if defined(HAVE_FSTATAT)
+  return fstatat(dir_fd, name, st, AT_SYMLINK_NOFOLLOW);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif /* HAVE_FSTATAT */
+}
+
+/* Returns TRUE if the directory entry is known, from its dirent, not to be a
+ * symlink (nor "." or ".."), i.e. if its real path is that of the directory
+ * plus its name.
+ */
+static int facts_mlsd_dent_is_plain(struct dirent *dent) {
+#if defined(_DIRENT_HAVE_D_TYPE) && defined(DT_UNKNOWN) && defined(DT_LNK)
+  if (dent->d_type == DT_UNKNOWN ||
+      dent->d_type == DT_LNK) {
+    return FALSE;
+  }
+
+  if (strcmp(dent->d_name, ".") == 0 ||
+      strcmp(dent->d_name, "..") == 0) {
+    return FALSE;
+  }
+
+  return TRUE;
+#else
+  return FALSE;
+#endif /* _DIRENT_HAVE_D_TYPE */
+}
+
 MODRET facts_mlsd(cmd_rec *cmd) {
   const char *path, *decoded_path, *best_path;
   const char *fake_user = NULL, *fake_group = NULL;
@@ -1442,7 +1561,10 @@ MODRET facts_mlsd(cmd_rec *cmd) {
   const mode_t *fake_mode = NULL;
   struct mlinfo info;
   unsigned char *ptr;
-  int flags = 0, res, succeeded = TRUE;
+  int flags = 0, res, succeeded = TRUE, dir_fd;
+  unsigned long nentries = 0;
+  const char *real_dir_path = NULL;
+  pool *batch_pool = NULL;
   DIR *dirh;
   struct dirent *dent;
 
@@ -1607,30 +1729,57 @@ MODRET facts_mlsd(cmd_rec *cmd) {
 
   facts_mlinfobuf_init();
 
+  /* If possible, look up the entries relative to the directory, rather than
+   * resolving their full paths.
+   */
+  dir_fd = facts_mlsd_dir_fd(dirh, best_path);
+  if (dir_fd >= 0) {
+    real_dir_path = dir_realpath(cmd->tmp_pool, best_path);
+  }
+
   while ((dent = pr_fsio_readdir(dirh)) != NULL) {
-    int hidden = FALSE, xerrno;
+    int hidden = FALSE, xerrno, mlinfo_flags;
     char *rel_path, *abs_path;
 
     pr_signals_handle();
 
-    rel_path = pdircat(cmd->tmp_pool, best_path, dent->d_name, NULL);
-    res = dir_check(cmd->tmp_pool, cmd, cmd->group, rel_path, &hidden);
+    /* Use a new pool for every batch of entries, so that memory use does
+     * not grow with the size of the directory.
+     */
+    if (nentries++ % FACTS_MLSD_BATCH_SIZE == 0) {
+      if (batch_pool != NULL) {
+        destroy_pool(batch_pool);
+      }
+
+      batch_pool = make_sub_pool(cmd->tmp_pool);
+      pr_pool_tag(batch_pool, "MLSD batch pool");
+    }
+
+    rel_path = pdircat(batch_pool, best_path, dent->d_name, NULL);
+    res = dir_check(batch_pool, cmd, cmd->group, rel_path, &hidden);
     if (!res || hidden) {
       continue;
     }
 
     /* Check that the file can be listed. */
-    abs_path = dir_realpath(cmd->tmp_pool, rel_path);
+    if (real_dir_path != NULL &&
+        facts_mlsd_dent_is_plain(dent) == TRUE) {
+      abs_path = pdircat(batch_pool, real_dir_path, dent->d_name, NULL);
+
+    } else {
+      abs_path = dir_realpath(batch_pool, rel_path);
+    }
+
     if (abs_path) {
-      res = dir_check(cmd->tmp_pool, cmd, cmd->group, abs_path, &hidden);
+      res = dir_check(batch_pool, cmd, cmd->group, abs_path, &hidden);
       
     } else {
-      abs_path = dir_canonical_path(cmd->tmp_pool, rel_path);
+      abs_path = dir_canonical_path(batch_pool, rel_path);
       if (abs_path == NULL) {
         abs_path = rel_path;
       }
 
-      res = dir_check_canon(cmd->tmp_pool, cmd, cmd->group, abs_path, &hidden);
+      res = dir_check_canon(batch_pool, cmd, cmd->group, abs_path, &hidden);
     }
 
     if (!res || hidden) {
@@ -1639,10 +1788,26 @@ MODRET facts_mlsd(cmd_rec *cmd) {
 
     memset(&info, 0, sizeof(struct mlinfo));
 
-    info.pool = make_sub_pool(cmd->tmp_pool);
+    info.pool = make_sub_pool(batch_pool);
     pr_pool_tag(info.pool, "MLSD facts pool");
-    if (facts_mlinfo_get(&info, rel_path, dent->d_name, flags,
+
+    mlinfo_flags = flags;
+    if (dir_fd >= 0) {
+      if (facts_mlsd_lstat(dir_fd, dent->d_name, &(info.st)) < 0) {
+        xerrno = errno;
+
+        pr_log_debug(DEBUG4, MOD_FACTS_VERSION ": error lstat'ing '%s': %s",
+          rel_path, strerror(xerrno));
+        destroy_pool(info.pool);
+        continue;
+      }
+
+      mlinfo_flags |= FACTS_MLINFO_FL_HAVE_STAT;
+    }
+
+    if (facts_mlinfo_get(&info, rel_path, dent->d_name, mlinfo_flags,
         fake_user, fake_uid, fake_group, fake_gid, fake_mode) < 0) {
+      destroy_pool(info.pool);
       continue;
     }
 
@@ -1672,6 +1837,10 @@ MODRET facts_mlsd(cmd_rec *cmd) {
 
   pr_fsio_closedir(dirh);
 
+  if (batch_pool != NULL) {
+    destroy_pool(batch_pool);
+  }
+
   if (XFER_ABORTED) {
     pr_data_close2();
     return PR_ERROR(cmd);
@@ -38,9 +38,19 @@ module log_module;
 /* Max path length plus 128 bytes for additional info. */
 #define EXTENDED_LOG_BUFFER_SIZE		(PR_TUNABLE_PATH_MAX + 128)
 
+/* The formatting buffer grows, as needed for longer records, up to this
+ * size; longer records are truncated.
+ */
+#ifndef EXTENDED_LOG_MAX_BUFFER_SIZE
+# define EXTENDED_LOG_MAX_BUFFER_SIZE		(64 * 1024)
+#endif /* EXTENDED_LOG_MAX_BUFFER_SIZE */
+
 #define EXTENDED_LOG_MODE			0644
 #define EXTENDED_LOG_FORMAT_DEFAULT		"default"
 
+/* Default flush interval, in seconds, for buffered logs. */
+#define LOG_BUFFER_DEFAULT_INTERVAL		5
+
 typedef struct logformat_struc	logformat_t;
 typedef struct logfile_struc 	logfile_t;
 
@@ -49,6 +59,9 @@ struct logformat_struc {
 
   char *lf_fmt_name;
   unsigned char	*lf_format;
+
+  /* The format compiled for resolving, once per logged command */
+  pr_jot_plan_t *lf_plan;
 };
 
 struct logfile_struc {
@@ -61,6 +74,9 @@ struct logfile_struc {
   logformat_t		*lf_format;
   pr_jot_filters_t	*lf_jot_filters;
 
+  /* Buffer for writes to this log, if LogBuffer is in effect */
+  pr_log_buffer_t	*lf_buffer;
+
   /* Pointer to the "owning" configuration */
   config_rec		*lf_conf;
 };
@@ -76,6 +92,12 @@ static xaset_t *format_set = NULL;
 static logfile_t *logs = NULL;
 static xaset_t *log_set = NULL;
 
+static pool *log_buffer_pool = NULL;
+static int log_buffer_timerno = -1;
+
+/* Reused for formatting every ExtendedLog record in the session. */
+static struct extlog_buffer *extlog_buf = NULL;
+
 static const char *trace_channel = "extlog";
 
 /* format string args:
@@ -177,6 +199,12 @@ static void parse_logformat(const char *directive, char *fmt_name,
   memcpy(lf->lf_format, format_buf, fmt_len);
   lf->lf_format[fmt_len] = '\0';
 
+  lf->lf_plan = pr_jot_compile_logfmt(log_pool, lf->lf_format);
+  if (lf->lf_plan == NULL) {
+    pr_log_pri(PR_LOG_NOTICE, MOD_LOG_VERSION
+      ": error compiling LogFormat '%s': %s", fmt_text, strerror(errno));
+  }
+
   if (format_set == NULL) {
     format_set = xaset_create(log_pool, NULL);
   }
@@ -392,6 +420,82 @@ MODRET set_allowlogsymlinks(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
+/* Syntax: LogBuffer size [units] [interval] ["sync"]|"off" */
+MODRET set_logbuffer(cmd_rec *cmd) {
+  register unsigned int i = 2;
+  config_rec *c;
+  off_t bufsz = 0;
+  int interval = LOG_BUFFER_DEFAULT_INTERVAL, flags = 0;
+
+  if (cmd->argc < 2 ||
+      cmd->argc > 5) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  if (strcasecmp(cmd->argv[1], "off") == 0) {
+    if (cmd->argc != 2) {
+      CONF_ERROR(cmd, "wrong number of parameters");
+    }
+
+    interval = 0;
+
+  } else {
+    const char *units = NULL;
+
+    /* The size may be followed by its units, e.g. "64 KB". */
+    if (cmd->argc > 2 &&
+        PR_ISALPHA(((char *) cmd->argv[2])[0]) &&
+        strcasecmp(cmd->argv[2], "sync") != 0) {
+      units = cmd->argv[2];
+      i++;
+    }
+
+    if (pr_str_get_nbytes(cmd->argv[1], units, &bufsz) < 0 ||
+        bufsz == 0 ||
+        bufsz > INT_MAX) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid buffer size: '",
+        (char *) cmd->argv[1], units ? " " : "", units ? units : "", "'",
+        NULL));
+    }
+
+    if (i < cmd->argc &&
+        strcasecmp(cmd->argv[i], "sync") != 0) {
+      if (pr_str_get_duration(cmd->argv[i], &interval) < 0) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid flush interval: '",
+          (char *) cmd->argv[i], "': ", strerror(errno), NULL));
+      }
+
+      i++;
+    }
+
+    if (i < cmd->argc) {
+      if (strcasecmp(cmd->argv[i], "sync") != 0) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown parameter: '",
+          (char *) cmd->argv[i], "'", NULL));
+      }
+
+      flags |= PR_LOG_BUFFER_FL_SYNC;
+      i++;
+    }
+
+    if (i < cmd->argc) {
+      CONF_ERROR(cmd, "wrong number of parameters");
+    }
+  }
+
+  c = add_config_param(cmd->argv[0], 3, NULL, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(size_t));
+  *((size_t *) c->argv[0]) = (size_t) bufsz;
+  c->argv[1] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[1]) = interval;
+  c->argv[2] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[2]) = flags;
+
+  return PR_HANDLED(cmd);
+}
+
 /* Syntax: ServerLog <filename> */
 MODRET set_serverlog(cmd_rec *cmd) {
   CHECK_ARGS(cmd, 1);
@@ -414,6 +518,9 @@ MODRET set_systemlog(cmd_rec *cmd) {
 static struct tm *get_gmtoff(pool *p, int *tz) {
   time_t now;
   struct tm *gmt, *tm = NULL;
+#if defined(HAVE_GMTIME_R)
+  struct tm gmt_buf;
+#endif /* HAVE_GMTIME_R */
 
   /* Note that the ordering of the calls to gmtime(3) and pr_localtime()
    * here are IMPORTANT; gmtime(3) MUST be called first.  Otherwise,
@@ -424,7 +531,7 @@ static struct tm *get_gmtoff(pool *p, int *tz) {
   time(&now);
 
 #if defined(HAVE_GMTIME_R)
-  gmt = gmtime_r(&now, pcalloc(p, sizeof(struct tm)));
+  gmt = gmtime_r(&now, &gmt_buf);
 #else
   gmt = gmtime(&now);
 #endif /* HAVE_GMTIME_R */
@@ -446,10 +553,63 @@ static struct tm *get_gmtoff(pool *p, int *tz) {
 
 /* Note: maybe the pr_buffer_t should be made to look like this? */
 struct extlog_buffer {
+  pool *pool;
   char *ptr, *buf;
   size_t bufsz, buflen;
 };
 
+static struct extlog_buffer *extlog_buffer_get(void) {
+  if (extlog_buf == NULL) {
+    extlog_buf = pcalloc(session.pool, sizeof(struct extlog_buffer));
+    extlog_buf->pool = session.pool;
+    extlog_buf->bufsz = EXTENDED_LOG_BUFFER_SIZE - 1;
+    extlog_buf->ptr = palloc(session.pool, EXTENDED_LOG_BUFFER_SIZE);
+  }
+
+  extlog_buf->buf = extlog_buf->ptr;
+  extlog_buf->buflen = extlog_buf->bufsz;
+  *(extlog_buf->buf) = '\0';
+
+  return extlog_buf;
+}
+
+static int extlog_buffer_has_room(struct extlog_buffer *log) {
+  return (log->buflen > 0 || log->bufsz < EXTENDED_LOG_MAX_BUFFER_SIZE);
+}
+
+static void extlog_buffer_grow(struct extlog_buffer *log, size_t text_len) {
+  size_t used, new_bufsz;
+  char *new_ptr;
+
+  used = log->bufsz - log->buflen;
+  new_bufsz = log->bufsz;
+
+  while (new_bufsz < used + text_len &&
+         new_bufsz < EXTENDED_LOG_MAX_BUFFER_SIZE) {
+    new_bufsz *= 2;
+  }
+
+  if (new_bufsz > EXTENDED_LOG_MAX_BUFFER_SIZE) {
+    new_bufsz = EXTENDED_LOG_MAX_BUFFER_SIZE;
+  }
+
+  if (new_bufsz <= log->bufsz) {
+    return;
+  }
+
+  pr_trace_msg(trace_channel, 15, "growing buffer from %lu to %lu bytes",
+    (unsigned long) log->bufsz, (unsigned long) new_bufsz);
+
+  /* Allow room for the terminating NUL. */
+  new_ptr = palloc(log->pool, new_bufsz + 1);
+  memcpy(new_ptr, log->ptr, used);
+
+  log->ptr = new_ptr;
+  log->buf = new_ptr + used;
+  log->bufsz = new_bufsz;
+  log->buflen = new_bufsz - used;
+}
+
 static void extlog_buffer_append(struct extlog_buffer *log, const char *text,
     size_t text_len) {
   if (text == NULL ||
@@ -458,7 +618,11 @@ static void extlog_buffer_append(struct extlog_buffer *log, const char *text,
   }
 
   if (text_len > log->buflen) {
-    text_len = log->buflen;
+    extlog_buffer_grow(log, text_len);
+
+    if (text_len > log->buflen) {
+      text_len = log->buflen;
+    }
   }
 
   pr_trace_msg(trace_channel, 19, "appending text '%.*s' (%lu) to buffer",
@@ -473,7 +637,7 @@ static int resolve_on_meta(pool *p, pr_jot_ctx_t *jot_ctx,
   struct extlog_buffer *log;
 
   log = jot_ctx->log;
-  if (log->buflen > 0) {
+  if (extlog_buffer_has_room(log)) {
     const char *text = NULL;
     size_t text_len = 0;
     char buf[1024];
@@ -516,7 +680,7 @@ static int resolve_on_meta(pool *p, pr_jot_ctx_t *jot_ctx,
         uid_t uid;
 
         uid = *((double *) val);
-        text = pr_uid2str(p, uid);
+        text = pr_uid2str(NULL, uid);
         break;
       }
 
@@ -524,7 +688,7 @@ static int resolve_on_meta(pool *p, pr_jot_ctx_t *jot_ctx,
         gid_t gid;
 
         gid = *((double *) val);
-        text = pr_gid2str(p, gid);
+        text = pr_gid2str(NULL, gid);
         break;
       }
 
@@ -661,7 +825,7 @@ static int resolve_on_default(pool *p, pr_jot_ctx_t *jot_ctx,
   struct extlog_buffer *log;
 
   log = jot_ctx->log;
-  if (log->buflen > 0) {
+  if (extlog_buffer_has_room(log)) {
     const char *text = NULL;
     size_t text_len = 0;
 
@@ -720,12 +884,8 @@ static int resolve_on_other(pool *p, pr_jot_ctx_t *jot_ctx,
   struct extlog_buffer *log;
 
   log = jot_ctx->log;
-  if (log->buflen > 0) {
-    pr_trace_msg(trace_channel, 19, "appending text '%.*s' (%lu) to buffer",
-      (int) text_len, text, (unsigned long) text_len);
-    memcpy(log->buf, text, text_len);
-    log->buf += text_len;
-    log->buflen -= text_len;
+  if (extlog_buffer_has_room(log)) {
+    extlog_buffer_append(log, (const char *) text, text_len);
   }
 
   return 0;
@@ -736,27 +896,31 @@ extern int syslog_sockfd;
 
 static void log_event(cmd_rec *cmd, logfile_t *lf) {
   int res;
-  unsigned char *f = NULL;
-  char logbuf[EXTENDED_LOG_BUFFER_SIZE] = {'\0'};
+  char *logbuf;
   logformat_t *fmt = NULL;
   size_t logbuflen;
   pool *tmp_pool;
-  pr_jot_ctx_t *jot_ctx;
+  pr_jot_ctx_t jot_ctx;
   struct extlog_buffer *log;
 
   fmt = lf->lf_format;
-  f = fmt->lf_format;
 
   tmp_pool = make_sub_pool(cmd->tmp_pool);
-  jot_ctx = pcalloc(tmp_pool, sizeof(pr_jot_ctx_t));
-  log = pcalloc(tmp_pool, sizeof(struct extlog_buffer));
-  log->bufsz = log->buflen = sizeof(logbuf) - 1;
-  log->ptr = log->buf = logbuf;
+  log = extlog_buffer_get();
+
+  jot_ctx.log = log;
+  jot_ctx.user_data = NULL;
 
-  jot_ctx->log = log;
+  if (fmt->lf_plan != NULL) {
+    res = pr_jot_resolve_plan(tmp_pool, cmd, lf->lf_jot_filters, fmt->lf_plan,
+      &jot_ctx, resolve_on_meta, resolve_on_default, resolve_on_other);
+
+  } else {
+    res = pr_jot_resolve_logfmt(tmp_pool, cmd, lf->lf_jot_filters,
+      fmt->lf_format, &jot_ctx, resolve_on_meta, resolve_on_default,
+      resolve_on_other);
+  }
 
-  res = pr_jot_resolve_logfmt(tmp_pool, cmd, lf->lf_jot_filters, f, jot_ctx,
-    resolve_on_meta, resolve_on_default, resolve_on_other);
   if (res < 0) {
     /* EPERM indicates that the event was filtered, thus is not necessarily
      * an unexpected condition.
@@ -771,13 +935,23 @@ static void log_event(cmd_rec *cmd, logfile_t *lf) {
   }
 
   extlog_buffer_append(log, "\n", 1);
+  *(log->buf) = '\0';
+
+  logbuf = log->ptr;
   logbuflen = (log->bufsz - log->buflen);
 
   if (lf->lf_fd != EXTENDED_LOG_SYSLOG) {
     pr_log_event_generate(PR_LOG_TYPE_EXTLOG, lf->lf_fd, -1, logbuf, logbuflen);
 
+    if (lf->lf_buffer != NULL) {
+      if (pr_log_buffer_write(lf->lf_buffer, logbuf, logbuflen) < 0) {
+        pr_trace_msg(trace_channel, 3,
+          "error buffering ExtendedLog '%s' message: %s", lf->lf_filename,
+          strerror(errno));
+      }
+
     /* What about short writes? */
-    if (write(lf->lf_fd, logbuf, logbuflen) < 0) {
+    } else if (write(lf->lf_fd, logbuf, logbuflen) < 0) {
       pr_log_pri(PR_LOG_ALERT, "error: cannot write ExtendedLog '%s': %s",
         lf->lf_filename, strerror(errno));
     }
@@ -791,6 +965,17 @@ static void log_event(cmd_rec *cmd, logfile_t *lf) {
   destroy_pool(tmp_pool);
 }
 
+static void log_close(logfile_t *lf) {
+  /* Write out anything still buffered for this log, before closing it. */
+  if (lf->lf_buffer != NULL) {
+    (void) pr_log_buffer_destroy(lf->lf_buffer);
+    lf->lf_buffer = NULL;
+  }
+
+  (void) close(lf->lf_fd);
+  lf->lf_fd = -1;
+}
+
 MODRET log_any(cmd_rec *cmd) {
   logfile_t *lf = NULL;
 
@@ -821,6 +1006,24 @@ MODRET log_any(cmd_rec *cmd) {
   return PR_DECLINED(cmd);
 }
 
+/* Timer handlers
+ */
+
+static int log_buffer_flush_cb(CALLBACK_FRAME) {
+  logfile_t *lf;
+
+  for (lf = logs; lf; lf = lf->next) {
+    if (lf->lf_buffer != NULL) {
+      (void) pr_log_buffer_flush(lf->lf_buffer);
+    }
+  }
+
+  (void) xferlog_flush();
+
+  /* Always restart this timer. */
+  return 1;
+}
+
 /* Event handlers
  */
 
@@ -929,13 +1132,23 @@ static void log_sess_reinit_ev(const void *event_data, void *user_data) {
     if (lf->lf_fd > -1) {
       /* No need to close the special EXTENDED_LOG_SYSLOG (i.e. fake) fd. */
       if (lf->lf_fd != EXTENDED_LOG_SYSLOG) {
-        (void) close(lf->lf_fd);
+        log_close(lf);
       }
 
       lf->lf_fd = -1;
     }
   }
 
+  if (log_buffer_timerno != -1) {
+    (void) pr_timer_remove(log_buffer_timerno, &log_module);
+    log_buffer_timerno = -1;
+  }
+
+  if (log_buffer_pool != NULL) {
+    destroy_pool(log_buffer_pool);
+    log_buffer_pool = NULL;
+  }
+
   /* Restore original LogOptions settings. */
   (void) pr_log_set_options(PR_LOG_OPT_DEFAULT);
 
@@ -1111,8 +1324,7 @@ MODRET log_post_pass(cmd_rec *cmd) {
           lf->lf_conf->config_type == CONF_ANON) {
         pr_log_debug(DEBUG7, "mod_log: closing ExtendedLog '%s' (fd %d)",
           lf->lf_filename, lf->lf_fd);
-        (void) close(lf->lf_fd);
-        lf->lf_fd = -1;
+        log_close(lf);
       }
     }
 
@@ -1127,8 +1339,7 @@ MODRET log_post_pass(cmd_rec *cmd) {
           lf->lf_conf != session.anon_config) {
         pr_log_debug(DEBUG7, "mod_log: closing ExtendedLog '%s' (fd %d)",
           lf->lf_filename, lf->lf_fd);
-        (void) close(lf->lf_fd);
-        lf->lf_fd = -1;
+        log_close(lf);
       }
     }
 
@@ -1150,8 +1361,7 @@ MODRET log_post_pass(cmd_rec *cmd) {
               strcmp(lfi->lf_filename, lf->lf_filename) == 0) {
             pr_log_debug(DEBUG7, "mod_log: closing ExtendedLog '%s' (fd %d)",
               lf->lf_filename, lfi->lf_fd);
-            (void) close(lfi->lf_fd);
-            lfi->lf_fd = -1;
+            log_close(lfi);
           }
         }
 
@@ -1159,8 +1369,7 @@ MODRET log_post_pass(cmd_rec *cmd) {
         if (lf->lf_fd != -1 &&
             lf->lf_fd != EXTENDED_LOG_SYSLOG &&
             pr_jot_filters_include_classes(lf->lf_jot_filters, CL_NONE) == TRUE) {
-          (void) close(lf->lf_fd);
-          lf->lf_fd = -1;
+          log_close(lf);
         }
       }
     }
@@ -1317,6 +1526,49 @@ static int log_sess_init(void) {
     }
   }
 
+  c = find_config(main_server->conf, CONF_PARAM, "LogBuffer", FALSE);
+  if (c != NULL &&
+      *((size_t *) c->argv[0]) > 0) {
+    size_t bufsz;
+    int interval, flags;
+
+    bufsz = *((size_t *) c->argv[0]);
+    interval = *((int *) c->argv[1]);
+    flags = *((int *) c->argv[2]);
+
+    log_buffer_pool = make_sub_pool(session.pool);
+    pr_pool_tag(log_buffer_pool, "mod_log buffer pool");
+
+    for (lf = logs; lf; lf = lf->next) {
+      if (lf->lf_fd < 0) {
+        continue;
+      }
+
+      lf->lf_buffer = pr_log_buffer_create(log_buffer_pool,
+        pstrcat(log_buffer_pool, "ExtendedLog ", lf->lf_filename, NULL),
+        lf->lf_fd, bufsz, interval, flags);
+    }
+
+    /* The TransferLog is opened later, once the user has authenticated. */
+    (void) xferlog_set_buffer(bufsz, interval, flags);
+
+    /* Make sure that records do not linger in the buffers of idle
+     * sessions.
+     */
+    if (interval > 0) {
+      log_buffer_timerno = pr_timer_add(interval, -1, &log_module,
+        log_buffer_flush_cb, "LogBuffer flush");
+    }
+
+    pr_log_debug(DEBUG5, "mod_log: buffering logs using %lu bytes per log, "
+      "flushed every %d %s%s", (unsigned long) bufsz, interval,
+      interval != 1 ? "seconds" : "second",
+      (flags & PR_LOG_BUFFER_FL_SYNC) ? ", with sync" : "");
+
+  } else {
+    (void) xferlog_set_buffer(0, 0, 0);
+  }
+
   /* Register event handlers for the session. */
   pr_event_register(&log_module, "core.exit", log_exit_ev, NULL);
   pr_event_register(&log_module, "core.timeout-stalled", log_xfer_stalled_ev,
@@ -1354,6 +1606,7 @@ static int log_sess_init(void) {
 static conftable log_conftab[] = {
   { "AllowLogSymlinks",	set_allowlogsymlinks,			NULL },
   { "ExtendedLog",	set_extendedlog,			NULL },
+  { "LogBuffer",	set_logbuffer,				NULL },
   { "LogFormat",	set_logformat,				NULL },
   { "LogOptions",	set_logoptions,				NULL },
   { "ServerLog",	set_serverlog,				NULL },
@@ -57,6 +57,7 @@ static int sendline(int flags, char *fmt, ...)
 #define LS_FL_NLST_ONLY			0x0004
 #define LS_FL_ADJUSTED_SYMLINKS		0x0008
 #define LS_FL_SORTED_NLST		0x0010
+#define LS_FL_STREAM_LISTINGS		0x0020
 static unsigned long list_flags = 0UL;
 
 #define LS_LIST_STYLE_UNIX		1
@@ -68,6 +69,19 @@ static int list_style = LS_LIST_STYLE_UNIX;
  */
 #define LS_MAX_DSIZE			(1024 * 1024 * 8)
 
+/* For streamed listings (ListOptions StreamListings), the maximum number of
+ * bytes of file names sorted in memory at a time; the names of larger
+ * directories are sorted in runs, which are spilled to temporary files and
+ * then merged.
+ */
+#define LS_SORT_RUN_SIZE		(1024 * 1024 * 4)
+
+/* For streamed listings, the minimum size of the list buffer, and the number
+ * of entries listed between clearings of the per-entry memory pool.
+ */
+#define LS_STREAM_BUFFER_SIZE		(1024 * 64)
+#define LS_STREAM_POOL_ENTRIES		256
+
 static unsigned char list_strict_opts = FALSE;
 static char *list_options = NULL;
 static unsigned char list_show_symlinks = TRUE, list_times_gmt = TRUE;
@@ -331,8 +345,23 @@ static int sendline(int flags, char *fmt, ...) {
 
   memset(buf, '\0', sizeof(buf));
 
+  /* Streamed listings are sent in larger chunks; grow the (empty) buffer
+   * if need be.
+   */
+  if (listbuf != NULL &&
+      listbuf_ptr == listbuf &&
+      (list_flags & LS_FL_STREAM_LISTINGS) &&
+      listbufsz < LS_STREAM_BUFFER_SIZE) {
+    listbuf = listbuf_ptr = NULL;
+  }
+
   if (listbuf == NULL) {
     listbufsz = pr_config_get_server_xfer_bufsz(PR_NETIO_IO_WR);
+    if ((list_flags & LS_FL_STREAM_LISTINGS) &&
+        listbufsz < LS_STREAM_BUFFER_SIZE) {
+      listbufsz = LS_STREAM_BUFFER_SIZE;
+    }
+
     listbuf = listbuf_ptr = pcalloc(session.pool, listbufsz);
     pr_trace_msg("data", 8, "allocated list buffer of %lu bytes",
       (unsigned long) listbufsz);
@@ -463,6 +492,24 @@ static char months[12][4] =
   { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
     "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
 
+/* For streamed listings, the fd of the directory being listed, if the
+ * directory is on the system filesystem; entries are then looked up relative
+ * to that fd.
+ */
+static int ls_dirfd = -1;
+
+static int ls_lstat(const char *name, struct stat *st) {
+#if defined(HAVE_DIRFD) && defined(HAVE_FSTATAT)
+  if (ls_dirfd >= 0 &&
+      strchr(name, '/') == NULL) {
+    return fstatat(ls_dirfd, name, st, AT_SYMLINK_NOFOLLOW);
+  }
+#endif /* HAVE_DIRFD and HAVE_FSTATAT */
+
+  pr_fs_clear_cache2(name);
+  return pr_fsio_lstat(name, st);
+}
+
 static int listfile(cmd_rec *cmd, pool *p, const char *resp_code,
     const char *name) {
   register unsigned int i;
@@ -514,8 +561,7 @@ static int listfile(cmd_rec *cmd, pool *p, const char *resp_code,
     p = cmd->tmp_pool;
   }
 
-  pr_fs_clear_cache2(name);
-  if (pr_fsio_lstat(name, &st) == 0) {
+  if (ls_lstat(name, &st) == 0) {
     char *display_name = NULL;
 
     suffix[0] = suffix[1] = '\0';
@@ -929,6 +975,11 @@ static struct filename *tail = NULL;
 static array_header *sort_arr = NULL;
 static pool *fpool = NULL;
 
+/* Set while streaming a listing whose lines need no further ordering or
+ * formatting, i.e. which can be sent as they are added.
+ */
+static int list_streaming = FALSE;
+
 static void addfile(cmd_rec *cmd, const char *name, const char *suffix,
     time_t sort_time, off_t size) {
   struct filename *p;
@@ -942,9 +993,11 @@ static void addfile(cmd_rec *cmd, const char *name, const char *suffix,
   /* If we are not sorting (-U is in effect), then we have no need to buffer
    * up the line, and can send it immediately.  This can provide quite a bit
    * of memory/CPU savings, especially for LIST commands on wide/deep
-   * directories (Bug#4060).
+   * directories (Bug#4060).  The same holds for streamed listings, whose
+   * entries are already read in sorted order.
    */
-  if (opt_U == 1) {
+  if (opt_U == 1 ||
+      list_streaming == TRUE) {
     (void) sendline(0, "%s%s\r\n", name, suffix);
     return;
   }
@@ -1325,10 +1378,399 @@ static char **sreaddir(const char *dirname, const int sort) {
   return p;
 }
 
+/* Streamed directory reading, for ListOptions StreamListings.  Rather than
+ * reading all of the names in a directory before listing any of them, as
+ * sreaddir() does, the names are returned as they are read.  For sorted
+ * listings, the names are sorted in runs of at most LS_SORT_RUN_SIZE bytes;
+ * all but the last run are spilled to temporary files, and the runs are
+ * then merged as the names are read.
+ */
+struct ls_run {
+  FILE *fh;
+  char *name;
+  size_t namesz;
+};
+
+struct ls_dir {
+  void *dirh;
+  int sort;
+
+  /* The in-memory run of names. */
+  char **names;
+  size_t names_size, nnames, next_name, run_bytes;
+
+  /* The spilled runs, and the run whose name was last returned. */
+  struct ls_run *runs;
+  unsigned int nruns;
+  struct ls_run *last_run;
+  int spill_failed;
+};
+
+static void *ls_alloc(void *ptr, size_t len) {
+  void *res;
+
+  res = realloc(ptr, len);
+  if (res == NULL) {
+    pr_log_pri(PR_LOG_ALERT, "Out of memory!");
+    exit(1);
+  }
+
+  return res;
+}
+
+/* Reads the next name of the given run; on EOF (or error), the run's name
+ * is freed, and set to NULL.
+ */
+static void ls_run_next(struct ls_run *run) {
+  size_t namelen;
+
+  if (fread(&namelen, sizeof(namelen), 1, run->fh) == 1) {
+    if (namelen + 1 > run->namesz) {
+      run->namesz = namelen + 1;
+      run->name = ls_alloc(run->name, run->namesz);
+    }
+
+    if (fread(run->name, 1, namelen, run->fh) == namelen) {
+      run->name[namelen] = '\0';
+      return;
+    }
+  }
+
+  if (ferror(run->fh)) {
+    pr_log_debug(DEBUG3, "error reading sorted directory names: %s",
+      strerror(errno));
+  }
+
+  free(run->name);
+  run->name = NULL;
+  run->namesz = 0;
+}
+
+/* Sorts the in-memory run of names, and writes it to a temporary file.  If
+ * that fails, the names are kept (and sorted) in memory.
+ */
+static void ls_spill_run(struct ls_dir *lsd) {
+  register size_t i;
+  FILE *fh;
+  struct ls_run *run;
+
+  qsort(lsd->names, lsd->nnames, sizeof(char *), dircmp);
+
+  fh = tmpfile();
+  if (fh == NULL) {
+    pr_log_debug(DEBUG3, "unable to create temporary file for sorting "
+      "directory names, sorting in memory: %s", strerror(errno));
+    lsd->spill_failed = TRUE;
+    return;
+  }
+
+  for (i = 0; i < lsd->nnames; i++) {
+    size_t namelen;
+
+    namelen = strlen(lsd->names[i]);
+    if (fwrite(&namelen, sizeof(namelen), 1, fh) != 1 ||
+        fwrite(lsd->names[i], 1, namelen, fh) != namelen) {
+      break;
+    }
+  }
+
+  if (i < lsd->nnames ||
+      fflush(fh) != 0) {
+    pr_log_debug(DEBUG3, "error writing sorted directory names, sorting in "
+      "memory: %s", strerror(errno));
+    fclose(fh);
+    lsd->spill_failed = TRUE;
+    return;
+  }
+
+  for (i = 0; i < lsd->nnames; i++) {
+    free(lsd->names[i]);
+  }
+  lsd->nnames = 0;
+  lsd->run_bytes = 0;
+
+  lsd->runs = ls_alloc(lsd->runs, (lsd->nruns + 1) * sizeof(struct ls_run));
+  run = &(lsd->runs[lsd->nruns++]);
+  run->fh = fh;
+  run->name = NULL;
+  run->namesz = 0;
+}
+
+static int ls_sort_names(struct ls_dir *lsd) {
+  register unsigned int i;
+  struct dirent *de;
+
+  while ((de = pr_fsio_readdir(lsd->dirh)) != NULL) {
+    size_t namelen;
+
+    pr_signals_handle();
+
+    namelen = strlen(de->d_name);
+    if (lsd->nnames > 0 &&
+        lsd->spill_failed == FALSE &&
+        lsd->run_bytes + namelen + 1 + sizeof(char *) > LS_SORT_RUN_SIZE) {
+      ls_spill_run(lsd);
+    }
+
+    if (lsd->nnames == lsd->names_size) {
+      lsd->names_size = lsd->names_size > 0 ? lsd->names_size * 2 : 64;
+      lsd->names = ls_alloc(lsd->names, lsd->names_size * sizeof(char *));
+    }
+
+    lsd->names[lsd->nnames] = ls_alloc(NULL, namelen + 1);
+    memcpy(lsd->names[lsd->nnames], de->d_name, namelen + 1);
+    lsd->nnames++;
+    lsd->run_bytes += namelen + 1 + sizeof(char *);
+  }
+
+  /* The last run stays in memory. */
+  PR_DEVEL_CLOCK(qsort(lsd->names, lsd->nnames, sizeof(char *), dircmp));
+
+  for (i = 0; i < lsd->nruns; i++) {
+    struct ls_run *run;
+
+    run = &(lsd->runs[i]);
+    if (fseek(run->fh, 0L, SEEK_SET) < 0) {
+      return -1;
+    }
+
+    ls_run_next(run);
+  }
+
+  if (lsd->nruns > 0) {
+    pr_trace_msg("data", 8, "merging %u sorted runs of directory names",
+      lsd->nruns + 1);
+  }
+
+  return 0;
+}
+
+static void ls_closedir(struct ls_dir *lsd) {
+  register size_t i;
+
+  if (lsd->dirh != NULL) {
+    pr_fsio_closedir(lsd->dirh);
+  }
+
+  for (i = 0; i < lsd->nnames; i++) {
+    free(lsd->names[i]);
+  }
+  free(lsd->names);
+
+  for (i = 0; i < lsd->nruns; i++) {
+    fclose(lsd->runs[i].fh);
+    free(lsd->runs[i].name);
+  }
+  free(lsd->runs);
+
+  free(lsd);
+}
+
+static struct ls_dir *ls_opendir(const char *dirname, const int sort) {
+  struct ls_dir *lsd;
+  struct stat st;
+  void *dirh;
+
+  pr_fs_clear_cache2(dirname);
+  if (pr_fsio_stat(dirname, &st) < 0) {
+    return NULL;
+  }
+
+  if (!S_ISDIR(st.st_mode)) {
+    errno = ENOTDIR;
+    return NULL;
+  }
+
+  dirh = pr_fsio_opendir(dirname);
+  if (dirh == NULL) {
+    return NULL;
+  }
+
+  lsd = ls_alloc(NULL, sizeof(struct ls_dir));
+  memset(lsd, '\0', sizeof(struct ls_dir));
+  lsd->dirh = dirh;
+  lsd->sort = sort;
+
+  if (sort &&
+      ls_sort_names(lsd) < 0) {
+    int xerrno = errno;
+
+    ls_closedir(lsd);
+
+    errno = xerrno;
+    return NULL;
+  }
+
+  return lsd;
+}
+
+/* Returns the next name in the directory; the name is valid until the next
+ * call.
+ */
+static const char *ls_readdir(struct ls_dir *lsd) {
+  register unsigned int i;
+  const char *name = NULL;
+  struct ls_run *best_run = NULL;
+
+  pr_signals_handle();
+
+  if (!lsd->sort) {
+    struct dirent *de;
+
+    de = pr_fsio_readdir(lsd->dirh);
+    return de != NULL ? de->d_name : NULL;
+  }
+
+  if (lsd->last_run != NULL) {
+    ls_run_next(lsd->last_run);
+    lsd->last_run = NULL;
+  }
+
+  if (lsd->next_name < lsd->nnames) {
+    name = lsd->names[lsd->next_name];
+  }
+
+  for (i = 0; i < lsd->nruns; i++) {
+    struct ls_run *run;
+
+    run = &(lsd->runs[i]);
+    if (run->name != NULL &&
+        (name == NULL || dircmp(&(run->name), &name) < 0)) {
+      name = run->name;
+      best_run = run;
+    }
+  }
+
+  if (best_run != NULL) {
+    lsd->last_run = best_run;
+
+  } else if (name != NULL) {
+    lsd->next_name++;
+  }
+
+  return name;
+}
+
+/* Returns the fd of the directory, if it is on the system filesystem (and
+ * thus can be used for looking up its entries), or -1 otherwise.
+ */
+static int ls_dir_fd(struct ls_dir *lsd) {
+#if defined(HAVE_DIRFD) && defined(HAVE_FSTATAT)
+  pr_fs_t *fs;
+
+  fs = pr_get_fs(pr_fs_getcwd(), NULL);
+  if (fs != NULL &&
+      strcmp(fs->fs_name, "system") == 0) {
+    return dirfd((DIR *) lsd->dirh);
+  }
+#endif /* HAVE_DIRFD and HAVE_FSTATAT */
+
+  return -1;
+}
+
+/* Lists the entries of the current directory as they are read, returning
+ * the (NULL-terminated) names of its subdirectories, if recursing; the
+ * location of the terminating NULL is returned in dir_end.
+ */
+static char **ls_streamdir(cmd_rec *cmd, pool *workp, const char *resp_code,
+    char ***dir_end) {
+  struct ls_dir *lsd;
+  const char *name;
+  char **dirs;
+  size_t dirs_size = 16, ndirs = 0;
+  unsigned long nentries = 0;
+  int aborted = FALSE;
+  pool *tmp_pool, *entry_pool;
+
+  lsd = ls_opendir(".", opt_U ? FALSE : TRUE);
+  if (lsd == NULL) {
+    return NULL;
+  }
+
+  dirs = ls_alloc(NULL, dirs_size * sizeof(char *));
+
+  /* Lines which need sorting/formatting are buffered in fpool, which thus
+   * must not be allocated from the per-entry pool.
+   */
+  if (fpool == NULL) {
+    fpool = make_sub_pool(cmd->tmp_pool);
+    pr_pool_tag(fpool, "mod_ls addfile pool");
+  }
+
+  if (!opt_C && !opt_S && !opt_t) {
+    list_streaming = TRUE;
+  }
+
+  ls_dirfd = ls_dir_fd(lsd);
+
+  /* Each entry allocates from cmd->tmp_pool, as well as the given pool; use
+   * a per-entry pool for both, cleared periodically, so that memory use does
+   * not grow with the size of the directory.
+   */
+  tmp_pool = cmd->tmp_pool;
+  entry_pool = make_sub_pool(workp);
+  pr_pool_tag(entry_pool, "mod_ls: ls_streamdir(): entry pool");
+  cmd->tmp_pool = entry_pool;
+
+  while ((name = ls_readdir(lsd)) != NULL) {
+    int res;
+
+    if (*name == '.' &&
+        !opt_a &&
+        (!opt_A || is_dotdir(name))) {
+      continue;
+    }
+
+    res = listfile(cmd, entry_pool, resp_code, name);
+    if (res == 2) {
+      aborted = TRUE;
+      break;
+    }
+
+    if (opt_R &&
+        res == 1) {
+      if (ndirs + 1 >= dirs_size) {
+        dirs_size *= 2;
+        dirs = ls_alloc(dirs, dirs_size * sizeof(char *));
+      }
+
+      dirs[ndirs] = ls_alloc(NULL, strlen(name) + 1);
+      memcpy(dirs[ndirs], name, strlen(name) + 1);
+      ndirs++;
+    }
+
+    nentries++;
+    if (nentries % LS_STREAM_POOL_ENTRIES == 0) {
+      destroy_pool(entry_pool);
+      entry_pool = make_sub_pool(workp);
+      pr_pool_tag(entry_pool, "mod_ls: ls_streamdir(): entry pool");
+      cmd->tmp_pool = entry_pool;
+    }
+  }
+
+  cmd->tmp_pool = tmp_pool;
+  destroy_pool(entry_pool);
+
+  ls_dirfd = -1;
+  list_streaming = FALSE;
+  ls_closedir(lsd);
+
+  /* Once the listing is aborted, there is nothing to recurse into. */
+  if (aborted == TRUE) {
+    while (ndirs > 0) {
+      free(dirs[--ndirs]);
+    }
+  }
+
+  dirs[ndirs] = NULL;
+  *dir_end = &(dirs[ndirs]);
+  return dirs;
+}
+
 /* This listdir() requires a chdir() first. */
 static int listdir(cmd_rec *cmd, pool *workp, const char *resp_code,
     const char *name) {
-  char **dir;
+  char **dir, **s = NULL;
   int dest_workp = 0;
   register unsigned int i = 0;
 
@@ -1372,43 +1814,50 @@ static int listdir(cmd_rec *cmd, pool *workp, const char *resp_code,
     dest_workp++;
   }
 
-  PR_DEVEL_CLOCK(dir = sreaddir(".", opt_U ? FALSE : TRUE));
-  if (dir) {
-    char **s;
-    char **r;
+  if (list_flags & LS_FL_STREAM_LISTINGS) {
+    /* The returned list contains only the subdirectories to recurse into. */
+    PR_DEVEL_CLOCK(dir = ls_streamdir(cmd, workp, resp_code, &s));
 
-    int d = 0;
+  } else {
+    PR_DEVEL_CLOCK(dir = sreaddir(".", opt_U ? FALSE : TRUE));
+    if (dir) {
+      int d = 0;
+
+      s = dir;
+      while (*s) {
+        if (**s == '.') {
+          if (!opt_a && (!opt_A || is_dotdir(*s))) {
+            d = 0;
 
-    s = dir;
-    while (*s) {
-      if (**s == '.') {
-        if (!opt_a && (!opt_A || is_dotdir(*s))) {
-          d = 0;
+          } else {
+            d = listfile(cmd, workp, resp_code, *s);
+          }
 
         } else {
           d = listfile(cmd, workp, resp_code, *s);
         }
 
-      } else {
-        d = listfile(cmd, workp, resp_code, *s);
-      }
+        if (opt_R && d == 0) {
 
-      if (opt_R && d == 0) {
+          /* This is a nasty hack.  If listfile() returns a zero, and we
+           * will be recursing (-R option), make sure we don't try to list
+           * this file again by changing the first character of the path
+           * to ".".  Such files are skipped later.
+           */
+          **s = '.';
+          *(*s + 1) = '\0';
 
-        /* This is a nasty hack.  If listfile() returns a zero, and we
-         * will be recursing (-R option), make sure we don't try to list
-         * this file again by changing the first character of the path
-         * to ".".  Such files are skipped later.
-         */
-        **s = '.';
-        *(*s + 1) = '\0';
+        } else if (d == 2) {
+          break;
+        }
 
-      } else if (d == 2) {
-        break;
+        s++;
       }
-
-      s++;
     }
+  }
+
+  if (dir) {
+    char **r;
 
     if (outputfiles(cmd) < 0) {
       if (dest_workp) {
@@ -2374,10 +2823,12 @@ static int nlstfile(cmd_rec *cmd, const char *file) {
  * error returned if data conn cannot be opened or is aborted.
  */
 static int nlstdir(cmd_rec *cmd, const char *dir) {
-  char **list, *p, *f,
-       file[PR_TUNABLE_PATH_MAX + 1] = {'\0'};
+  char **list = NULL, file[PR_TUNABLE_PATH_MAX + 1] = {'\0'};
+  const char *p, *f;
   char cwd_buf[PR_TUNABLE_PATH_MAX + 1] = {'\0'};
-  pool *workp;
+  pool *workp, *tmp_pool = NULL, *entry_pool;
+  struct ls_dir *lsd = NULL;
+  unsigned long nentries = 0;
   unsigned char symhold;
   int curdir = FALSE, i, j, count = 0, hidden = 0, use_sorting = FALSE;
   mode_t mode;
@@ -2436,8 +2887,15 @@ static int nlstdir(cmd_rec *cmd, const char *dir) {
     use_sorting = TRUE;
   }
 
-  PR_DEVEL_CLOCK(list = sreaddir(".", use_sorting));
-  if (list == NULL) {
+  if (list_flags & LS_FL_STREAM_LISTINGS) {
+    PR_DEVEL_CLOCK(lsd = ls_opendir(".", use_sorting));
+
+  } else {
+    PR_DEVEL_CLOCK(list = sreaddir(".", use_sorting));
+  }
+
+  if (list == NULL &&
+      lsd == NULL) {
     pr_trace_msg("fsio", 9,
       "sreaddir() error on '.': %s", strerror(errno));
 
@@ -2462,9 +2920,38 @@ static int nlstdir(cmd_rec *cmd, const char *dir) {
     }
   }
 
+  /* For streamed listings, use a per-entry pool (for cmd->tmp_pool, too),
+   * cleared periodically, so that memory use does not grow with the size of
+   * the directory.
+   */
+  entry_pool = workp;
+  if (lsd != NULL) {
+    tmp_pool = cmd->tmp_pool;
+    entry_pool = make_sub_pool(workp);
+    pr_pool_tag(entry_pool, "mod_ls: nlstdir(): entry pool");
+    cmd->tmp_pool = entry_pool;
+  }
+
   j = 0;
-  while (list[j] && count >= 0) {
-    p = list[j++];
+  while (count >= 0) {
+    if (lsd != NULL) {
+      nentries++;
+      if (nentries % LS_STREAM_POOL_ENTRIES == 0) {
+        destroy_pool(entry_pool);
+        entry_pool = make_sub_pool(workp);
+        pr_pool_tag(entry_pool, "mod_ls: nlstdir(): entry pool");
+        cmd->tmp_pool = entry_pool;
+      }
+
+      p = ls_readdir(lsd);
+
+    } else {
+      p = list[j++];
+    }
+
+    if (p == NULL) {
+      break;
+    }
 
     pr_signals_handle();
 
@@ -2499,7 +2986,7 @@ static int nlstdir(cmd_rec *cmd, const char *dir) {
       f = p;
     }
 
-    if (ls_perms(workp, cmd, dir_best_path(cmd->tmp_pool, f), &hidden)) {
+    if (ls_perms(entry_pool, cmd, dir_best_path(cmd->tmp_pool, f), &hidden)) {
       if (hidden) {
         continue;
       }
@@ -2567,6 +3054,11 @@ static int nlstdir(cmd_rec *cmd, const char *dir) {
     }
   }
 
+  if (lsd != NULL) {
+    cmd->tmp_pool = tmp_pool;
+    ls_closedir(lsd);
+  }
+
   sendline(LS_SENDLINE_FL_FLUSH, " ");
 
   if (!curdir) {
@@ -2577,11 +3069,13 @@ static int nlstdir(cmd_rec *cmd, const char *dir) {
   /* Explicitly free the memory allocated for containing the list of
    * filenames.
    */
-  i = 0;
-  while (list[i] != NULL) {
-    free(list[i++]);
+  if (list != NULL) {
+    i = 0;
+    while (list[i] != NULL) {
+      free(list[i++]);
+    }
+    free(list);
   }
-  free(list);
 
   return count;
 }
@@ -3600,6 +4094,9 @@ MODRET set_listoptions(cmd_rec *cmd) {
       } else if (strcasecmp(cmd->argv[i], "SortedNLST") == 0) {
         flags |= LS_FL_SORTED_NLST;
 
+      } else if (strcasecmp(cmd->argv[i], "StreamListings") == 0) {
+        flags |= LS_FL_STREAM_LISTINGS;
+
       } else {
         CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, ": unknown keyword: '",
           (char *) cmd->argv[i], "'", NULL));
@@ -78,6 +78,7 @@ static int xfer_parse_cmdlist(const char *, config_rec *, char *);
 module xfer_module;
 
 static int xfer_logged_sendfile_decline_msg = FALSE;
+static int xfer_logged_splice_decline_msg = FALSE;
 
 static const char *trace_channel = "xfer";
 
@@ -546,22 +547,32 @@ static int transmit_normal(pool *p, char *buf, size_t bufsz) {
 }
 
 #ifdef HAVE_SENDFILE
+/* Returns TRUE if the RFC2228 data channel protection is handled by the
+ * kernel, e.g. kernel TLS, such that we can write directly to the socket.
+ */
+static int have_kernel_rfc2228_data(void) {
+  if (pr_table_get(session.notes, "mod_tls.ktls-send", NULL) != NULL) {
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
 static int transmit_sendfile(off_t data_len, off_t *data_offset,
     pr_sendfile_t *sent_len) {
   off_t send_len;
 
   /* We don't use sendfile() if:
-   * - We're using bandwidth throttling.
    * - We're transmitting an ASCII file.
-   * - We're using RFC2228 data channel protection
+   * - We're using RFC2228 data channel protection, not handled by the
+   *   kernel
    * - We're using MODE Z compression
    * - There's no data left to transmit.
    * - UseSendfile is set to off.
    */
-  if (pr_throttle_have_rate() ||
-     !(session.xfer.file_size - data_len) ||
+  if (!(session.xfer.file_size - data_len) ||
      (session.sf_flags & (SF_ASCII|SF_ASCII_OVERRIDE)) ||
-     have_rfc2228_data || have_zmode ||
+     (have_rfc2228_data && !have_kernel_rfc2228_data()) || have_zmode ||
      !use_sendfile) {
 
     if (!xfer_logged_sendfile_decline_msg) {
@@ -569,14 +580,11 @@ static int transmit_sendfile(off_t data_len, off_t *data_offset,
         pr_log_debug(DEBUG10, "declining use of sendfile due to UseSendfile "
           "configuration setting");
 
-      } else if (pr_throttle_have_rate()) {
-        pr_log_debug(DEBUG10, "declining use of sendfile due to TransferRate "
-          "restrictions");
-    
       } else if (session.sf_flags & (SF_ASCII|SF_ASCII_OVERRIDE)) {
         pr_log_debug(DEBUG10, "declining use of sendfile for ASCII data");
 
-      } else if (have_rfc2228_data) {
+      } else if (have_rfc2228_data &&
+                 !have_kernel_rfc2228_data()) {
         pr_log_debug(DEBUG10, "declining use of sendfile due to RFC2228 data "
           "channel protections");
 
@@ -595,7 +603,13 @@ static int transmit_sendfile(off_t data_len, off_t *data_offset,
     return 0;
   }
 
-  pr_log_debug(DEBUG10, "using sendfile capability for transmitting data");
+  if (have_rfc2228_data) {
+    pr_log_debug(DEBUG10, "using sendfile capability for transmitting data "
+      "via kernel-handled RFC2228 data channel protections");
+
+  } else {
+    pr_log_debug(DEBUG10, "using sendfile capability for transmitting data");
+  }
 
   /* Determine how many bytes to send using sendfile(2).  By default,
    * we want to send all of the remaining bytes.
@@ -630,6 +644,21 @@ static int transmit_sendfile(off_t data_len, off_t *data_offset,
     }
   }
 
+  /* If throttling, send no more than a rate-sized chunk at a time; the
+   * caller pauses between chunks as needed.
+   */
+  if (pr_throttle_have_rate()) {
+    off_t throttle_len;
+
+    throttle_len = pr_throttle_get_xfer_len(session.xfer.total_bytes);
+    if (throttle_len > 0 &&
+        send_len > throttle_len) {
+      pr_trace_msg(trace_channel, 19, "using sendfile with TransferRate "
+        "chunk length (%" PR_LU " bytes)", (pr_off_t) throttle_len);
+      send_len = throttle_len;
+    }
+  }
+
  retry:
   *sent_len = pr_data_sendfile(PR_FH_FD(retr_fh), data_offset, send_len);
 
@@ -757,6 +786,100 @@ static long transmit_data(pool *p, off_t data_len, off_t *data_offset,
   return res;
 }
 
+/* Reads the next chunk of uploaded data into the given buffer.  If possible,
+ * up to splice_len bytes are instead moved directly from the data connection
+ * into stor_fh using pr_data_splice(), in which case *spliced is set to TRUE
+ * and the returned data have already been written.
+ */
+static int receive_data(char *buf, size_t bufsz, size_t splice_len,
+    int *spliced) {
+#ifdef HAVE_SPLICE
+  int res;
+
+  *spliced = FALSE;
+
+  /* We don't use splice() if:
+   * - UseSendfile is set to off (or splice() has already failed).
+   * - We're receiving an ASCII file.
+   * - We're using RFC2228 data channel protection
+   * - We're using MODE Z compression
+   * - Someone wants to see the data as it is read.
+   * - The file is not handled by the system FS.
+   * - We are not allowed to read any more data that way.
+   */
+  if (!use_sendfile ||
+      (session.sf_flags & (SF_ASCII|SF_ASCII_OVERRIDE)) ||
+      have_rfc2228_data || have_zmode ||
+      pr_event_listening("core.data-read") > 0 ||
+      strcmp(stor_fh->fh_fs->fs_name, "system") != 0 ||
+      splice_len == 0) {
+
+    if (!xfer_logged_splice_decline_msg &&
+        splice_len > 0) {
+      if (!use_sendfile) {
+        pr_log_debug(DEBUG10, "declining use of splice due to UseSendfile "
+          "configuration setting");
+
+      } else if (session.sf_flags & (SF_ASCII|SF_ASCII_OVERRIDE)) {
+        pr_log_debug(DEBUG10, "declining use of splice for ASCII data");
+
+      } else if (have_rfc2228_data) {
+        pr_log_debug(DEBUG10, "declining use of splice due to RFC2228 data "
+          "channel protections");
+
+      } else if (have_zmode) {
+        pr_log_debug(DEBUG10, "declining use of splice due to MODE Z "
+          "restrictions");
+
+      } else if (pr_event_listening("core.data-read") > 0) {
+        pr_log_debug(DEBUG10, "declining use of splice due to data "
+          "read listeners");
+
+      } else {
+        pr_log_debug(DEBUG10, "declining use of splice for non-system FS "
+          "'%s'", stor_fh->fh_fs->fs_name);
+      }
+
+      xfer_logged_splice_decline_msg = TRUE;
+    }
+
+    return pr_data_xfer(buf, bufsz);
+  }
+
+  res = pr_data_splice(PR_FH_FD(stor_fh), splice_len);
+  if (res < 0) {
+    int xerrno = errno;
+
+    switch (xerrno) {
+#ifdef ENOSYS
+      case ENOSYS:
+#endif /* ENOSYS */
+      case EINVAL:
+        /* No splice support for this data connection or file, apparently.
+         * Do it the normal way, for the rest of this transfer.
+         */
+        pr_log_debug(DEBUG10, "use of splice(2) failed due to %s (%d), "
+          "falling back to normal data transmission", strerror(xerrno),
+          xerrno);
+        use_sendfile = FALSE;
+        xfer_logged_splice_decline_msg = TRUE;
+        return pr_data_xfer(buf, bufsz);
+
+      default:
+        break;
+    }
+
+    errno = xerrno;
+  }
+
+  *spliced = TRUE;
+  return res;
+#else
+  *spliced = FALSE;
+  return pr_data_xfer(buf, bufsz);
+#endif /* HAVE_SPLICE */
+}
+
 static void stor_chown(pool *p) {
   struct stat st;
   const char *xfer_path = NULL;
@@ -1771,6 +1894,7 @@ MODRET xfer_stor(cmd_rec *cmd) {
   const char *path;
   char *lbuf;
   int bufsz, len, xerrno = 0;
+  config_rec *c;
   off_t nbytes_stored, nbytes_max_store = 0;
   unsigned char have_limit = FALSE;
   struct stat st;
@@ -2047,8 +2171,60 @@ MODRET xfer_stor(cmd_rec *cmd) {
   pr_trace_msg("data", 8, "allocated upload buffer of %lu bytes",
     (unsigned long) bufsz);
 
-  while ((len = pr_data_xfer(lbuf, bufsz)) > 0) {
-    int res;
+  /* Check for UseSendfile, which also governs use of splice(2) for
+   * uploads.
+   */
+  use_sendfile = TRUE;
+  xfer_logged_splice_decline_msg = FALSE;
+
+  c = find_config(CURRENT_CONF, CONF_PARAM, "UseSendfile", FALSE);
+  if (c != NULL) {
+    use_sendfile = *((unsigned char *) c->argv[0]);
+  }
+
+  while (TRUE) {
+    int res, spliced = FALSE;
+    off_t splice_len = bufsz;
+
+    /* Never splice past the MaxStoreFileSize limit or the requested range;
+     * the normal code path below handles any data beyond those.
+     */
+    if (have_limit &&
+        splice_len > nbytes_max_store - st.st_size - nbytes_stored) {
+      splice_len = nbytes_max_store - st.st_size - nbytes_stored;
+    }
+
+    if (session.range_len > 0 &&
+        splice_len > upload_len - nbytes_stored) {
+      splice_len = upload_len - nbytes_stored;
+    }
+
+    if (splice_len < 0) {
+      splice_len = 0;
+    }
+
+    len = receive_data(lbuf, bufsz, (size_t) splice_len, &spliced);
+    if (len <= 0) {
+      if (len < 0 &&
+          spliced == TRUE) {
+        xerrno = errno;
+
+        (void) pr_trace_msg("fileperms", 1, "%s, user '%s' (UID %s, GID %s): "
+          "error splicing data to '%s': %s", (char *) cmd->argv[0],
+          session.user, pr_uid2str(cmd->tmp_pool, session.uid),
+          pr_gid2str(cmd->tmp_pool, session.gid), stor_fh->fh_path,
+          strerror(xerrno));
+
+        stor_abort(cmd->pool);
+        pr_data_abort(xerrno, FALSE);
+
+        pr_cmd_set_errno(cmd, xerrno);
+        errno = xerrno;
+        return PR_ERROR(cmd);
+      }
+
+      break;
+    }
 
     pr_signals_handle();
 
@@ -2085,13 +2261,19 @@ MODRET xfer_stor(cmd_rec *cmd) {
       return PR_ERROR(cmd);
     }
 
-    /* XXX Need to handle short writes better here.  It is possible that
-     * the underlying filesystem (e.g. a network-mounted filesystem) could
-     * be doing short writes, and we ideally should be more resilient/graceful
-     * in the face of such things.
-     */
-    res = pr_fsio_write_with_error(cmd->pool, stor_fh, lbuf, len, &err);
-    xerrno = errno;
+    if (spliced == TRUE) {
+      /* The spliced data have already been written to the file. */
+      res = len;
+
+    } else {
+      /* XXX Need to handle short writes better here.  It is possible that
+       * the underlying filesystem (e.g. a network-mounted filesystem) could
+       * be doing short writes, and we ideally should be more
+       * resilient/graceful in the face of such things.
+       */
+      res = pr_fsio_write_with_error(cmd->pool, stor_fh, lbuf, len, &err);
+      xerrno = errno;
+    }
 
     while (res < 0 &&
            xerrno == EINTR) {
@@ -26,11 +26,196 @@
 
 #include "conf.h"
 
+/* On x86 platforms, use SSE2 (always available on x86_64) and, if the CPU
+ * supports it at runtime, AVX2 to scan for CR/LF characters a vector at a
+ * time.  Other platforms use the scalar loops.
+ */
+#if defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    defined(__SSE2__)
+# include <emmintrin.h>
+# define PR_ASCII_USE_SSE2	1
+
+# if defined(__clang__) || \
+     (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#  include <immintrin.h>
+#  define PR_ASCII_USE_AVX2	1
+# endif
+#endif
+
+static int have_dangling_cr = FALSE;
+
+/* Reusable output buffer for pr_ascii_ftp_to_crlf2().  Like the buffers
+ * returned by pr_ascii_ftp_to_crlf(), this uses malloc(3) rather than pools
+ * (see Bug#4352); it is allocated once, and only ever grown, for the lifetime
+ * of the session process.
+ */
+static char *ascii_buf = NULL;
+static size_t ascii_bufsz = 0;
+
+#if defined(PR_ASCII_USE_AVX2)
+static int ascii_have_avx2 = -1;
+
+static int ascii_use_avx2(void) {
+  if (ascii_have_avx2 < 0) {
+    __builtin_cpu_init();
+    ascii_have_avx2 = __builtin_cpu_supports("avx2") ? TRUE : FALSE;
+  }
+
+  return ascii_have_avx2;
+}
+
+/* The vector scanners return the index of the first match found, or the
+ * index at which they stopped scanning (because fewer than a full vector of
+ * bytes remain).  The scalar scanners finish the job from that index.
+ */
+__attribute__((target("avx2")))
+static size_t ascii_avx2_find_bare_lf(const char *src, size_t i, size_t len) {
+  const __m256i cr = _mm256_set1_epi8('\r'), lf = _mm256_set1_epi8('\n');
+
+  while (i + 32 <= len) {
+    __m256i curr, prev;
+    unsigned int mask;
+
+    curr = _mm256_loadu_si256((const __m256i *) (src + i));
+    prev = _mm256_loadu_si256((const __m256i *) (src + i - 1));
+
+    mask = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(curr, lf)) &
+      ~((unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(prev, cr)));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+
+    i += 32;
+  }
+
+  return i;
+}
+
+__attribute__((target("avx2")))
+static size_t ascii_avx2_find_crlf(const char *src, size_t i, size_t len) {
+  const __m256i cr = _mm256_set1_epi8('\r'), lf = _mm256_set1_epi8('\n');
+
+  while (i + 33 <= len) {
+    __m256i curr, next;
+    unsigned int mask;
+
+    curr = _mm256_loadu_si256((const __m256i *) (src + i));
+    next = _mm256_loadu_si256((const __m256i *) (src + i + 1));
+
+    mask = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(curr, cr)) &
+      (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(next, lf));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+
+    i += 32;
+  }
+
+  return i;
+}
+#endif /* PR_ASCII_USE_AVX2 */
+
+#if defined(PR_ASCII_USE_SSE2)
+static size_t ascii_sse2_find_bare_lf(const char *src, size_t i, size_t len) {
+  const __m128i cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n');
+
+  while (i + 16 <= len) {
+    __m128i curr, prev;
+    unsigned int mask;
+
+    curr = _mm_loadu_si128((const __m128i *) (src + i));
+    prev = _mm_loadu_si128((const __m128i *) (src + i - 1));
+
+    mask = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(curr, lf)) &
+      ~((unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(prev, cr)));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+
+    i += 16;
+  }
+
+  return i;
+}
+
+static size_t ascii_sse2_find_crlf(const char *src, size_t i, size_t len) {
+  const __m128i cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n');
+
+  while (i + 17 <= len) {
+    __m128i curr, next;
+    unsigned int mask;
+
+    curr = _mm_loadu_si128((const __m128i *) (src + i));
+    next = _mm_loadu_si128((const __m128i *) (src + i + 1));
+
+    mask = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(curr, cr)) &
+      (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(next, lf));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+
+    i += 16;
+  }
+
+  return i;
+}
+#endif /* PR_ASCII_USE_SSE2 */
+
+/* Returns the index of the first LF, at or after index `i', which is not
+ * preceded by a CR, or `len' if there is no such LF.  Note that `i' MUST be
+ * at least 1.
+ */
+static size_t ascii_find_bare_lf(const char *src, size_t i, size_t len) {
+#if defined(PR_ASCII_USE_AVX2)
+  if (ascii_use_avx2() == TRUE) {
+    i = ascii_avx2_find_bare_lf(src, i, len);
+  }
+#endif /* PR_ASCII_USE_AVX2 */
+
+#if defined(PR_ASCII_USE_SSE2)
+  i = ascii_sse2_find_bare_lf(src, i, len);
+#endif /* PR_ASCII_USE_SSE2 */
+
+  for (; i < len; i++) {
+    if (src[i] == '\n' &&
+        src[i-1] != '\r') {
+      return i;
+    }
+  }
+
+  return len;
+}
+
+/* Returns the index of the first CR, at or after index `i', which is followed
+ * by an LF, or `len' if there is no such CRLF.
+ */
+static size_t ascii_find_crlf(const char *src, size_t i, size_t len) {
+#if defined(PR_ASCII_USE_AVX2)
+  if (ascii_use_avx2() == TRUE) {
+    i = ascii_avx2_find_crlf(src, i, len);
+  }
+#endif /* PR_ASCII_USE_AVX2 */
+
+#if defined(PR_ASCII_USE_SSE2)
+  i = ascii_sse2_find_crlf(src, i, len);
+#endif /* PR_ASCII_USE_SSE2 */
+
+  for (; i + 1 < len; i++) {
+    if (src[i] == '\r' &&
+        src[i+1] == '\n') {
+      return i;
+    }
+  }
+
+  return len;
+}
+
 int pr_ascii_ftp_from_crlf(pool *p, char *in, size_t inlen, char **out,
     size_t *outlen) {
-  char *src, *dst;
-  size_t rem;
-  int adj;
+  char *dst;
+  size_t i, crlf_pos, run_len;
+  int adj = 0;
 
   (void) p;
 
@@ -46,48 +231,92 @@ int pr_ascii_ftp_from_crlf(pool *p, char *in, size_t inlen, char **out,
     return 0;
   }
 
-  src = in;
-  rem = inlen;
   dst = *out;
-  adj = 0;
-
-  while (rem--) {
-    if (*src != '\r') {
-      *dst++ = *src++;
-      (*outlen)++;
-
-    } else {
-      if (rem == 0) {
-        /* copy, but save it for later */
-        adj++;
-        *dst++ = *src++;
-
-      } else {
-        if (*(src+1) == '\n') {
-          /* Skip the CR. */
-          src++;
-
-        } else {
-          *dst++ = *src++;
-          (*outlen)++;
-        }
+  i = 0;
+
+  /* Copy each run of data up to the next CRLF, skipping the CR.  Note that
+   * the output buffer may be the same as the input buffer, hence the use of
+   * memmove(3).
+   */
+  while (i < inlen) {
+    crlf_pos = ascii_find_crlf(in, i, inlen);
+
+    run_len = crlf_pos - i;
+    if (run_len > 0) {
+      if (dst != in + i) {
+        memmove(dst, in + i, run_len);
       }
+
+      dst += run_len;
+      *outlen += run_len;
     }
+
+    if (crlf_pos == inlen) {
+      break;
+    }
+
+    /* Skip the CR. */
+    i = crlf_pos + 1;
+  }
+
+  if (in[inlen-1] == '\r') {
+    /* We copied the trailing CR, but save it for later; the next buffer
+     * might start with an LF.
+     */
+    (*outlen)--;
+    adj++;
   }
 
   return adj;
 }
 
-static int have_dangling_cr = FALSE;
+/* Returns the index of the first bare LF in the given buffer, taking into
+ * account any dangling CR from the previous buffer.
+ */
+static size_t ascii_first_bare_lf(const char *src, size_t src_len) {
+  if (have_dangling_cr == FALSE &&
+      src[0] == '\n') {
+    return 0;
+  }
+
+  return ascii_find_bare_lf(src, 1, src_len);
+}
+
+/* Copies the source buffer into the destination buffer, which MUST be at
+ * least twice the size of the source buffer, adding a CR before each bare LF,
+ * starting with the bare LF at `lf_pos'.  Returns the number of bytes written.
+ */
+static size_t ascii_copy_to_crlf(const char *src, size_t src_len,
+    size_t lf_pos, char *dst) {
+  size_t i = 0, j = 0;
+
+  if (lf_pos > 0) {
+    memcpy(dst, src, lf_pos);
+    i = j = lf_pos;
+  }
+
+  while (j < src_len) {
+    size_t next_pos;
+
+    /* Here, src[j] is always a bare LF. */
+    dst[i++] = '\r';
+
+    next_pos = ascii_find_bare_lf(src, j + 1, src_len);
+    memcpy(dst + i, src + j, next_pos - j);
+    i += (next_pos - j);
+    j = next_pos;
+  }
+
+  return i;
+}
 
 /* This function rewrites the contents of the given buffer, making sure that
  * each LF has a preceding CR, as required by RFC959.
  */
 int pr_ascii_ftp_to_crlf(pool *p, char *in, size_t inlen, char **out,
     size_t *outlen) {
-  register unsigned int i = 0, j = 0;
-  char *dst = NULL, *src;
-  size_t src_len, lf_pos;
+  char *dst = NULL;
+  size_t src_len, lf_pos, dst_len;
 
   if (p == NULL ||
       in == NULL ||
@@ -102,31 +331,17 @@ int pr_ascii_ftp_to_crlf(pool *p, char *in, size_t inlen, char **out,
     return 0;
   }
 
-  src = in;
-  src_len = lf_pos = inlen;
+  src_len = inlen;
 
   /* First, determine the position of the first bare LF. */
-  if (have_dangling_cr == FALSE &&
-      src[0] == '\n') {
-    lf_pos = 0;
-    goto found_lf;
-  }
-
-  for (i = 1; i < src_len; i++) {
-    if (src[i] == '\n' &&
-        src[i-1] != '\r') {
-      lf_pos = i;
-      break;
-    }
-  }
+  lf_pos = ascii_first_bare_lf(in, src_len);
 
-found_lf:
   /* If the last character in the buffer is CR, then we have a dangling CR.
    * The first character in the next buffer could be an LF, and without
    * this flag, that LF would be treated as a bare LF, thus resulting in
    * an added extraneous CR in the stream.
    */
-  have_dangling_cr = (src[src_len-1] == '\r') ? TRUE : FALSE;
+  have_dangling_cr = (in[src_len-1] == '\r') ? TRUE : FALSE;
 
   if (lf_pos == src_len) {
     /* No translation needed. */
@@ -153,31 +368,62 @@ found_lf:
     exit(1);
   }
 
-  if (lf_pos > 0) {
-    memcpy(dst, src, lf_pos);
-    i = j = lf_pos;
+  dst_len = ascii_copy_to_crlf(in, src_len, lf_pos, dst);
+  pr_signals_handle();
+
+  *outlen = dst_len;
+  *out = dst;
 
-  } else {
-    dst[0] = '\r';
-    dst[1] = '\n';
-    i = 2;
-    j = 1;
+  return (int) (dst_len - src_len);
+}
+
+int pr_ascii_ftp_to_crlf2(char *in, size_t inlen, char **out,
+    size_t *outlen) {
+  size_t lf_pos, dst_len;
+
+  if (in == NULL ||
+      out == NULL ||
+      outlen == NULL) {
+    errno = EINVAL;
+    return -1;
   }
 
-  while (j < src_len) {
-    if (src[j] == '\n' &&
-        src[j-1] != '\r') {
-      dst[i++] = '\r';
+  if (inlen == 0) {
+    *out = in;
+    *outlen = 0;
+    return 0;
+  }
+
+  lf_pos = ascii_first_bare_lf(in, inlen);
+  have_dangling_cr = (in[inlen-1] == '\r') ? TRUE : FALSE;
+
+  if (lf_pos == inlen) {
+    /* No translation needed, thus no copy needed, either. */
+    *out = in;
+    *outlen = inlen;
+    return 0;
+  }
+
+  if (ascii_bufsz < (inlen * 2)) {
+    char *buf;
+
+    buf = realloc(ascii_buf, inlen * 2);
+    if (buf == NULL) {
+      pr_log_pri(PR_LOG_ALERT, "Out of memory!");
+      exit(1);
     }
 
-    dst[i++] = src[j++];
+    ascii_buf = buf;
+    ascii_bufsz = inlen * 2;
   }
+
+  dst_len = ascii_copy_to_crlf(in, inlen, lf_pos, ascii_buf);
   pr_signals_handle();
 
-  *outlen = i;
-  *out = dst;
+  *out = ascii_buf;
+  *outlen = dst_len;
 
-  return (int) i - j;
+  return (int) (dst_len - inlen);
 }
 
 void pr_ascii_ftp_reset(void) {
@@ -189,6 +189,50 @@ conn_t *pr_ipbind_get_listening_conn(server_rec *server,
 
 static array_header *listener_list = NULL;
 
+int pr_ipbind_accept(conn_t *listener, int *listenfd) {
+  int fd;
+
+  if (listener == NULL ||
+      listenfd == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (listener->mode != CM_LISTEN) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  fd = pr_inet_accept_nowait(listener->pool, listener);
+  if (fd == -1) {
+    int xerrno = errno;
+
+    /* Handle errors gracefully.  If we're here, then
+     * ipbind->ib_server->listen contains either error information, or
+     * we just got caught in a blocking condition.
+     */
+    if (listener->mode == CM_ERROR) {
+
+      /* Ignore ECONNABORTED, as they tend to be health checks/probes by
+       * e.g. load balancers and other naive TCP clients.
+       */
+      if (listener->xerrno != ECONNABORTED) {
+        pr_log_pri(PR_LOG_ERR, "error: unable to accept an incoming "
+          "connection: %s", strerror(listener->xerrno));
+      }
+
+      listener->xerrno = 0;
+      listener->mode = CM_LISTEN;
+
+      errno = xerrno;
+      return -1;
+    }
+  }
+
+  *listenfd = fd;
+  return 0;
+}
+
 conn_t *pr_ipbind_accept_conn(fd_set *readfds, int *listenfd) {
   conn_t **listeners = listener_list->elts;
   register unsigned int i = 0;
@@ -205,34 +249,10 @@ conn_t *pr_ipbind_accept_conn(fd_set *readfds, int *listenfd) {
     pr_signals_handle();
     if (FD_ISSET(listener->listen_fd, readfds) &&
         listener->mode == CM_LISTEN) {
-      int fd = pr_inet_accept_nowait(listener->pool, listener);
-
-      if (fd == -1) {
-        int xerrno = errno;
-
-        /* Handle errors gracefully.  If we're here, then
-         * ipbind->ib_server->listen contains either error information, or
-         * we just got caught in a blocking condition.
-         */
-        if (listener->mode == CM_ERROR) {
-
-          /* Ignore ECONNABORTED, as they tend to be health checks/probes by
-           * e.g. load balancers and other naive TCP clients.
-           */
-          if (listener->xerrno != ECONNABORTED) {
-            pr_log_pri(PR_LOG_ERR, "error: unable to accept an incoming "
-              "connection: %s", strerror(listener->xerrno));
-          }
-
-          listener->xerrno = 0;
-          listener->mode = CM_LISTEN;
-
-          errno = xerrno;
-          return NULL;
-        }
+      if (pr_ipbind_accept(listener, listenfd) < 0) {
+        return NULL;
       }
 
-      *listenfd = fd;
       return listener;
     }
   }
@@ -459,6 +479,26 @@ int pr_ipbind_close_listeners(void) {
   return 0;
 }
 
+/* Discard all of the listening connections, including those which would
+ * otherwise be reused across restarts.
+ */
+int pr_ipbind_close_listening_conns(void) {
+  if (listening_conn_list == NULL) {
+    return 0;
+  }
+
+  if (listener_list != NULL) {
+    listener_list->nelts = 0;
+  }
+
+  /* Destroying the conn pools closes the listening sockets. */
+  destroy_pool(listening_conn_pool);
+  listening_conn_pool = NULL;
+  listening_conn_list = NULL;
+
+  return 0;
+}
+
 int pr_ipbind_create(server_rec *server, const pr_netaddr_t *addr,
     unsigned int port) {
   pr_ipbind_t *existing = NULL, *ipbind = NULL;
@@ -749,18 +789,10 @@ server_rec *pr_ipbind_get_server(const pr_netaddr_t *addr, unsigned int port) {
   return NULL;
 }
 
-int pr_ipbind_listen(fd_set *readfds) {
-  int listen_flags = PR_INET_LISTEN_FL_FATAL_ON_ERROR, maxfd = 0;
+array_header *pr_ipbind_get_listeners(void) {
+  int listen_flags = PR_INET_LISTEN_FL_FATAL_ON_ERROR;
   register unsigned int i = 0;
 
-  /* sanity check */
-  if (readfds == NULL) {
-    errno = EINVAL;
-    return -1;
-  }
-
-  FD_ZERO(readfds);
-
   if (binding_pool == NULL) {
     binding_pool = make_sub_pool(permanent_pool);
     pr_pool_tag(binding_pool, "Bindings Pool");
@@ -807,18 +839,39 @@ int pr_ipbind_listen(fd_set *readfds) {
         }
 
         if (ipbind->ib_listener->mode == CM_LISTEN) {
-          FD_SET(ipbind->ib_listener->listen_fd, readfds);
-          if (ipbind->ib_listener->listen_fd > maxfd) {
-            maxfd = ipbind->ib_listener->listen_fd;
-          }
-
-          /* Add this to the listener list as well. */
+          /* Add this to the listener list. */
           *((conn_t **) push_array(listener_list)) = ipbind->ib_listener;
         }
       }
     }
   }
 
+  return listener_list;
+}
+
+int pr_ipbind_listen(fd_set *readfds) {
+  int maxfd = 0;
+  register unsigned int i = 0;
+  conn_t **listeners;
+
+  /* sanity check */
+  if (readfds == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  FD_ZERO(readfds);
+
+  pr_ipbind_get_listeners();
+
+  listeners = listener_list->elts;
+  for (i = 0; i < listener_list->nelts; i++) {
+    FD_SET(listeners[i]->listen_fd, readfds);
+    if (listeners[i]->listen_fd > maxfd) {
+      maxfd = listeners[i]->listen_fd;
+    }
+  }
+
   return maxfd;
 }
 
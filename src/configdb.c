@@ -45,6 +45,70 @@ static pool *config_tab_pool = NULL;
 static pr_table_t *config_tab = NULL;
 static unsigned int config_id = 0;
 
+/* Config index.  For each config set, the index maps a config ID to the
+ * "candidates" in that set, in set order: the config_recs with that ID, and
+ * the config_recs whose subsets (at any depth) contain that ID.
+ */
+typedef struct {
+  config_rec *c;
+
+  /* Position of the config_rec in its set. */
+  unsigned int ord;
+
+  unsigned char match;
+  unsigned char holder;
+
+} config_index_cand_t;
+
+typedef struct {
+  unsigned int id;
+  array_header *cands;
+
+} config_index_ent_t;
+
+typedef struct {
+  unsigned int nents, nused;
+  config_index_ent_t *ents;
+
+} config_index_set_t;
+
+/* Maps config sets to their index, and config_recs to their position. */
+typedef struct {
+  const void *key;
+  config_index_set_t *set_index;
+  unsigned int ord;
+
+} config_index_ptr_t;
+
+static pool *config_index_pool = NULL;
+static xaset_t *config_index_servers = NULL;
+static config_index_ptr_t *config_index_ptrs = NULL;
+static unsigned int config_index_nptrs = 0;
+
+/* The index is only usable while its generation matches that of the
+ * configuration.
+ */
+static unsigned long config_gen = 0;
+static unsigned long config_index_gen = 0;
+static int config_index_built = FALSE;
+
+/* TRUE if every named config_rec in the index has a config ID; a search for
+ * a name without an ID then cannot match anything.
+ */
+static int config_index_have_ids = FALSE;
+
+/* Number of searches done with the current index, and number of searches
+ * done since the index became stale.  A stale index is rebuilt only after
+ * config_index_threshold searches, and that threshold grows for configurations
+ * which keep changing, so that the rebuilds do not cost more than they save.
+ */
+static unsigned long config_index_nlookups = 0;
+static unsigned int config_index_nstale = 0;
+static unsigned int config_index_threshold = 0;
+
+#define CONFIG_INDEX_MIN_THRESHOLD	32
+#define CONFIG_INDEX_MAX_THRESHOLD	8192
+
 static const char *trace_channel = "config";
 
 /* Adds a config_rec to the specified set */
@@ -98,6 +162,8 @@ config_rec *pr_config_add_set(xaset_t **set, const char *name, int flags) {
     c->config_id = pr_config_set_id(c->name);
   }
 
+  pr_config_index_invalidate();
+
   if (flags & PR_CONFIG_FL_INSERT_HEAD) {
     xaset_insert(*set, (xasetmember_t *) c);
     
@@ -464,6 +530,457 @@ void pr_config_merge_down(xaset_t *s, int dynamic) {
   }
 }
 
+static unsigned int config_index_hash(const void *ptr) {
+  unsigned long h;
+
+  h = (unsigned long) ptr;
+  h ^= (h >> 4) ^ (h >> 12);
+  return (unsigned int) (h * 2654435761UL);
+}
+
+static config_index_ptr_t *config_index_get_ptr(const void *key, int create) {
+  unsigned int i, mask;
+
+  if (config_index_ptrs == NULL) {
+    return NULL;
+  }
+
+  mask = config_index_nptrs - 1;
+  for (i = config_index_hash(key) & mask;
+       config_index_ptrs[i].key != NULL;
+       i = (i + 1) & mask) {
+    if (config_index_ptrs[i].key == key) {
+      return &(config_index_ptrs[i]);
+    }
+  }
+
+  if (create == FALSE) {
+    return NULL;
+  }
+
+  config_index_ptrs[i].key = key;
+  return &(config_index_ptrs[i]);
+}
+
+static config_index_ent_t *config_index_get_ent(config_index_set_t *si,
+    unsigned int id, int create) {
+  unsigned int i, mask;
+
+  mask = si->nents - 1;
+  for (i = (id * 2654435761U) & mask;
+       si->ents[i].id != 0;
+       i = (i + 1) & mask) {
+    if (si->ents[i].id == id) {
+      return &(si->ents[i]);
+    }
+  }
+
+  if (create == FALSE) {
+    return NULL;
+  }
+
+  si->ents[i].id = id;
+  si->nused++;
+  return &(si->ents[i]);
+}
+
+static void config_index_add_cand(config_index_set_t *si, unsigned int id,
+    config_rec *c, unsigned int ord, int holder) {
+  config_index_ent_t *ent;
+  config_index_cand_t *cand = NULL;
+
+  if (id == 0) {
+    return;
+  }
+
+  ent = config_index_get_ent(si, id, TRUE);
+  if (ent->cands == NULL) {
+    ent->cands = make_array(config_index_pool, 1, sizeof(config_index_cand_t));
+
+  } else {
+    cand = &(((config_index_cand_t *) ent->cands->elts)[ent->cands->nelts-1]);
+    if (cand->c != c) {
+      cand = NULL;
+    }
+  }
+
+  if (cand == NULL) {
+    cand = push_array(ent->cands);
+    cand->c = c;
+    cand->ord = ord;
+    cand->match = cand->holder = FALSE;
+  }
+
+  if (holder) {
+    cand->holder = TRUE;
+
+  } else {
+    cand->match = TRUE;
+  }
+}
+
+static unsigned int config_index_count(xaset_t *set) {
+  config_rec *c;
+  unsigned int count = 1;
+
+  for (c = (config_rec *) set->xas_list; c; c = c->next) {
+    count++;
+
+    if (c->subset != NULL &&
+        c->subset->xas_list != NULL) {
+      count += config_index_count(c->subset);
+    }
+  }
+
+  return count;
+}
+
+static config_index_set_t *config_index_set(xaset_t *set) {
+  config_rec *c;
+  config_index_set_t *si;
+  config_index_ptr_t *ptr;
+  unsigned int bound = 0, nents, ord;
+
+  for (c = (config_rec *) set->xas_list; c; c = c->next) {
+    bound += 2;
+
+    if (c->subset != NULL &&
+        c->subset->xas_list != NULL) {
+      config_index_set_t *sub_si;
+
+      sub_si = config_index_set(c->subset);
+      bound += sub_si->nused;
+    }
+  }
+
+  for (nents = 8; nents < (bound * 2); nents <<= 1) {
+  }
+
+  si = pcalloc(config_index_pool, sizeof(config_index_set_t));
+  si->nents = nents;
+  si->ents = pcalloc(config_index_pool, nents * sizeof(config_index_ent_t));
+
+  for (c = (config_rec *) set->xas_list, ord = 0; c; c = c->next, ord++) {
+    ptr = config_index_get_ptr(c, TRUE);
+    ptr->ord = ord;
+
+    config_index_add_cand(si, c->config_id, c, ord, FALSE);
+
+    /* The linear search also matches by name, thus index the ID of the
+     * current name, should the name have been changed.
+     */
+    if (c->name != NULL) {
+      unsigned int id;
+
+      id = pr_config_get_id(c->name);
+      if (id == 0) {
+        id = pr_config_set_id(c->name);
+        if (id == 0) {
+          config_index_have_ids = FALSE;
+        }
+      }
+
+      if (id != c->config_id) {
+        config_index_add_cand(si, id, c, ord, FALSE);
+      }
+    }
+
+    if (c->subset != NULL &&
+        c->subset->xas_list != NULL) {
+      register unsigned int i;
+      config_index_set_t *sub_si;
+
+      ptr = config_index_get_ptr(c->subset, FALSE);
+      sub_si = ptr->set_index;
+
+      for (i = 0; i < sub_si->nents; i++) {
+        if (sub_si->ents[i].id != 0) {
+          config_index_add_cand(si, sub_si->ents[i].id, c, ord, TRUE);
+        }
+      }
+    }
+  }
+
+  ptr = config_index_get_ptr(set, TRUE);
+  ptr->set_index = si;
+
+  return si;
+}
+
+static void config_index_clear(void) {
+  if (config_index_pool != NULL) {
+    destroy_pool(config_index_pool);
+    config_index_pool = NULL;
+  }
+
+  config_index_ptrs = NULL;
+  config_index_nptrs = 0;
+  config_index_built = FALSE;
+}
+
+static int config_index_rebuild(void) {
+  server_rec *s;
+  unsigned int count = 0;
+
+  config_index_clear();
+
+  if (config_index_servers == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  for (s = (server_rec *) config_index_servers->xas_list; s; s = s->next) {
+    if (s->conf != NULL &&
+        s->conf->xas_list != NULL) {
+      count += config_index_count(s->conf);
+    }
+  }
+
+  config_index_pool = make_sub_pool(permanent_pool);
+  pr_pool_tag(config_index_pool, "Config Index Pool");
+
+  for (config_index_nptrs = 16; config_index_nptrs < (count * 2);
+       config_index_nptrs <<= 1) {
+  }
+
+  config_index_ptrs = pcalloc(config_index_pool,
+    config_index_nptrs * sizeof(config_index_ptr_t));
+  config_index_have_ids = TRUE;
+
+  for (s = (server_rec *) config_index_servers->xas_list; s; s = s->next) {
+    if (s->conf != NULL &&
+        s->conf->xas_list != NULL) {
+      config_index_set(s->conf);
+    }
+  }
+
+  config_index_built = TRUE;
+  config_index_gen = config_gen;
+  config_index_nlookups = 0;
+  config_index_nstale = 0;
+
+  pr_trace_msg(trace_channel, 17, "built config index (%u sets/records)",
+    count);
+  return 0;
+}
+
+int pr_config_index_build(xaset_t *servers) {
+  if (servers == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  config_index_servers = servers;
+  config_index_threshold = CONFIG_INDEX_MIN_THRESHOLD;
+
+  return config_index_rebuild();
+}
+
+void pr_config_index_invalidate(void) {
+  config_gen++;
+}
+
+unsigned long pr_config_get_generation(void) {
+  return config_gen;
+}
+
+static int config_index_usable(void) {
+  if (config_index_servers == NULL) {
+    return FALSE;
+  }
+
+  if (config_index_built &&
+      config_index_gen == config_gen) {
+    config_index_nlookups++;
+    return TRUE;
+  }
+
+  config_index_nstale++;
+  if (config_index_nstale < config_index_threshold) {
+    return FALSE;
+  }
+
+  /* If the previous index did not see much use before going stale, wait
+   * longer before the next rebuild.
+   */
+  if (config_index_built &&
+      config_index_nlookups < config_index_threshold) {
+    if (config_index_threshold < CONFIG_INDEX_MAX_THRESHOLD) {
+      config_index_threshold *= 2;
+    }
+
+  } else {
+    config_index_threshold = CONFIG_INDEX_MIN_THRESHOLD;
+  }
+
+  if (config_index_rebuild() < 0) {
+    return FALSE;
+  }
+
+  config_index_nlookups++;
+  return TRUE;
+}
+
+static int config_index_find(config_rec *, config_rec *, int, unsigned int,
+  int, unsigned long, config_rec **);
+
+/* Searches the subsets of, and then the config_recs of, the set of the given
+ * config_rec, starting at that config_rec.
+ */
+static int config_index_find_set(config_rec *top, int type, unsigned int cid,
+    int recurse, unsigned long flags, config_rec **res) {
+  config_index_ptr_t *ptr;
+  config_index_ent_t *ent = NULL;
+  config_index_cand_t *cands;
+  unsigned int i, top_ord;
+
+  ptr = config_index_get_ptr(top->set, FALSE);
+  if (ptr == NULL ||
+      ptr->set_index == NULL) {
+    return -1;
+  }
+
+  if (cid != 0) {
+    ent = config_index_get_ent(ptr->set_index, cid, FALSE);
+  }
+
+  ptr = config_index_get_ptr(top, FALSE);
+  if (ptr == NULL) {
+    return -1;
+  }
+
+  if (ent == NULL) {
+    return 0;
+  }
+
+  top_ord = ptr->ord;
+  cands = ent->cands->elts;
+
+  /* Search subsets. */
+  if (recurse) {
+    for (i = 0; i < ent->cands->nelts; i++) {
+      config_index_ptr_t *sub_ptr;
+      config_index_ent_t *sub_ent;
+      config_index_cand_t *sub_cands;
+      unsigned int j;
+
+      if (cands[i].ord < top_ord ||
+          cands[i].holder == FALSE) {
+        continue;
+      }
+
+      if (recurse > 1 &&
+          cands[i].c != top) {
+        /* Sibling subsets are already searched by the caller. */
+        break;
+      }
+
+      sub_ptr = config_index_get_ptr(cands[i].c->subset, FALSE);
+      if (sub_ptr == NULL ||
+          sub_ptr->set_index == NULL) {
+        return -1;
+      }
+
+      sub_ent = config_index_get_ent(sub_ptr->set_index, cid, FALSE);
+      if (sub_ent == NULL) {
+        return -1;
+      }
+
+      sub_cands = sub_ent->cands->elts;
+      for (j = 0; j < sub_ent->cands->nelts; j++) {
+        config_rec *subc;
+        int ret;
+
+        subc = sub_cands[j].c;
+
+        if ((subc->config_type == CONF_ANON &&
+             (flags & PR_CONFIG_FIND_FL_SKIP_ANON)) ||
+            (subc->config_type == CONF_DIR &&
+             (flags & PR_CONFIG_FIND_FL_SKIP_DIR)) ||
+            (subc->config_type == CONF_LIMIT &&
+             (flags & PR_CONFIG_FIND_FL_SKIP_LIMIT)) ||
+            (subc->config_type == CONF_DYNDIR &&
+             (flags & PR_CONFIG_FIND_FL_SKIP_DYNDIR))) {
+          continue;
+        }
+
+        ret = config_index_find(NULL, subc, type, cid, recurse + 1, flags,
+          res);
+        if (ret < 0 ||
+            *res != NULL) {
+          return ret;
+        }
+      }
+    }
+  }
+
+  /* Search the current set. */
+  for (i = 0; i < ent->cands->nelts; i++) {
+    if (cands[i].ord < top_ord ||
+        cands[i].match == FALSE) {
+      continue;
+    }
+
+    if (recurse > 1 &&
+        cands[i].c != top) {
+      break;
+    }
+
+    if (type == -1 ||
+        type == cands[i].c->config_type) {
+      *res = cands[i].c;
+      return 0;
+    }
+  }
+
+  return 0;
+}
+
+/* Searches the config_rec trees, as find_config_next2() does, using the
+ * config index.  Returns -1 if the index does not cover the config_recs to
+ * be searched, in which case the caller needs to do a linear search.
+ */
+static int config_index_find(config_rec *prev, config_rec *c, int type,
+    unsigned int cid, int recurse, unsigned long flags, config_rec **res) {
+  config_rec *top = c;
+
+  if (prev == NULL) {
+    prev = top;
+  }
+
+  *res = NULL;
+
+  do {
+    pr_signals_handle();
+
+    if (top != NULL) {
+      if (config_index_find_set(top, type, cid, recurse, flags, res) < 0) {
+        return -1;
+      }
+
+      if (*res != NULL) {
+        return 0;
+      }
+    }
+
+    if (recurse == 1) {
+      /* All siblings have been searched; continue the search at the previous
+       * level.
+       */
+      if (prev->parent &&
+          prev->parent->next &&
+          prev->parent->set != find_config_top) {
+        prev = top = prev->parent->next;
+        continue;
+      }
+    }
+    break;
+
+  } while (TRUE);
+
+  return 0;
+}
+
 config_rec *find_config_next2(config_rec *prev, config_rec *c, int type,
     const char *name, int recurse, unsigned long flags) {
   config_rec *top = c;
@@ -501,6 +1018,21 @@ config_rec *find_config_next2(config_rec *prev, config_rec *c, int type,
 
   if (name != NULL) {
     cid = pr_config_get_id(name);
+
+    if (config_index_usable() == TRUE &&
+        (cid != 0 || config_index_have_ids == TRUE)) {
+      config_rec *res = NULL;
+
+      if (config_index_find(prev, top, type, cid, recurse, flags,
+          &res) == 0) {
+        if (res == NULL) {
+          errno = ENOENT;
+        }
+
+        return res;
+      }
+    }
+
     namelen = strlen(name);
   }
 
@@ -714,6 +1246,7 @@ int pr_config_remove(xaset_t *set, const char *name, int flags, int recurse) {
 
     found_set = c->set;
     xaset_remove(found_set, (xasetmember_t *) c);
+    pr_config_index_invalidate();
 
     /* If the set is empty, and has no more contained members in the xas_list,
      * destroy the set.
@@ -944,6 +1477,11 @@ void init_config(void) {
     global_config_pool = NULL;
   }
 
+  /* Any config index refers to the configuration being discarded. */
+  config_index_clear();
+  config_index_servers = NULL;
+  config_gen++;
+
   if (config_tab != NULL) {
     /* Clear the existing config ID table.  This needs to happen when proftpd
      * is restarting.
@@ -57,6 +57,30 @@ static pr_netio_stream_t *nstrm = NULL;
 
 static long timeout_linger = PR_TUNABLE_TIMEOUTLINGER;
 
+#if defined(HAVE_SPLICE)
+/* Pipe used for splicing uploaded data from the data connection into the
+ * file, and whether splicing into the file has failed for this transfer.
+ */
+static int data_splice_fds[2] = { -1, -1 };
+static int data_splice_failed = FALSE;
+
+static void data_splice_close(void) {
+  if (data_splice_fds[0] >= 0) {
+    (void) close(data_splice_fds[0]);
+    data_splice_fds[0] = -1;
+  }
+
+  if (data_splice_fds[1] >= 0) {
+    (void) close(data_splice_fds[1]);
+    data_splice_fds[1] = -1;
+  }
+
+  data_splice_failed = FALSE;
+}
+#else
+# define data_splice_close()
+#endif /* HAVE_SPLICE */
+
 static int timeout_idle = PR_TUNABLE_TIMEOUTIDLE;
 static int timeout_noxfer = PR_TUNABLE_TIMEOUTNOXFER;
 static int timeout_stalled = PR_TUNABLE_TIMEOUTSTALLED;
@@ -658,6 +682,7 @@ int pr_data_open(char *filename, char *reason, int direction, off_t size) {
 
 void pr_data_close2(void) {
   nstrm = NULL;
+  data_splice_close();
 
   if (session.d != NULL) {
     pr_inet_lingering_close(session.pool, session.d, timeout_linger);
@@ -699,6 +724,8 @@ void pr_data_close(int quiet) {
  * set if the OOB byte won the race.
  */
 void pr_data_cleanup(void) {
+  data_splice_close();
+
   /* sanity check */
   if (session.d != NULL) {
     pr_inet_lingering_close(session.pool, session.d, timeout_linger);
@@ -721,6 +748,7 @@ void pr_data_cleanup(void) {
 void pr_data_abort(int err, int quiet) {
   int true_abort = XFER_ABORTED;
   nstrm = NULL;
+  data_splice_close();
 
   pr_trace_msg(trace_channel, 9,
     "aborting data transfer (errno = %s (%d), quiet = %s, true abort = %s)",
@@ -1445,7 +1473,7 @@ int pr_data_xfer(char *cl_buf, size_t cl_size) {
       int bwrote = 0;
       int buflen = cl_size;
       unsigned int xferbuflen;
-      char *xfer_buf = NULL;
+      char *xfer_data = NULL;
 
       pr_signals_handle();
 
@@ -1455,9 +1483,6 @@ int pr_data_xfer(char *cl_buf, size_t cl_size) {
 
       xferbuflen = buflen;
 
-      /* Fill up our internal buffer. */
-      memcpy(session.xfer.buf, cl_buf, buflen);
-
       /* We use ASCII translation if:
        *
        * - SF_ASCII_OVERRIDE session flag is set (e.g. for LIST/NLST)
@@ -1469,30 +1494,31 @@ int pr_data_xfer(char *cl_buf, size_t cl_size) {
         char *out = NULL;
         size_t outlen = 0;
 
-        if (tmp_pool == NULL) {
-          tmp_pool = make_sub_pool(session.xfer.p);
-          pr_pool_tag(tmp_pool, "ASCII download");
-        }
-
-        /* Scan the internal buffer, looking for LFs with no preceding CRs.
-         * Add CRs (and expand the internal buffer) as necessary. xferbuflen
-         * will be adjusted so that it contains the length of data in
-         * the internal buffer, including any added CRs.
+        /* Scan the client buffer, looking for LFs with no preceding CRs.
+         * Add CRs as necessary; the converted data (if any) are written
+         * into a reused buffer, avoiding both a copy into the internal
+         * buffer and an allocation per write.  xferbuflen will be adjusted
+         * so that it contains the length of the data to write, including
+         * any added CRs.
          */
-        res = pr_ascii_ftp_to_crlf(tmp_pool, session.xfer.buf, xferbuflen,
-          &out, &outlen);
+        res = pr_ascii_ftp_to_crlf2(cl_buf, xferbuflen, &out, &outlen);
         if (res < 0) {
           pr_trace_msg(trace_channel, 1, "error writing ASCII data: %s",
             strerror(errno));
 
         } else {
-          xfer_buf = session.xfer.buf;
-          session.xfer.buf = out;
+          xfer_data = out;
           session.xfer.buflen = xferbuflen = outlen;
         }
       }
 
-      bwrote = pr_netio_write(session.d->outstrm, session.xfer.buf, xferbuflen);
+      if (xfer_data == NULL) {
+        /* Fill up our internal buffer. */
+        memcpy(session.xfer.buf, cl_buf, buflen);
+        xfer_data = session.xfer.buf;
+      }
+
+      bwrote = pr_netio_write(session.d->outstrm, xfer_data, xferbuflen);
       while (bwrote < 0) {
         int xerrno = errno;
 
@@ -1504,18 +1530,11 @@ int pr_data_xfer(char *cl_buf, size_t cl_size) {
           errno = EINTR;
           pr_signals_handle();
              
-          bwrote = pr_netio_write(session.d->outstrm, session.xfer.buf,
-            xferbuflen);
+          bwrote = pr_netio_write(session.d->outstrm, xfer_data, xferbuflen);
           continue;
         }
 
         destroy_pool(tmp_pool);
-        if (xfer_buf != NULL) {
-          /* Free up the malloc'd memory. */
-          free(session.xfer.buf);
-          session.xfer.buf = xfer_buf;
-        }
-
         errno = xerrno;
         return -1;
       }
@@ -1547,14 +1566,6 @@ int pr_data_xfer(char *cl_buf, size_t cl_size) {
         cl_buf += buflen;
         total += buflen;
       }
-
-      if (xfer_buf != NULL) {
-        /* Yes, we are using malloc et al here, rather than the memory pools.
-         * See Bug#4352 for details.
-         */
-        free(session.xfer.buf);
-        session.xfer.buf = xfer_buf;
-      }
     }
 
     len = total;
@@ -1872,3 +1883,258 @@ pr_sendfile_t pr_data_sendfile(int retr_fd, off_t *offset, off_t count) {
   return -1;
 }
 #endif /* HAVE_SENDFILE */
+
+#if defined(HAVE_SPLICE)
+/* Move the spliced data sitting in the pipe into the file, falling back to
+ * read(2)/write(2) if the file does not support splice(2).
+ */
+static int data_splice_drain(int fd, size_t len) {
+  while (len > 0) {
+    ssize_t res;
+
+    pr_signals_handle();
+
+    if (data_splice_failed == FALSE) {
+      res = splice(data_splice_fds[0], NULL, fd, NULL, len, SPLICE_F_MOVE);
+      if (res < 0) {
+        int xerrno = errno;
+
+        if (xerrno == EINTR) {
+          continue;
+        }
+
+        if (xerrno != EINVAL &&
+            xerrno != ENOSYS) {
+          errno = xerrno;
+          return -1;
+        }
+
+        pr_trace_msg(trace_channel, 9,
+          "unable to splice data into fd %d: %s, using write(2) instead", fd,
+          strerror(xerrno));
+        data_splice_failed = TRUE;
+        continue;
+      }
+
+    } else {
+      char buf[PR_TUNABLE_BUFFER_SIZE];
+      ssize_t nread;
+
+      nread = read(data_splice_fds[0], buf,
+        len > sizeof(buf) ? sizeof(buf) : len);
+      if (nread <= 0) {
+        if (nread < 0 &&
+            errno == EINTR) {
+          continue;
+        }
+
+        if (nread == 0) {
+          errno = EIO;
+        }
+
+        return -1;
+      }
+
+      res = write(fd, buf, nread);
+      while (res < 0 &&
+             errno == EINTR) {
+        pr_signals_handle();
+        res = write(fd, buf, nread);
+      }
+
+      if (res != nread) {
+        if (res >= 0) {
+          errno = EIO;
+        }
+
+        return -1;
+      }
+    }
+
+    len -= res;
+  }
+
+  return 0;
+}
+
+/* pr_data_splice() is the upload counterpart of pr_data_sendfile(): it moves
+ * up to count bytes from the data connection into the given file descriptor,
+ * at its current offset, without copying the data through userspace.  No
+ * ASCII translation is performed, and any NetIO read handlers are bypassed.
+ *
+ * Returns the number of bytes moved, 0 if the data connection closed, or -1
+ * if error (with errno set).  An errno of ENOSYS or EINVAL indicates that
+ * splicing is not supported, and the caller should use pr_data_xfer()
+ * instead.
+ */
+int pr_data_splice(int fd, size_t count) {
+  ssize_t len;
+
+  if (fd < 0 ||
+      count == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (session.xfer.direction != PR_NETIO_IO_RD) {
+    errno = EPERM;
+    return -1;
+  }
+
+  if (data_splice_failed == TRUE) {
+    errno = ENOSYS;
+    return -1;
+  }
+
+  if (count > INT_MAX) {
+    count = INT_MAX;
+  }
+
+  /* Poll the control channel for any commands we should handle, like
+   * QUIT or ABOR.
+   */
+  poll_ctrl();
+
+  if (session.d == NULL) {
+    int xerrno;
+
+#if defined(ECONNABORTED)
+    xerrno = ECONNABORTED;
+#elif defined(ENOTCONN)
+    xerrno = ENOTCONN;
+#else
+    xerrno = EIO;
+#endif
+
+    pr_trace_msg(trace_channel, 1,
+      "data connection is null prior to data transfer (possibly from "
+      "aborted transfer), returning '%s' error", strerror(xerrno));
+
+    errno = xerrno;
+    return -1;
+  }
+
+  if (data_splice_fds[0] < 0) {
+    if (pipe(data_splice_fds) < 0) {
+      int xerrno = errno;
+
+      pr_trace_msg(trace_channel, 3, "error creating splice pipe: %s",
+        strerror(xerrno));
+      data_splice_fds[0] = data_splice_fds[1] = -1;
+
+      errno = xerrno;
+      return -1;
+    }
+
+# if defined(F_SETPIPE_SZ)
+    /* Ask for a pipe large enough to hold an entire transfer buffer; the
+     * kernel may give us less, which simply means shorter splices.
+     */
+    if (fcntl(data_splice_fds[1], F_SETPIPE_SZ, (int) count) < 0) {
+      pr_trace_msg(trace_channel, 12, "unable to set splice pipe size to %lu "
+        "bytes: %s", (unsigned long) count, strerror(errno));
+    }
+# endif /* F_SETPIPE_SZ */
+  }
+
+  while (TRUE) {
+    int res;
+
+    pr_signals_handle();
+
+    if (XFER_ABORTED) {
+      return 0;
+    }
+
+    res = pr_netio_poll(session.d->instrm);
+    if (res == 1) {
+      /* Stream aborted. */
+      return 0;
+    }
+
+    if (res < 0) {
+      return -1;
+    }
+
+    len = splice(PR_NETIO_FD(session.d->instrm), NULL, data_splice_fds[1],
+      NULL, count, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+    if (len < 0) {
+      int xerrno = errno;
+
+      if (xerrno == EAGAIN ||
+          xerrno == EINTR) {
+        /* Treat this like pr_netio_read() does; delay briefly via the
+         * signal handling, then poll again.
+         */
+        errno = EINTR;
+        pr_signals_handle();
+        continue;
+      }
+
+      session.d->instrm->strm_errno = xerrno;
+      errno = xerrno;
+      return -1;
+    }
+
+    break;
+  }
+
+  if (len == 0) {
+    return 0;
+  }
+
+  pr_trace_msg(trace_channel, 19, "spliced %ld %s from network",
+    (long) len, len != 1 ? "bytes" : "byte");
+
+  if (data_first_byte_read == FALSE) {
+    if (pr_trace_get_level(timing_channel)) {
+      unsigned long elapsed_ms;
+      uint64_t read_ms;
+
+      pr_gettimeofday_millis(&read_ms);
+      elapsed_ms = (unsigned long) (read_ms - data_start_ms);
+
+      pr_trace_msg(timing_channel, 7,
+        "Time for first data byte read: %lu ms", elapsed_ms);
+    }
+
+    data_first_byte_read = TRUE;
+  }
+
+  session.total_raw_in += len;
+
+  if (data_splice_drain(fd, (size_t) len) < 0) {
+    int xerrno = errno;
+
+    pr_trace_msg(trace_channel, 3, "error writing spliced data to fd %d: %s",
+      fd, strerror(xerrno));
+
+    /* Any data left in the pipe is lost at this point, so make sure that the
+     * pipe is not reused.
+     */
+    data_splice_close();
+
+    errno = xerrno;
+    return -1;
+  }
+
+  if (timeout_stalled) {
+    pr_timer_reset(PR_TIMER_STALLED, ANY_MODULE);
+  }
+
+  if (timeout_idle) {
+    pr_timer_reset(PR_TIMER_IDLE, ANY_MODULE);
+  }
+
+  session.xfer.total_bytes += len;
+  session.total_bytes += len;
+  session.total_bytes_in += len;
+
+  return (int) len;
+}
+#else
+int pr_data_splice(int fd, size_t count) {
+  errno = ENOSYS;
+  return -1;
+}
+#endif /* HAVE_SPLICE */
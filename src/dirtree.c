@@ -57,6 +57,45 @@ static array_header *defines_list = NULL;
 static pool *defines_perm_pool = NULL;
 static array_header *defines_perm_list = NULL;
 
+/* Per-session cache of the <Directory> sections matched for paths, and of the
+ * <Limit> checks done for those sections.  The cached results depend on the
+ * configuration, and on who the session is; a change to either empties the
+ * cache.
+ */
+static pool *dir_cache_pool = NULL;
+static pr_table_t *dir_match_tab = NULL;
+static pr_table_t *dir_prefix_tab = NULL;
+static pr_table_t *dir_limits_tab = NULL;
+
+/* Directories containing entries which may match a different <Directory>
+ * section than their siblings do.
+ */
+static pr_table_t *dir_parents_tab = NULL;
+static int dir_cache_have_globs = FALSE;
+
+/* <Limit> checks using AllowFilter/DenyFilter depend on the command
+ * arguments, and thus cannot be cached.
+ */
+static int dir_cache_have_filters = FALSE;
+
+static struct {
+  unsigned long config_gen;
+  const config_rec *anon_config;
+  const char *chroot_path;
+  const char *user, *group;
+  const array_header *groups;
+  const void *conn_class;
+} dir_cache_owner;
+
+struct dir_match_ent {
+  config_rec *c;
+};
+
+struct dir_limits_ent {
+  int res;
+  int xerrno;
+};
+
 static int allow_dyn_config(const char *path) {
   config_rec *c = NULL;
   unsigned int ctxt_precedence = 0;
@@ -426,6 +465,167 @@ void kludge_enable_umask(void) {
 
 /* Per-directory configuration */
 
+static void dir_cache_clear(void) {
+  if (dir_cache_pool != NULL) {
+    destroy_pool(dir_cache_pool);
+    dir_cache_pool = NULL;
+  }
+
+  dir_match_tab = dir_prefix_tab = dir_limits_tab = NULL;
+  dir_parents_tab = NULL;
+}
+
+static void dir_cache_scan(xaset_t *set) {
+  config_rec *c;
+
+  if (set == NULL) {
+    return;
+  }
+
+  for (c = (config_rec *) set->xas_list; c; c = c->next) {
+    if (c->config_type == CONF_PARAM &&
+        c->name != NULL &&
+        (strcmp(c->name, "AllowFilter") == 0 ||
+         strcmp(c->name, "DenyFilter") == 0)) {
+      dir_cache_have_filters = TRUE;
+    }
+
+    if (c->config_type == CONF_DIR &&
+        c->name != NULL) {
+      char *dir_path, *ptr;
+      size_t dir_pathlen;
+
+      /* Determine the path as recur_match_path() does. */
+      dir_path = c->name;
+      if (c->argv != NULL &&
+          c->argv[1] != NULL) {
+        if (*(char *)(c->argv[1]) == '~') {
+          c->argv[1] = dir_canonical_path(c->pool, (char *) c->argv[1]);
+        }
+
+        dir_path = pdircat(dir_cache_pool, (char *) c->argv[1], dir_path,
+          NULL);
+
+      } else {
+        dir_path = pstrdup(dir_cache_pool, dir_path);
+      }
+
+      dir_pathlen = strlen(dir_path);
+      if (dir_pathlen > 1 &&
+          dir_path[dir_pathlen-1] == '/') {
+        dir_path[--dir_pathlen] = '\0';
+      }
+
+      if (strpbrk(dir_path, "*?[\\") != NULL) {
+        /* Any path may match a glob, regardless of its parent directory. */
+        dir_cache_have_globs = TRUE;
+
+      } else if (dir_pathlen > 1) {
+        ptr = strrchr(dir_path, '/');
+        if (ptr != NULL) {
+          *ptr = '\0';
+          (void) pr_table_add(dir_parents_tab,
+            *dir_path ? dir_path : "/", (void *) c, sizeof(config_rec *));
+        }
+      }
+    }
+
+    if (c->subset != NULL) {
+      dir_cache_scan(c->subset);
+    }
+  }
+}
+
+/* Returns TRUE if the cache can be used, emptying it first if the
+ * configuration, or the session, has changed since the cached results were
+ * obtained.
+ */
+static int dir_cache_usable(void) {
+  unsigned long config_gen;
+
+  if (main_server == NULL) {
+    return FALSE;
+  }
+
+  config_gen = pr_config_get_generation();
+
+  if (dir_cache_pool != NULL &&
+      dir_cache_owner.config_gen == config_gen &&
+      dir_cache_owner.anon_config == session.anon_config &&
+      dir_cache_owner.chroot_path == session.chroot_path &&
+      dir_cache_owner.user == session.user &&
+      dir_cache_owner.group == session.group &&
+      dir_cache_owner.groups == session.groups &&
+      dir_cache_owner.conn_class == session.conn_class) {
+    return TRUE;
+  }
+
+  dir_cache_clear();
+
+  dir_cache_pool = make_sub_pool(permanent_pool);
+  pr_pool_tag(dir_cache_pool, "Directory Cache Pool");
+
+  dir_match_tab = pr_table_alloc(dir_cache_pool, 0);
+  dir_prefix_tab = pr_table_alloc(dir_cache_pool, 0);
+  dir_limits_tab = pr_table_alloc(dir_cache_pool, 0);
+  dir_parents_tab = pr_table_alloc(dir_cache_pool, 0);
+
+  dir_cache_have_globs = dir_cache_have_filters = FALSE;
+  dir_cache_scan(main_server->conf);
+
+  dir_cache_owner.config_gen = config_gen;
+  dir_cache_owner.anon_config = session.anon_config;
+  dir_cache_owner.chroot_path = session.chroot_path;
+  dir_cache_owner.user = session.user;
+  dir_cache_owner.group = session.group;
+  dir_cache_owner.groups = session.groups;
+  dir_cache_owner.conn_class = session.conn_class;
+
+  pr_trace_msg("directory", 17,
+    "emptied directory cache (globs = %s, filters = %s)",
+    dir_cache_have_globs ? "true" : "false",
+    dir_cache_have_filters ? "true" : "false");
+  return TRUE;
+}
+
+/* Entries of the given directory all match the same <Directory> section,
+ * unless a glob could match some of them, or a section is for one of them.
+ */
+static int dir_cache_same_entries(const char *dir_path) {
+  if (dir_cache_have_globs == TRUE) {
+    return FALSE;
+  }
+
+  if (pr_table_get(dir_parents_tab, dir_path, NULL) != NULL) {
+    return FALSE;
+  }
+
+  /* dir_match_path() checks whether the path is within the chroot path. */
+  if (session.anon_config != NULL &&
+      session.chroot_path != NULL) {
+    size_t dir_pathlen;
+
+    dir_pathlen = strlen(dir_path);
+    if (strlen(session.chroot_path) > dir_pathlen &&
+        strncmp(session.chroot_path, dir_path, dir_pathlen) == 0) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static void dir_cache_add(pr_table_t *tab, const char *key, void *value,
+    size_t valuesz) {
+  if (pr_table_count(tab) >= PR_TUNABLE_DIR_CACHE_SIZE) {
+    /* Start over, rather than tracking which entries are the least used. */
+    dir_cache_clear();
+    return;
+  }
+
+  (void) pr_table_add(tab, pstrdup(dir_cache_pool, key), value, valuesz);
+}
+
 static size_t _strmatch(register char *s1, register char *s2) {
   register size_t len = 0;
 
@@ -549,10 +749,13 @@ static config_rec *recur_match_path(pool *p, xaset_t *s, char *path) {
   return NULL;
 }
 
+static config_rec *dir_match_path2(pool *, char *);
+
 config_rec *dir_match_path(pool *p, char *path) {
   config_rec *res = NULL;
-  char *tmp = NULL;
+  char *tmp = NULL, *dir_path = NULL, *ptr;
   size_t tmplen;
+  int use_cache = FALSE;
 
   if (p == NULL ||
       path == NULL ||
@@ -573,6 +776,79 @@ config_rec *dir_match_path(pool *p, char *path) {
     *(tmp + tmplen - 1) = '\0';
   }
 
+  if (dir_cache_usable() == TRUE) {
+    const struct dir_match_ent *ent;
+
+    ent = pr_table_get(dir_match_tab, tmp, NULL);
+    if (ent == NULL) {
+      dir_path = pstrdup(p, tmp);
+      ptr = strrchr(dir_path, '/');
+      if (ptr != NULL &&
+          *(ptr + 1) != '\0') {
+        *ptr = '\0';
+        if (*dir_path == '\0') {
+          dir_path = "/";
+        }
+
+        if (dir_cache_same_entries(dir_path) == TRUE) {
+          ent = pr_table_get(dir_prefix_tab, dir_path, NULL);
+
+        } else {
+          dir_path = NULL;
+        }
+
+      } else {
+        dir_path = NULL;
+      }
+    }
+
+    if (ent != NULL) {
+      if (ent->c != NULL) {
+        pr_trace_msg("directory", 3,
+          "matched <Directory %s> for path '%s' (cached)", ent->c->name, tmp);
+
+      } else {
+        pr_trace_msg("directory", 3,
+          "no matching <Directory> found for '%s' (cached)", tmp);
+        errno = ENOENT;
+      }
+
+      return ent->c;
+    }
+
+    use_cache = TRUE;
+  }
+
+  res = dir_match_path2(p, tmp);
+
+  if (use_cache == TRUE &&
+      dir_cache_pool != NULL) {
+    struct dir_match_ent *ent;
+    int xerrno = errno;
+
+    ent = palloc(dir_cache_pool, sizeof(struct dir_match_ent));
+    ent->c = res;
+
+    /* Cache the match for every entry of the directory, if possible, rather
+     * than for this path alone.
+     */
+    if (dir_path != NULL) {
+      dir_cache_add(dir_prefix_tab, dir_path, ent,
+        sizeof(struct dir_match_ent *));
+
+    } else {
+      dir_cache_add(dir_match_tab, tmp, ent, sizeof(struct dir_match_ent *));
+    }
+
+    errno = xerrno;
+  }
+
+  return res;
+}
+
+static config_rec *dir_match_path2(pool *p, char *tmp) {
+  config_rec *res = NULL;
+
   if (session.anon_config) {
     res = recur_match_path(p, session.anon_config->subset, tmp);
 
@@ -1445,8 +1721,57 @@ static int check_limits(xaset_t *set, cmd_rec *cmd, const char *cmd_name,
   return res;
 }
 
+static int dir_check_limits2(cmd_rec *, config_rec *, const char *, int);
+
 int dir_check_limits(cmd_rec *cmd, config_rec *c, const char *cmd_name,
     int hidden) {
+  int res = 1, use_cache = FALSE;
+  config_rec *start = c;
+  char key[256];
+
+  if (cmd_name != NULL &&
+      strlen(cmd_name) < 128 &&
+      dir_cache_usable() == TRUE &&
+      dir_cache_have_filters == FALSE) {
+    const struct dir_limits_ent *ent;
+    size_t i;
+
+    /* Commands are compared case-insensitively. */
+    pr_snprintf(key, sizeof(key), "%p %d %s", (void *) c, hidden ? 1 : 0,
+      cmd_name);
+    for (i = 0; key[i]; i++) {
+      key[i] = toupper((int) key[i]);
+    }
+
+    ent = pr_table_get(dir_limits_tab, key, NULL);
+    if (ent != NULL) {
+      errno = ent->xerrno;
+      return ent->res;
+    }
+
+    use_cache = TRUE;
+  }
+
+  res = dir_check_limits2(cmd, start, cmd_name, hidden);
+
+  if (use_cache == TRUE &&
+      dir_cache_pool != NULL) {
+    struct dir_limits_ent *ent;
+    int xerrno = errno;
+
+    ent = palloc(dir_cache_pool, sizeof(struct dir_limits_ent));
+    ent->res = res;
+    ent->xerrno = xerrno;
+    dir_cache_add(dir_limits_tab, key, ent, sizeof(struct dir_limits_ent *));
+
+    errno = xerrno;
+  }
+
+  return res;
+}
+
+static int dir_check_limits2(cmd_rec *cmd, config_rec *c,
+    const char *cmd_name, int hidden) {
   int res = 1;
 
   for (; c && (res == 1); c = c->parent) {
@@ -1655,6 +1980,7 @@ void build_dyn_config(pool *p, const char *_path, struct stat *stp,
 
             if (newd->flags & CF_DYNAMIC) {
               xaset_remove(d->subset, (xasetmember_t *) newd);
+              pr_config_index_invalidate();
               removed++;
             }
           }
@@ -1671,6 +1997,7 @@ void build_dyn_config(pool *p, const char *_path, struct stat *stp,
            */
           if (isfile == -1) {
             xaset_remove(*set, (xasetmember_t *) d);
+            pr_config_index_invalidate();
           }
         }
       }
@@ -2133,6 +2460,8 @@ static void reparent_all(config_rec *newparent, xaset_t *set) {
     c->set = newparent->subset;
     c->parent = newparent;
   }
+
+  pr_config_index_invalidate();
 }
 
 /* Recursively find the most appropriate place to move a CONF_DIR
@@ -2266,6 +2595,7 @@ static void reorder_dirs(xaset_t *set, int flags) {
         }
 
         xaset_remove(c->parent->subset, (xasetmember_t *) c);
+        pr_config_index_invalidate();
 
       } else {
         newparent = find_best_dir(set, c->name, &tmp);
@@ -2278,6 +2608,7 @@ static void reorder_dirs(xaset_t *set, int flags) {
           xaset_insert(newparent->subset, (xasetmember_t *) c);
           c->set = newparent->subset;
           c->parent = newparent;
+          pr_config_index_invalidate();
         }
       }
     }
@@ -2396,6 +2727,8 @@ void resolve_deferred_dirs(server_rec *s) {
         }
       }
 
+      pr_config_index_invalidate();
+
       pr_trace_msg(trace_channel, 11,
         "resolved <Directory %s> to <Directory %s>", orig_name, c->name);
 
@@ -2489,6 +2822,7 @@ static void fixup_globals(xaset_t *list) {
         }
 
         xaset_remove(s->conf, (xasetmember_t *) c);
+        pr_config_index_invalidate();
 
         if (s->conf != NULL &&
             s->conf->xas_list == NULL) {
@@ -2672,6 +3006,11 @@ int fixup_servers(xaset_t *list) {
   }
 
   pr_inet_clear();
+
+  if (pr_config_index_build(list) < 0) {
+    pr_log_debug(DEBUG0, "error building config index: %s", strerror(errno));
+  }
+
   return 0;
 }
 
@@ -2790,6 +3129,9 @@ void init_dirtree(void) {
   pool *dirtree_pool = make_sub_pool(permanent_pool);
   pr_pool_tag(dirtree_pool, "Dirtree Pool");
 
+  /* Any cached results refer to the configuration being discarded. */
+  dir_cache_clear();
+
   if (server_list) {
     server_rec *s, *s_next;
 
@@ -35,6 +35,25 @@ struct jot_filters_rec {
   array_header *cmd_ids;
 };
 
+/* A compiled LogFormat is a flat list of operations: literal text segments,
+ * and variables with their arguments, if any, already extracted.
+ */
+struct jot_op {
+  /* The LogFormat ID, or JOT_OP_TEXT for a literal text segment. */
+  unsigned char logfmt_id;
+
+  /* The literal text, or the NUL-terminated variable argument. */
+  unsigned char *data;
+  size_t datalen;
+};
+
+#define JOT_OP_TEXT		0
+
+struct jot_plan_rec {
+  struct jot_op *ops;
+  unsigned int nops;
+};
+
 /* For tracking the size of deleted files. */
 static off_t jot_deleted_filesz = 0;
 
@@ -1095,6 +1114,28 @@ static const char *get_meta_transfer_type(cmd_rec *cmd) {
   return transfer_type;
 }
 
+/* Callers check the trace level before calling this, so that resolving a
+ * compiled plan need only check it once per record, rather than per variable.
+ */
+static void trace_logfmt_id(unsigned char logfmt_id, const char *logfmt_data) {
+  const char *id_name;
+
+  id_name = pr_jot_get_logfmt_id_name(logfmt_id);
+  if (id_name != NULL) {
+
+    if (logfmt_data != NULL) {
+      pr_trace_msg(trace_channel, 17,
+        "resolving LogFormat ID %u (%s) with data '%s' (%lu)",
+        (unsigned int) logfmt_id, id_name, logfmt_data,
+        (unsigned long) strlen(logfmt_data));
+
+    } else {
+      pr_trace_msg(trace_channel, 17, "resolving LogFormat ID %u (%s)",
+        (unsigned int) logfmt_id, id_name);
+    }
+  }
+}
+
 static int resolve_logfmt_id(pool *p, unsigned char logfmt_id,
     const char *logfmt_data, pr_jot_ctx_t *ctx, cmd_rec *cmd,
     int (*on_meta)(pool *, pr_jot_ctx_t *, unsigned char,
@@ -1102,25 +1143,6 @@ static int resolve_logfmt_id(pool *p, unsigned char logfmt_id,
     int (*on_default)(pool *, pr_jot_ctx_t *, unsigned char)) {
   int res = 0;
 
-  if (pr_trace_get_level(trace_channel) >= 17) {
-    const char *id_name;
-
-    id_name = pr_jot_get_logfmt_id_name(logfmt_id);
-    if (id_name != NULL) {
-
-      if (logfmt_data != NULL) {
-        pr_trace_msg(trace_channel, 17,
-          "resolving LogFormat ID %u (%s) with data '%s' (%lu)",
-          (unsigned int) logfmt_id, id_name, logfmt_data,
-          (unsigned long) strlen(logfmt_data));
-
-      } else {
-        pr_trace_msg(trace_channel, 17, "resolving LogFormat ID %u (%s)",
-          (unsigned int) logfmt_id, id_name);
-      }
-    }
-  }
-
   switch (logfmt_id) {
     case LOGFMT_META_BASENAME: {
       const char *basename;
@@ -1984,6 +2006,10 @@ static int resolve_meta(pool *p, unsigned char **logfmt, pr_jot_ctx_t *ctx,
    */
   logfmt_data = pstrndup(p, logfmt_data, logfmt_datalen);
 
+  if (pr_trace_get_level(trace_channel) >= 17) {
+    trace_logfmt_id(logfmt_id, logfmt_data);
+  }
+
   res = resolve_logfmt_id(p, logfmt_id, logfmt_data, ctx, cmd, on_meta,
     on_default);
   if (res < 0) {
@@ -2159,6 +2185,10 @@ int pr_jot_resolve_logfmt_id(pool *p, cmd_rec *cmd, pr_jot_filters_t *filters,
       break;
   }
 
+  if (pr_trace_get_level(trace_channel) >= 17) {
+    trace_logfmt_id(logfmt_id, logfmt_data);
+  }
+
   res = resolve_logfmt_id(p, logfmt_id, logfmt_data, ctx, cmd, on_meta,
     on_default);
   return res;
@@ -2273,6 +2303,196 @@ int pr_jot_resolve_logfmt(pool *p, cmd_rec *cmd, pr_jot_filters_t *filters,
   return 0;
 }
 
+static void plan_add_op(array_header *ops, unsigned char logfmt_id,
+    unsigned char *data, size_t datalen) {
+  struct jot_op *op;
+
+  op = push_array(ops);
+  op->logfmt_id = logfmt_id;
+  op->data = data;
+  op->datalen = datalen;
+}
+
+pr_jot_plan_t *pr_jot_compile_logfmt(pool *p, unsigned char *logfmt) {
+  pr_jot_plan_t *plan;
+  array_header *ops;
+  size_t text_len;
+
+  if (p == NULL ||
+      logfmt == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  ops = make_array(p, 8, sizeof(struct jot_op));
+  text_len = 0;
+
+  while (*logfmt) {
+    unsigned char logfmt_id, *data = NULL;
+    size_t datalen = 0;
+
+    pr_signals_handle();
+
+    if (*logfmt != LOGFMT_META_START) {
+      logfmt++;
+      text_len++;
+      continue;
+    }
+
+    if (text_len > 0) {
+      plan_add_op(ops, JOT_OP_TEXT,
+        (unsigned char *) pstrndup(p, (char *) (logfmt - text_len), text_len),
+        text_len);
+      text_len = 0;
+    }
+
+    logfmt_id = *(logfmt + 1);
+    if (logfmt_id == 0) {
+      /* Truncated buffer; there is no ID following the META_START. */
+      break;
+    }
+
+    /* Advance past the META_START and the ID. */
+    logfmt += 2;
+
+    switch (logfmt_id) {
+      case LOGFMT_META_CUSTOM:
+      case LOGFMT_META_ENV_VAR:
+      case LOGFMT_META_NOTE_VAR:
+      case LOGFMT_META_TIME:
+        if (*logfmt == LOGFMT_META_START &&
+            *(logfmt + 1) == LOGFMT_META_ARG) {
+          unsigned char *arg;
+
+          logfmt += 2;
+          arg = logfmt;
+
+          while (*logfmt &&
+                 *logfmt != LOGFMT_META_ARG_END) {
+            logfmt++;
+          }
+
+          datalen = logfmt - arg;
+          data = (unsigned char *) pstrndup(p, (char *) arg, datalen);
+
+          if (*logfmt == LOGFMT_META_ARG_END) {
+            logfmt++;
+          }
+        }
+        break;
+
+      default:
+        break;
+    }
+
+    plan_add_op(ops, logfmt_id, data, datalen);
+  }
+
+  if (text_len > 0) {
+    plan_add_op(ops, JOT_OP_TEXT,
+      (unsigned char *) pstrndup(p, (char *) (logfmt - text_len), text_len),
+      text_len);
+  }
+
+  plan = pcalloc(p, sizeof(pr_jot_plan_t));
+  plan->ops = ops->elts;
+  plan->nops = ops->nelts;
+
+  pr_trace_msg(trace_channel, 19, "compiled LogFormat into %u %s",
+    plan->nops, plan->nops != 1 ? "operations" : "operation");
+  return plan;
+}
+
+int pr_jot_resolve_plan(pool *p, cmd_rec *cmd, pr_jot_filters_t *filters,
+    pr_jot_plan_t *plan, pr_jot_ctx_t *ctx,
+    int (*on_meta)(pool *, pr_jot_ctx_t *, unsigned char, const char *,
+      const void *),
+    int (*on_default)(pool *, pr_jot_ctx_t *, unsigned char),
+    int (*on_other)(pool *, pr_jot_ctx_t *, unsigned char *, size_t)) {
+  register unsigned int i;
+  int jottable = FALSE, res, tracing;
+
+  if (p == NULL ||
+      cmd == NULL ||
+      plan == NULL ||
+      on_meta == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  jottable = is_jottable(p, cmd, filters);
+  if (jottable == FALSE) {
+    pr_trace_msg(trace_channel, 17, "ignoring filtered event '%s'",
+      (const char *) cmd->argv[0]);
+    errno = EPERM;
+    return -1;
+  }
+
+  if (on_default == NULL) {
+    on_default = jot_resolve_on_default;
+  }
+
+  if (on_other == NULL) {
+    on_other = jot_resolve_on_other;
+  }
+
+  tracing = (pr_trace_get_level(trace_channel) >= 17);
+
+  for (i = 0; i < plan->nops; i++) {
+    struct jot_op *op;
+
+    pr_signals_handle();
+
+    op = &(plan->ops[i]);
+    res = 0;
+
+    switch (op->logfmt_id) {
+      case JOT_OP_TEXT:
+        res = (on_other)(p, ctx, op->data, op->datalen);
+        break;
+
+      case LOGFMT_META_CONNECT:
+        if (cmd->cmd_class == CL_CONNECT) {
+          int val = TRUE;
+
+          if (tracing) {
+            trace_logfmt_id(op->logfmt_id, NULL);
+          }
+
+          res = (on_meta)(p, ctx, LOGFMT_META_CONNECT, NULL, &val);
+        }
+        break;
+
+      case LOGFMT_META_DISCONNECT:
+        if (cmd->cmd_class == CL_DISCONNECT) {
+          int val = TRUE;
+
+          if (tracing) {
+            trace_logfmt_id(op->logfmt_id, NULL);
+          }
+
+          res = (on_meta)(p, ctx, LOGFMT_META_DISCONNECT, NULL, &val);
+        }
+        break;
+
+      default:
+        if (tracing) {
+          trace_logfmt_id(op->logfmt_id, (const char *) op->data);
+        }
+
+        res = resolve_logfmt_id(p, op->logfmt_id, (const char *) op->data,
+          ctx, cmd, on_meta, on_default);
+        break;
+    }
+
+    if (res < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
 static int jot_parse_on_unknown(pool *p, pr_jot_ctx_t *ctx, const char *text,
     size_t text_len) {
   return 0;
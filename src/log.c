@@ -976,6 +976,291 @@ int pr_log_event_listening(unsigned int log_type) {
   return TRUE;
 }
 
+struct log_buffer_rec {
+  pr_log_buffer_t *next, *prev;
+  pool *pool;
+
+  const char *name;
+  int fd;
+  pid_t pid;
+  int interval;
+  int flags;
+
+  char *buf;
+  size_t bufsz, buflen;
+
+  /* When the oldest pending record was buffered. */
+  time_t first_ts;
+
+  unsigned long npending;
+
+  /* Records in the buffer, including any whose writing has been delayed. */
+  unsigned long nbuffered;
+
+  unsigned long nrecords;
+  unsigned long ndelayed;
+  unsigned long ndropped;
+
+  int reported;
+};
+
+/* All of the log buffers in use, so that they can be flushed together. */
+static pr_log_buffer_t *log_buffers = NULL;
+
+static void log_buffer_report(pr_log_buffer_t *lb) {
+  if (lb->reported == TRUE ||
+      lb->pid != getpid()) {
+    return;
+  }
+
+  lb->reported = TRUE;
+
+  pr_log_debug(DEBUG5, "%s buffer: %lu %s buffered, %lu delayed, %lu dropped",
+    lb->name, lb->nrecords, lb->nrecords != 1 ? "records" : "record",
+    lb->ndelayed, lb->ndropped);
+
+  if (lb->ndropped > 0) {
+    pr_log_pri(PR_LOG_NOTICE, "dropped %lu %s %s", lb->ndropped, lb->name,
+      lb->ndropped != 1 ? "records" : "record");
+  }
+}
+
+static void log_buffer_cleanup_cb(void *data) {
+  pr_log_buffer_t *lb;
+
+  lb = data;
+  log_buffer_report(lb);
+
+  if (lb->prev != NULL) {
+    lb->prev->next = lb->next;
+
+  } else {
+    log_buffers = lb->next;
+  }
+
+  if (lb->next != NULL) {
+    lb->next->prev = lb->prev;
+  }
+}
+
+pr_log_buffer_t *pr_log_buffer_create(pool *p, const char *name, int fd,
+    size_t bufsz, int interval, int flags) {
+  pr_log_buffer_t *lb;
+
+  if (p == NULL ||
+      name == NULL ||
+      fd < 0 ||
+      bufsz == 0 ||
+      interval < 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  lb = pcalloc(p, sizeof(pr_log_buffer_t));
+  lb->pool = p;
+  lb->name = pstrdup(p, name);
+  lb->fd = fd;
+  lb->pid = getpid();
+  lb->interval = interval;
+  lb->flags = flags;
+  lb->bufsz = bufsz;
+  lb->buf = palloc(p, bufsz);
+
+  lb->next = log_buffers;
+  if (log_buffers != NULL) {
+    log_buffers->prev = lb;
+  }
+  log_buffers = lb;
+
+  register_cleanup2(p, lb, log_buffer_cleanup_cb);
+  return lb;
+}
+
+int pr_log_buffer_flush(pr_log_buffer_t *lb) {
+  size_t written = 0;
+  int xerrno = 0;
+
+  if (lb == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (lb->buflen == 0) {
+    return 0;
+  }
+
+  if (lb->pid != getpid()) {
+    /* These records belong to our parent, who will write them out. */
+    lb->buflen = 0;
+    lb->npending = 0;
+    lb->nbuffered = 0;
+    return 0;
+  }
+
+  while (written < lb->buflen) {
+    ssize_t res;
+
+    res = write(lb->fd, lb->buf + written, lb->buflen - written);
+    if (res < 0) {
+      xerrno = errno;
+
+      if (xerrno == EINTR) {
+        pr_signals_handle();
+        continue;
+      }
+
+      break;
+    }
+
+    written += res;
+  }
+
+  if (written < lb->buflen) {
+    /* Keep what could not be written, to be retried on the next flush. */
+    memmove(lb->buf, lb->buf + written, lb->buflen - written);
+    lb->buflen -= written;
+    lb->ndelayed += lb->npending;
+    lb->npending = 0;
+
+    pr_trace_msg(trace_channel, 3,
+      "error flushing log buffer for fd %d (%lu bytes pending): %s", lb->fd,
+      (unsigned long) lb->buflen, strerror(xerrno));
+
+    errno = xerrno;
+    return -1;
+  }
+
+  lb->buflen = 0;
+  lb->npending = 0;
+  lb->nbuffered = 0;
+
+  if (lb->flags & PR_LOG_BUFFER_FL_SYNC) {
+#if defined(HAVE_FDATASYNC)
+    if (fdatasync(lb->fd) < 0) {
+#else
+    if (fsync(lb->fd) < 0) {
+#endif /* HAVE_FDATASYNC */
+      pr_trace_msg(trace_channel, 3, "error syncing log fd %d: %s", lb->fd,
+        strerror(errno));
+    }
+  }
+
+  return 0;
+}
+
+int pr_log_buffer_write(pr_log_buffer_t *lb, const char *text,
+    size_t textlen) {
+  time_t now;
+
+  if (lb == NULL ||
+      text == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (textlen == 0) {
+    return 0;
+  }
+
+  if (lb->buflen + textlen > lb->bufsz) {
+    (void) pr_log_buffer_flush(lb);
+  }
+
+  if (lb->buflen + textlen > lb->bufsz) {
+    if (lb->buflen == 0) {
+      /* Too large to be buffered at all; write it out directly. */
+      if (write(lb->fd, text, textlen) < 0) {
+        lb->ndropped++;
+        return -1;
+      }
+
+      lb->nrecords++;
+      return 0;
+    }
+
+    lb->ndropped++;
+    errno = ENOSPC;
+    return -1;
+  }
+
+  time(&now);
+
+  if (lb->buflen == 0) {
+    lb->first_ts = now;
+  }
+
+  memcpy(lb->buf + lb->buflen, text, textlen);
+  lb->buflen += textlen;
+  lb->npending++;
+  lb->nbuffered++;
+  lb->nrecords++;
+
+  if (lb->interval > 0 &&
+      (now - lb->first_ts) >= lb->interval) {
+    (void) pr_log_buffer_flush(lb);
+  }
+
+  return 0;
+}
+
+int pr_log_buffer_destroy(pr_log_buffer_t *lb) {
+  int res;
+
+  if (lb == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  res = pr_log_buffer_flush(lb);
+  if (lb->buflen > 0) {
+    lb->ndropped += lb->nbuffered;
+    lb->buflen = 0;
+    lb->nbuffered = 0;
+  }
+
+  unregister_cleanup(lb->pool, lb, log_buffer_cleanup_cb);
+  log_buffer_cleanup_cb(lb);
+
+  return res;
+}
+
+int pr_log_buffer_flush_all(void) {
+  pr_log_buffer_t *lb;
+  int res = 0;
+
+  for (lb = log_buffers; lb != NULL; lb = lb->next) {
+    if (pr_log_buffer_flush(lb) < 0) {
+      res = -1;
+    }
+
+    log_buffer_report(lb);
+  }
+
+  return res;
+}
+
+int pr_log_buffer_get_stats(pr_log_buffer_t *lb, unsigned long *nrecords,
+    unsigned long *ndelayed, unsigned long *ndropped) {
+  if (lb == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (nrecords != NULL) {
+    *nrecords = lb->nrecords;
+  }
+
+  if (ndelayed != NULL) {
+    *ndelayed = lb->ndelayed;
+  }
+
+  if (ndropped != NULL) {
+    *ndropped = lb->ndropped;
+  }
+
+  return 0;
+}
+
 void pr_log_stacktrace(int log_fd, const char *name) {
 #if defined(HAVE_EXECINFO_H) && \
     defined(HAVE_BACKTRACE) && \
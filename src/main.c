@@ -46,6 +46,17 @@
 # include <openssl/opensslv.h>
 #endif /* PR_USE_OPENSSL */
 
+/* Where available, wait for connections on the listening sockets using
+ * epoll(7), and for the other fds of interest using poll(2).  Otherwise,
+ * select(2) is used for all of them.
+ */
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE) && \
+    defined(HAVE_POLL_H) && defined(HAVE_POLL)
+# define PR_USE_DAEMON_EPOLL	1
+# include <poll.h>
+# include <sys/epoll.h>
+#endif
+
 int (*cmd_auth_chk)(cmd_rec *);
 void (*cmd_handler)(server_rec *, conn_t *);
 
@@ -58,6 +69,12 @@ extern xaset_t *server_list;
 unsigned long max_connects = 0UL;
 unsigned int max_connect_interval = 1;
 
+/* Number of idle, pre-forked processes to keep, as set by SpareServers. */
+unsigned int prefork_min_spares = 0, prefork_max_spares = 0;
+
+/* Number of processes accepting connections, as set by AcceptorProcesses. */
+unsigned int acceptor_nprocs = 1;
+
 session_t session;
 
 /* Is this process the master standalone daemon process? */
@@ -95,8 +112,238 @@ static cmd_rec *make_ftp_cmd(pool *p, char *buf, size_t buflen, int flags);
 
 static const char *config_filename = PR_CONFIG_FILE_PATH;
 
-/* Add child semaphore fds into the rfd for selecting */
-static int semaphore_fds(fd_set *rfd, int maxfd) {
+#ifndef PR_DEVEL_NO_FORK
+static void acceptor_close_fds(void);
+static void prefork_retire_workers(void);
+#endif /* PR_DEVEL_NO_FORK */
+
+/* The set of fds on which the daemon waits, i.e. the listening sockets, the
+ * child semaphore pipes, and the sockets to any idle or acceptor processes.
+ * When epoll(7) is used, the listening sockets are registered once with an
+ * epoll instance, and only its fd is polled along with the others; this way,
+ * the number of listening sockets is not limited by FD_SETSIZE, nor do they
+ * need to be rescanned on every pass through the daemon loop.
+ */
+#ifdef PR_USE_DAEMON_EPOLL
+# define DAEMON_EPOLL_MAX_EVENTS	64
+
+typedef struct {
+  conn_t *listener;
+  int listen_fd;
+} daemon_listener_t;
+
+static struct pollfd *daemon_pollfds = NULL;
+static unsigned int daemon_npollfds = 0, daemon_pollfdsz = 0;
+
+static int daemon_epfd = -1;
+static pool *daemon_epoll_pool = NULL;
+static array_header *daemon_epoll_listeners = NULL;
+
+/* When the epoll instance cannot be used, the listening sockets are polled
+ * directly, starting at this index into daemon_pollfds.
+ */
+static array_header *daemon_listeners = NULL;
+static unsigned int daemon_listeners_idx = 0;
+
+static const char *daemon_wait_name = "poll(2)";
+#else
+static fd_set daemon_readfds;
+static int daemon_maxfd = -1;
+
+static const char *daemon_wait_name = "select(2)";
+#endif /* PR_USE_DAEMON_EPOLL */
+
+static void daemon_fds_clear(void) {
+#ifdef PR_USE_DAEMON_EPOLL
+  daemon_npollfds = 0;
+#else
+  FD_ZERO(&daemon_readfds);
+  daemon_maxfd = -1;
+#endif /* PR_USE_DAEMON_EPOLL */
+}
+
+static void daemon_fds_add(int fd) {
+#ifdef PR_USE_DAEMON_EPOLL
+  if (daemon_npollfds == daemon_pollfdsz) {
+    struct pollfd *pollfds;
+    unsigned int pollfdsz;
+
+    pollfdsz = daemon_pollfdsz > 0 ? daemon_pollfdsz * 2 : 32;
+    pollfds = realloc(daemon_pollfds, pollfdsz * sizeof(struct pollfd));
+    if (pollfds == NULL) {
+      pr_log_pri(PR_LOG_ALERT, "Out of memory!");
+      exit(1);
+    }
+
+    daemon_pollfds = pollfds;
+    daemon_pollfdsz = pollfdsz;
+  }
+
+  daemon_pollfds[daemon_npollfds].fd = fd;
+  daemon_pollfds[daemon_npollfds].events = POLLIN;
+  daemon_pollfds[daemon_npollfds].revents = 0;
+  daemon_npollfds++;
+#else
+  FD_SET(fd, &daemon_readfds);
+  if (fd > daemon_maxfd) {
+    daemon_maxfd = fd;
+  }
+#endif /* PR_USE_DAEMON_EPOLL */
+}
+
+static int daemon_fds_isset(int fd) {
+#ifdef PR_USE_DAEMON_EPOLL
+  register unsigned int i;
+
+  for (i = 0; i < daemon_npollfds; i++) {
+    if (daemon_pollfds[i].fd == fd) {
+      return (daemon_pollfds[i].revents & (POLLIN|POLLHUP|POLLERR)) ?
+        TRUE : FALSE;
+    }
+  }
+
+  return FALSE;
+#else
+  return FD_ISSET(fd, &daemon_readfds) ? TRUE : FALSE;
+#endif /* PR_USE_DAEMON_EPOLL */
+}
+
+/* Returns the number of ready fds, 0 on timeout, or -1 on error (setting
+ * errno).  A NULL timeout means to wait indefinitely.
+ */
+static int daemon_fds_wait(struct timeval *tv) {
+#ifdef PR_USE_DAEMON_EPOLL
+  int timeout = -1;
+
+  if (tv != NULL) {
+    timeout = (int) ((tv->tv_sec * 1000) + (tv->tv_usec / 1000));
+  }
+
+  return poll(daemon_pollfds, daemon_npollfds, timeout);
+#else
+  return select(daemon_maxfd + 1, &daemon_readfds, NULL, NULL, tv);
+#endif /* PR_USE_DAEMON_EPOLL */
+}
+
+#ifdef PR_USE_DAEMON_EPOLL
+static void daemon_epoll_close(void) {
+  if (daemon_epfd >= 0) {
+    (void) close(daemon_epfd);
+    daemon_epfd = -1;
+  }
+
+  if (daemon_epoll_pool != NULL) {
+    destroy_pool(daemon_epoll_pool);
+    daemon_epoll_pool = NULL;
+    daemon_epoll_listeners = NULL;
+  }
+}
+
+/* Make sure that the epoll instance watches exactly the given listening
+ * sockets.  The set of listeners rarely changes, so the epoll instance is
+ * only rebuilt when it does.
+ */
+static int daemon_epoll_update(array_header *listeners) {
+  register unsigned int i;
+  conn_t **elts;
+  daemon_listener_t *registered;
+
+  elts = listeners->elts;
+
+  if (daemon_epfd >= 0 &&
+      daemon_epoll_listeners->nelts == listeners->nelts) {
+    registered = daemon_epoll_listeners->elts;
+
+    for (i = 0; i < listeners->nelts; i++) {
+      if (registered[i].listener != elts[i] ||
+          registered[i].listen_fd != elts[i]->listen_fd) {
+        break;
+      }
+    }
+
+    if (i == listeners->nelts) {
+      return 0;
+    }
+  }
+
+  daemon_epoll_close();
+
+  daemon_epfd = epoll_create(listeners->nelts > 0 ? listeners->nelts : 1);
+  if (daemon_epfd < 0) {
+    pr_log_pri(PR_LOG_NOTICE, "unable to create epoll instance: %s",
+      strerror(errno));
+    return -1;
+  }
+
+  (void) fcntl(daemon_epfd, F_SETFD, FD_CLOEXEC);
+
+  daemon_epoll_pool = make_sub_pool(permanent_pool);
+  pr_pool_tag(daemon_epoll_pool, "Daemon epoll Pool");
+
+  daemon_epoll_listeners = make_array(daemon_epoll_pool, listeners->nelts,
+    sizeof(daemon_listener_t));
+
+  for (i = 0; i < listeners->nelts; i++) {
+    struct epoll_event ev;
+    daemon_listener_t *dl;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = elts[i];
+
+    if (epoll_ctl(daemon_epfd, EPOLL_CTL_ADD, elts[i]->listen_fd, &ev) < 0) {
+      pr_log_pri(PR_LOG_NOTICE, "unable to add fd %d to epoll instance: %s",
+        elts[i]->listen_fd, strerror(errno));
+      daemon_epoll_close();
+      return -1;
+    }
+
+    dl = push_array(daemon_epoll_listeners);
+    dl->listener = elts[i];
+    dl->listen_fd = elts[i]->listen_fd;
+  }
+
+  pr_log_debug(DEBUG10, "watching %u listening %s using epoll",
+    listeners->nelts, listeners->nelts != 1 ? "sockets" : "socket");
+  return 0;
+}
+#endif /* PR_USE_DAEMON_EPOLL */
+
+/* Add the listening sockets to the set of fds to wait on. */
+static void daemon_listen_fds(void) {
+#ifdef PR_USE_DAEMON_EPOLL
+  register unsigned int i;
+  conn_t **elts;
+
+  daemon_listeners = pr_ipbind_get_listeners();
+
+  if (daemon_epoll_update(daemon_listeners) == 0) {
+    daemon_fds_add(daemon_epfd);
+    return;
+  }
+
+  daemon_listeners_idx = daemon_npollfds;
+
+  elts = daemon_listeners->elts;
+  for (i = 0; i < daemon_listeners->nelts; i++) {
+    daemon_fds_add(elts[i]->listen_fd);
+  }
+#else
+  int maxfd;
+
+  maxfd = pr_ipbind_listen(&daemon_readfds);
+  if (maxfd > daemon_maxfd) {
+    daemon_maxfd = maxfd;
+  }
+#endif /* PR_USE_DAEMON_EPOLL */
+}
+
+/* Add child semaphore fds into the set of fds to wait on; returns the number
+ * of fds added.
+ */
+static int semaphore_fds(void) {
+  int nfds = 0;
+
   if (child_count()) {
     pr_child_t *ch;
 
@@ -104,15 +351,13 @@ static int semaphore_fds(fd_set *rfd, int maxfd) {
       pr_signals_handle();
 
       if (ch->ch_pipefd != -1) {
-        FD_SET(ch->ch_pipefd, rfd);
-        if (ch->ch_pipefd > maxfd) {
-          maxfd = ch->ch_pipefd;
-        }
+        daemon_fds_add(ch->ch_pipefd);
+        nfds++;
       }
     }
   }
 
-  return maxfd;
+  return nfds;
 }
 
 void set_auth_check(int (*chk)(cmd_rec*)) {
@@ -958,8 +1203,7 @@ static void cmd_loop(server_rec *server, conn_t *c) {
 }
 
 void restart_daemon(void *d1, void *d2, void *d3, void *d4) {
-  int maxfd, res, xerrno;
-  fd_set childfds;
+  int res, xerrno;
   struct timeval restart_start, restart_finish;
   long restart_elapsed = 0;
 
@@ -975,37 +1219,50 @@ void restart_daemon(void *d1, void *d2, void *d3, void *d4) {
 
   gettimeofday(&restart_start, NULL);
 
-  /* Make sure none of our children haven't completed start up */
-  FD_ZERO(&childfds);
-  maxfd = -1;
+#ifndef PR_DEVEL_NO_FORK
+  /* Idle pre-forked processes have the old configuration; let them go. */
+  prefork_retire_workers();
+  prefork_min_spares = prefork_max_spares = 0;
 
-  maxfd = semaphore_fds(&childfds, maxfd);
-  if (maxfd > -1) {
+  /* As do any acceptor processes. */
+  acceptor_close_fds();
+  acceptor_nprocs = 1;
+#endif /* PR_DEVEL_NO_FORK */
+
+  /* Make sure none of our children haven't completed start up */
+  daemon_fds_clear();
+  if (semaphore_fds() > 0) {
     pr_log_pri(PR_LOG_NOTICE, "waiting for child processes to complete "
       "initialization");
 
-    while (maxfd != -1) {
+    while (TRUE) {
       int i;
 
-      i = select(maxfd + 1, &childfds, NULL, NULL, NULL);
+      i = daemon_fds_wait(NULL);
       if (i > 0) {
         pr_child_t *ch;
 
         for (ch = child_get(NULL); ch; ch = child_get(ch)) {
           if (ch->ch_pipefd != -1 &&
-             FD_ISSET(ch->ch_pipefd, &childfds)) {
+             daemon_fds_isset(ch->ch_pipefd)) {
             (void) close(ch->ch_pipefd);
             ch->ch_pipefd = -1;
           }
         }
       }
 
-      FD_ZERO(&childfds);
-      maxfd = -1;
-      maxfd = semaphore_fds(&childfds, maxfd);
+      daemon_fds_clear();
+      if (semaphore_fds() == 0) {
+        break;
+      }
     }
   }
 
+#ifdef PR_USE_DAEMON_EPOLL
+  /* The listening sockets may change; start afresh. */
+  daemon_epoll_close();
+#endif /* PR_USE_DAEMON_EPOLL */
+
   free_bindings();
 
   /* Run through the list of registered restart callbacks. */
@@ -1182,6 +1439,15 @@ static void fork_server(int fd, conn_t *l, unsigned char no_fork) {
 
       /* No longer need the read side of the semaphore pipe. */
       (void) close(semfds[0]);
+
+      /* Nor the daemon's end of any idle processes' sockets. */
+      prefork_retire_workers();
+
+      /* Nor any acceptor process sockets, nor the epoll instance. */
+      acceptor_close_fds();
+#ifdef PR_USE_DAEMON_EPOLL
+      daemon_epoll_close();
+#endif /* PR_USE_DAEMON_EPOLL */
       break;
 
     case -1:
@@ -1525,166 +1791,1071 @@ static void fork_server(int fd, conn_t *l, unsigned char no_fork) {
 #endif /* PR_DEVEL_NO_DAEMON */
 }
 
-static void disc_children(void) {
+/* Acceptor support.  When AcceptorProcesses is configured, and the listening
+ * sockets have SO_REUSEPORT enabled, the daemon forks additional acceptor
+ * processes, each of which opens its own listening sockets on the same
+ * addresses and ports.  The kernel then spreads incoming connections across
+ * all of these sockets, and thus across the daemon and its acceptors, which
+ * accept connections, and fork for them, in parallel.  Each acceptor runs
+ * the daemon loop, observing its share of MaxInstances, MaxConnectionRate,
+ * and SpareServers, and exits when its socket to the daemon is closed (as on
+ * restart), leaving any sessions it forked to finish.
+ */
 
-  if (disc && disc <= time(NULL) && child_count()) {
-    sigset_t sig_set;
+/* The number of processes, including the daemon, sharing the accepting of
+ * connections.
+ */
+static unsigned int acceptor_active = 1;
 
-    sigemptyset(&sig_set);
-    sigaddset(&sig_set, SIGTERM);
-    sigaddset(&sig_set, SIGCHLD);
-    sigaddset(&sig_set, SIGUSR1);
-    sigaddset(&sig_set, SIGUSR2);
+/* This process's index among them; the daemon is 0. */
+static unsigned int acceptor_idx = 0;
 
-    if (sigprocmask(SIG_BLOCK, &sig_set, NULL) < 0) {
-      pr_log_pri(PR_LOG_NOTICE,
-        "unable to block signal set: %s", strerror(errno));
-    }
+/* Returns this process's share of the given daemon-wide limit.  The shares
+ * add up to the limit: any remainder goes to the lowest-indexed processes,
+ * so a share may be zero.  Callers must thus check the limit, not the share,
+ * for zero (i.e. no limit).
+ */
+static unsigned long acceptor_share(unsigned long limit) {
+  unsigned long share;
 
-    PRIVS_ROOT
-    child_signal(SIGUSR1);
-    PRIVS_RELINQUISH
+  if (limit == 0 ||
+      acceptor_active <= 1) {
+    return limit;
+  }
 
-    if (sigprocmask(SIG_UNBLOCK, &sig_set, NULL) < 0) {
-      pr_log_pri(PR_LOG_NOTICE,
-        "unable to unblock signal set: %s", strerror(errno));
-    }
+  share = limit / acceptor_active;
+  if (acceptor_idx < (limit % acceptor_active)) {
+    share++;
   }
-}
 
-static void daemon_loop(void) {
-  fd_set listenfds;
-  conn_t *listen_conn;
-  int i, err_count = 0, fd, xerrno = 0;
-  unsigned long nconnects = 0UL;
-  time_t last_error;
-  struct timeval tv;
-  static int running = 0;
+  return share;
+}
 
-  pr_proctitle_set("(accepting connections)");
+#ifndef PR_DEVEL_NO_FORK
+typedef struct {
+  pid_t pid;
+  int sockfd;
+  unsigned int idx;
+} acceptor_proc_t;
 
-  time(&last_error);
+static pool *acceptor_pool = NULL;
+static array_header *acceptor_procs = NULL;
 
-  while (TRUE) {
-    int maxfd;
+/* In an acceptor process, its end of the socket to the daemon. */
+static int acceptor_sockfd = -1;
 
-    run_schedule();
+static time_t acceptor_spawn_ts = 0;
+static int acceptor_warned = FALSE;
 
-    FD_ZERO(&listenfds);
-    maxfd = pr_ipbind_listen(&listenfds);
+static void daemon_loop(void);
 
-    /* Monitor children pipes */
-    maxfd = semaphore_fds(&listenfds, maxfd);
+static void acceptor_close_fds(void) {
+  register unsigned int i;
 
-    /* Check for ftp shutdown message file */
-    switch (check_shutmsg(permanent_pool, PR_SHUTMSG_PATH, &shut, &deny,
-        &disc, shutmsg, sizeof(shutmsg))) {
-      case 1:
-        if (!shutting_down) {
-          disc_children();
-        }
-        shutting_down = TRUE;
-        break;
+  /* Closing our end of the socket tells the acceptor process to exit. */
+  if (acceptor_procs != NULL) {
+    acceptor_proc_t *procs;
 
-      default:
-        shutting_down = FALSE;
-        deny = disc = (time_t) 0;
-        break;
+    procs = acceptor_procs->elts;
+    for (i = 0; i < acceptor_procs->nelts; i++) {
+      (void) close(procs[i].sockfd);
     }
 
-    if (shutting_down) {
-      tv.tv_sec = 5L;
-      tv.tv_usec = 0L;
-
-    } else {
+    acceptor_procs->nelts = 0;
+  }
 
-      tv.tv_sec = PR_TUNABLE_SELECT_TIMEOUT;
-      tv.tv_usec = 0L;
-    }
+  if (acceptor_sockfd >= 0) {
+    (void) close(acceptor_sockfd);
+    acceptor_sockfd = -1;
+  }
 
-    /* If running (a flag signaling whether proftpd is just starting up)
-     * AND shutting_down (a flag signalling the present of /etc/shutmsg) are
-     * true, then log an error stating this -- but don't stop the server.
-     */
-    if (shutting_down && !running) {
+  /* Allow any replacements to be spawned right away. */
+  acceptor_spawn_ts = 0;
+  acceptor_warned = FALSE;
+}
 
-      /* Check the value of the deny time_t struct w/ the current time.
-       * If the deny time has passed, log that all incoming connections
-       * will be refused.  If not, note the date at which they will be
-       * refused in the future.
-       */
-      time_t now = time(NULL);
+/* Add the acceptor process sockets (or, in an acceptor process, its socket
+ * to the daemon) into the set of fds to wait on.  These sockets only become
+ * readable when the other end has gone away.
+ */
+static void acceptor_fds(void) {
+  register unsigned int i;
+  acceptor_proc_t *procs;
 
-      if (difftime(deny, now) < 0.0) {
-        pr_log_pri(PR_LOG_WARNING, PR_SHUTMSG_PATH
-          " present: all incoming connections will be refused");
+  if (acceptor_sockfd >= 0) {
+    daemon_fds_add(acceptor_sockfd);
+    return;
+  }
 
-      } else {
-#if defined(HAVE_CTIME_R)
-        char deny_ts[32];
+  if (acceptor_procs == NULL) {
+    return;
+  }
 
-        memset(deny_ts, '\0', sizeof(deny_ts));
-        (void) ctime_r(&deny, deny_ts);
-#else
-        char *deny_ts = NULL;
-        deny_ts = ctime(&deny);
-#endif /* HAVE_CTIME_R */
+  procs = acceptor_procs->elts;
+  for (i = 0; i < acceptor_procs->nelts; i++) {
+    daemon_fds_add(procs[i].sockfd);
+  }
+}
 
-        pr_log_pri(PR_LOG_NOTICE,
-          PR_SHUTMSG_PATH " present: incoming connections "
-          "will be denied starting %s", CHOP(deny_ts));
-      }
+static void acceptor_check_fds(void) {
+  register unsigned int i;
+  acceptor_proc_t *procs;
+
+  if (acceptor_sockfd >= 0) {
+    if (daemon_fds_isset(acceptor_sockfd)) {
+      pr_log_debug(DEBUG5, "daemon process closed connection, "
+        "acceptor process exiting");
+      prefork_retire_workers();
+      pr_session_end(0);
     }
 
-    running = 1;
-    xerrno = errno = 0;
+    return;
+  }
 
-    PR_DEVEL_CLOCK(i = select(maxfd + 1, &listenfds, NULL, NULL, &tv));
-    if (i < 0) {
-      xerrno = errno;
+  if (acceptor_procs == NULL) {
+    return;
+  }
+
+  procs = acceptor_procs->elts;
+  for (i = acceptor_procs->nelts; i > 0; i--) {
+    if (daemon_fds_isset(procs[i-1].sockfd)) {
+      pr_log_pri(PR_LOG_NOTICE, "acceptor process (PID %lu) went away",
+        (unsigned long) procs[i-1].pid);
+      (void) close(procs[i-1].sockfd);
+
+      procs[i-1] = procs[acceptor_procs->nelts - 1];
+      acceptor_procs->nelts--;
     }
+  }
+}
 
-    if (i == -1 &&
-        xerrno == EINTR) {
-      errno = xerrno;
-      pr_signals_handle();
+static void acceptor_shutdown_ev(const void *event_data, void *user_data) {
+  register unsigned int i;
+  acceptor_proc_t *procs;
 
-      /* We handled our signal; clear errno. */
-      xerrno = errno = 0;
-      continue;
+  if (acceptor_sockfd >= 0 ||
+      acceptor_procs == NULL) {
+    return;
+  }
+
+  /* Acceptor processes terminate their own sessions, just as the daemon
+   * does.
+   */
+  procs = acceptor_procs->elts;
+  for (i = 0; i < acceptor_procs->nelts; i++) {
+    if (kill(procs[i].pid, SIGTERM) < 0) {
+      pr_trace_msg("signal", 1, "error sending signal %d to PID %lu: %s",
+        SIGTERM, (unsigned long) procs[i].pid, strerror(errno));
     }
+  }
+}
 
-    if (have_dead_child) {
-      sigset_t sig_set;
+static void acceptor_main(int sockfd, unsigned int idx) {
+  /* We do not need the daemon's end of the other acceptor or idle processes'
+   * sockets.
+   */
+  acceptor_close_fds();
+  prefork_retire_workers();
 
-      sigemptyset(&sig_set);
-      sigaddset(&sig_set, SIGCHLD);
-      sigaddset(&sig_set, SIGTERM);
-      pr_alarms_block();
-      if (sigprocmask(SIG_BLOCK, &sig_set, NULL) < 0) {
-        pr_log_pri(PR_LOG_NOTICE,
-          "unable to block signal set: %s", strerror(errno));
-      }
+  acceptor_sockfd = sockfd;
+  acceptor_idx = idx;
 
-      have_dead_child = FALSE;
-      child_update();
+  /* The daemon's children are not ours to track. */
+  if (child_count()) {
+    pr_child_t *ch;
 
-      if (sigprocmask(SIG_UNBLOCK, &sig_set, NULL) < 0) {
-        pr_log_pri(PR_LOG_NOTICE,
-          "unable to unblock signal set: %s", strerror(errno));
+    for (ch = child_get(NULL); ch; ch = child_get(ch)) {
+      if (ch->ch_dead == FALSE) {
+        (void) child_remove(ch->ch_pid);
       }
-
-      pr_alarms_unblock();
     }
 
-    if (i == -1) {
-      time_t this_error;
+    child_update();
+  }
+
+  /* Restarts, timers, and the handling of the acceptor processes belong to
+   * the daemon; it is the daemon which has the pidfile, scoreboard, etc.
+   * Any other exit handlers stay registered, for the sessions we fork.
+   */
+  if (signal(SIGHUP, SIG_IGN) == SIG_ERR) {
+    pr_log_pri(PR_LOG_NOTICE,
+      "unable to install SIGHUP (signal %d) handler: %s", SIGHUP,
+      strerror(errno));
+  }
+
+  timers_init();
+  pr_event_unregister(NULL, "core.shutdown", acceptor_shutdown_ev);
+
+#ifdef PR_USE_DAEMON_EPOLL
+  daemon_epoll_close();
+#endif /* PR_USE_DAEMON_EPOLL */
+
+  /* Open our own listening sockets; SO_REUSEPORT allows them to be bound
+   * to the same addresses as the daemon's.
+   */
+  pr_ipbind_close_listening_conns();
+  free_bindings();
+  init_bindings();
+
+  pr_log_debug(DEBUG5, "acceptor process started");
+
+  daemon_loop();
+  pr_session_end(0);
+}
+
+static int acceptor_spawn(void) {
+  register unsigned int i;
+  int sockfds[2] = { -1, -1 };
+  unsigned int idx;
+  pid_t pid;
+  acceptor_proc_t *proc;
+
+  /* Use the lowest index not used by a running acceptor process. */
+  for (idx = 1; acceptor_procs != NULL; idx++) {
+    acceptor_proc_t *procs;
+
+    procs = acceptor_procs->elts;
+    for (i = 0; i < acceptor_procs->nelts; i++) {
+      if (procs[i].idx == idx) {
+        break;
+      }
+    }
+
+    if (i == acceptor_procs->nelts) {
+      break;
+    }
+  }
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockfds) < 0) {
+    pr_log_pri(PR_LOG_ALERT, "socketpair(2) failed: %s", strerror(errno));
+    return -1;
+  }
+
+  (void) fcntl(sockfds[0], F_SETFD, FD_CLOEXEC);
+  (void) fcntl(sockfds[1], F_SETFD, FD_CLOEXEC);
+
+  pid = fork();
+  switch (pid) {
+    case 0:
+      (void) close(sockfds[0]);
+      acceptor_main(sockfds[1], idx);
+      break;
+
+    case -1:
+      pr_log_pri(PR_LOG_ALERT, "unable to fork(): %s", strerror(errno));
+      (void) close(sockfds[0]);
+      (void) close(sockfds[1]);
+      return -1;
+
+    default:
+      break;
+  }
+
+  (void) close(sockfds[1]);
+
+  if (acceptor_pool == NULL) {
+    acceptor_pool = make_sub_pool(permanent_pool);
+    pr_pool_tag(acceptor_pool, "Acceptor Pool");
+
+    acceptor_procs = make_array(acceptor_pool, 0, sizeof(acceptor_proc_t));
+
+    pr_event_register(NULL, "core.shutdown", acceptor_shutdown_ev, NULL);
+  }
+
+  proc = push_array(acceptor_procs);
+  proc->pid = pid;
+  proc->sockfd = sockfds[0];
+  proc->idx = idx;
+
+  return 0;
+}
+
+/* Make sure that the configured number of acceptor processes are running. */
+static void acceptor_maintain(void) {
+  unsigned int nprocs, nrunning, nspawned = 0;
+  time_t now;
+
+  /* Acceptor processes do not spawn others. */
+  if (acceptor_sockfd >= 0) {
+    return;
+  }
+
+  nprocs = acceptor_nprocs;
+  if (nprocs > 1) {
+    if (no_forking == TRUE) {
+      nprocs = 1;
+
+    } else if (main_server->tcp_reuse_port != 1) {
+      if (acceptor_warned == FALSE) {
+        pr_log_pri(PR_LOG_WARNING, "AcceptorProcesses requires "
+          "'SocketOptions reuseport on', using only the daemon process");
+        acceptor_warned = TRUE;
+      }
+
+      nprocs = 1;
+    }
+  }
+
+  acceptor_active = nprocs;
+
+  nrunning = acceptor_procs != NULL ? acceptor_procs->nelts : 0;
+  if (nrunning + 1 >= nprocs) {
+    return;
+  }
+
+  /* Respawn at most once a second, in case acceptor processes keep failing,
+   * e.g. because they cannot bind their listening sockets.
+   */
+  time(&now);
+  if (now == acceptor_spawn_ts) {
+    return;
+  }
+  acceptor_spawn_ts = now;
+
+  while (nrunning + 1 < nprocs) {
+    pr_signals_handle();
+
+    if (acceptor_spawn() < 0) {
+      break;
+    }
+
+    nrunning++;
+    nspawned++;
+  }
+
+  if (nspawned > 0) {
+    pr_log_debug(DEBUG5, "spawned %u acceptor %s", nspawned,
+      nspawned != 1 ? "processes" : "process");
+  }
+}
+#endif /* PR_DEVEL_NO_FORK */
+
+#ifndef PR_DEVEL_NO_FORK
+/* Prefork support.  When SpareServers is configured, the daemon keeps a pool
+ * of forked, idle processes, each waiting on a Unix domain socket to be
+ * handed an accepted control connection.  This moves the fork(2) out of the
+ * way of accepting connections.  Idle processes are not in the child list,
+ * and thus do not count against MaxInstances or MaxConnectionRate, and have
+ * no scoreboard entries, until they are given a connection; each process
+ * handles a single session, just as a process forked for that connection
+ * would.
+ */
+
+typedef struct {
+  pid_t pid;
+  int sockfd;
+} prefork_worker_t;
+
+typedef struct {
+  int listen_fd;
+  conn_t *listener;
+} prefork_listener_t;
+
+static pool *prefork_pool = NULL;
+static array_header *prefork_workers = NULL;
+
+/* Recent connection rate, used for adapting the number of spare processes
+ * to the load.
+ */
+static unsigned int prefork_nconns = 0, prefork_rate = 0;
+static time_t prefork_rate_ts = 0;
+
+static void prefork_remove_worker(unsigned int idx) {
+  prefork_worker_t *workers;
+
+  workers = prefork_workers->elts;
+  (void) close(workers[idx].sockfd);
+
+  workers[idx] = workers[prefork_workers->nelts - 1];
+  prefork_workers->nelts--;
+}
+
+static void prefork_retire_workers(void) {
+  if (prefork_workers == NULL) {
+    return;
+  }
+
+  /* Closing our end of the socket tells the idle process to exit. */
+  while (prefork_workers->nelts > 0) {
+    prefork_remove_worker(prefork_workers->nelts - 1);
+  }
+}
+
+/* Add the idle process sockets into the set of fds to wait on.  These
+ * sockets only become readable when the idle process has gone away.
+ */
+static void prefork_fds(void) {
+  register unsigned int i;
+  prefork_worker_t *workers;
+
+  if (prefork_workers == NULL) {
+    return;
+  }
+
+  workers = prefork_workers->elts;
+  for (i = 0; i < prefork_workers->nelts; i++) {
+    daemon_fds_add(workers[i].sockfd);
+  }
+}
+
+static void prefork_check_fds(void) {
+  register unsigned int i;
+  prefork_worker_t *workers;
+
+  if (prefork_workers == NULL) {
+    return;
+  }
+
+  workers = prefork_workers->elts;
+  for (i = prefork_workers->nelts; i > 0; i--) {
+    if (daemon_fds_isset(workers[i-1].sockfd)) {
+      pr_log_debug(DEBUG5, "idle process (PID %lu) went away",
+        (unsigned long) workers[i-1].pid);
+      prefork_remove_worker(i-1);
+    }
+  }
+}
+
+static void prefork_worker_main(int sockfd, int semfd) {
+  register unsigned int i;
+  int fd = -1, listen_fd = -1;
+  array_header *listeners;
+  pr_ipbind_t *ipbind;
+  prefork_listener_t *elts;
+  prefork_worker_t *workers;
+  conn_t *listener = NULL;
+
+  is_master = FALSE;
+  session.pid = getpid();
+
+  /* Remember which listening conn_t goes with which fd, before closing the
+   * listening fds; the daemon tells us the listening fd for the connection
+   * it hands us.
+   */
+  listeners = make_array(permanent_pool, 1, sizeof(prefork_listener_t));
+  for (ipbind = pr_ipbind_get(NULL); ipbind; ipbind = pr_ipbind_get(ipbind)) {
+    prefork_listener_t *pl;
+
+    if (ipbind->ib_listener == NULL ||
+        ipbind->ib_listener->listen_fd < 0) {
+      continue;
+    }
+
+    pl = push_array(listeners);
+    pl->listen_fd = ipbind->ib_listener->listen_fd;
+    pl->listener = ipbind->ib_listener;
+  }
+
+  pr_ipbind_close_listeners();
+
+  /* We do not need the daemon's end of the other idle processes' sockets. */
+  if (prefork_workers != NULL) {
+    workers = prefork_workers->elts;
+    for (i = 0; i < prefork_workers->nelts; i++) {
+      (void) close(workers[i].sockfd);
+    }
+
+    prefork_workers->nelts = 0;
+  }
+
+  acceptor_close_fds();
+#ifdef PR_USE_DAEMON_EPOLL
+  daemon_epoll_close();
+#endif /* PR_USE_DAEMON_EPOLL */
+
+  /* Tell the daemon that we have closed the listening fds. */
+  (void) close(semfd);
+
+  pr_proctitle_set("(idle)");
+
+  while (fd < 0) {
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char cmsgbuf[CMSG_SPACE(sizeof(int))];
+    ssize_t res;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &listen_fd;
+    iov.iov_len = sizeof(listen_fd);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsgbuf;
+    msg.msg_controllen = sizeof(cmsgbuf);
+
+    res = recvmsg(sockfd, &msg, 0);
+    if (res < 0) {
+      if (errno == EINTR) {
+        pr_signals_handle();
+        continue;
+      }
+
+      pr_log_pri(PR_LOG_NOTICE, "idle process unable to receive connection: %s",
+        strerror(errno));
+      exit(1);
+    }
+
+    if (res == 0) {
+      /* The daemon has retired us, or has gone away. */
+      exit(0);
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET &&
+          cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+      }
+    }
+
+    if (fd < 0 ||
+        res != sizeof(listen_fd)) {
+      pr_log_pri(PR_LOG_NOTICE, "idle process received malformed message");
+      exit(1);
+    }
+  }
+
+  (void) close(sockfd);
+
+  elts = listeners->elts;
+  for (i = 0; i < listeners->nelts; i++) {
+    if (elts[i].listen_fd == listen_fd) {
+      listener = elts[i].listener;
+      break;
+    }
+  }
+
+  if (listener == NULL) {
+    pr_log_pri(PR_LOG_NOTICE,
+      "idle process received connection for unknown listening fd %d",
+      listen_fd);
+    (void) close(fd);
+    exit(1);
+  }
+
+  /* The shutdown state may have changed since we were forked. */
+  shutting_down = FALSE;
+  deny = disc = (time_t) 0;
+  if (check_shutmsg(permanent_pool, PR_SHUTMSG_PATH, &shut, &deny, &disc,
+      shutmsg, sizeof(shutmsg)) == 1) {
+    shutting_down = TRUE;
+  }
+
+  fork_server(fd, listener, TRUE);
+  exit(0);
+}
+
+static int prefork_spawn_worker(void) {
+  int sockfds[2] = { -1, -1 }, semfds[2] = { -1, -1 };
+  pid_t pid;
+  prefork_worker_t *worker;
+  char buf[1];
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockfds) < 0) {
+    pr_log_pri(PR_LOG_ALERT, "socketpair(2) failed: %s", strerror(errno));
+    return -1;
+  }
+
+  if (pipe(semfds) < 0) {
+    pr_log_pri(PR_LOG_ALERT, "pipe(2) failed: %s", strerror(errno));
+    (void) close(sockfds[0]);
+    (void) close(sockfds[1]);
+    return -1;
+  }
+
+  (void) fcntl(sockfds[0], F_SETFD, FD_CLOEXEC);
+  (void) fcntl(semfds[0], F_SETFD, FD_CLOEXEC);
+
+  pid = fork();
+  switch (pid) {
+    case 0:
+      (void) close(sockfds[0]);
+      (void) close(semfds[0]);
+      prefork_worker_main(sockfds[1], semfds[1]);
+      break;
+
+    case -1:
+      pr_log_pri(PR_LOG_ALERT, "unable to fork(): %s", strerror(errno));
+      (void) close(sockfds[0]);
+      (void) close(sockfds[1]);
+      (void) close(semfds[0]);
+      (void) close(semfds[1]);
+      return -1;
+
+    default:
+      break;
+  }
+
+  (void) close(sockfds[1]);
+  (void) close(semfds[1]);
+
+  /* Wait for the new process to close its copies of the listening fds, so
+   * that a restart cannot race with it (see fork_server()).  This is quick,
+   * and read(2) returns once the process closes its end, or exits.
+   */
+  while (read(semfds[0], buf, sizeof(buf)) < 0 &&
+         errno == EINTR) {
+    pr_signals_handle();
+  }
+  (void) close(semfds[0]);
+
+  if (prefork_pool == NULL) {
+    prefork_pool = make_sub_pool(permanent_pool);
+    pr_pool_tag(prefork_pool, "Prefork Pool");
+
+    prefork_workers = make_array(prefork_pool, 0, sizeof(prefork_worker_t));
+  }
+
+  worker = push_array(prefork_workers);
+  worker->pid = pid;
+  worker->sockfd = sockfds[0];
+
+  return 0;
+}
+
+/* Hand the accepted connection to an idle process.  Returns 0 on success,
+ * or -1 (with errno set to ENOENT) if no idle process was available.
+ */
+static int prefork_dispatch(int fd, conn_t *l) {
+  prefork_nconns++;
+
+  while (prefork_workers != NULL &&
+         prefork_workers->nelts > 0) {
+    prefork_worker_t *workers, worker;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char cmsgbuf[CMSG_SPACE(sizeof(int))];
+    int listen_fd, res, xerrno;
+    sigset_t sig_set;
+
+    /* Use the most recently spawned process. */
+    workers = prefork_workers->elts;
+    worker = workers[prefork_workers->nelts - 1];
+    prefork_workers->nelts--;
+
+    listen_fd = l->listen_fd;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(cmsgbuf, 0, sizeof(cmsgbuf));
+    iov.iov_base = &listen_fd;
+    iov.iov_len = sizeof(listen_fd);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsgbuf;
+    msg.msg_controllen = sizeof(cmsgbuf);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    /* As in fork_server(), block SIGCHLD until the process is in the child
+     * list, in case its session ends very quickly.
+     */
+    sigemptyset(&sig_set);
+    sigaddset(&sig_set, SIGTERM);
+    sigaddset(&sig_set, SIGCHLD);
+    sigaddset(&sig_set, SIGUSR1);
+    sigaddset(&sig_set, SIGUSR2);
+
+    if (sigprocmask(SIG_BLOCK, &sig_set, NULL) < 0) {
+      pr_log_pri(PR_LOG_NOTICE,
+        "unable to block signal set: %s", strerror(errno));
+    }
+
+    res = sendmsg(worker.sockfd, &msg, 0);
+    xerrno = errno;
+
+    if (res == (int) sizeof(listen_fd)) {
+      child_add(worker.pid, -1);
+    }
+
+    if (sigprocmask(SIG_UNBLOCK, &sig_set, NULL) < 0) {
+      pr_log_pri(PR_LOG_NOTICE,
+        "unable to unblock signal set: %s", strerror(errno));
+    }
+
+    (void) close(worker.sockfd);
+
+    if (res == (int) sizeof(listen_fd)) {
+      /* The parent doesn't need the socket open. */
+      (void) close(fd);
+      return 0;
+    }
+
+    pr_log_debug(DEBUG5, "error handing connection to idle process "
+      "(PID %lu): %s", (unsigned long) worker.pid,
+      res < 0 ? strerror(xerrno) : "short write");
+  }
+
+  errno = ENOENT;
+  return -1;
+}
+
+/* Adjust the number of idle processes: the number of spares to keep is the
+ * minimum, plus the recent connection rate, up to the maximum.
+ */
+static void prefork_maintain(void) {
+  unsigned int nidle, target, nspawned = 0;
+  unsigned long max_instances;
+  time_t now;
+
+  if (prefork_min_spares == 0 ||
+      no_forking == TRUE) {
+    prefork_retire_workers();
+    return;
+  }
+
+  time(&now);
+  if (now != prefork_rate_ts) {
+    long elapsed;
+
+    elapsed = (long) (now - prefork_rate_ts);
+
+    /* Decay the previous rate by half for each elapsed second. */
+    prefork_rate = (prefork_rate + prefork_nconns) / 2;
+    while (--elapsed > 0 &&
+           prefork_rate > 0) {
+      prefork_rate /= 2;
+    }
+
+    prefork_nconns = 0;
+    prefork_rate_ts = now;
+  }
+
+  /* With acceptor processes, each keeps its share of the spares. */
+  target = acceptor_share(prefork_min_spares) + prefork_rate;
+  if (target > acceptor_share(prefork_max_spares)) {
+    target = acceptor_share(prefork_max_spares);
+  }
+
+  /* There is no point in keeping more processes than MaxInstances would
+   * allow to be used.
+   */
+  max_instances = acceptor_share(ServerMaxInstances);
+  if (ServerMaxInstances > 0) {
+    if (child_count() >= max_instances) {
+      target = 0;
+
+    } else if (target > max_instances - child_count()) {
+      target = max_instances - child_count();
+    }
+  }
+
+  nidle = prefork_workers != NULL ? prefork_workers->nelts : 0;
+
+  while (nidle < target &&
+         nspawned < PR_TUNABLE_PREFORK_SPAWN_MAX) {
+    pr_signals_handle();
+
+    if (prefork_spawn_worker() < 0) {
+      break;
+    }
+
+    nidle++;
+    nspawned++;
+  }
+
+  if (nspawned > 0) {
+    pr_log_debug(DEBUG5, "spawned %u idle %s (%u idle, target %u)", nspawned,
+      nspawned != 1 ? "processes" : "process", nidle, target);
+  }
+
+  /* Retire excess idle processes gradually, one per pass, starting with the
+   * least recently spawned.
+   */
+  if (nidle > target &&
+      prefork_workers != NULL &&
+      prefork_workers->nelts > 0) {
+    prefork_remove_worker(0);
+  }
+}
+#endif /* PR_DEVEL_NO_FORK */
+
+static void disc_children(void) {
+
+  if (disc && disc <= time(NULL) && child_count()) {
+    sigset_t sig_set;
+
+    sigemptyset(&sig_set);
+    sigaddset(&sig_set, SIGTERM);
+    sigaddset(&sig_set, SIGCHLD);
+    sigaddset(&sig_set, SIGUSR1);
+    sigaddset(&sig_set, SIGUSR2);
+
+    if (sigprocmask(SIG_BLOCK, &sig_set, NULL) < 0) {
+      pr_log_pri(PR_LOG_NOTICE,
+        "unable to block signal set: %s", strerror(errno));
+    }
+
+    PRIVS_ROOT
+    child_signal(SIGUSR1);
+    PRIVS_RELINQUISH
+
+    if (sigprocmask(SIG_UNBLOCK, &sig_set, NULL) < 0) {
+      pr_log_pri(PR_LOG_NOTICE,
+        "unable to unblock signal set: %s", strerror(errno));
+    }
+  }
+}
+
+/* Hand off a newly accepted connection, unless doing so would exceed the
+ * MaxInstances or MaxConnectionRate limits.  The given connection count
+ * includes this connection.
+ */
+static void daemon_handle_conn(int fd, conn_t *listen_conn,
+    unsigned long *nconnects) {
+  unsigned long max_instances, max_conns;
+
+  max_instances = acceptor_share(ServerMaxInstances);
+  max_conns = acceptor_share(max_connects);
+
+  /* Check for exceeded MaxInstances. */
+  if (ServerMaxInstances > 0 &&
+      child_count() >= max_instances) {
+    pr_event_generate("core.max-instances", NULL);
+
+    pr_log_pri(PR_LOG_WARNING,
+      "MaxInstances (%lu) reached, new connection denied", max_instances);
+    close(fd);
+
+  /* Check for exceeded MaxConnectionRate. */
+  } else if (max_connects && (*nconnects > max_conns)) {
+    pr_event_generate("core.max-connection-rate", NULL);
+
+    pr_log_pri(PR_LOG_WARNING,
+      "MaxConnectionRate (%lu/%u secs) reached, new connection denied",
+      max_conns, max_connect_interval);
+    close(fd);
+
+  /* Fork off a child to handle the connection, unless an idle
+   * pre-forked process can handle it.
+   */
+  } else {
+    int dispatched = FALSE;
+
+#ifndef PR_DEVEL_NO_FORK
+    if (prefork_min_spares > 0 &&
+        no_forking == FALSE &&
+        prefork_dispatch(fd, listen_conn) == 0) {
+      dispatched = TRUE;
+    }
+#endif /* PR_DEVEL_NO_FORK */
+
+    if (dispatched == FALSE) {
+      PR_DEVEL_CLOCK(fork_server(fd, listen_conn, no_forking));
+    }
+
+    /* Any further connections accepted on this pass count this one. */
+    (*nconnects)++;
+  }
+}
+
+/* Accept connections on the ready listening sockets.  Fork off servers to
+ * handle each connection; our job is to get back to answering connections
+ * ASAP, so leave the work of determining which server the connection is for
+ * to our child.
+ */
+static void daemon_accept_conns(unsigned long *nconnects) {
+  conn_t *listen_conn;
+  int fd = -1;
+#ifdef PR_USE_DAEMON_EPOLL
+  register int i;
+
+  if (daemon_epfd >= 0) {
+    struct epoll_event events[DAEMON_EPOLL_MAX_EVENTS];
+    int nevents;
+
+    if (daemon_fds_isset(daemon_epfd) == FALSE) {
+      return;
+    }
+
+    nevents = epoll_wait(daemon_epfd, events, DAEMON_EPOLL_MAX_EVENTS, 0);
+    for (i = 0; i < nevents; i++) {
+      pr_signals_handle();
+
+      listen_conn = events[i].data.ptr;
+      if (pr_ipbind_accept(listen_conn, &fd) < 0 ||
+          fd < 0) {
+        continue;
+      }
+
+      daemon_handle_conn(fd, listen_conn, nconnects);
+    }
+
+  } else if (daemon_listeners != NULL) {
+    conn_t **listeners;
+
+    listeners = daemon_listeners->elts;
+    for (i = 0; i < (int) daemon_listeners->nelts; i++) {
+      struct pollfd *pfd;
+
+      pr_signals_handle();
+
+      pfd = &(daemon_pollfds[daemon_listeners_idx + i]);
+      if (!(pfd->revents & (POLLIN|POLLHUP|POLLERR))) {
+        continue;
+      }
+
+      listen_conn = listeners[i];
+      if (pr_ipbind_accept(listen_conn, &fd) < 0 ||
+          fd < 0) {
+        continue;
+      }
+
+      daemon_handle_conn(fd, listen_conn, nconnects);
+    }
+  }
+#else
+  /* Accept the connection. */
+  listen_conn = pr_ipbind_accept_conn(&daemon_readfds, &fd);
+  if (listen_conn != NULL) {
+    daemon_handle_conn(fd, listen_conn, nconnects);
+  }
+#endif /* PR_USE_DAEMON_EPOLL */
+}
+
+static void daemon_loop(void) {
+  int i, err_count = 0, xerrno = 0;
+  unsigned long nconnects = 0UL;
+  time_t last_error;
+  struct timeval tv;
+  static int running = 0;
+
+  pr_proctitle_set("(accepting connections)");
+
+  time(&last_error);
+
+  while (TRUE) {
+    run_schedule();
+
+#ifndef PR_DEVEL_NO_FORK
+    acceptor_maintain();
+    prefork_maintain();
+#endif /* PR_DEVEL_NO_FORK */
+
+    daemon_fds_clear();
+    daemon_listen_fds();
+
+    /* Monitor children pipes */
+    semaphore_fds();
+
+#ifndef PR_DEVEL_NO_FORK
+    /* Monitor idle and acceptor processes */
+    prefork_fds();
+    acceptor_fds();
+#endif /* PR_DEVEL_NO_FORK */
+
+    /* Check for ftp shutdown message file */
+    switch (check_shutmsg(permanent_pool, PR_SHUTMSG_PATH, &shut, &deny,
+        &disc, shutmsg, sizeof(shutmsg))) {
+      case 1:
+        if (!shutting_down) {
+          disc_children();
+        }
+        shutting_down = TRUE;
+        break;
+
+      default:
+        shutting_down = FALSE;
+        deny = disc = (time_t) 0;
+        break;
+    }
+
+    if (shutting_down) {
+      tv.tv_sec = 5L;
+      tv.tv_usec = 0L;
+
+    } else {
+
+      tv.tv_sec = PR_TUNABLE_SELECT_TIMEOUT;
+      tv.tv_usec = 0L;
+    }
+
+    /* If running (a flag signaling whether proftpd is just starting up)
+     * AND shutting_down (a flag signalling the present of /etc/shutmsg) are
+     * true, then log an error stating this -- but don't stop the server.
+     */
+    if (shutting_down && !running) {
+
+      /* Check the value of the deny time_t struct w/ the current time.
+       * If the deny time has passed, log that all incoming connections
+       * will be refused.  If not, note the date at which they will be
+       * refused in the future.
+       */
+      time_t now = time(NULL);
+
+      if (difftime(deny, now) < 0.0) {
+        pr_log_pri(PR_LOG_WARNING, PR_SHUTMSG_PATH
+          " present: all incoming connections will be refused");
+
+      } else {
+#if defined(HAVE_CTIME_R)
+        char deny_ts[32];
+
+        memset(deny_ts, '\0', sizeof(deny_ts));
+        (void) ctime_r(&deny, deny_ts);
+#else
+        char *deny_ts = NULL;
+        deny_ts = ctime(&deny);
+#endif /* HAVE_CTIME_R */
+
+        pr_log_pri(PR_LOG_NOTICE,
+          PR_SHUTMSG_PATH " present: incoming connections "
+          "will be denied starting %s", CHOP(deny_ts));
+      }
+    }
+
+    running = 1;
+    xerrno = errno = 0;
+
+    PR_DEVEL_CLOCK(i = daemon_fds_wait(&tv));
+    if (i < 0) {
+      xerrno = errno;
+    }
+
+    if (i == -1 &&
+        xerrno == EINTR) {
+      errno = xerrno;
+      pr_signals_handle();
+
+      /* We handled our signal; clear errno. */
+      xerrno = errno = 0;
+      continue;
+    }
+
+    if (have_dead_child) {
+      sigset_t sig_set;
+
+      sigemptyset(&sig_set);
+      sigaddset(&sig_set, SIGCHLD);
+      sigaddset(&sig_set, SIGTERM);
+      pr_alarms_block();
+      if (sigprocmask(SIG_BLOCK, &sig_set, NULL) < 0) {
+        pr_log_pri(PR_LOG_NOTICE,
+          "unable to block signal set: %s", strerror(errno));
+      }
+
+      have_dead_child = FALSE;
+      child_update();
+
+      if (sigprocmask(SIG_UNBLOCK, &sig_set, NULL) < 0) {
+        pr_log_pri(PR_LOG_NOTICE,
+          "unable to unblock signal set: %s", strerror(errno));
+      }
+
+      pr_alarms_unblock();
+    }
+
+    if (i == -1) {
+      time_t this_error;
 
       time(&this_error);
 
       if ((this_error - last_error) <= 5 && err_count++ > 10) {
-        pr_log_pri(PR_LOG_ERR, "fatal: select(2) failing repeatedly, shutting "
-          "down");
+        pr_log_pri(PR_LOG_ERR, "fatal: %s failing repeatedly, shutting "
+          "down", daemon_wait_name);
         exit(1);
 
       } else if ((this_error - last_error) > 5) {
@@ -1692,8 +2863,8 @@ static void daemon_loop(void) {
         err_count = 0;
       }
 
-      pr_log_pri(PR_LOG_WARNING, "select(2) failed in daemon_loop(): %s",
-        strerror(xerrno));
+      pr_log_pri(PR_LOG_WARNING, "%s failed in daemon_loop(): %s",
+        daemon_wait_name, strerror(xerrno));
     }
 
     if (i == 0) {
@@ -1712,7 +2883,7 @@ static void daemon_loop(void) {
 
       for (ch = child_get(NULL); ch; ch = child_get(ch)) {
 	if (ch->ch_pipefd != -1 &&
-            FD_ISSET(ch->ch_pipefd, &listenfds)) {
+            daemon_fds_isset(ch->ch_pipefd)) {
 	  (void) close(ch->ch_pipefd);
 	  ch->ch_pipefd = -1;
 	}
@@ -1726,46 +2897,19 @@ static void daemon_loop(void) {
       }
     }
 
+#ifndef PR_DEVEL_NO_FORK
+    prefork_check_fds();
+    acceptor_check_fds();
+#endif /* PR_DEVEL_NO_FORK */
+
     pr_signals_handle();
 
     if (i < 0) {
       continue;
     }
 
-    /* Accept the connection. */
-    listen_conn = pr_ipbind_accept_conn(&listenfds, &fd);
+    daemon_accept_conns(&nconnects);
 
-    /* Fork off servers to handle each connection our job is to get back to
-     * answering connections ASAP, so leave the work of determining which
-     * server the connection is for to our child.
-     */
-
-    if (listen_conn != NULL) {
-
-      /* Check for exceeded MaxInstances. */
-      if (ServerMaxInstances > 0 &&
-          child_count() >= ServerMaxInstances) {
-        pr_event_generate("core.max-instances", NULL);
-        
-        pr_log_pri(PR_LOG_WARNING,
-          "MaxInstances (%lu) reached, new connection denied",
-          ServerMaxInstances);
-        close(fd);
-
-      /* Check for exceeded MaxConnectionRate. */
-      } else if (max_connects && (nconnects > max_connects)) {
-        pr_event_generate("core.max-connection-rate", NULL);
-
-        pr_log_pri(PR_LOG_WARNING,
-          "MaxConnectionRate (%lu/%u secs) reached, new connection denied",
-          max_connects, max_connect_interval);
-        close(fd);
-
-      /* Fork off a child to handle the connection. */
-      } else {
-        PR_DEVEL_CLOCK(fork_server(fd, listen_conn, no_forking));
-      }
-    }
 #ifdef PR_DEVEL_NO_DAEMON
     /* Do not continue the while() loop here if not daemonizing. */
     break;
@@ -209,6 +209,7 @@ config_rec *pr_parser_config_ctxt_close(int *empty) {
     if (c != NULL &&
         (!c->subset || !c->subset->xas_list)) {
       xaset_remove(c->set, (xasetmember_t *) c);
+      pr_config_index_invalidate();
       destroy_pool(c->pool);
 
       if (empty) {
@@ -226,6 +227,7 @@ config_rec *pr_parser_config_ctxt_close(int *empty) {
   if (c != NULL &&
       (!c->subset || !c->subset->xas_list)) {
     xaset_remove(c->set, (xasetmember_t *) c);
+    pr_config_index_invalidate();
     destroy_pool(c->pool);
 
     if (empty) {
@@ -300,6 +302,7 @@ config_rec *pr_parser_config_ctxt_open(const char *name) {
   c->set = *set;
   c->parent = parent;
   c->name = pstrdup(c->pool, name);
+  pr_config_index_invalidate();
 
   if (parent) {
     if (parent->config_type == CONF_DYNDIR) {
@@ -27,6 +27,20 @@
 #include "conf.h"
 #include "privs.h"
 
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+/* Session processes update their scoreboard slots through a shared mapping
+ * of the ScoreboardFile, guarded by the per-slot sequence numbers in the
+ * slot index, when possible.  Otherwise, we fall back to locking and writing
+ * the slot in the ScoreboardFile.
+ */
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H) && \
+    defined(HAVE_PREAD) && defined(__GNUC__)
+# define PR_USE_SCOREBOARD_SHM
+#endif
+
 /* From src/dirtree.c */
 extern char ServerType;
 
@@ -48,13 +62,329 @@ static struct flock entry_lock;
 static unsigned char scoreboard_read_locked = FALSE;
 static unsigned char scoreboard_write_locked = FALSE;
 
+/* Offset of the next entry to be read by pr_scoreboard_entry_read(), if
+ * known.
+ */
+static off_t scan_pos = -1;
+
+#ifdef PR_USE_SCOREBOARD_SHM
+/* Our mapping of the slot index in the ScoreboardMutex file. */
+static pr_scoreboard_index_header_t *scoreboard_index = NULL;
+static unsigned int scoreboard_index_nslots = 0;
+
+/* Our mapping of our own slot in the ScoreboardFile. */
+static void *shm_entry_map = NULL;
+static size_t shm_entry_maplen = 0;
+static pr_scoreboard_entry_t *shm_entry = NULL;
+static unsigned int shm_entry_slot = 0;
+#endif /* PR_USE_SCOREBOARD_SHM */
+
 /* Max number of attempts for lock requests */
 #define SCOREBOARD_MAX_LOCK_ATTEMPTS	10
 
+/* Max number of attempts to read a slot which is being changed. */
+#define SCOREBOARD_MAX_READ_ATTEMPTS	10
+
 static const char *trace_channel = "scoreboard";
 
 /* Internal routines */
 
+#ifdef PR_USE_SCOREBOARD_SHM
+static pr_scoreboard_index_slot_t *index_get_slot(unsigned int slotno) {
+  if (scoreboard_index == NULL ||
+      slotno >= scoreboard_index_nslots) {
+    return NULL;
+  }
+
+  return ((pr_scoreboard_index_slot_t *) (scoreboard_index + 1)) + slotno;
+}
+
+static void index_unmap(void) {
+  if (scoreboard_index != NULL) {
+    (void) munmap((void *) scoreboard_index,
+      sizeof(pr_scoreboard_index_header_t) +
+      (scoreboard_index_nslots * sizeof(pr_scoreboard_index_slot_t)));
+    scoreboard_index = NULL;
+    scoreboard_index_nslots = 0;
+  }
+}
+
+/* Maps the slot index from the ScoreboardMutex file.  If `nslots' is
+ * non-zero, the index is created, or grown to cover at least that many
+ * slots, as necessary; the caller MUST hold the scoreboard write lock in
+ * that case.
+ */
+static int index_map(unsigned int nslots) {
+  struct stat st;
+  unsigned int file_nslots = 0;
+  size_t len;
+  void *ptr;
+
+  if (scoreboard_mutex_fd < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (fstat(scoreboard_mutex_fd, &st) < 0) {
+    return -1;
+  }
+
+  if (st.st_size >= (off_t) sizeof(pr_scoreboard_index_header_t)) {
+    file_nslots = (st.st_size - sizeof(pr_scoreboard_index_header_t)) /
+      sizeof(pr_scoreboard_index_slot_t);
+  }
+
+  if (nslots > 0 &&
+      (file_nslots < nslots || file_nslots == 0)) {
+    unsigned int growth = PR_TUNABLE_SCOREBOARD_INDEX_GROWTH;
+
+    if (growth == 0) {
+      growth = 1;
+    }
+
+    file_nslots = ((nslots + growth - 1) / growth) * growth;
+    if (ftruncate(scoreboard_mutex_fd,
+        sizeof(pr_scoreboard_index_header_t) +
+        (file_nslots * sizeof(pr_scoreboard_index_slot_t))) < 0) {
+      int xerrno = errno;
+
+      pr_trace_msg(trace_channel, 3,
+        "error growing scoreboard slot index to %u slots: %s", file_nslots,
+        strerror(xerrno));
+
+      errno = xerrno;
+      return -1;
+    }
+
+    pr_trace_msg(trace_channel, 9, "grew scoreboard slot index to %u slots",
+      file_nslots);
+  }
+
+  if (file_nslots == 0) {
+    index_unmap();
+    errno = ENOENT;
+    return -1;
+  }
+
+  if (scoreboard_index == NULL ||
+      scoreboard_index_nslots != file_nslots) {
+    index_unmap();
+
+    len = sizeof(pr_scoreboard_index_header_t) +
+      (file_nslots * sizeof(pr_scoreboard_index_slot_t));
+    ptr = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED,
+      scoreboard_mutex_fd, 0);
+    if (ptr == MAP_FAILED) {
+      int xerrno = errno;
+
+      pr_trace_msg(trace_channel, 3, "error mapping scoreboard slot index: %s",
+        strerror(xerrno));
+
+      errno = xerrno;
+      return -1;
+    }
+
+    scoreboard_index = ptr;
+    scoreboard_index_nslots = file_nslots;
+  }
+
+  if (nslots > 0) {
+    if (scoreboard_index->sci_magic != PR_SCOREBOARD_INDEX_MAGIC) {
+      memset(scoreboard_index, 0, sizeof(pr_scoreboard_index_header_t) +
+        (file_nslots * sizeof(pr_scoreboard_index_slot_t)));
+      scoreboard_index->sci_magic = PR_SCOREBOARD_INDEX_MAGIC;
+    }
+
+    scoreboard_index->sci_nslots = file_nslots;
+
+  } else if (scoreboard_index->sci_magic != PR_SCOREBOARD_INDEX_MAGIC) {
+    index_unmap();
+    errno = ENOENT;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Returns the number of the slot at the given ScoreboardFile offset. */
+static unsigned int index_get_slotno(off_t offset) {
+  return (offset - sizeof(pr_scoreboard_header_t)) /
+    sizeof(pr_scoreboard_entry_t);
+}
+
+/* Removes and returns the first slot on the free list, or returns -1 if the
+ * list is empty.  Requires the scoreboard write lock.
+ */
+static int index_pop_free(void) {
+  pr_scoreboard_index_slot_t *slot;
+  unsigned int slotno;
+
+  if (scoreboard_index == NULL ||
+      scoreboard_index->sci_free == 0) {
+    return -1;
+  }
+
+  slotno = scoreboard_index->sci_free - 1;
+  slot = index_get_slot(slotno);
+  if (slot == NULL) {
+    /* A free list pointing past the end of the index is no longer usable;
+     * the next scrub will rebuild it.
+     */
+    scoreboard_index->sci_free = 0;
+    return -1;
+  }
+
+  scoreboard_index->sci_free = slot->scs_next_free;
+  slot->scs_next_free = 0;
+  return (int) slotno;
+}
+
+/* Adds the given slot to the free list.  Requires the scoreboard write
+ * lock.
+ */
+static void index_push_free(unsigned int slotno) {
+  pr_scoreboard_index_slot_t *slot;
+
+  slot = index_get_slot(slotno);
+  if (slot == NULL) {
+    return;
+  }
+
+  slot->scs_next_free = scoreboard_index->sci_free;
+  scoreboard_index->sci_free = slotno + 1;
+}
+
+static void slot_write_begin(pr_scoreboard_index_slot_t *slot) {
+  if (slot != NULL) {
+    slot->scs_seqno++;
+    __sync_synchronize();
+  }
+}
+
+static void slot_write_end(pr_scoreboard_index_slot_t *slot) {
+  if (slot != NULL) {
+    __sync_synchronize();
+    slot->scs_seqno++;
+  }
+}
+
+static void entry_unmap(void) {
+  if (shm_entry_map != NULL) {
+    (void) munmap(shm_entry_map, shm_entry_maplen);
+    shm_entry_map = NULL;
+    shm_entry_maplen = 0;
+    shm_entry = NULL;
+  }
+}
+
+/* Maps our own slot, at the entry_lock offset, from the ScoreboardFile. */
+static int entry_map(void) {
+  long pagesz;
+  off_t map_offset;
+  size_t map_len;
+  void *ptr;
+
+  pagesz = sysconf(_SC_PAGESIZE);
+  if (pagesz <= 0) {
+    pagesz = 4096;
+  }
+
+  map_offset = entry_lock.l_start - (entry_lock.l_start % pagesz);
+  map_len = (entry_lock.l_start - map_offset) + sizeof(pr_scoreboard_entry_t);
+
+  ptr = mmap(NULL, map_len, PROT_READ|PROT_WRITE, MAP_SHARED, scoreboard_fd,
+    map_offset);
+  if (ptr == MAP_FAILED) {
+    return -1;
+  }
+
+  shm_entry_map = ptr;
+  shm_entry_maplen = map_len;
+  shm_entry = (pr_scoreboard_entry_t *) (((char *) ptr) +
+    (entry_lock.l_start - map_offset));
+  shm_entry_slot = index_get_slotno(entry_lock.l_start);
+
+  return 0;
+}
+
+/* Finds a slot for a new entry using the free list in the slot index,
+ * setting the entry_lock offset to that slot, or to the end of the
+ * ScoreboardFile if no free slots are listed.  Requires the scoreboard write
+ * lock.
+ */
+static int entry_find_slot(void) {
+  struct stat st;
+  int slotno;
+  unsigned int nslots;
+
+  while ((slotno = index_pop_free()) >= 0) {
+    pid_t slot_pid = 0;
+    off_t offset;
+    ssize_t res;
+
+    offset = sizeof(pr_scoreboard_header_t) +
+      ((off_t) slotno * sizeof(pr_scoreboard_entry_t));
+
+    /* The free list is only a hint; make sure the slot really is free. */
+    res = pread(scoreboard_fd, &slot_pid, sizeof(slot_pid), offset);
+    if (res == sizeof(slot_pid) &&
+        slot_pid == 0) {
+      entry_lock.l_start = offset;
+      return 0;
+    }
+  }
+
+  if (fstat(scoreboard_fd, &st) < 0) {
+    return -1;
+  }
+
+  nslots = 0;
+  if (st.st_size > (off_t) sizeof(pr_scoreboard_header_t)) {
+    nslots = (st.st_size - sizeof(pr_scoreboard_header_t)) /
+      sizeof(pr_scoreboard_entry_t);
+  }
+
+  if (index_map(nslots + 1) < 0) {
+    return -1;
+  }
+
+  entry_lock.l_start = sizeof(pr_scoreboard_header_t) +
+    ((off_t) nslots * sizeof(pr_scoreboard_entry_t));
+  return 0;
+}
+
+/* Re-reads the entry at the given offset, for as long as the slot's sequence
+ * number shows that it was being changed while we read it.
+ */
+static void entry_reread(pr_scoreboard_index_slot_t *slot, unsigned int seqno,
+    pr_scoreboard_entry_t *sce, off_t offset) {
+  unsigned int nattempts = 1;
+
+  __sync_synchronize();
+
+  while ((seqno & 1) ||
+         seqno != slot->scs_seqno) {
+    nattempts++;
+    if (nattempts > SCOREBOARD_MAX_READ_ATTEMPTS) {
+      pr_trace_msg(trace_channel, 5,
+        "scoreboard slot at offset %" PR_LU " still changing after %u "
+        "attempts, using last read", (pr_off_t) offset, nattempts - 1);
+      break;
+    }
+
+    seqno = slot->scs_seqno;
+    __sync_synchronize();
+
+    if (pread(scoreboard_fd, sce, sizeof(pr_scoreboard_entry_t), offset) !=
+        sizeof(pr_scoreboard_entry_t)) {
+      break;
+    }
+
+    __sync_synchronize();
+  }
+}
+#endif /* PR_USE_SCOREBOARD_SHM */
+
 static char *handle_score_str(const char *fmt, va_list cmdap) {
   static char buf[PR_TUNABLE_SCOREBOARD_BUFFER_SIZE] = {'\0'};
   memset(buf, '\0', sizeof(buf));
@@ -398,13 +728,22 @@ int pr_close_scoreboard(int keep_mutex) {
 
   pr_trace_msg(trace_channel, 4, "closing scoreboard fd %d", scoreboard_fd);
 
+#ifdef PR_USE_SCOREBOARD_SHM
+  entry_unmap();
+#endif /* PR_USE_SCOREBOARD_SHM */
+
   (void) close(scoreboard_fd);
   scoreboard_fd = -1;
+  scan_pos = -1;
 
   if (keep_mutex == FALSE) {
     pr_trace_msg(trace_channel, 4, "closing scoreboard mutex fd %d",
       scoreboard_mutex_fd);
 
+#ifdef PR_USE_SCOREBOARD_SHM
+    index_unmap();
+#endif /* PR_USE_SCOREBOARD_SHM */
+
     (void) close(scoreboard_mutex_fd);
     scoreboard_mutex_fd = -1;
   }
@@ -418,6 +757,11 @@ void pr_delete_scoreboard(void) {
     return;
   }
 
+#ifdef PR_USE_SCOREBOARD_SHM
+  entry_unmap();
+  index_unmap();
+#endif /* PR_USE_SCOREBOARD_SHM */
+
   if (scoreboard_fd > -1) {
     (void) close(scoreboard_fd);
   }
@@ -429,6 +773,7 @@ void pr_delete_scoreboard(void) {
   scoreboard_fd = -1;
   scoreboard_mutex_fd = -1;
   scoreboard_opener = 0;
+  scan_pos = -1;
 
   /* As a performance hack, setting "ScoreboardFile /dev/null" makes
    * proftpd write all its scoreboard entries to /dev/null.  But we don't
@@ -665,6 +1010,7 @@ int pr_restore_scoreboard(void) {
   /* Position the file position pointer of the scoreboard back to
    * where it was, prior to the last pr_rewind_scoreboard() call.
    */
+  scan_pos = -1;
   if (lseek(scoreboard_fd, current_pos, SEEK_SET) == (off_t) -1) {
     return -1;
   }
@@ -696,9 +1042,17 @@ int pr_rewind_scoreboard(void) {
    */
   if (lseek(scoreboard_fd, (off_t) sizeof(pr_scoreboard_header_t),
       SEEK_SET) == (off_t) -1) {
+    scan_pos = -1;
     return -1;
   }
 
+  scan_pos = sizeof(pr_scoreboard_header_t);
+
+#ifdef PR_USE_SCOREBOARD_SHM
+  /* Pick up any changes to the slot index, for checking the entries read. */
+  (void) index_map(0);
+#endif /* PR_USE_SCOREBOARD_SHM */
+
   return 0;
 }
 
@@ -841,10 +1195,21 @@ int pr_scoreboard_entry_add(void) {
   /* No interruptions, please. */
   pr_signals_block();
 
+#ifdef PR_USE_SCOREBOARD_SHM
+  if (index_map(1) == 0 &&
+      entry_find_slot() == 0) {
+    found_slot = TRUE;
+  }
+#endif /* PR_USE_SCOREBOARD_SHM */
+
   /* If the scoreboard is open, the file position is already past the
    * header.
    */
-  while (TRUE) {
+  if (found_slot == FALSE) {
+    scan_pos = -1;
+  }
+
+  while (found_slot == FALSE) {
     while ((res = read(scoreboard_fd, &entry, sizeof(entry))) ==
         sizeof(entry)) {
 
@@ -874,7 +1239,38 @@ int pr_scoreboard_entry_add(void) {
   entry.sce_uid = geteuid();
   entry.sce_gid = getegid();
 
+#ifdef PR_USE_SCOREBOARD_SHM
+  if (scoreboard_index != NULL) {
+    pr_scoreboard_index_slot_t *slot;
+
+    slot = index_get_slot(index_get_slotno(entry_lock.l_start));
+
+    /* A previous user of this slot may have died in the middle of an
+     * update.
+     */
+    if (slot != NULL &&
+        (slot->scs_seqno & 1)) {
+      slot->scs_seqno++;
+    }
+
+    slot_write_begin(slot);
+    res = write_entry(scoreboard_fd);
+    slot_write_end(slot);
+
+    if (res == 0 &&
+        entry_map() < 0) {
+      pr_trace_msg(trace_channel, 3,
+        "error mapping scoreboard entry, using file updates: %s",
+        strerror(errno));
+    }
+
+  } else {
+    res = write_entry(scoreboard_fd);
+  }
+#else
   res = write_entry(scoreboard_fd);
+#endif /* PR_USE_SCOREBOARD_SHM */
+
   if (res < 0) {
     pr_log_pri(PR_LOG_NOTICE, "error writing scoreboard entry: %s",
       strerror(errno));
@@ -910,6 +1306,30 @@ int pr_scoreboard_entry_del(unsigned char verbose) {
 
   memset(&entry, '\0', sizeof(entry));
 
+#ifdef PR_USE_SCOREBOARD_SHM
+  if (shm_entry != NULL) {
+    pr_scoreboard_index_slot_t *slot;
+
+    wlock_scoreboard();
+
+    slot = index_get_slot(shm_entry_slot);
+    slot_write_begin(slot);
+    memcpy(shm_entry, &entry, sizeof(entry));
+    slot_write_end(slot);
+
+    if (index_map(shm_entry_slot + 1) == 0) {
+      index_push_free(shm_entry_slot);
+    }
+
+    entry_unmap();
+
+    have_entry = FALSE;
+    unlock_scoreboard();
+
+    return 0;
+  }
+#endif /* PR_USE_SCOREBOARD_SHM */
+
   /* Write-lock this entry */
   wlock_entry(scoreboard_fd);
 
@@ -976,6 +1396,19 @@ pr_scoreboard_entry_t *pr_scoreboard_entry_read(void) {
 
   /* NOTE: use readv(2), pread(2)? */
   while (TRUE) {
+#ifdef PR_USE_SCOREBOARD_SHM
+    pr_scoreboard_index_slot_t *slot = NULL;
+    unsigned int seqno = 0;
+
+    if (scan_pos >= 0) {
+      slot = index_get_slot(index_get_slotno(scan_pos));
+      if (slot != NULL) {
+        seqno = slot->scs_seqno;
+        __sync_synchronize();
+      }
+    }
+#endif /* PR_USE_SCOREBOARD_SHM */
+
     while ((res = read(scoreboard_fd, &scan_entry, sizeof(scan_entry))) <= 0) {
       int xerrno = errno;
 
@@ -990,6 +1423,17 @@ pr_scoreboard_entry_t *pr_scoreboard_entry_read(void) {
       return NULL;
     }
 
+#ifdef PR_USE_SCOREBOARD_SHM
+    if (scan_pos >= 0) {
+      if (slot != NULL &&
+          res == sizeof(scan_entry)) {
+        entry_reread(slot, seqno, &scan_entry, scan_pos);
+      }
+
+      scan_pos += res;
+    }
+#endif /* PR_USE_SCOREBOARD_SHM */
+
     if (scan_entry.sce_pid) {
       unlock_scoreboard();
       return &scan_entry;
@@ -1348,6 +1792,21 @@ int pr_scoreboard_entry_update(pid_t pid, ...) {
 
   va_end(ap);
 
+#ifdef PR_USE_SCOREBOARD_SHM
+  if (shm_entry != NULL) {
+    pr_scoreboard_index_slot_t *slot;
+
+    /* We are the only writer of our slot; no locking needed. */
+    slot = index_get_slot(shm_entry_slot);
+    slot_write_begin(slot);
+    memcpy(shm_entry, &entry, sizeof(entry));
+    slot_write_end(slot);
+
+    pr_trace_msg(trace_channel, 3, "finished updating scoreboard entry");
+    return 0;
+  }
+#endif /* PR_USE_SCOREBOARD_SHM */
+
   /* Write-lock this entry */
   wlock_entry(scoreboard_fd);
   if (write_entry(scoreboard_fd) < 0) {
@@ -1397,6 +1856,11 @@ int pr_scoreboard_scrub(void) {
   off_t curr_offset = 0;
   pid_t curr_pgrp = 0;
   pr_scoreboard_entry_t sce;
+#ifdef PR_USE_SCOREBOARD_SHM
+  int have_index = FALSE;
+  unsigned int free_tail = 0;
+  struct stat st;
+#endif /* PR_USE_SCOREBOARD_SHM */
 
   if (scoreboard_engine == FALSE) {
     return 0;
@@ -1451,7 +1915,18 @@ int pr_scoreboard_scrub(void) {
   }
 
   entry_lock.l_start = curr_offset;
- 
+
+#ifdef PR_USE_SCOREBOARD_SHM
+  /* Since we visit every slot, rebuild the list of free slots as we go. */
+  if (fstat(fd, &st) == 0 &&
+      st.st_size > (off_t) sizeof(pr_scoreboard_header_t)) {
+    if (index_map(index_get_slotno(st.st_size)) == 0) {
+      scoreboard_index->sci_free = 0;
+      have_index = TRUE;
+    }
+  }
+#endif /* PR_USE_SCOREBOARD_SHM */
+
   PRIVS_ROOT
 
   while (TRUE) {
@@ -1487,6 +1962,15 @@ int pr_scoreboard_scrub(void) {
     }
 
     if (res == sizeof(sce)) {
+#ifdef PR_USE_SCOREBOARD_SHM
+      pr_scoreboard_index_slot_t *slot = NULL;
+      unsigned int slotno = 0;
+
+      if (have_index) {
+        slotno = index_get_slotno(curr_offset);
+        slot = index_get_slot(slotno);
+      }
+#endif /* PR_USE_SCOREBOARD_SHM */
 
       /* Check to see if the PID in this entry is valid.  If not, erase
        * the slot.
@@ -1522,6 +2006,10 @@ int pr_scoreboard_scrub(void) {
          * are no incoming processes to use take it.
          */
 
+#ifdef PR_USE_SCOREBOARD_SHM
+        slot_write_begin(slot);
+#endif /* PR_USE_SCOREBOARD_SHM */
+
         res = write(fd, &sce, sizeof(sce));
         while (res != sizeof(sce)) {
           if (res < 0) {
@@ -1546,7 +2034,27 @@ int pr_scoreboard_scrub(void) {
               res, (unsigned long) sizeof(sce));
           }
         }
+
+#ifdef PR_USE_SCOREBOARD_SHM
+        slot_write_end(slot);
+#endif /* PR_USE_SCOREBOARD_SHM */
+      }
+
+#ifdef PR_USE_SCOREBOARD_SHM
+      if (slot != NULL &&
+          sce.sce_pid == 0) {
+        slot->scs_next_free = 0;
+
+        if (free_tail == 0) {
+          scoreboard_index->sci_free = slotno + 1;
+
+        } else {
+          index_get_slot(free_tail - 1)->scs_next_free = slotno + 1;
+        }
+
+        free_tail = slotno + 1;
       }
+#endif /* PR_USE_SCOREBOARD_SHM */
 
       /* Unlock the slot, and move to the next one. */
       unlock_entry(fd);
@@ -81,6 +81,11 @@ static void sess_cleanup(int flags) {
   /* Run all the exit handlers */
   pr_event_generate("core.exit", NULL);
 
+  /* Write out any log records still buffered, now that the exit handlers
+   * have had their chance to log.
+   */
+  (void) pr_log_buffer_flush_all();
+
   if (!is_master ||
       (ServerType == SERVER_INETD &&
       !(flags & PR_SESS_END_FL_SYNTAX_CHECK))) {
@@ -209,6 +209,28 @@ void pr_throttle_init(cmd_rec *cmd) {
   }
 }
 
+off_t pr_throttle_get_xfer_len(off_t xferlen) {
+  off_t chunk_len;
+
+  if (!have_xfer_rate) {
+    return 0;
+  }
+
+  chunk_len = (off_t) ((xfer_rate_bps * PR_TUNABLE_XFER_THROTTLE_INTERVAL) /
+    1000.0);
+  if (chunk_len < 1) {
+    chunk_len = 1;
+  }
+
+  /* Any remaining freebytes can be sent without throttling. */
+  if (xferlen >= 0 &&
+      xferlen < xfer_rate_freebytes) {
+    chunk_len += (xfer_rate_freebytes - xferlen);
+  }
+
+  return chunk_len;
+}
+
 void pr_throttle_pause(off_t xferlen, int xfer_ending) {
   long ideal = 0, elapsed = 0;
   off_t orig_xferlen = xferlen;
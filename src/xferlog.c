@@ -30,7 +30,28 @@
 
 static int xferlogfd = -1;
 
+/* Buffering of TransferLog writes, if configured. */
+static pool *xferlog_buf_pool = NULL;
+static pr_log_buffer_t *xferlog_buf = NULL;
+static size_t xferlog_bufsz = 0;
+static int xferlog_buf_interval = 0;
+static int xferlog_buf_flags = 0;
+
+static void xferlog_buffer_close(void) {
+  if (xferlog_buf == NULL) {
+    return;
+  }
+
+  (void) pr_log_buffer_destroy(xferlog_buf);
+
+  destroy_pool(xferlog_buf_pool);
+  xferlog_buf_pool = NULL;
+  xferlog_buf = NULL;
+}
+
 void xferlog_close(void) {
+  xferlog_buffer_close();
+
   if (xferlogfd != -1) {
     (void) close(xferlogfd);
   }
@@ -38,6 +59,27 @@ void xferlog_close(void) {
   xferlogfd = -1;
 }
 
+int xferlog_set_buffer(size_t bufsz, int interval, int flags) {
+  if (interval < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  xferlog_bufsz = bufsz;
+  xferlog_buf_interval = interval;
+  xferlog_buf_flags = flags;
+
+  return 0;
+}
+
+int xferlog_flush(void) {
+  if (xferlog_buf == NULL) {
+    return 0;
+  }
+
+  return pr_log_buffer_flush(xferlog_buf);
+}
+
 int xferlog_open(const char *path) {
 
   if (path == NULL) {
@@ -59,6 +101,14 @@ int xferlog_open(const char *path) {
         path, strerror(xerrno));
 
       errno = xerrno;
+
+    } else if (xferlog_bufsz > 0) {
+      xferlog_buf_pool = make_sub_pool(session.pool != NULL ? session.pool :
+        permanent_pool);
+      pr_pool_tag(xferlog_buf_pool, "TransferLog buffer pool");
+
+      xferlog_buf = pr_log_buffer_create(xferlog_buf_pool, "TransferLog",
+        xferlogfd, xferlog_bufsz, xferlog_buf_interval, xferlog_buf_flags);
     }
   }
 
@@ -131,5 +181,13 @@ int xferlog_write(long xfertime, const char *remhost, off_t fsize,
   pr_log_event_generate(PR_LOG_TYPE_XFERLOG, xferlogfd, -1, buf, len);
   destroy_pool(tmp_pool);
 
+  if (xferlog_buf != NULL) {
+    if (pr_log_buffer_write(xferlog_buf, buf, len) < 0) {
+      return -1;
+    }
+
+    return len;
+  }
+
   return write(xferlogfd, buf, len);
 }
@@ -41,6 +41,147 @@ static void tear_down(void) {
   } 
 }
 
+/* The byte-at-a-time implementations of pr_ascii_ftp_to_crlf() and
+ * pr_ascii_ftp_from_crlf(), prior to the use of vectorized scanning, for
+ * comparison/benchmarking.
+ */
+static int ref_have_dangling_cr = FALSE;
+
+static int ref_ascii_ftp_to_crlf(char *in, size_t inlen, char **out,
+    size_t *outlen) {
+  register unsigned int i = 0, j = 0;
+  char *dst = NULL, *src;
+  size_t src_len, lf_pos;
+
+  if (inlen == 0) {
+    *out = in;
+    return 0;
+  }
+
+  src = in;
+  src_len = lf_pos = inlen;
+
+  if (ref_have_dangling_cr == FALSE &&
+      src[0] == '\n') {
+    lf_pos = 0;
+    goto found_lf;
+  }
+
+  for (i = 1; i < src_len; i++) {
+    if (src[i] == '\n' &&
+        src[i-1] != '\r') {
+      lf_pos = i;
+      break;
+    }
+  }
+
+found_lf:
+  ref_have_dangling_cr = (src[src_len-1] == '\r') ? TRUE : FALSE;
+
+  if (lf_pos == src_len) {
+    *outlen = inlen;
+
+    dst = malloc(inlen);
+    memcpy(dst, in, inlen);
+    *out = dst;
+    return 0;
+  }
+
+  dst = malloc(src_len * 2);
+
+  if (lf_pos > 0) {
+    memcpy(dst, src, lf_pos);
+    i = j = lf_pos;
+
+  } else {
+    dst[0] = '\r';
+    dst[1] = '\n';
+    i = 2;
+    j = 1;
+  }
+
+  while (j < src_len) {
+    if (src[j] == '\n' &&
+        src[j-1] != '\r') {
+      dst[i++] = '\r';
+    }
+
+    dst[i++] = src[j++];
+  }
+
+  *outlen = i;
+  *out = dst;
+  return (int) i - j;
+}
+
+static int ref_ascii_ftp_from_crlf(char *in, size_t inlen, char **out,
+    size_t *outlen) {
+  char *src, *dst;
+  size_t rem;
+  int adj = 0;
+
+  src = in;
+  rem = inlen;
+  dst = *out;
+
+  while (rem--) {
+    if (*src != '\r') {
+      *dst++ = *src++;
+      (*outlen)++;
+
+    } else {
+      if (rem == 0) {
+        adj++;
+        *dst++ = *src++;
+
+      } else {
+        if (*(src+1) == '\n') {
+          src++;
+
+        } else {
+          *dst++ = *src++;
+          (*outlen)++;
+        }
+      }
+    }
+  }
+
+  return adj;
+}
+
+/* Fills the given buffer with "text": printable characters, with a mix of
+ * bare LFs, CRLFs, and bare CRs.
+ */
+static void fill_text(char *buf, size_t buflen, unsigned int seed) {
+  register unsigned int i;
+
+  srandom(seed);
+  for (i = 0; i < buflen; i++) {
+    long r;
+
+    r = random() % 64;
+    if (r == 0) {
+      buf[i] = '\n';
+
+    } else if (r == 1) {
+      buf[i] = '\r';
+
+    } else if (r == 2 &&
+               i + 1 < buflen) {
+      buf[i++] = '\r';
+      buf[i] = '\n';
+
+    } else {
+      buf[i] = 'a' + (r % 26);
+    }
+  }
+}
+
+static double elapsed_secs(struct timeval *start, struct timeval *end) {
+  return (end->tv_sec - start->tv_sec) +
+    ((end->tv_usec - start->tv_usec) / 1000000.0);
+}
+
 START_TEST (ascii_ftp_from_crlf_test) {
   int res;
   char *src, *dst, *expected;
@@ -348,6 +489,297 @@ START_TEST (ascii_ftp_to_crlf_test) {
 }
 END_TEST
 
+START_TEST (ascii_ftp_to_crlf2_test) {
+  int res;
+  char *src, *dst, *expected;
+  size_t src_len, dst_len, expected_len;
+
+  mark_point();
+  pr_ascii_ftp_reset();
+  res = pr_ascii_ftp_to_crlf2(NULL, 0, NULL, NULL);
+  fail_unless(res == -1, "Failed to handle null arguments");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* Handle empty input buffer. */
+  mark_point();
+  pr_ascii_ftp_reset();
+  src = "";
+  src_len = 0;
+  dst = NULL;
+  dst_len = 1;
+  res = pr_ascii_ftp_to_crlf2(src, src_len, &dst, &dst_len);
+  fail_unless(res == 0, "Failed to handle empty input buffer");
+  fail_unless(dst_len == 0, "Failed to set output buffer length");
+  fail_unless(dst == src, "Failed to set output buffer");
+
+  /* Handle input buffer needing no translation; no copy should be made. */
+  mark_point();
+  pr_ascii_ftp_reset();
+  src = "he\r\nl\rlo";
+  src_len = 8;
+  dst = NULL;
+  dst_len = 0;
+  res = pr_ascii_ftp_to_crlf2(src, src_len, &dst, &dst_len);
+  fail_unless(res == 0, "Failed to handle input buffer needing no translation");
+  fail_unless(dst == src, "Expected input buffer %p, got %p", src, dst);
+  fail_unless(dst_len == src_len,
+    "Expected output buffer length %lu, got %lu", (unsigned long) src_len,
+    (unsigned long) dst_len);
+
+  /* Handle input buffer with LFs, no CRs. */
+  mark_point();
+  pr_ascii_ftp_reset();
+  src = "\nhe\nl\nlo\n";
+  src_len = 10;
+  dst = NULL;
+  dst_len = 0;
+  res = pr_ascii_ftp_to_crlf2(src, src_len, &dst, &dst_len);
+  fail_unless(res == 4, "Expected 4, got %d", res);
+  expected = "\r\nhe\r\nl\r\nlo\r\n";
+  expected_len = 14;
+  fail_unless(dst_len == expected_len,
+    "Expected output buffer length %lu, got %lu", (unsigned long) expected_len,
+    (unsigned long) dst_len);
+  fail_unless(memcmp(dst, expected, dst_len) == 0,
+    "Expected output buffer '%s', got '%.*s'", expected, (int) dst_len, dst);
+
+  /* Handle input buffer with trailing CR, followed by a leading LF. */
+  mark_point();
+  pr_ascii_ftp_reset();
+  src = "hel\r";
+  src_len = 4;
+  dst = NULL;
+  dst_len = 0;
+  res = pr_ascii_ftp_to_crlf2(src, src_len, &dst, &dst_len);
+  fail_unless(res == 0, "Failed to handle input buffer with trailing CR");
+
+  src = "\nlo\n";
+  src_len = 4;
+  dst = NULL;
+  dst_len = 0;
+  res = pr_ascii_ftp_to_crlf2(src, src_len, &dst, &dst_len);
+  fail_unless(res == 1, "Failed to handle next input buffer after trailing CR");
+  expected = "\nlo\r\n";
+  expected_len = 5;
+  fail_unless(dst_len == expected_len,
+    "Expected output buffer length %lu, got %lu", (unsigned long) expected_len,
+    (unsigned long) dst_len);
+  fail_unless(memcmp(dst, expected, dst_len) == 0,
+    "Expected output buffer '%s', got '%.*s'", expected, (int) dst_len, dst);
+}
+END_TEST
+
+START_TEST (ascii_ftp_to_crlf_split_test) {
+  register unsigned int i;
+  char *text;
+  size_t text_len = 16384;
+
+  /* Compare the output against the byte-at-a-time implementation, splitting
+   * the input at varying boundaries, so that the vector scanning and the
+   * dangling CR handling are both exercised.
+   */
+  text = palloc(p, text_len);
+  fill_text(text, text_len, 17);
+
+  for (i = 1; i < 300; i++) {
+    size_t offset = 0;
+
+    pr_ascii_ftp_reset();
+    ref_have_dangling_cr = FALSE;
+
+    while (offset < text_len) {
+      int res, expected_res;
+      char *dst = NULL, *expected = NULL;
+      size_t chunk_len, dst_len = 0, expected_len = 0;
+
+      chunk_len = text_len - offset;
+      if (chunk_len > i) {
+        chunk_len = i;
+      }
+
+      expected_res = ref_ascii_ftp_to_crlf(text + offset, chunk_len, &expected,
+        &expected_len);
+      res = pr_ascii_ftp_to_crlf2(text + offset, chunk_len, &dst, &dst_len);
+      fail_unless(res == expected_res,
+        "Expected %d, got %d (chunk len %lu, offset %lu)", expected_res, res,
+        (unsigned long) chunk_len, (unsigned long) offset);
+      fail_unless(dst_len == expected_len,
+        "Expected output buffer length %lu, got %lu (chunk len %lu, "
+        "offset %lu)", (unsigned long) expected_len, (unsigned long) dst_len,
+        (unsigned long) chunk_len, (unsigned long) offset);
+      fail_unless(memcmp(dst, expected, dst_len) == 0,
+        "Output buffer mismatch (chunk len %lu, offset %lu)",
+        (unsigned long) chunk_len, (unsigned long) offset);
+      free(expected);
+
+      offset += chunk_len;
+    }
+  }
+}
+END_TEST
+
+START_TEST (ascii_ftp_from_crlf_split_test) {
+  register unsigned int i;
+  char *text, *expected;
+  size_t text_len = 16384, expected_len = 0;
+
+  text = palloc(p, text_len);
+  fill_text(text, text_len, 23);
+
+  /* The expected output: every CR immediately followed by an LF removed. */
+  expected = palloc(p, text_len);
+  for (i = 0; i < text_len; i++) {
+    if (text[i] == '\r' &&
+        i + 1 < text_len &&
+        text[i+1] == '\n') {
+      continue;
+    }
+
+    expected[expected_len++] = text[i];
+  }
+
+  /* Convert in place, the way pr_data_xfer() does, carrying over any
+   * trailing CR into the next chunk.
+   */
+  for (i = 2; i < 300; i++) {
+    char *buf, *out;
+    size_t offset = 0, buflen = 0, out_len = 0;
+
+    buf = palloc(p, i + 1);
+    out = palloc(p, text_len);
+
+    pr_ascii_ftp_reset();
+
+    while (offset < text_len || buflen > 0) {
+      int res;
+      size_t chunk_len, len = 0;
+
+      chunk_len = text_len - offset;
+      if (chunk_len > i - buflen) {
+        chunk_len = i - buflen;
+      }
+
+      memcpy(buf + buflen, text + offset, chunk_len);
+      buflen += chunk_len;
+      offset += chunk_len;
+
+      if (offset == text_len &&
+          buflen == 1) {
+        /* At the end of data, a sole trailing CR is passed through. */
+        out[out_len++] = buf[0];
+        break;
+      }
+
+      res = pr_ascii_ftp_from_crlf(p, buf, buflen, &buf, &len);
+      fail_unless(res >= 0, "Failed to handle chunk: %s", strerror(errno));
+
+      memcpy(out + out_len, buf, len);
+      out_len += len;
+
+      if (res > 0) {
+        buf[0] = buf[len];
+      }
+      buflen = res;
+    }
+
+    fail_unless(out_len == expected_len,
+      "Expected output length %lu, got %lu (chunk len %u)",
+      (unsigned long) expected_len, (unsigned long) out_len, i);
+    fail_unless(memcmp(out, expected, out_len) == 0,
+      "Output mismatch (chunk len %u)", i);
+  }
+}
+END_TEST
+
+START_TEST (ascii_ftp_crlf_bench_test) {
+  register unsigned int i;
+  char *text, *buf;
+  size_t chunk_len = 8192, text_len = 1024 * 1024;
+  struct timeval start, end;
+  double ref_secs, secs;
+  unsigned int iters = 20;
+
+  /* Compare the byte-at-a-time implementations against the current ones, for
+   * converting "text" in typical data transfer buffer sizes.  Use the
+   * TEST_VERBOSE environment variable to see the timings.
+   */
+  text = palloc(p, text_len);
+  fill_text(text, text_len, 31);
+
+  ref_have_dangling_cr = FALSE;
+  gettimeofday(&start, NULL);
+  for (i = 0; i < iters; i++) {
+    size_t offset;
+
+    for (offset = 0; offset < text_len; offset += chunk_len) {
+      char *dst = NULL;
+      size_t dst_len = 0;
+
+      (void) ref_ascii_ftp_to_crlf(text + offset, chunk_len, &dst, &dst_len);
+      free(dst);
+    }
+  }
+  gettimeofday(&end, NULL);
+  ref_secs = elapsed_secs(&start, &end);
+
+  pr_ascii_ftp_reset();
+  gettimeofday(&start, NULL);
+  for (i = 0; i < iters; i++) {
+    size_t offset;
+
+    for (offset = 0; offset < text_len; offset += chunk_len) {
+      char *dst = NULL;
+      size_t dst_len = 0;
+
+      (void) pr_ascii_ftp_to_crlf2(text + offset, chunk_len, &dst, &dst_len);
+    }
+  }
+  gettimeofday(&end, NULL);
+  secs = elapsed_secs(&start, &end);
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    fprintf(stderr, "ASCII to CRLF (%u MB): byte-at-a-time %0.3f secs, "
+      "current %0.3f secs\n", iters, ref_secs, secs);
+  }
+
+  buf = palloc(p, chunk_len);
+
+  gettimeofday(&start, NULL);
+  for (i = 0; i < iters; i++) {
+    size_t offset;
+
+    for (offset = 0; offset < text_len; offset += chunk_len) {
+      size_t buf_len = 0;
+
+      memcpy(buf, text + offset, chunk_len);
+      (void) ref_ascii_ftp_from_crlf(buf, chunk_len, &buf, &buf_len);
+    }
+  }
+  gettimeofday(&end, NULL);
+  ref_secs = elapsed_secs(&start, &end);
+
+  gettimeofday(&start, NULL);
+  for (i = 0; i < iters; i++) {
+    size_t offset;
+
+    for (offset = 0; offset < text_len; offset += chunk_len) {
+      size_t buf_len = 0;
+
+      memcpy(buf, text + offset, chunk_len);
+      (void) pr_ascii_ftp_from_crlf(p, buf, chunk_len, &buf, &buf_len);
+    }
+  }
+  gettimeofday(&end, NULL);
+  secs = elapsed_secs(&start, &end);
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    fprintf(stderr, "ASCII from CRLF (%u MB): byte-at-a-time %0.3f secs, "
+      "current %0.3f secs\n", iters, ref_secs, secs);
+  }
+}
+END_TEST
+
 Suite *tests_get_ascii_suite(void) {
   Suite *suite;
   TCase *testcase;
@@ -360,6 +792,10 @@ Suite *tests_get_ascii_suite(void) {
 
   tcase_add_test(testcase, ascii_ftp_from_crlf_test);
   tcase_add_test(testcase, ascii_ftp_to_crlf_test);
+  tcase_add_test(testcase, ascii_ftp_to_crlf2_test);
+  tcase_add_test(testcase, ascii_ftp_to_crlf_split_test);
+  tcase_add_test(testcase, ascii_ftp_from_crlf_split_test);
+  tcase_add_test(testcase, ascii_ftp_crlf_bench_test);
 
   suite_add_tcase(suite, testcase);
 
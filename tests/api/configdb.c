@@ -712,6 +712,331 @@ START_TEST (config_merge_down_test) {
 }
 END_TEST
 
+START_TEST (config_index_build_test) {
+  register unsigned int i;
+  int res;
+  config_rec *c, *c2;
+  server_rec *s;
+  xaset_t *servers;
+  const char *name;
+
+  mark_point();
+  res = pr_config_index_build(NULL);
+  fail_unless(res < 0, "Failed to handle null servers");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  servers = xaset_create(p, NULL);
+  pr_parser_prepare(p, &servers);
+
+  s = pr_parser_server_ctxt_open("127.0.0.1");
+  fail_unless(s != NULL, "Failed to open server context: %s", strerror(errno));
+
+  name = "foo";
+  c = add_config_param_str(name, 1, "bar");
+  fail_unless(c != NULL, "Failed to add config '%s': %s", name,
+    strerror(errno));
+
+  c = pr_parser_config_ctxt_open("/tmp");
+  fail_unless(c != NULL, "Failed to open config context: %s",
+    strerror(errno));
+  c->config_type = CONF_DIR;
+
+  c2 = add_config_param_str(name, 1, "baz");
+  fail_unless(c2 != NULL, "Failed to add config '%s': %s", name,
+    strerror(errno));
+  (void) pr_parser_config_ctxt_close(NULL);
+
+  mark_point();
+  res = pr_config_index_build(servers);
+  fail_unless(res == 0, "Failed to build config index: %s", strerror(errno));
+
+  c = find_config(s->conf, CONF_PARAM, name, TRUE);
+  fail_unless(c == c2, "Expected config %p, got %p", c2, c);
+
+  c = find_config_next(c, c->next, CONF_PARAM, name, TRUE);
+  fail_unless(c != NULL, "Failed to find next config '%s'", name);
+  fail_unless(strcmp(c->argv[0], "bar") == 0, "Expected 'bar', got '%s'",
+    (char *) c->argv[0]);
+
+  c = find_config_next(c, c->next, CONF_PARAM, name, TRUE);
+  fail_unless(c == NULL, "Found next config '%s' unexpectedly", name);
+  fail_unless(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  c = find_config(s->conf, CONF_PARAM, "nonexistent", TRUE);
+  fail_unless(c == NULL, "Found config 'nonexistent' unexpectedly");
+  fail_unless(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  /* Changing the configuration makes the index stale; searches must still
+   * see the changes.
+   */
+  mark_point();
+  res = pr_config_remove(s->conf, name, 0, TRUE);
+  fail_unless(res > 0, "Failed to remove config '%s': %s", name,
+    strerror(errno));
+
+  c = find_config(s->conf, CONF_PARAM, name, TRUE);
+  fail_unless(c == NULL, "Found config '%s' unexpectedly", name);
+  fail_unless(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  c = pr_conf_add_server_config_param_str(s, "quxx", 1, "norf");
+  fail_unless(c != NULL, "Failed to add config 'quxx': %s", strerror(errno));
+
+  c2 = find_config(s->conf, CONF_PARAM, "quxx", FALSE);
+  fail_unless(c2 == c, "Expected config %p, got %p", c, c2);
+
+  /* Changes made directly to the config sets are only seen, once the index
+   * is rebuilt, if the index is invalidated.
+   */
+  xaset_remove(s->conf, (xasetmember_t *) c);
+  pr_config_index_invalidate();
+
+  for (i = 0; i < 1000; i++) {
+    c2 = find_config(s->conf, CONF_PARAM, "quxx", FALSE);
+    fail_unless(c2 == NULL, "Found config 'quxx' unexpectedly");
+  }
+
+  mark_point();
+  init_config();
+
+  c = find_config(s->conf, CONF_DIR, "/tmp", FALSE);
+  fail_unless(c != NULL, "Failed to find config '/tmp'");
+
+  pr_parser_server_ctxt_close();
+}
+END_TEST
+
+/* Replays the given configuration file, using a minimal reader: sections
+ * become config contexts, and every other line becomes a CONF_PARAM config.
+ */
+static void config_replay_file(const char *path, array_header *sets) {
+  FILE *fh;
+  char buf[1024];
+
+  fh = fopen(path, "r");
+  fail_unless(fh != NULL, "Failed to open '%s': %s", path, strerror(errno));
+
+  while (fgets(buf, sizeof(buf), fh) != NULL) {
+    char *line, *name, *arg, *ptr;
+    config_rec *c;
+
+    line = buf;
+    while (PR_ISSPACE(*line)) {
+      line++;
+    }
+
+    ptr = line + strlen(line);
+    while (ptr > line &&
+           PR_ISSPACE(ptr[-1])) {
+      *(--ptr) = '\0';
+    }
+
+    if (*line == '\0' ||
+        *line == '#') {
+      continue;
+    }
+
+    if (strncmp(line, "</", 2) == 0) {
+      (void) pr_parser_config_ctxt_close(NULL);
+      continue;
+    }
+
+    if (*line == '<') {
+      line++;
+      ptr = strchr(line, '>');
+      if (ptr != NULL) {
+        *ptr = '\0';
+      }
+    }
+
+    name = line;
+    arg = name + strcspn(name, " \t");
+    if (*arg != '\0') {
+      *arg++ = '\0';
+      while (PR_ISSPACE(*arg)) {
+        arg++;
+      }
+    }
+
+    if (line != buf &&
+        line[-1] == '<') {
+      int config_type;
+
+      if (strcmp(name, "Global") == 0) {
+        c = pr_parser_config_ctxt_open("<Global>");
+        config_type = CONF_GLOBAL;
+
+      } else if (strcmp(name, "Limit") == 0) {
+        c = pr_parser_config_ctxt_open("Limit");
+        config_type = CONF_LIMIT;
+
+      } else {
+        c = pr_parser_config_ctxt_open(arg);
+        config_type = strcmp(name, "Anonymous") == 0 ? CONF_ANON : CONF_DIR;
+      }
+
+      fail_unless(c != NULL, "Failed to open config context '%s': %s", name,
+        strerror(errno));
+      c->config_type = config_type;
+
+      *((config_rec **) push_array(sets)) = c;
+      continue;
+    }
+
+    c = add_config_param_str(name, 1, arg);
+    fail_unless(c != NULL, "Failed to add config '%s': %s", name,
+      strerror(errno));
+  }
+
+  fclose(fh);
+}
+
+/* Performs the searches a session would do, recording every config_rec
+ * found.
+ */
+static array_header *config_replay_searches(server_rec *s,
+    array_header *sets, const char **names) {
+  register unsigned int i;
+  array_header *found;
+  int types[2] = { -1, CONF_PARAM };
+  unsigned long flags[2] = { 0, PR_CONFIG_FIND_FL_SKIP_ANON|PR_CONFIG_FIND_FL_SKIP_DIR };
+
+  found = make_array(p, 1024, sizeof(void *));
+
+  for (i = 0; i <= sets->nelts; i++) {
+    register unsigned int j;
+    xaset_t *set;
+
+    if (i == sets->nelts) {
+      set = s->conf;
+
+    } else {
+      config_rec *c;
+
+      c = ((config_rec **) sets->elts)[i];
+      set = c->subset;
+    }
+
+    if (set == NULL) {
+      continue;
+    }
+
+    for (j = 0; names[j] != NULL; j++) {
+      register unsigned int k;
+      int recurse;
+
+      for (recurse = 0; recurse < 2; recurse++) {
+        for (k = 0; k < 4; k++) {
+          config_rec *c;
+          int type;
+          unsigned long fl;
+
+          type = types[k % 2];
+          fl = flags[k / 2];
+
+          c = find_config2(set, type, names[j], recurse, fl);
+          while (c != NULL) {
+            *((config_rec **) push_array(found)) = c;
+            c = find_config_next2(c, c->next, type, names[j], recurse, fl);
+          }
+          *((config_rec **) push_array(found)) = NULL;
+        }
+
+        *((void **) push_array(found)) = get_param_ptr(set, names[j], recurse);
+      }
+    }
+  }
+
+  return found;
+}
+
+static double elapsed_secs(struct timeval *start, struct timeval *end) {
+  return (end->tv_sec - start->tv_sec) +
+    ((end->tv_usec - start->tv_usec) / 1000000.0);
+}
+
+START_TEST (config_index_replay_test) {
+  register unsigned int i;
+  int res;
+  server_rec *s;
+  xaset_t *servers;
+  array_header *sets, *linear, *indexed;
+  struct timeval start, end;
+  double linear_secs, indexed_secs;
+  const char *path;
+  const char *names[] = {
+    "ServerName",
+    "AllowOverwrite",
+    "DefaultRoot",
+    "DenyAll",
+    "AllowAll",
+    "AllowUser",
+    "DisplayChdir",
+    "HiddenStores",
+    "HideFiles",
+    "HideNoAccess",
+    "TransferRate",
+    "Umask",
+    "User",
+    "UserAlias",
+
+    /* Searches for directives which are not configured are common. */
+    "DirFakeUser",
+    "RootRevoke",
+    "ServerIdent",
+    "TimesGMT",
+    "UseGlobbing",
+    NULL
+  };
+
+  servers = xaset_create(p, NULL);
+  pr_parser_prepare(p, &servers);
+
+  s = pr_parser_server_ctxt_open("127.0.0.1");
+  fail_unless(s != NULL, "Failed to open server context: %s", strerror(errno));
+
+  path = "api/etc/configdb/bench.conf";
+  sets = make_array(p, 64, sizeof(config_rec *));
+  config_replay_file(path, sets);
+
+  gettimeofday(&start, NULL);
+  linear = config_replay_searches(s, sets, names);
+  gettimeofday(&end, NULL);
+  linear_secs = elapsed_secs(&start, &end);
+
+  mark_point();
+  res = pr_config_index_build(servers);
+  fail_unless(res == 0, "Failed to build config index: %s", strerror(errno));
+
+  gettimeofday(&start, NULL);
+  indexed = config_replay_searches(s, sets, names);
+  gettimeofday(&end, NULL);
+  indexed_secs = elapsed_secs(&start, &end);
+
+  fail_unless(linear->nelts == indexed->nelts,
+    "Expected %u search results, got %u", linear->nelts, indexed->nelts);
+
+  for (i = 0; i < linear->nelts; i++) {
+    void *expected, *found;
+
+    expected = ((void **) linear->elts)[i];
+    found = ((void **) indexed->elts)[i];
+    fail_unless(expected == found, "Expected %p for search result #%u, got %p",
+      expected, i, found);
+  }
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    fprintf(stderr, "Config searches (%u results): linear %0.3f secs, "
+      "indexed %0.3f secs\n", linear->nelts, linear_secs, indexed_secs);
+  }
+
+  pr_parser_server_ctxt_close();
+}
+END_TEST
+
 Suite *tests_get_config_suite(void) {
   Suite *suite;
   TCase *testcase;
@@ -736,6 +1061,8 @@ Suite *tests_get_config_suite(void) {
   tcase_add_test(testcase, config_get_param_ptr_test);
   tcase_add_test(testcase, config_set_get_id_test);
   tcase_add_test(testcase, config_merge_down_test);
+  tcase_add_test(testcase, config_index_build_test);
+  tcase_add_test(testcase, config_index_replay_test);
 
   suite_add_tcase(suite, testcase);
   return suite;
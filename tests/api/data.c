@@ -351,6 +351,43 @@ START_TEST (data_sendfile_test) {
 }
 END_TEST
 
+START_TEST (data_splice_test) {
+  int fd = -1, res;
+
+  res = pr_data_splice(fd, 1);
+  if (res < 0 &&
+      errno == ENOSYS) {
+    return;
+  }
+
+  res = pr_data_splice(fd, 1);
+  fail_unless(res < 0, "Failed to handle bad file descriptor");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  fd = 1;
+  res = pr_data_splice(fd, 0);
+  fail_unless(res < 0, "Failed to handle zero count");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  session.xfer.direction = PR_NETIO_IO_WR;
+  res = pr_data_splice(fd, 1);
+  fail_unless(res < 0, "Failed to handle invalid transfer direction");
+  fail_unless(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+
+  session.xfer.direction = PR_NETIO_IO_RD;
+  res = pr_data_splice(fd, 1);
+  fail_unless(res < 0, "Failed to handle lack of data connection");
+  fail_unless(errno == ECONNABORTED || errno == ENOTCONN || errno == EIO,
+    "Expected ECONNABORTED (%d), got %s (%d)", ECONNABORTED,
+    strerror(errno), errno);
+
+  session.xfer.direction = 0;
+}
+END_TEST
+
 START_TEST (data_init_test) {
   int rd = PR_NETIO_IO_RD, wr = PR_NETIO_IO_WR;
   char *filename = NULL;
@@ -1449,6 +1486,7 @@ Suite *tests_get_data_suite(void) {
   tcase_add_test(testcase, data_set_timeout_test);
   tcase_add_test(testcase, data_ignore_ascii_test);
   tcase_add_test(testcase, data_sendfile_test);
+  tcase_add_test(testcase, data_splice_test);
 
   tcase_add_test(testcase, data_init_test);
   tcase_add_test(testcase, data_open_active_test);
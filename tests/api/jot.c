@@ -4904,6 +4904,303 @@ START_TEST (jot_resolve_logfmts_test) {
 }
 END_TEST
 
+static char *plan_text = NULL;
+
+static int plan_on_meta(pool *jot_pool, pr_jot_ctx_t *jot_ctx,
+    unsigned char logfmt_id, const char *jot_hint, const void *val) {
+  char buf[32];
+
+  pr_snprintf(buf, sizeof(buf)-1, "{%u}", (unsigned int) logfmt_id);
+  plan_text = pstrcat(p, plan_text, buf, jot_hint ? jot_hint : "", NULL);
+  return 0;
+}
+
+static int plan_on_default(pool *jot_pool, pr_jot_ctx_t *jot_ctx,
+    unsigned char logfmt_id) {
+  char buf[32];
+
+  pr_snprintf(buf, sizeof(buf)-1, "<%u>", (unsigned int) logfmt_id);
+  plan_text = pstrcat(p, plan_text, buf, NULL);
+  return 0;
+}
+
+static int plan_on_other(pool *jot_pool, pr_jot_ctx_t *jot_ctx,
+    unsigned char *text, size_t text_len) {
+  plan_text = pstrcat(p, plan_text, pstrndup(p, (char *) text, text_len),
+    NULL);
+  return 0;
+}
+
+static unsigned char *parse_logfmt_text(const char *text) {
+  int res;
+  pr_jot_ctx_t *jot_ctx;
+  pr_jot_parsed_t *jot_parsed;
+  unsigned char *logfmt;
+  size_t logfmt_len;
+
+  logfmt_len = 1024;
+  logfmt = pcalloc(p, logfmt_len + 1);
+
+  jot_ctx = pcalloc(p, sizeof(pr_jot_ctx_t));
+  jot_parsed = pcalloc(p, sizeof(pr_jot_parsed_t));
+  jot_parsed->bufsz = jot_parsed->buflen = logfmt_len;
+  jot_parsed->ptr = jot_parsed->buf = logfmt;
+  jot_ctx->log = jot_parsed;
+
+  res = pr_jot_parse_logfmt(p, text, jot_ctx, pr_jot_parse_on_meta,
+    pr_jot_parse_on_unknown, pr_jot_parse_on_other, 0);
+  fail_unless(res == 0, "Failed to parse text '%s': %s", text, strerror(errno));
+
+  return logfmt;
+}
+
+START_TEST (jot_compile_logfmt_test) {
+  int res;
+  cmd_rec *cmd;
+  pr_jot_plan_t *plan;
+  unsigned char *logfmt;
+
+  mark_point();
+  plan = pr_jot_compile_logfmt(NULL, NULL);
+  fail_unless(plan == NULL, "Failed to handle null pool");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  plan = pr_jot_compile_logfmt(p, NULL);
+  fail_unless(plan == NULL, "Failed to handle null logfmt");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  logfmt = (unsigned char *) "";
+
+  mark_point();
+  plan = pr_jot_compile_logfmt(p, logfmt);
+  fail_unless(plan != NULL, "Failed to compile empty logfmt: %s",
+    strerror(errno));
+
+  cmd = pr_cmd_alloc(p, 1, pstrdup(p, "FOO"));
+  resolve_on_meta_count = resolve_on_default_count = resolve_on_other_count = 0;
+
+  mark_point();
+  res = pr_jot_resolve_plan(p, cmd, NULL, plan, NULL, resolve_on_meta,
+    resolve_on_default, resolve_on_other);
+  fail_unless(res == 0, "Failed to resolve empty plan: %s", strerror(errno));
+  fail_unless(resolve_on_meta_count == 0,
+    "Expected on_meta count 0, got %u", resolve_on_meta_count);
+  fail_unless(resolve_on_default_count == 0,
+    "Expected on_default count 0, got %u", resolve_on_default_count);
+  fail_unless(resolve_on_other_count == 0,
+    "Expected on_other count 0, got %u", resolve_on_other_count);
+
+  /* Variables, with and without arguments, between text segments. */
+  logfmt = parse_logfmt_text("foo %m bar %{note:baz}");
+
+  mark_point();
+  plan = pr_jot_compile_logfmt(p, logfmt);
+  fail_unless(plan != NULL, "Failed to compile logfmt: %s", strerror(errno));
+
+  mark_point();
+  res = pr_jot_resolve_plan(p, cmd, NULL, plan, NULL, resolve_on_meta,
+    resolve_on_default, resolve_on_other);
+  fail_unless(res == 0, "Failed to resolve plan: %s", strerror(errno));
+  fail_unless(resolve_on_meta_count == 1,
+    "Expected on_meta count 1, got %u", resolve_on_meta_count);
+  fail_unless(resolve_on_default_count == 1,
+    "Expected on_default count 1, got %u", resolve_on_default_count);
+  fail_unless(resolve_on_other_count == 2,
+    "Expected on_other count 2, got %u", resolve_on_other_count);
+}
+END_TEST
+
+START_TEST (jot_resolve_plan_test) {
+  register unsigned int i;
+  int res;
+  cmd_rec *cmd;
+  pr_jot_filters_t *jot_filters;
+  pr_jot_plan_t *plan;
+  unsigned char *logfmt;
+  const char *expected;
+  const char *texts[] = {
+    "%h %l %u %t \"%r\" %s %b",
+    "%a %A %{basename} %f %F %m %J %{file-modified} %{transfer-status}",
+    "%{FOO}e %{note:bar} %{%Y-%m-%d}t %{0} %{protocol}%%",
+    "%{iso8601} %T %{microsecs} %{gid} %{uid} %P%p",
+    "no variables at all",
+    NULL
+  };
+
+  mark_point();
+  res = pr_jot_resolve_plan(NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+  fail_unless(res < 0, "Failed to handle null pool");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = pr_jot_resolve_plan(p, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+  fail_unless(res < 0, "Failed to handle null cmd");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  cmd = pr_cmd_alloc(p, 2, pstrdup(p, "RETR"), pstrdup(p, "foo.txt"));
+  cmd->arg = pstrdup(p, "foo.txt");
+  cmd->cmd_class = CL_READ;
+  cmd->cmd_id = pr_cmd_get_id("RETR");
+
+  mark_point();
+  res = pr_jot_resolve_plan(p, cmd, NULL, NULL, NULL, NULL, NULL, NULL);
+  fail_unless(res < 0, "Failed to handle null plan");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  plan = pr_jot_compile_logfmt(p, (unsigned char *) "");
+
+  mark_point();
+  res = pr_jot_resolve_plan(p, cmd, NULL, plan, NULL, NULL, NULL, NULL);
+  fail_unless(res < 0, "Failed to handle null on_meta");
+  fail_unless(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* Filtered events are reported as such. */
+  jot_filters = pr_jot_filters_create(p, "AUTH", PR_JOT_FILTER_TYPE_CLASSES,
+    0);
+
+  mark_point();
+  res = pr_jot_resolve_plan(p, cmd, jot_filters, plan, NULL, resolve_on_meta,
+    NULL, NULL);
+  fail_unless(res < 0, "Failed to handle filtered event");
+  fail_unless(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+
+  /* A compiled plan resolves exactly as its LogFormat buffer does. */
+  for (i = 0; texts[i] != NULL; i++) {
+    logfmt = parse_logfmt_text(texts[i]);
+
+    plan_text = "";
+    res = pr_jot_resolve_logfmt(p, cmd, NULL, logfmt, NULL, plan_on_meta,
+      plan_on_default, plan_on_other);
+    fail_unless(res == 0, "Failed to resolve logfmt '%s': %s", texts[i],
+      strerror(errno));
+    expected = plan_text;
+
+    mark_point();
+    plan = pr_jot_compile_logfmt(p, logfmt);
+    fail_unless(plan != NULL, "Failed to compile logfmt '%s': %s", texts[i],
+      strerror(errno));
+
+    plan_text = "";
+    res = pr_jot_resolve_plan(p, cmd, NULL, plan, NULL, plan_on_meta,
+      plan_on_default, plan_on_other);
+    fail_unless(res == 0, "Failed to resolve plan '%s': %s", texts[i],
+      strerror(errno));
+    fail_unless(strcmp(plan_text, expected) == 0,
+      "Expected '%s', got '%s'", expected, plan_text);
+  }
+}
+END_TEST
+
+START_TEST (jot_resolve_plan_connect_test) {
+  int res;
+  cmd_rec *cmd;
+  pr_jot_plan_t *plan;
+  unsigned char logfmt[5];
+
+  cmd = pr_cmd_alloc(p, 1, pstrdup(p, "FOO"));
+  cmd->cmd_class = CL_CONNECT;
+  logfmt[0] = LOGFMT_META_START;
+  logfmt[1] = LOGFMT_META_CONNECT;
+  logfmt[2] = LOGFMT_META_START;
+  logfmt[3] = LOGFMT_META_DISCONNECT;
+  logfmt[4] = 0;
+
+  plan = pr_jot_compile_logfmt(p, logfmt);
+  fail_unless(plan != NULL, "Failed to compile logfmt: %s", strerror(errno));
+
+  resolve_on_meta_count = resolve_on_default_count = resolve_on_other_count = 0;
+
+  mark_point();
+  res = pr_jot_resolve_plan(p, cmd, NULL, plan, NULL, resolve_on_meta,
+    resolve_on_default, resolve_on_other);
+  fail_unless(res == 0, "Failed to resolve plan: %s", strerror(errno));
+  fail_unless(resolve_on_meta_count == 1,
+    "Expected on_meta count 1, got %u", resolve_on_meta_count);
+  fail_unless(resolve_on_default_count == 0,
+    "Expected on_default count 0, got %u", resolve_on_default_count);
+
+  cmd->cmd_class = CL_MISC;
+  resolve_on_meta_count = 0;
+
+  mark_point();
+  res = pr_jot_resolve_plan(p, cmd, NULL, plan, NULL, resolve_on_meta,
+    resolve_on_default, resolve_on_other);
+  fail_unless(res == 0, "Failed to resolve plan: %s", strerror(errno));
+  fail_unless(resolve_on_meta_count == 0,
+    "Expected on_meta count 0, got %u", resolve_on_meta_count);
+}
+END_TEST
+
+static double elapsed_secs(struct timeval *start, struct timeval *end) {
+  return (end->tv_sec - start->tv_sec) +
+    ((end->tv_usec - start->tv_usec) / 1000000.0);
+}
+
+START_TEST (jot_resolve_plan_bench_test) {
+  register unsigned int i;
+  int res;
+  cmd_rec *cmd;
+  pr_jot_plan_t *plan;
+  unsigned char *logfmt;
+  struct timeval start, end;
+  double ref_secs, secs;
+  unsigned int iters = 20000;
+  const char *text = "%h %l %u %t \"%r\" %s %b %{note:foo} %{FOO}e %T";
+
+  /* Compare resolving the LogFormat buffer against resolving its compiled
+   * plan, for a typical ExtendedLog format.  Use the TEST_VERBOSE environment
+   * variable to see the timings.
+   */
+  cmd = pr_cmd_alloc(p, 2, pstrdup(p, "RETR"), pstrdup(p, "foo.txt"));
+  cmd->arg = pstrdup(p, "foo.txt");
+  cmd->cmd_class = CL_READ;
+  cmd->cmd_id = pr_cmd_get_id("RETR");
+
+  logfmt = parse_logfmt_text(text);
+  plan = pr_jot_compile_logfmt(p, logfmt);
+  fail_unless(plan != NULL, "Failed to compile logfmt: %s", strerror(errno));
+
+  gettimeofday(&start, NULL);
+  for (i = 0; i < iters; i++) {
+    pool *tmp_pool;
+
+    tmp_pool = make_sub_pool(p);
+    res = pr_jot_resolve_logfmt(tmp_pool, cmd, NULL, logfmt, NULL,
+      resolve_on_meta, resolve_on_default, resolve_on_other);
+    fail_unless(res == 0, "Failed to resolve logfmt: %s", strerror(errno));
+    destroy_pool(tmp_pool);
+  }
+  gettimeofday(&end, NULL);
+  ref_secs = elapsed_secs(&start, &end);
+
+  gettimeofday(&start, NULL);
+  for (i = 0; i < iters; i++) {
+    pool *tmp_pool;
+
+    tmp_pool = make_sub_pool(p);
+    res = pr_jot_resolve_plan(tmp_pool, cmd, NULL, plan, NULL,
+      resolve_on_meta, resolve_on_default, resolve_on_other);
+    fail_unless(res == 0, "Failed to resolve plan: %s", strerror(errno));
+    destroy_pool(tmp_pool);
+  }
+  gettimeofday(&end, NULL);
+  secs = elapsed_secs(&start, &end);
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    fprintf(stderr, "Resolve LogFormat (%u records): interpreted %0.3f secs, "
+      "compiled %0.3f secs\n", iters, ref_secs, secs);
+  }
+}
+END_TEST
+
 static unsigned int scan_on_meta_count = 0;
 
 static int scan_on_meta(pool *jot_pool, pr_jot_ctx_t *jot_ctx,
@@ -5166,6 +5463,10 @@ Suite *tests_get_jot_suite(void) {
   tcase_add_test(testcase, jot_resolve_logfmt_disconnect_test);
   tcase_add_test(testcase, jot_resolve_logfmt_custom_test);
   tcase_add_test(testcase, jot_resolve_logfmts_test);
+  tcase_add_test(testcase, jot_compile_logfmt_test);
+  tcase_add_test(testcase, jot_resolve_plan_test);
+  tcase_add_test(testcase, jot_resolve_plan_connect_test);
+  tcase_add_test(testcase, jot_resolve_plan_bench_test);
 
   tcase_add_test(testcase, jot_scan_logfmt_test);
   tcase_add_test(testcase, jot_on_json_test);
@@ -817,6 +817,82 @@ START_TEST (scoreboard_entry_read_test) {
 }
 END_TEST
 
+START_TEST (scoreboard_entry_reuse_test) {
+  int res;
+  struct stat st;
+  off_t scoreboard_size;
+  pid_t pid = getpid();
+  pr_scoreboard_entry_t *score;
+
+  res = mkdir(test_dir, 0775);
+  fail_unless(res == 0, "Failed to create directory '%s': %s", test_dir,
+    strerror(errno));
+
+  res = chmod(test_dir, 0775);
+  fail_unless(res == 0, "Failed to set perms on '%s' to 0775': %s", test_dir,
+    strerror(errno));
+
+  res = pr_set_scoreboard(test_file);
+  fail_unless(res == 0, "Failed to set scoreboard to '%s': %s", test_file,
+    strerror(errno));
+
+  res = pr_open_scoreboard(O_RDWR);
+  fail_unless(res == 0, "Failed to open scoreboard: %s", strerror(errno));
+
+  res = pr_scoreboard_entry_add();
+  fail_unless(res == 0, "Failed to add entry to scoreboard: %s",
+    strerror(errno));
+
+  res = stat(test_file, &st);
+  fail_unless(res == 0, "Failed to stat '%s': %s", test_file, strerror(errno));
+  scoreboard_size = st.st_size;
+
+  /* Updates must be visible to readers of the ScoreboardFile. */
+  res = pr_scoreboard_entry_update(pid, PR_SCORE_CMD, "%s", "RETR", NULL,
+    NULL);
+  fail_unless(res == 0, "Failed to update PR_SCORE_CMD: %s", strerror(errno));
+
+  res = pr_rewind_scoreboard();
+  fail_unless(res == 0, "Failed to rewind scoreboard: %s", strerror(errno));
+
+  score = pr_scoreboard_entry_read();
+  fail_unless(score != NULL, "Failed to read scoreboard entry: %s",
+    strerror(errno));
+  fail_unless(strcmp(score->sce_cmd, "RETR") == 0,
+    "Expected command 'RETR', got '%s'", score->sce_cmd);
+
+  res = pr_scoreboard_entry_del(FALSE);
+  fail_unless(res == 0, "Failed to delete entry from scoreboard: %s",
+    strerror(errno));
+
+  res = pr_rewind_scoreboard();
+  fail_unless(res == 0, "Failed to rewind scoreboard: %s", strerror(errno));
+
+  score = pr_scoreboard_entry_read();
+  fail_unless(score == NULL, "Unexpectedly read scoreboard entry");
+
+  /* The freed slot should be reused, rather than the scoreboard growing. */
+  res = pr_scoreboard_entry_add();
+  fail_unless(res == 0, "Failed to add entry to scoreboard: %s",
+    strerror(errno));
+
+  res = stat(test_file, &st);
+  fail_unless(res == 0, "Failed to stat '%s': %s", test_file, strerror(errno));
+  fail_unless(st.st_size == scoreboard_size,
+    "Expected scoreboard size %lu, got %lu", (unsigned long) scoreboard_size,
+    (unsigned long) st.st_size);
+
+  res = pr_scoreboard_entry_del(FALSE);
+  fail_unless(res == 0, "Failed to delete entry from scoreboard: %s",
+    strerror(errno));
+
+  (void) pr_close_scoreboard(FALSE);
+  (void) unlink(test_mutex);
+  (void) unlink(test_file);
+  (void) rmdir(test_dir);
+}
+END_TEST
+
 START_TEST (scoreboard_entry_get_test) {
   register unsigned int i;
   int res;
@@ -1199,6 +1275,7 @@ Suite *tests_get_scoreboard_suite(void) {
   tcase_add_test(testcase, scoreboard_entry_add_test);
   tcase_add_test(testcase, scoreboard_entry_del_test);
   tcase_add_test(testcase, scoreboard_entry_read_test);
+  tcase_add_test(testcase, scoreboard_entry_reuse_test);
   tcase_add_test(testcase, scoreboard_entry_get_test);
   tcase_add_test(testcase, scoreboard_entry_update_test);
   tcase_add_test(testcase, scoreboard_entry_kill_test);
@@ -33,9 +33,131 @@ static pr_scoreboard_header_t util_header;
 
 static unsigned char util_scoreboard_read_locked = FALSE;
 
+/* Offset of the next entry to be read, if known. */
+static off_t util_scan_pos = -1;
+
+/* Check the entries read against the slot index in the ScoreboardMutex file,
+ * when possible.
+ */
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H) && \
+    defined(HAVE_PREAD) && defined(__GNUC__)
+# define UTIL_USE_SCOREBOARD_INDEX
+
+/* Max number of attempts to read a slot which is being changed. */
+# define UTIL_SCOREBOARD_MAX_READ_ATTEMPTS	10
+
+static pr_scoreboard_index_header_t *util_index = NULL;
+static size_t util_index_len = 0;
+static unsigned int util_index_nslots = 0;
+#endif /* UTIL_USE_SCOREBOARD_INDEX */
+
 /* Internal routines
  */
 
+#ifdef UTIL_USE_SCOREBOARD_INDEX
+static void unmap_scoreboard_index(void) {
+  if (util_index != NULL) {
+    (void) munmap((void *) util_index, util_index_len);
+    util_index = NULL;
+    util_index_len = 0;
+    util_index_nslots = 0;
+  }
+}
+
+static void map_scoreboard_index(void) {
+  char path[PR_TUNABLE_PATH_MAX] = {'\0'};
+  struct stat st;
+  size_t pathlen;
+  void *ptr;
+  int fd;
+
+  /* We only know of the default ScoreboardMutex path.  Without the index,
+   * we simply read the entries as they are.
+   */
+  pathlen = strlen(util_scoreboard_file);
+  if (pathlen + 5 > sizeof(path)) {
+    return;
+  }
+
+  memcpy(path, util_scoreboard_file, pathlen);
+  memcpy(path + pathlen, ".lck", 5);
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+
+  if (fstat(fd, &st) < 0 ||
+      st.st_size < (off_t) (sizeof(pr_scoreboard_index_header_t) +
+        sizeof(pr_scoreboard_index_slot_t))) {
+    (void) close(fd);
+    return;
+  }
+
+  ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  (void) close(fd);
+
+  if (ptr == MAP_FAILED) {
+    return;
+  }
+
+  util_index = ptr;
+  util_index_len = st.st_size;
+
+  if (util_index->sci_magic != UTIL_SCOREBOARD_INDEX_MAGIC) {
+    unmap_scoreboard_index();
+    return;
+  }
+
+  util_index_nslots = (util_index_len - sizeof(pr_scoreboard_index_header_t)) /
+    sizeof(pr_scoreboard_index_slot_t);
+}
+
+static pr_scoreboard_index_slot_t *get_scoreboard_index_slot(off_t offset) {
+  unsigned int slotno;
+
+  if (util_index == NULL) {
+    return NULL;
+  }
+
+  slotno = (offset - sizeof(pr_scoreboard_header_t)) /
+    sizeof(pr_scoreboard_entry_t);
+  if (slotno >= util_index_nslots) {
+    return NULL;
+  }
+
+  return ((pr_scoreboard_index_slot_t *) (util_index + 1)) + slotno;
+}
+
+/* Re-read the entry at the given offset for as long as its slot's sequence
+ * number shows that it was being changed while we read it.
+ */
+static void reread_scoreboard_entry(pr_scoreboard_index_slot_t *slot,
+    unsigned int seqno, pr_scoreboard_entry_t *sce, off_t offset) {
+  unsigned int nattempts = 1;
+
+  __sync_synchronize();
+
+  while ((seqno & 1) ||
+         seqno != slot->scs_seqno) {
+    nattempts++;
+    if (nattempts > UTIL_SCOREBOARD_MAX_READ_ATTEMPTS) {
+      break;
+    }
+
+    seqno = slot->scs_seqno;
+    __sync_synchronize();
+
+    if (pread(util_scoreboard_fd, sce, sizeof(pr_scoreboard_entry_t),
+        offset) != sizeof(pr_scoreboard_entry_t)) {
+      break;
+    }
+
+    __sync_synchronize();
+  }
+}
+#endif /* UTIL_USE_SCOREBOARD_INDEX */
+
 static int read_scoreboard_header(pr_scoreboard_header_t *header) {
   int res = 0;
 
@@ -127,6 +249,11 @@ int util_close_scoreboard(void) {
 
   (void) close(util_scoreboard_fd);
   util_scoreboard_fd = -1;
+  util_scan_pos = -1;
+
+#ifdef UTIL_USE_SCOREBOARD_INDEX
+  unmap_scoreboard_index();
+#endif /* UTIL_USE_SCOREBOARD_INDEX */
 
   return 0;
 }
@@ -166,6 +293,12 @@ int util_open_scoreboard(int flags) {
   if (res < 0)
     return res;
 
+  util_scan_pos = sizeof(pr_scoreboard_header_t);
+
+#ifdef UTIL_USE_SCOREBOARD_INDEX
+  map_scoreboard_index();
+#endif /* UTIL_USE_SCOREBOARD_INDEX */
+
   return 0;
 }
 
@@ -233,6 +366,19 @@ pr_scoreboard_entry_t *util_scoreboard_entry_read(void) {
   /* NOTE: use readv(2)? */
   errno = 0;
   while (scan_entry.sce_pid == 0) {
+#ifdef UTIL_USE_SCOREBOARD_INDEX
+    pr_scoreboard_index_slot_t *slot = NULL;
+    unsigned int seqno = 0;
+
+    if (util_scan_pos >= 0) {
+      slot = get_scoreboard_index_slot(util_scan_pos);
+      if (slot != NULL) {
+        seqno = slot->scs_seqno;
+        __sync_synchronize();
+      }
+    }
+#endif /* UTIL_USE_SCOREBOARD_INDEX */
+
     while ((res = read(util_scoreboard_fd, &scan_entry,
         sizeof(scan_entry))) <= 0) {
 
@@ -252,6 +398,17 @@ pr_scoreboard_entry_t *util_scoreboard_entry_read(void) {
       }
     }
 
+    if (util_scan_pos >= 0) {
+#ifdef UTIL_USE_SCOREBOARD_INDEX
+      if (slot != NULL &&
+          res == sizeof(scan_entry)) {
+        reread_scoreboard_entry(slot, seqno, &scan_entry, util_scan_pos);
+      }
+#endif /* UTIL_USE_SCOREBOARD_INDEX */
+
+      util_scan_pos += res;
+    }
+
     if (scan_entry.sce_pid) {
       unlock_scoreboard();
       return &scan_entry;
@@ -71,6 +71,10 @@
 # include <sys/stat.h>
 #endif
 
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
 #include "pool.h"
 #include "ascii.h"
 #include "default_paths.h"
@@ -143,6 +147,25 @@ typedef struct {
 
 } pr_scoreboard_entry_t;
 
+/* Structures used for the slot index kept in the ScoreboardMutex file, which
+ * holds a sequence number per scoreboard slot.  An odd sequence number means
+ * that the slot is being changed; a changed sequence number means that the
+ * slot was changed while being read.
+ */
+#define UTIL_SCOREBOARD_INDEX_MAGIC		0x5c0eb0a7
+
+typedef struct {
+  unsigned int sci_magic;
+  unsigned int sci_nslots;
+  unsigned int sci_free;
+  unsigned int sci_reserved;
+} pr_scoreboard_index_header_t;
+
+typedef struct {
+  volatile unsigned int scs_seqno;
+  unsigned int scs_next_free;
+} pr_scoreboard_index_slot_t;
+
 /* Scoreboard error values */
 #define UTIL_SCORE_ERR_BAD_MAGIC	-2
 #define UTIL_SCORE_ERR_OLDER_VERSION	-3